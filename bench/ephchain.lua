@@ -0,0 +1,65 @@
+--[[
+** Deep ephemeron chains for the collector ('convergeephemerons' in
+** 'lgc.cpp'). Each key of a chain is reachable only through the value
+** of the previous entry, so marking it needs one propagation per link.
+** Chains go through many weak tables (in random order) and through a
+** single one; a full collection must keep a chain while its head is
+** alive and free it afterwards. Times should grow linearly with N.
+** Usage: lua ephchain.lua [N] [incremental|generational]
+]]
+
+local N = math.tointeger(tonumber(arg and arg[1])) or 20000
+local modes = (arg and arg[2]) and {arg[2]} or {"incremental", "generational"}
+
+local weakk = {__mode = "k"}
+
+
+-- build a chain of 'n' links; return its head, the tables and a probe
+-- (a weak reference to the last key)
+local function build (n, ntabs)
+	local tabs = {}
+	for i = 1, ntabs do tabs[i] = setmetatable({}, weakk) end
+	local keys = {}
+	for i = 1, n + 1 do keys[i] = {} end
+	for i = 1, n do
+		tabs[math.random(ntabs)][keys[i]] = keys[i + 1]
+	end
+	local probe = setmetatable({keys[n + 1]}, {__mode = "v"})
+	return keys[1], tabs, probe
+end
+
+
+local function count (tabs)
+	local n = 0
+	for i = 1, #tabs do
+		for _ in pairs(tabs[i]) do n = n + 1 end
+	end
+	return n
+end
+
+
+local function run (n, ntabs)
+	local head, tabs, probe = build(n, ntabs)
+	collectgarbage()
+	local t0 = os.clock()
+	collectgarbage()
+	local t = os.clock() - t0
+	assert(probe[1] ~= nil, "end of chain collected")
+	assert(count(tabs) == n, "chain entry collected")
+	head = nil
+	collectgarbage()
+	collectgarbage()
+	assert(probe[1] == nil and count(tabs) == 0, "dead chain kept")
+	return t
+end
+
+
+math.randomseed(42)
+for _, mode in ipairs(modes) do
+	collectgarbage(mode)
+	for _, n in ipairs{N // 4, N // 2, N} do
+		print(string.format("%-12s N=%-8d many tables %.4f s   one table %.4f s",
+		                    mode, n, run(n, n), run(n, 1)))
+	end
+end
+collectgarbage("incremental")
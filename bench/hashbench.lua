@@ -0,0 +1,89 @@
+--[[
+** Hash part of tables ('ltable.cpp'): insertions, lookups, misses and
+** traversals with string and integer keys. Run it with a default build
+** (chained nodes) and with one configured with LUAMOD_SWISSHASH
+** (control bytes) to compare the two layouts. Integer keys are looked
+** up both in insertion order and in random order.
+** Usage: lua hashbench.lua [N] [rounds]
+]]
+
+local N = math.tointeger(tonumber(arg and arg[1])) or 1000000
+local R = math.tointeger(tonumber(arg and arg[2])) or 5
+
+local clock = os.clock
+local results = {}
+
+
+-- best time of 'R' runs of 'f'
+local function bench (name, f)
+	local best = math.huge
+	for r = 1, R do
+		local t0 = clock()
+		f()
+		best = math.min(best, clock() - t0)
+	end
+	results[#results + 1] = string.format("%-22s %.3f s", name, best)
+end
+
+
+local function shuffled (a)
+	local b = table.move(a, 1, #a, 1, {})
+	for i = #b, 2, -1 do
+		local j = math.random(i)
+		b[i], b[j] = b[j], b[i]
+	end
+	return b
+end
+
+
+math.randomseed(42)
+local skeys, ikeys, jkeys = {}, {}, {}
+for i = 1, N do
+	skeys[i] = "key_" .. tostring(i * 2654435761 % 4294967296)
+	ikeys[i] = i * 1000003  -- keys in progression (all in the hash part)
+	jkeys[i] = math.random(1 << 40)  -- random keys
+end
+local irand = shuffled(ikeys)
+
+local st, it, jt
+bench("string insert", function ()
+	st = {}
+	for i = 1, N do st[skeys[i]] = i end
+end)
+bench("string lookup", function ()
+	local s = 0
+	for i = 1, N do s = s + st[skeys[i]] end
+end)
+bench("string miss", function ()
+	local m = 0
+	for i = 1, N do if st[ikeys[i]] == nil then m = m + 1 end end
+	assert(m == N)
+end)
+bench("int insert", function ()
+	it = {}
+	for i = 1, N do it[ikeys[i]] = i end
+end)
+bench("int lookup", function ()
+	local s = 0
+	for i = 1, N do s = s + it[ikeys[i]] end
+end)
+bench("int lookup (shuffled)", function ()
+	local s = 0
+	for i = 1, N do s = s + it[irand[i]] end
+end)
+bench("random int insert", function ()
+	jt = {}
+	for i = 1, N do jt[jkeys[i]] = i end
+end)
+bench("random int lookup", function ()
+	local s = 0
+	for i = 1, N do s = s + jt[jkeys[i]] end
+end)
+bench("traversal", function ()
+	local s = 0
+	for k, v in pairs(st) do s = s + v end
+	for k, v in next, it do s = s + v end
+end)
+
+print(string.format("N=%d, best of %d", N, R))
+print(table.concat(results, "\n"))
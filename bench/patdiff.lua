@@ -0,0 +1,585 @@
+--[[
+** Differential test of the pattern compiler in 'lstrlib.cpp'.
+** 'ref' below is a line-by-line port of the backtracking matcher that
+** the compiled matcher replaced; random patterns (malformed ones
+** included) and subjects are run through both, and every result and
+** error message must agree.
+** Usage: lua patdiff.lua [seed] [iterations]
+]]
+
+local seed = math.tointeger(tonumber(arg and arg[1])) or 42
+local iterations = math.tointeger(tonumber(arg and arg[2])) or 50000
+
+local byte, sub, fmt = string.byte, string.sub, string.format
+
+local MAXCCALLS = 200
+local MAXCAPTURES = 32
+local CAP_UNFINISHED = -1
+local CAP_POSITION = -2
+local L_ESC = 37  -- '%'
+
+
+--[[
+** {======================================================
+** Reference matcher
+** =======================================================
+]]
+
+local ref = {}
+
+-- character classes of the C locale
+local function isdigit (c) return 48 <= c and c <= 57 end
+local function islower (c) return 97 <= c and c <= 122 end
+local function isupper (c) return 65 <= c and c <= 90 end
+local function isalpha (c) return islower(c) or isupper(c) end
+local function isalnum (c) return isalpha(c) or isdigit(c) end
+local function iscntrl (c) return c < 32 or c == 127 end
+local function isgraph (c) return 33 <= c and c <= 126 end
+local function ispunct (c) return isgraph(c) and not isalnum(c) end
+local function isspace (c) return c == 32 or (9 <= c and c <= 13) end
+local function isxdigit (c)
+	return isdigit(c) or (97 <= c and c <= 102) or (65 <= c and c <= 70)
+end
+
+local classes = {
+	[97] = isalpha, [99] = iscntrl, [100] = isdigit, [103] = isgraph,
+	[108] = islower, [112] = ispunct, [115] = isspace, [117] = isupper,
+	[119] = isalnum, [120] = isxdigit,
+	[122] = function (c) return c == 0 end,  -- '%z' (deprecated)
+}
+
+local function match_class (c, cl)
+	local f = classes[isupper(cl) and cl + 32 or cl]
+	if not f then return cl == c end
+	local res = f(c)
+	if islower(cl) then return res else return not res end
+end
+
+
+-- byte at 'i', or 0 past the end (C strings are NUL-terminated)
+local function at (s, i)
+	return byte(s, i) or 0
+end
+
+
+local function new_state (src, pat)
+	return {src = src, src_end = #src + 1, pat = pat, p_end = #pat + 1,
+	        level = 0, matchdepth = MAXCCALLS, init = {}, len = {}}
+end
+
+
+local function check_capture (ms, l)
+	l = l - 49  -- '1'
+	if l < 0 or l >= ms.level or ms.len[l] == CAP_UNFINISHED then
+		error(fmt("invalid capture index %%%d", l + 1), 0)
+	end
+	return l
+end
+
+
+local function capture_to_close (ms)
+	for level = ms.level - 1, 0, -1 do
+		if ms.len[level] == CAP_UNFINISHED then return level end
+	end
+	error("invalid pattern capture", 0)
+end
+
+
+local function classend (ms, p)
+	local pat = ms.pat
+	local c = at(pat, p)
+	p = p + 1
+	if c == L_ESC then
+		if p == ms.p_end then error("malformed pattern (ends with '%')", 0) end
+		return p + 1
+	elseif c == 91 then  -- '['
+		if at(pat, p) == 94 then p = p + 1 end  -- '^'
+		repeat  -- look for a ']'
+			if p == ms.p_end then error("malformed pattern (missing ']')", 0) end
+			local cc = at(pat, p)
+			p = p + 1
+			if cc == L_ESC and p < ms.p_end then p = p + 1 end
+		until at(pat, p) == 93
+		return p + 1
+	end
+	return p
+end
+
+
+local function matchbracketclass (ms, c, p, ec)
+	local pat = ms.pat
+	local sig = true
+	if at(pat, p + 1) == 94 then  -- '^'
+		sig = false
+		p = p + 1
+	end
+	p = p + 1
+	while p < ec do
+		local pc = at(pat, p)
+		if pc == L_ESC then
+			p = p + 1
+			if match_class(c, at(pat, p)) then return sig end
+		elseif at(pat, p + 1) == 45 and p + 2 < ec then  -- '-'
+			p = p + 2
+			if pc <= c and c <= at(pat, p) then return sig end
+		elseif pc == c then
+			return sig
+		end
+		p = p + 1
+	end
+	return not sig
+end
+
+
+local function singlematch (ms, s, p, ep)
+	if s >= ms.src_end then return false end
+	local c = byte(ms.src, s)
+	local pc = at(ms.pat, p)
+	if pc == 46 then return true  -- '.'
+	elseif pc == L_ESC then return match_class(c, at(ms.pat, p + 1))
+	elseif pc == 91 then return matchbracketclass(ms, c, p, ep - 1)
+	else return pc == c
+	end
+end
+
+
+local function matchbalance (ms, s, p)
+	if p >= ms.p_end - 1 then
+		error("malformed pattern (missing arguments to '%b')", 0)
+	end
+	local src = ms.src
+	if at(src, s) ~= at(ms.pat, p) then return nil end
+	local b, e = at(ms.pat, p), at(ms.pat, p + 1)
+	local cont = 1
+	s = s + 1
+	while s < ms.src_end do
+		local c = byte(src, s)
+		if c == e then
+			cont = cont - 1
+			if cont == 0 then return s + 1 end
+		elseif c == b then
+			cont = cont + 1
+		end
+		s = s + 1
+	end
+	return nil
+end
+
+
+local match
+
+local function max_expand (ms, s, p, ep)
+	local i = 0
+	while singlematch(ms, s + i, p, ep) do i = i + 1 end
+	while i >= 0 do
+		local res = match(ms, s + i, ep + 1)
+		if res then return res end
+		i = i - 1
+	end
+	return nil
+end
+
+
+local function min_expand (ms, s, p, ep)
+	while true do
+		local res = match(ms, s, ep + 1)
+		if res then return res
+		elseif singlematch(ms, s, p, ep) then s = s + 1
+		else return nil
+		end
+	end
+end
+
+
+local function start_capture (ms, s, p, what)
+	local level = ms.level
+	if level >= MAXCAPTURES then error("too many captures", 0) end
+	ms.init[level] = s
+	ms.len[level] = what
+	ms.level = level + 1
+	local res = match(ms, s, p)
+	if not res then ms.level = ms.level - 1 end
+	return res
+end
+
+
+local function end_capture (ms, s, p)
+	local l = capture_to_close(ms)
+	ms.len[l] = s - ms.init[l]
+	local res = match(ms, s, p)
+	if not res then ms.len[l] = CAP_UNFINISHED end
+	return res
+end
+
+
+local function match_capture (ms, s, l)
+	l = check_capture(ms, l)
+	local len = ms.len[l]
+	local init = ms.init[l]
+	-- (a position capture has a negative length and always fails)
+	if ms.src_end - s >= len and len >= 0 and
+	   sub(ms.src, init, init + len - 1) == sub(ms.src, s, s + len - 1) then
+		return s + len
+	end
+	return nil
+end
+
+
+function match (ms, s, p)
+	if ms.matchdepth == 0 then error("pattern too complex", 0) end
+	ms.matchdepth = ms.matchdepth - 1
+	local pat = ms.pat
+	while p ~= ms.p_end do  -- each 'goto init' is another iteration
+		local pc = at(pat, p)
+		local dflt = false
+		if pc == 40 then  -- '('
+			if at(pat, p + 1) == 41 then
+				s = start_capture(ms, s, p + 2, CAP_POSITION)
+			else
+				s = start_capture(ms, s, p + 1, CAP_UNFINISHED)
+			end
+			break
+		elseif pc == 41 then  -- ')'
+			s = end_capture(ms, s, p + 1)
+			break
+		elseif pc == 36 and p + 1 == ms.p_end then  -- '$' at the end
+			if s ~= ms.src_end then s = nil end
+			break
+		elseif pc == L_ESC then
+			local nc = at(pat, p + 1)
+			if nc == 98 then  -- 'b'
+				s = matchbalance(ms, s, p + 2)
+				if not s then break end
+				p = p + 4
+			elseif nc == 102 then  -- 'f'
+				p = p + 2
+				if at(pat, p) ~= 91 then
+					error("missing '[' after '%f' in pattern", 0)
+				end
+				local ep = classend(ms, p)
+				local previous = (s == 1) and 0 or byte(ms.src, s - 1)
+				if not matchbracketclass(ms, previous, p, ep - 1) and
+				   matchbracketclass(ms, at(ms.src, s), p, ep - 1) then
+					p = ep
+				else
+					s = nil
+					break
+				end
+			elseif isdigit(nc) then
+				s = match_capture(ms, s, nc)
+				if not s then break end
+				p = p + 2
+			else
+				dflt = true
+			end
+		else
+			dflt = true
+		end
+		if dflt then
+			local ep = classend(ms, p)
+			local epc = at(pat, ep)
+			if not singlematch(ms, s, p, ep) then
+				if epc == 42 or epc == 63 or epc == 45 then  -- '*' '?' '-'
+					p = ep + 1
+				else
+					s = nil
+					break
+				end
+			elseif epc == 63 then  -- '?'
+				local res = match(ms, s + 1, ep + 1)
+				if res then
+					s = res
+					break
+				end
+				p = ep + 1
+			elseif epc == 43 then  -- '+'
+				s = max_expand(ms, s + 1, p, ep)
+				break
+			elseif epc == 42 then  -- '*'
+				s = max_expand(ms, s, p, ep)
+				break
+			elseif epc == 45 then  -- '-'
+				s = min_expand(ms, s, p, ep)
+				break
+			else
+				s = s + 1
+				p = ep
+			end
+		end
+	end
+	ms.matchdepth = ms.matchdepth + 1
+	return s
+end
+
+
+local function get_onecapture (ms, i, s, e)
+	if i >= ms.level then
+		if i ~= 0 then error(fmt("invalid capture index %%%d", i + 1), 0) end
+		return sub(ms.src, s, e - 1)
+	end
+	local l = ms.len[i]
+	if l == CAP_UNFINISHED then error("unfinished capture", 0) end
+	if l == CAP_POSITION then return ms.init[i] end
+	return sub(ms.src, ms.init[i], ms.init[i] + l - 1)
+end
+
+
+local function push_captures (ms, s, e, t)
+	local n = (ms.level == 0 and s) and 1 or ms.level
+	for i = 0, n - 1 do t[#t + 1] = get_onecapture(ms, i, s, e) end
+	return t
+end
+
+
+local function posrelat (pos, len)
+	if pos > 0 then return pos
+	elseif pos == 0 then return 1
+	elseif pos < -len then return 1
+	end
+	return len + pos + 1
+end
+
+
+local function nospecials (p)
+	return not p:find("[%^%$%*%+%?%.%(%[%%%-]")
+end
+
+
+local function find_aux (find, s, p, init, plain)
+	init = posrelat(init or 1, #s)
+	if init > #s + 1 then return nil end
+	if find and (plain or nospecials(p)) then
+		local i, j = s:find(p, init, true)  -- a plain search is not under test
+		if i then return i, j end
+		return nil
+	end
+	local anchor = (at(p, 1) == 94)
+	if anchor then p = sub(p, 2) end
+	local ms = new_state(s, p)
+	local s1 = init
+	repeat
+		ms.level = 0
+		local res = match(ms, s1, 1)
+		if res then
+			if find then
+				return table.unpack(push_captures(ms, nil, 0, {s1, res - 1}))
+			end
+			return table.unpack(push_captures(ms, s1, res, {}))
+		end
+		s1 = s1 + 1
+	until s1 > ms.src_end or anchor
+	return nil
+end
+
+function ref.find (s, p, init, plain) return find_aux(true, s, p, init, plain) end
+function ref.match (s, p, init) return find_aux(false, s, p, init) end
+
+
+function ref.gmatch (s, p, init)
+	init = posrelat(init or 1, #s)
+	if init > #s + 1 then init = #s + 2 end
+	local ms = new_state(s, p)
+	local src, lastmatch = init, nil
+	return function ()
+		while src <= ms.src_end do
+			ms.level = 0
+			local e = match(ms, src, 1)
+			if e and e ~= lastmatch then
+				local caps = push_captures(ms, src, e, {})
+				src, lastmatch = e, e
+				return table.unpack(caps)
+			end
+			src = src + 1
+		end
+		return nil
+	end
+end
+
+
+local function add_s (ms, b, s, e, news)
+	local i = 1
+	while true do
+		local j = news:find("%", i, true)
+		if not j then break end
+		b[#b + 1] = sub(news, i, j - 1)
+		local c = at(news, j + 1)
+		if c == L_ESC then
+			b[#b + 1] = "%"
+		elseif c == 48 then  -- '0'
+			b[#b + 1] = sub(ms.src, s, e - 1)
+		elseif isdigit(c) then
+			local cap = get_onecapture(ms, c - 49, s, e)
+			-- (this build does not convert numbers to strings, so a position
+			-- added to the buffer contributes nothing)
+			if type(cap) == "string" then b[#b + 1] = cap end
+		else
+			error("invalid use of '%' in replacement string", 0)
+		end
+		i = j + 2
+	end
+	b[#b + 1] = sub(news, i)
+end
+
+
+local function add_value (ms, b, s, e, repl)
+	local v
+	local tr = type(repl)
+	if tr == "function" then
+		v = repl(table.unpack(push_captures(ms, s, e, {})))
+	elseif tr == "table" then
+		v = repl[get_onecapture(ms, 0, s, e)]
+	else
+		add_s(ms, b, s, e, repl)
+		return true
+	end
+	if not v then
+		b[#b + 1] = sub(ms.src, s, e - 1)
+		return false
+	elseif type(v) ~= "string" then
+		error(fmt("invalid replacement value (a %s)", type(v)), 0)
+	end
+	b[#b + 1] = v
+	return true
+end
+
+
+function ref.gsub (src, p, repl, max_s)
+	max_s = max_s or #src + 1
+	local anchor = (at(p, 1) == 94)
+	if anchor then p = sub(p, 2) end
+	local ms = new_state(src, p)
+	local b, n, changed = {}, 0, false
+	local s, lastmatch = 1, nil
+	while n < max_s do
+		ms.level = 0
+		local e = match(ms, s, 1)
+		if e and e ~= lastmatch then
+			n = n + 1
+			changed = add_value(ms, b, s, e, repl) or changed
+			s, lastmatch = e, e
+		elseif s < ms.src_end then
+			b[#b + 1] = sub(src, s, s)
+			s = s + 1
+		else
+			break
+		end
+		if anchor then break end
+	end
+	if not changed then return src, n end
+	b[#b + 1] = sub(src, s)
+	return table.concat(b), n
+end
+
+-- }======================================================
+
+
+--[[
+** {======================================================
+** Random cases
+** =======================================================
+]]
+
+local atoms = {
+	"a", "b", "c", ".", "x", "\0", "%%", "%.", "$", "^",
+	"%a", "%d", "%s", "%w", "%p", "%A", "%x", "%z", "%u", "%l", "%c", "%g",
+	"[abc]", "[^abc]", "[a-c]", "[%a_]", "[]]", "[^]]", "[a-]", "[%]]",
+	"[a-%]]", "[%a-z]", "[%d%s]", "[\0-\31]", "[^%s]",
+	"(", ")", "()", "%b()", "%bab", "%f[%w]", "%f[%W]", "%0", "%1", "%2",
+	"*", "+", "-", "?",
+	-- malformed
+	"%", "[", "[a", "[%]", "[^", "%b", "%b(", "%f", "%fa",
+}
+
+local chars = {
+	"a", "b", "c", "x", "Z", "1", "2", " ", "_", "-", "(", ")", "]", "%",
+	"\0", "\n", "\200",
+}
+
+local function randpat ()
+	local t = {}
+	for i = 1, math.random(0, 7) do t[i] = atoms[math.random(#atoms)] end
+	return table.concat(t)
+end
+
+local function randsubject ()
+	local t = {}
+	for i = 1, math.random(0, 14) do t[i] = chars[math.random(#chars)] end
+	return table.concat(t)
+end
+
+local function show (ok, ...)
+	local t = {tostring(ok), tostring(select('#', ...))}
+	if not ok then  -- drop the position that 'luaL_error' prepends
+		return t[1] .. " " .. string.gsub(tostring(...), "^[^\n]-:%d+: ", "")
+	end
+	for i = 1, select('#', ...) do
+		local v = select(i, ...)
+		t[#t + 1] = (type(v) == "string") and fmt("%q", v) or tostring(v)
+	end
+	return table.concat(t, " ")
+end
+
+local function countargs (...)
+	return "<" .. tostring(select('#', ...)) .. ">"
+end
+
+local repltable = {a = "A", ["("] = false, [""] = "E", ab = "AB"}
+
+local function gmatchall (gmatch, s, p, init)
+	local t = {}
+	for a, b in gmatch(s, p, init) do
+		t[#t + 1] = tostring(a) .. ":" .. tostring(b)
+		if #t > 50 then break end
+	end
+	return table.concat(t, ",")
+end
+
+-- each case runs the same operation against both matchers
+local cases = {
+	function (m, s, p, i) return m.find(s, p, i) end,
+	function (m, s, p, i) return m.match(s, p, i) end,
+	function (m, s, p) return m.gsub(s, p, "<%0>") end,
+	function (m, s, p) return m.gsub(s, p, "%1%%") end,
+	function (m, s, p, i) return m.gsub(s, p, countargs, i % 4) end,
+	function (m, s, p) return m.gsub(s, p, repltable) end,
+	function (m, s, p, i) return gmatchall(m.gmatch, s, p, i) end,
+}
+
+local new = {find = string.find, match = string.match,
+             gmatch = string.gmatch, gsub = string.gsub}
+
+local function check (what, s, p, i)
+	local case = cases[what]
+	local expected = show(pcall(case, ref, s, p, i))
+	local got = show(pcall(case, new, s, p, i))
+	if expected ~= got then
+		error(fmt("mismatch (case %d, init %d) for pattern %q on %q:\n" ..
+		          "  expected: %s\n  got:      %s", what, i, p, s, expected, got))
+	end
+end
+
+math.randomseed(seed)
+local pats = {}
+for i = 1, 300 do pats[i] = randpat() end
+for n = 1, iterations do
+	check(math.random(#cases), randsubject(), pats[math.random(#pats)],
+	      math.random(-3, 5))
+end
+
+-- patterns that hit the recursion and capture limits
+local a300 = string.rep("a", 300)
+for what = 1, #cases do
+	check(what, a300, string.rep("a?", 300) .. a300, 1)
+	check(what, a300, string.rep("(", 40), 1)
+	check(what, a300, string.rep("(a)", MAXCAPTURES), 1)
+	check(what, a300, string.rep("(a)", MAXCAPTURES + 1), 1)
+	check(what, a300, string.rep("a-", 250) .. "$", 1)
+end
+for depth = MAXCCALLS - 5, MAXCCALLS + 5 do  -- around the recursion limit
+	check(1, a300, string.rep("a?", depth), 1)
+	check(1, a300, string.rep("(a)", depth % MAXCAPTURES) .. string.rep("a*", depth), 1)
+end
+
+print(fmt("patdiff: %d cases agree (seed %d)", iterations, seed))
+
+-- }======================================================
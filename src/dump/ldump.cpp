@@ -16,6 +16,7 @@
 #include "lua.hpp"
 
 #include "lobject.hpp"
+#include "lopcodes.hpp"
 #include "lstate.hpp"
 #include "lundump.hpp"
 
@@ -127,10 +128,19 @@ struct DumpState
 		}
 	}
 
+	/*
+	** Instructions are dumped one by one so that quickened opcodes are
+	** saved in their generic form.
+	*/
 	void dumpCode(const Proto *f)
 	{
 		dumpInt(f->sizecode);
-		dumpVector(f->code, f->sizecode);
+		for (int i = 0; i < f->sizecode; i++)
+		{
+			Instruction inst = f->code[i];
+			SET_OPCODE(inst, luaP_genericop(GET_OPCODE(inst)));
+			dumpVar(&inst);
+		}
 	}
 
 	void dumpFunction(const Proto *f, TString *psource);
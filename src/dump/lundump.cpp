@@ -15,6 +15,7 @@
 
 #include "lua.hpp"
 
+#include "lcode.hpp"
 #include "ldebug.hpp"
 #include "ldo.hpp"
 #include "lfunc.hpp"
@@ -167,6 +168,8 @@ static void loadCode(LoadState *S, Proto *f)
 	f->code = luaM::newvectorchecked<Instruction>(S->L, n);
 	f->sizecode = n;
 	loadVector(S, f->code, n);
+	luaK_fuse(f->code, n);
+	luaF::initcache(S->L, f);
 }
 
 
@@ -200,7 +203,7 @@ static void loadConstants(LoadState *S, Proto *f)
 				setfltvalue(o, loadNumber(S));
 				break;
 			case LUA_VNUMINT:
-				setivalue(o, loadInteger(S));
+				setivalue(S->L, o, loadInteger(S));
 				break;
 			case LUA_VSHRSTR:
 			case LUA_VLNGSTR:
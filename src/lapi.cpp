@@ -20,6 +20,7 @@
 #include "ldo.hpp"
 #include "lfunc.hpp"
 #include "lgc.hpp"
+#include "lgcpar.hpp"
 #include "lmem.hpp"
 #include "lobject.hpp"
 #include "lstate.hpp"
@@ -416,7 +417,7 @@ LUA_API int lua_compare(lua_State *L, int index1, int index2, LuaCompareOp op)
 
 LUA_API size_t lua_stringtonumber(lua_State *L, const char *s)
 {
-	size_t sz = luaO_str2num(s, s2v(L->top.p));
+	size_t sz = luaO_str2num(L, s, s2v(L->top.p));
 	if (sz != 0)
 		api_incr_top(L);
 	return sz;
@@ -542,6 +543,7 @@ LUA_API const void *lua_topointer(lua_State *L, int idx)
 		case LUA_VUSERDATA:
 		case LUA_VLIGHTUSERDATA:
 			return touserdata(o);
+		case LUA_VNUMINT: return NULL; /* even if boxed */
 		default: {
 			if (iscollectable(o))
 				return gcvalue(o);
@@ -578,7 +580,7 @@ LUA_API void lua_pushnumber(lua_State *L, lua_Number n)
 LUA_API void lua_pushinteger(lua_State *L, lua_Integer n)
 {
 	lua_lock(L);
-	setivalue(s2v(L->top.p), n);
+	setivalue(L, s2v(L->top.p), n);
 	api_incr_top(L);
 	lua_unlock(L);
 }
@@ -692,6 +694,9 @@ LUA_API void lua_pushboolean(lua_State *L, int b)
 LUA_API void lua_pushlightuserdata(lua_State *L, void *p)
 {
 	lua_lock(L);
+#if defined(LUA_USE_NANBOX)
+	api_check(L, nbptrfits(p), "light userdata does not fit a NaN-box");
+#endif
 	setpvalue(s2v(L->top.p), p);
 	api_incr_top(L);
 	lua_unlock(L);
@@ -786,10 +791,10 @@ LUA_API int lua_geti(lua_State *L, int idx, lua_Integer n)
 	{
 		setobj2s(L, L->top.p, slot);
 	}
-	else
+	else if (!luaV_fastgetpacked(t, n, slot, s2v(L->top.p)))
 	{
 		TValue aux;
-		setivalue(&aux, n);
+		setivalue(L, &aux, n);
 		luaV_finishget(L, t, &aux, L->top.p, slot);
 	}
 	api_incr_top(L);
@@ -826,6 +831,12 @@ LUA_API int lua_rawget(lua_State *L, int idx)
 	api_checknelems(L, 1);
 	t = gettable(L, idx);
 	val = luaH_get(t, s2v(L->top.p - 1));
+#if defined(LUA_USE_PACKEDARRAY)
+	TValue aux;
+	if (ispackedslot(val) &&
+		luaH_getpacked(t, packedkey(s2v(L->top.p - 1)), &aux))
+		val = &aux; /* present entry of a packed array part */
+#endif
 	L->top.p--; /* remove key */
 	return finishrawget(L, val);
 }
@@ -834,9 +845,16 @@ LUA_API int lua_rawget(lua_State *L, int idx)
 LUA_API int lua_rawgeti(lua_State *L, int idx, lua_Integer n)
 {
 	Table *t;
+	const TValue *val;
 	lua_lock(L);
 	t = gettable(L, idx);
-	return finishrawget(L, luaH_getint(t, n));
+	val = luaH_getint(t, n);
+#if defined(LUA_USE_PACKEDARRAY)
+	TValue aux;
+	if (ispackedslot(val) && luaH_getpacked(t, n, &aux))
+		val = &aux; /* present entry of a packed array part */
+#endif
+	return finishrawget(L, val);
 }
 
 
@@ -991,10 +1009,10 @@ LUA_API void lua_seti(lua_State *L, int idx, lua_Integer n)
 	{
 		luaV_finishfastset(L, t, slot, s2v(L->top.p - 1));
 	}
-	else
+	else if (!luaV_fastsetpacked(t, n, slot, s2v(L->top.p - 1)))
 	{
 		TValue aux;
-		setivalue(&aux, n);
+		setivalue(L, &aux, n);
 		luaV_finishset(L, t, &aux, s2v(L->top.p - 1), slot);
 	}
 	L->top.p--; /* pop value */
@@ -1058,6 +1076,7 @@ LUA_API int lua_setmetatable(lua_State *L, int objindex)
 	{
 		case LUA_TTABLE: {
 			hvalue(obj)->metatable = mt;
+			luaH_newversion(L, hvalue(obj));
 			if (mt)
 			{
 				luaC_objbarrier(L, gcvalue(obj), mt);
@@ -1320,6 +1339,49 @@ LUA_API int lua_gc(lua_State *L, int what, ...)
 				res = 1; /* signal it */
 			break;
 		}
+		case LUA_GCBUDGET: {
+			int us = va_arg(argp, int);
+			lu_byte oldstp = g->gcstp;
+			g->gcstp = 0; /* allow GC to run (GCSTPGC must be zero here) */
+			res = luaC_budgetstep(L, us);
+			g->gcstp = oldstp; /* restore previous state */
+			break;
+		}
+		case LUA_GCPARALLEL: {
+			int n = va_arg(argp, int);
+#if defined(LUA_USE_PARALLELMARK)
+			res = luaC_setgcworkers(L, n);
+#else
+			(void) n;
+			res = -1; /* not available */
+#endif
+			break;
+		}
+		case LUA_GCBGFREE: {
+			int on = va_arg(argp, int);
+#if defined(LUA_USE_PARALLELMARK)
+			res = luaC_setbgfree(L, on);
+#else
+			(void) on;
+			res = -1; /* not available */
+#endif
+			break;
+		}
+		case LUA_GCFINQUEUE: {
+			int on = va_arg(argp, int);
+			res = g->gcfinqueue;
+			if (on >= 0)
+				g->gcfinqueue = cast_byte(on != 0);
+			break;
+		}
+		case LUA_GCFINALIZE: {
+			int n = va_arg(argp, int);
+			int us = va_arg(argp, int);
+			luaC_runfinalizers(L, n, us);
+			res = (g->finstats.pending > INT_MAX) ? INT_MAX
+							: cast_int(g->finstats.pending);
+			break;
+		}
 		case LUA_GCSETPAUSE: {
 			int data = va_arg(argp, int);
 			res = getgcparam(g->gcpause);
@@ -1369,6 +1431,60 @@ LUA_API int lua_gc(lua_State *L, int what, ...)
 }
 
 
+/*
+** Copy the collector statistics to 'stats' (if not NULL) and, if
+** 'reset', clear them. Returns 0 (with 'stats' zeroed) if statistics
+** are not compiled in.
+*/
+LUA_API int lua_gcstats(lua_State *L, lua_GCStats *stats, int reset)
+{
+#if defined(LUA_USE_GCSTATS)
+	global_State *g = G(L);
+	lua_lock(L);
+	if (stats)
+		*stats = g->gcstats;
+	if (reset)
+		memset(&g->gcstats, 0, sizeof(g->gcstats));
+	lua_unlock(L);
+	return 1;
+#else
+	UNUSED(L); UNUSED(reset);
+	if (stats)
+		memset(stats, 0, sizeof(*stats));
+	return 0;
+#endif
+}
+
+
+LUA_API void lua_finstats(lua_State *L, lua_FinStats *stats, int reset)
+{
+	global_State *g = G(L);
+	lua_lock(L);
+	if (stats)
+		*stats = g->finstats;
+	if (reset)
+	{
+		g->finstats.maxpending = g->finstats.pending;
+		g->finstats.queued = g->finstats.finalized = g->finstats.errors = 0;
+	}
+	lua_unlock(L);
+}
+
+
+/*
+** Write a heap snapshot through 'writer' (see 'luaC_heapsnapshot');
+** returns the writer's error code, or 0.
+*/
+LUA_API int lua_heapsnapshot(lua_State *L, lua_Writer writer, void *data)
+{
+	int status;
+	lua_lock(L);
+	status = luaC_heapsnapshot(L, writer, data);
+	lua_unlock(L);
+	return status;
+}
+
+
 /*
 ** miscellaneous functions
 */
@@ -1466,12 +1582,29 @@ LUA_API lua_Alloc lua_getallocf(lua_State *L, void **ud)
 LUA_API void lua_setallocf(lua_State *L, lua_Alloc f, void *ud)
 {
 	lua_lock(L);
+#if defined(LUA_USE_PARALLELMARK)
+	luaC_syncfree(G(L)); /* pending blocks belong to the old allocator */
+#endif
 	G(L)->ud = ud;
 	G(L)->frealloc = f;
 	lua_unlock(L);
 }
 
 
+/*
+** Tell whether the allocation function releases all the memory of the
+** state when it frees the main block of the state (the last block
+** freed by 'lua_close'). If so, 'lua_close' runs the pending finalizers
+** and then frees only that block, instead of every object.
+*/
+LUA_API void lua_setarena(lua_State *L, int on)
+{
+	lua_lock(L);
+	G(L)->arena = cast_byte(on != 0);
+	lua_unlock(L);
+}
+
+
 void lua_setwarnf(lua_State *L, lua_WarnFunction f, void *ud)
 {
 	lua_lock(L);
@@ -1481,6 +1614,19 @@ void lua_setwarnf(lua_State *L, lua_WarnFunction f, void *ud)
 }
 
 
+/*
+** Register 'f' as the primitive 'next', which must behave as 'lua_next'
+** for a table argument. Generic 'for' loops iterating with 'f' over a
+** table do not call it, but traverse the table directly.
+*/
+LUA_API void lua_setnextfunction(lua_State *L, lua_CFunction f)
+{
+	lua_lock(L);
+	G(L)->nextf = f;
+	lua_unlock(L);
+}
+
+
 void lua_warning(lua_State *L, const char *msg, int tocont)
 {
 	lua_lock(L);
@@ -1586,6 +1732,40 @@ static UpVal **getupvalref(lua_State *L, int fidx, int n, LClosure **pf)
 }
 
 
+/*
+** Get the type feedback of the 'n'-th instruction (1-based) of the Lua
+** function at 'funcindex': execution count, tag masks of its operands
+** (see 'TypeFeedback') and line. Returns 0 if there is no such
+** instruction.
+*/
+LUA_API int lua_gettypefeedback(lua_State *L, int funcindex, int n,
+										  unsigned int *count, unsigned int *seen,
+										  int *line)
+{
+	const TValue *o;
+	Proto *p;
+	lua_lock(L);
+	o = index2value(L, funcindex);
+	if (!ttisLclosure(o) || n < 1 || n > (p = clLvalue(o)->p)->sizecode)
+	{
+		lua_unlock(L);
+		return 0;
+	}
+	if (p->typefb != NULL)
+	{
+		const TypeFeedback *fb = &p->typefb[n - 1];
+		*count = fb->count;
+		seen[0] = fb->seen[0];
+		seen[1] = fb->seen[1];
+	}
+	else
+		*count = seen[0] = seen[1] = 0;
+	*line = luaG_getfuncline(p, n - 1);
+	lua_unlock(L);
+	return 1;
+}
+
+
 LUA_API void *lua_upvalueid(lua_State *L, int fidx, int n)
 {
 	TValue *fi = index2value(L, fidx);
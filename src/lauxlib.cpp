@@ -17,6 +17,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <new>
+
 
 /*
 ** This file uses only the official API of Lua.
@@ -952,6 +954,10 @@ static const char *getS(lua_State *L, void *ud, size_t *size)
 }
 
 
+/*
+** Besides 'b' and 't', 'mode' may contain 'o' to run the optimizer
+** over text chunks (e.g., "to" or "bto").
+*/
 LUALIB_API int luaL_loadbufferx(lua_State *L, const char *buff, size_t size,
 											const char *name, const char *mode)
 {
@@ -1165,6 +1171,376 @@ static void *l_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
 }
 
 
+/*
+** {======================================================
+** Size-class allocator
+** =======================================================
+*/
+
+/*
+** Blocks of up to POOLMAXSIZE bytes are carved from slabs and, once
+** freed, kept in a free list for their size class; larger blocks go
+** to 'realloc' (with a small header). Lua always passes the size of a
+** block when resizing or freeing it, so small blocks need no headers.
+** A pool serves one state (it is the 'ud' of its allocation function);
+** as a state is used by one thread at a time, the pool needs no
+** per-thread caches. (With the background freeing thread of the
+** collector, frees may come from another thread, so then a spin lock
+** protects the pool.) The pool is destroyed when its state frees its
+** last block, in 'lua_close'.
+**
+** An arena ('LUAL_ALLOCARENA') is a pool that also keeps its large
+** blocks in a list (through their headers). When the state frees its main
+** block (the first block it allocated), the arena frees all slabs and
+** large blocks at once; so 'lua_close' does not need to free each
+** object (see 'lua_setarena').
+**
+** Both can limit the memory in use ('luaL_setmemlimit'): allocations
+** beyond the limit fail, which makes Lua run an emergency collection
+** and try again.
+**
+** Lua assumes that shrinking a block never fails, so a shrink that
+** changes the class of a block does not take new memory from the
+** system: without a free block or room in the current slab, the block
+** stays where it is. A small block then is just larger than its new
+** class; a large block becomes a slab of its own (freed with the
+** pool), as its size is now small for Lua.
+*/
+
+#if defined(LUA_USE_PARALLELMARK)
+#include <atomic>
+#endif
+
+
+#define POOLGRAIN	16 /* size-class granularity (and alignment) */
+#define POOLMAXSIZE	256 /* largest block served by the pool */
+#define NPOOLCLASSES	(POOLMAXSIZE / POOLGRAIN)
+#define POOLSLABSIZE	(32 * 1024) /* memory taken from the system at a time */
+
+#define sizeclass(s)	(((s) - 1) / POOLGRAIN)
+#define classsize(c)	(((c) + 1) * POOLGRAIN)
+
+
+typedef struct PoolBlock
+{
+	struct PoolBlock *next;
+} PoolBlock;
+
+
+/* header of a large block (linked in a list only in an arena) */
+typedef struct alignas(POOLGRAIN) LargeBlock
+{
+	struct LargeBlock *prev;
+	struct LargeBlock *next;
+} LargeBlock;
+
+
+typedef struct Pool
+{
+	PoolBlock *freeblocks[NPOOLCLASSES]; /* free blocks of each class */
+	char *bump; /* free space in the current slab */
+	char *bumpend;
+	PoolBlock *slabs; /* list of all slabs */
+	size_t inuse; /* bytes of all blocks in use (as requested) */
+	size_t limit; /* maximum for 'inuse' (0 for no limit) */
+	int arena; /* true if an arena */
+	LargeBlock large; /* list of large blocks (in an arena) */
+	void *mainblock; /* first block allocated */
+	luaL_AllocStats stats;
+#if defined(LUA_USE_PARALLELMARK)
+	std::atomic_flag lock = ATOMIC_FLAG_INIT;
+#endif
+} Pool;
+
+
+#if defined(LUA_USE_PARALLELMARK)
+#define lockpool(p)	{ while ((p)->lock.test_and_set(std::memory_order_acquire)) {} }
+#define unlockpool(p)	(p)->lock.clear(std::memory_order_release)
+#else
+#define lockpool(p)	((void)0)
+#define unlockpool(p)	((void)0)
+#endif
+
+
+static void destroypool(Pool *p)
+{
+	PoolBlock *s = p->slabs;
+	while (s != NULL)
+	{
+		PoolBlock *next = s->next;
+		free(s);
+		s = next;
+	}
+	if (p->arena)
+	{
+		LargeBlock *b = p->large.next;
+		while (b != &p->large)
+		{
+			LargeBlock *next = b->next;
+			free(b);
+			b = next;
+		}
+	}
+	delete p;
+}
+
+
+static void linklarge(Pool *p, LargeBlock *b)
+{
+	b->prev = &p->large;
+	b->next = p->large.next;
+	b->next->prev = b;
+	p->large.next = b;
+}
+
+
+static void unlinklarge(LargeBlock *b)
+{
+	b->prev->next = b->next;
+	b->next->prev = b->prev;
+}
+
+
+/* allocate or resize a large block ('nsize' > 0) */
+static void *largeresize(Pool *p, void *ptr, size_t nsize)
+{
+	LargeBlock *b = (ptr != NULL) ? (LargeBlock *) ptr - 1 : NULL;
+	LargeBlock *nb;
+	if (b != NULL && p->arena)
+		unlinklarge(b);
+	nb = (LargeBlock *) realloc(b, sizeof(LargeBlock) + nsize);
+	if (nb == NULL)
+	{
+		if (b != NULL && p->arena)
+			linklarge(p, b); /* block is still valid */
+		return NULL;
+	}
+	if (p->arena)
+		linklarge(p, nb);
+	return nb + 1;
+}
+
+
+static void largefree(Pool *p, void *ptr)
+{
+	LargeBlock *b = (LargeBlock *) ptr - 1;
+	if (p->arena)
+		unlinklarge(b);
+	free(b);
+}
+
+
+/*
+** Large block 'ptr' (of 'osize' bytes) is being shrunk to a small size
+** and there is no room for it in the slabs: keep it in place, as a
+** slab of its own.
+*/
+static void largetoslab(Pool *p, void *ptr, size_t osize, size_t nsize)
+{
+	LargeBlock *b = (LargeBlock *) ptr - 1;
+	PoolBlock *s = (PoolBlock *) b; /* header becomes the slab link */
+	if (p->arena)
+		unlinklarge(b);
+	s->next = p->slabs;
+	p->slabs = s;
+	p->stats.largebytes -= osize;
+	p->stats.slabbytes += sizeof(LargeBlock) + osize;
+	p->stats.usedbytes += classsize(sizeclass(nsize));
+	p->stats.requestedbytes += nsize;
+}
+
+
+/*
+** Get a small block of 'size' bytes. Unless 'grow', it does not take a
+** new slab from the system (it may then fail even with memory free).
+*/
+static void *poolget(Pool *p, size_t size, int grow)
+{
+	int c = sizeclass(size);
+	size_t bsize = classsize(c);
+	PoolBlock *b = p->freeblocks[c];
+	if (b != NULL)
+	{
+		/* reuse a free block */
+		p->freeblocks[c] = b->next;
+		p->stats.nalloc++;
+		p->stats.nhits++;
+	}
+	else
+	{
+		if (cast_sizet(p->bumpend - p->bump) < bsize)
+		{
+			if (!grow)
+				return NULL;
+			/* current slab is exhausted; get a new one */
+			PoolBlock *s = (PoolBlock *) malloc(POOLSLABSIZE);
+			if (s == NULL)
+				return NULL;
+			s->next = p->slabs;
+			p->slabs = s;
+			p->bump = (char *) s + POOLGRAIN;
+			p->bumpend = (char *) s + POOLSLABSIZE;
+			p->stats.slabbytes += POOLSLABSIZE;
+		}
+		b = (PoolBlock *) p->bump;
+		p->bump += bsize;
+		p->stats.nalloc++;
+	}
+	p->stats.usedbytes += bsize;
+	p->stats.requestedbytes += size;
+	return b;
+}
+
+
+static void poolput(Pool *p, void *block, size_t size)
+{
+	int c = sizeclass(size);
+	PoolBlock *b = (PoolBlock *) block;
+	b->next = p->freeblocks[c];
+	p->freeblocks[c] = b;
+	p->stats.usedbytes -= classsize(c);
+	p->stats.requestedbytes -= size;
+}
+
+
+static void *poolresize(Pool *p, void *ptr, size_t osize, size_t nsize)
+{
+	void *nb;
+	if (ptr == NULL)
+		osize = 0; /* 'osize' is the type of a new object */
+	if (osize > POOLMAXSIZE && nsize > POOLMAXSIZE)
+	{
+		/* both large */
+		nb = largeresize(p, ptr, nsize);
+		if (nb == NULL && nsize < osize)
+			nb = ptr; /* a shrink cannot fail; keep the block */
+		if (nb != NULL)
+			p->stats.largebytes += nsize - osize;
+		return nb;
+	}
+	if (nsize == 0)
+	{
+		if (osize > POOLMAXSIZE)
+		{
+			largefree(p, ptr);
+			p->stats.largebytes -= osize;
+		}
+		else if (ptr != NULL)
+			poolput(p, ptr, osize);
+		return NULL;
+	}
+	if (osize > 0 && osize <= POOLMAXSIZE && nsize <= POOLMAXSIZE &&
+		 sizeclass(osize) == sizeclass(nsize))
+	{
+		/* same class */
+		p->stats.requestedbytes += nsize - osize;
+		return ptr;
+	}
+	if (nsize <= POOLMAXSIZE)
+		nb = poolget(p, nsize, nsize > osize);
+	else if ((nb = largeresize(p, NULL, nsize)) != NULL)
+	{
+		p->stats.nlarge++;
+		p->stats.largebytes += nsize;
+	}
+	if (nb == NULL)
+	{
+		if (nsize > osize)
+			return NULL; /* growing a block can fail */
+		if (osize > POOLMAXSIZE)
+			largetoslab(p, ptr, osize, nsize);
+		else
+		{
+			/* the block keeps its class; Lua now sees a smaller one */
+			p->stats.usedbytes -= classsize(sizeclass(osize)) -
+										 classsize(sizeclass(nsize));
+			p->stats.requestedbytes -= osize - nsize;
+		}
+		return ptr;
+	}
+	if (ptr != NULL)
+	{
+		/* move the block */
+		memcpy(nb, ptr, (osize < nsize) ? osize : nsize);
+		poolresize(p, ptr, osize, 0);
+	}
+	return nb;
+}
+
+
+static void *pool_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	Pool *p = (Pool *) ud;
+	void *nb;
+	size_t oldsize = (ptr != NULL) ? osize : 0;
+	int empty;
+	if (p->arena && nsize == 0 && ptr != NULL && ptr == p->mainblock)
+	{
+		/* freeing the main block releases the whole arena */
+		destroypool(p);
+		return NULL;
+	}
+	lockpool(p);
+	if (p->limit != 0 && nsize > oldsize && p->inuse + (nsize - oldsize) > p->limit)
+		nb = NULL; /* over the limit */
+	else
+		nb = poolresize(p, ptr, osize, nsize);
+	if (nb != NULL || nsize == 0)
+		p->inuse += nsize - oldsize;
+	if (p->mainblock == NULL)
+		p->mainblock = nb;
+	empty = (p->inuse == 0);
+	unlockpool(p);
+	if (empty) /* freed the last block (or could not allocate any)? */
+		destroypool(p);
+	return nb;
+}
+
+
+static lua_State *newpoolstate(int arena)
+{
+	lua_State *L;
+	Pool *p = new (std::nothrow) Pool();
+	if (p == NULL)
+		return NULL;
+	p->arena = arena;
+	p->large.prev = p->large.next = &p->large;
+	/* if the state cannot be created, 'pool_alloc' frees the pool */
+	L = lua_newstate(pool_alloc, p);
+	if (L != NULL && arena)
+		lua_setarena(L, 1);
+	return L;
+}
+
+
+LUALIB_API int luaL_setmemlimit(lua_State *L, size_t limit)
+{
+	void *ud;
+	if (lua_getallocf(L, &ud) != pool_alloc)
+		return 0; /* state does not use the size-class allocator */
+	Pool *p = (Pool *) ud;
+	lockpool(p);
+	p->limit = limit;
+	unlockpool(p);
+	return 1;
+}
+
+
+LUALIB_API int luaL_allocstats(lua_State *L, luaL_AllocStats *stats)
+{
+	void *ud;
+	if (lua_getallocf(L, &ud) != pool_alloc)
+		return 0; /* state does not use the size-class allocator */
+	Pool *p = (Pool *) ud;
+	lockpool(p);
+	*stats = p->stats;
+	unlockpool(p);
+	return 1;
+}
+
+/* }====================================================== */
+
+
 /*
 ** Standard panic funcion just prints an error message. The test
 ** with 'lua_type' avoids possible memory errors in 'lua_tostring'.
@@ -1243,9 +1619,11 @@ static void warnfon(void *ud, const char *message, int tocont)
 }
 
 
-LUALIB_API lua_State *luaL_newstate(void)
+LUALIB_API lua_State *luaL_newstatealloc(int allocator)
 {
-	lua_State *L = lua_newstate(l_alloc, NULL);
+	lua_State *L = (allocator == LUAL_ALLOCSYSTEM)
+							? lua_newstate(l_alloc, NULL)
+							: newpoolstate(allocator == LUAL_ALLOCARENA);
 	if (l_likely(L))
 	{
 		lua_atpanic(L, &panic);
@@ -1255,6 +1633,12 @@ LUALIB_API lua_State *luaL_newstate(void)
 }
 
 
+LUALIB_API lua_State *luaL_newstate(void)
+{
+	return luaL_newstatealloc(LUAL_DEFAULTALLOC);
+}
+
+
 LUALIB_API void luaL_checkversion_(lua_State *L, lua_Number ver, size_t sz)
 {
 	lua_Number v = lua_version(L);
@@ -126,6 +126,37 @@ LUALIB_API int (luaL_loadstring)(lua_State *L, const char *s);
 
 LUALIB_API auto (luaL_newstate)(void) -> lua_State*;
 
+
+/* allocators for 'luaL_newstatealloc' */
+constexpr auto LUAL_ALLOCSYSTEM = 0; /* 'realloc' and 'free' */
+constexpr auto LUAL_ALLOCPOOL   = 1; /* size-class pool for small blocks */
+constexpr auto LUAL_ALLOCARENA  = 2; /* pool released at once by 'lua_close' */
+
+/* allocator used by 'luaL_newstate' */
+#if !defined(LUAL_DEFAULTALLOC)
+#define LUAL_DEFAULTALLOC	LUAL_ALLOCSYSTEM
+#endif
+
+LUALIB_API auto (luaL_newstatealloc)(int allocator) -> lua_State*;
+
+
+/* statistics of the size-class allocator (see 'luaL_allocstats') */
+typedef struct luaL_AllocStats
+{
+	size_t slabbytes; /* memory of all slabs */
+	size_t usedbytes; /* slab memory in blocks in use */
+	size_t requestedbytes; /* memory requested for those blocks */
+	size_t largebytes; /* memory in blocks too large for the slabs */
+	lua_Unsigned nalloc; /* allocations of small blocks */
+	lua_Unsigned nhits; /* those served by a free list */
+	lua_Unsigned nlarge; /* allocations of large blocks */
+} luaL_AllocStats;
+
+LUALIB_API int (luaL_allocstats)(lua_State *L, luaL_AllocStats *stats);
+
+/* limit the memory in use by a state created with a pool or an arena */
+LUALIB_API int (luaL_setmemlimit)(lua_State *L, size_t limit);
+
 LUALIB_API lua_Integer (luaL_len)(lua_State *L, int idx);
 
 LUALIB_API void (luaL_addgsub)(luaL_Buffer *b, const char *s,
@@ -58,14 +58,15 @@ l_noret luaK_semerror(LexState *ls, const char *msg)
 ** If expression is a numeric constant, fills 'v' with its value
 ** and returns 1. Otherwise, returns 0.
 */
-static int tonumeral(const expdesc *e, TValue *v)
+static int tonumeral(FuncState *fs, const expdesc *e, TValue *v)
 {
+	UNUSED(fs); /* needed only by NaN-boxed integers (see 'setivalue') */
 	if (hasjumps(e))
 		return 0; /* not a numeral */
 	switch (e->k)
 	{
 		case VKINT:
-			if (v) setivalue(v, e->u.ival);
+			if (v) setivalue(fs->ls->L, v, e->u.ival);
 			return 1;
 		case VKFLT:
 			if (v) setfltvalue(v, e->u.nval);
@@ -112,7 +113,7 @@ int luaK_exp2const(FuncState *fs, const expdesc *e, TValue *v)
 			setobj(fs->ls->L, v, const2val(fs, e));
 			return 1;
 		}
-		default: return tonumeral(e, v);
+		default: return tonumeral(fs, e, v);
 	}
 }
 
@@ -368,8 +369,9 @@ static void savelineinfo(FuncState *fs, Proto *f, int line)
 	int pc = fs->pc - 1; /* last instruction coded */
 	if (abs(linedif) >= LIMLINEDIFF || fs->iwthabs++ >= MAXIWTHABS)
 	{
-		f->abslineinfo = luaM::growvector(
+		f->abslineinfo = luaY_growvector(
 			fs->ls->L,
+			&fs->ls->dyd->arena,
 			f->abslineinfo,
 			fs->nabslineinfo,
 			&f->sizeabslineinfo,
@@ -381,8 +383,9 @@ static void savelineinfo(FuncState *fs, Proto *f, int line)
 		linedif = ABSLINEINFO; /* signal that there is absolute information */
 		fs->iwthabs = 1; /* restart counter */
 	}
-	f->lineinfo = luaM::growvector(
+	f->lineinfo = luaY_growvector(
 		fs->ls->L,
+		&fs->ls->dyd->arena,
 		f->lineinfo,
 		pc,
 		&f->sizelineinfo,
@@ -439,8 +442,9 @@ int luaK_code(FuncState *fs, Instruction i)
 {
 	Proto *f = fs->f;
 	/* put new instruction in code array */
-	f->code = luaM::growvector<Instruction>(
+	f->code = luaY_growvector<Instruction>(
 		fs->ls->L,
+		&fs->ls->dyd->arena,
 		f->code,
 		fs->pc,
 		&f->sizecode,
@@ -626,11 +630,16 @@ static int addk(FuncState *fs, TValue *key, TValue *v)
 	lua_State *L = fs->ls->L;
 	Proto *f = fs->f;
 	const TValue *idx = luaH_get(fs->ls->h, key); /* query scanner table */
+	const TValue *old = idx;
 	int k, oldsize;
-	if (ttisinteger(idx))
+#if defined(LUA_USE_PACKEDARRAY)
+	if (ispackedslot(idx) && luaH_getpacked(fs->ls->h, packedkey(key), &val))
+		old = &val; /* entry of a packed array part */
+#endif
+	if (ttisinteger(old))
 	{
 		/* is there an index there? */
-		k = cast_int(ivalue(idx));
+		k = cast_int(ivalue(old));
 		/* correct value? (warning: must distinguish floats from integers!) */
 		if (k < fs->nk && ttypetag(&f->k[k]) == ttypetag(v) &&
 			luaV_rawequalobj(&f->k[k], v))
@@ -641,9 +650,9 @@ static int addk(FuncState *fs, TValue *key, TValue *v)
 	k = fs->nk;
 	/* numerical value does not need GC barrier;
 		table has no metatable, so it does not need to invalidate cache */
-	setivalue(&val, k);
+	setivalue(L, &val, k);
 	luaH_finishset(L, fs->ls->h, key, idx, &val);
-	f->k = luaM::growvector<TValue>(L, f->k, k, &f->sizek, MAXARG_Ax, "constants");
+	f->k = luaY_growvector<TValue>(L, &fs->ls->dyd->arena, f->k, k, &f->sizek, MAXARG_Ax, "constants");
 	while (oldsize < f->sizek)
 		setnilvalue(&f->k[oldsize++]);
 	setobj(L, &f->k[k], v);
@@ -670,7 +679,7 @@ static int stringK(FuncState *fs, TString *s)
 static int luaK_intK(FuncState *fs, lua_Integer n)
 {
 	TValue o;
-	setivalue(&o, n);
+	setivalue(fs->ls->L, &o, n);
 	return addk(fs, &o, &o); /* use integer itself as key */
 }
 
@@ -1536,7 +1545,8 @@ static int constfolding(FuncState *fs, int op, expdesc *e1,
 								const expdesc *e2)
 {
 	TValue v1, v2, res;
-	if (!tonumeral(e1, &v1) || !tonumeral(e2, &v2) || !validop(op, &v1, &v2))
+	if (!tonumeral(fs, e1, &v1) || !tonumeral(fs, e2, &v2) ||
+		!validop(op, &v1, &v2))
 		return 0; /* non-numeric operands or not safe to fold */
 	luaO_rawarith(fs->ls->L, op, &v1, &v2, &res); /* does operation */
 	if (ttisinteger(&res))
@@ -1721,7 +1731,7 @@ static void codebinNoK(FuncState *fs, BinOpr opr,
 static void codearith(FuncState *fs, BinOpr opr,
 							expdesc *e1, expdesc *e2, int flip, int line)
 {
-	if (tonumeral(e2, NULL) && luaK_exp2K(fs, e2)) /* K operand? */
+	if (tonumeral(fs, e2, NULL) && luaK_exp2K(fs, e2)) /* K operand? */
 		codebinK(fs, opr, e1, e2, flip, line);
 	else /* 'e2' is neither an immediate nor a K operand */
 		codebinNoK(fs, opr, e1, e2, flip, line);
@@ -1737,7 +1747,7 @@ static void codecommutative(FuncState *fs, BinOpr op,
 									expdesc *e1, expdesc *e2, int line)
 {
 	int flip = 0;
-	if (tonumeral(e1, NULL))
+	if (tonumeral(fs, e1, NULL))
 	{
 		/* is first operand a numeric constant? */
 		swapexps(e1, e2); /* change order */
@@ -1902,7 +1912,7 @@ void luaK_infix(FuncState *fs, BinOpr op, expdesc *v)
 		case OPR_BXOR:
 		case OPR_SHL:
 		case OPR_SHR: {
-			if (!tonumeral(v, NULL))
+			if (!tonumeral(fs, v, NULL))
 				luaK_exp2anyreg(fs, v);
 			/* else keep numeral, which may be folded or used as an immediate
 				operand */
@@ -1910,7 +1920,7 @@ void luaK_infix(FuncState *fs, BinOpr op, expdesc *v)
 		}
 		case OPR_EQ:
 		case OPR_NE: {
-			if (!tonumeral(v, NULL))
+			if (!tonumeral(fs, v, NULL))
 				exp2RK(fs, v);
 			/* else keep numeral, which may be an immediate operand */
 			break;
@@ -2099,6 +2109,51 @@ void luaK_setlist(FuncState *fs, int base, int nelems, int tostore)
 }
 
 
+/*
+** Superinstruction for the pair of instructions with opcodes 'op1'
+** and 'op2', or 'op1' itself if there is none.
+*/
+static OpCode fusedop(OpCode op1, OpCode op2)
+{
+	switch (op1)
+	{
+		case OP_GETTABUP:
+			return (op2 == OP_GETFIELD) ? OP_GETTABUPFIELD : op1;
+		case OP_GETUPVAL:
+			return (op2 == OP_GETFIELD) ? OP_GETUPVALFIELD : op1;
+		case OP_GETFIELD:
+			return (op2 == OP_CALL) ? OP_GETFIELDCALL : op1;
+		case OP_LOADK:
+			return (op2 == OP_SETFIELD) ? OP_LOADKSETFIELD : op1;
+		default:
+			return op1;
+	}
+}
+
+
+/*
+** Peephole pass that turns common pairs of instructions into
+** superinstructions. Only the opcode of the first instruction changes,
+** so code size, line information and jump targets are preserved. The
+** second instruction of a pair is never itself fused, so that it is
+** always executed by its plain handler.
+*/
+void luaK_fuse(Instruction *code, int n)
+{
+	int i;
+	for (i = 0; i + 1 < n; i++)
+	{
+		Instruction *pc = &code[i];
+		OpCode op = fusedop(GET_OPCODE(*pc), GET_OPCODE(*(pc + 1)));
+		if (op != GET_OPCODE(*pc))
+		{
+			SET_OPCODE(*pc, op);
+			i++; /* skip second instruction of the pair */
+		}
+	}
+}
+
+
 /*
 ** return the final target of a jump (skipping jumps to jumps)
 */
@@ -2118,6 +2173,280 @@ static int finaltarget(Instruction *code, int i)
 }
 
 
+/*
+** {======================================================
+** Optional optimizer (load mode 'o')
+** =======================================================
+*/
+
+/* flags for each instruction, kept in 'luaK_optimize' scratch space */
+#define OPTREACH	1	/* instruction is reachable */
+#define OPTTARGET	2	/* instruction is the target of some jump */
+#define OPTDROP		4	/* instruction will be removed */
+
+
+/*
+** Instructions that write only register A from other registers,
+** constants or upvalues, and so can have their result retargeted.
+*/
+static int issimpleload(Instruction i)
+{
+	switch (GET_OPCODE(i))
+	{
+		case OP_MOVE: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+		case OP_LOADFALSE: case OP_LOADTRUE: case OP_GETUPVAL:
+		case OP_GETTABUP: case OP_GETTABLE: case OP_GETI: case OP_GETFIELD:
+			return 1;
+		case OP_LOADNIL:
+			return (GETARG_B(i) == 0);
+		default: return 0;
+	}
+}
+
+
+/*
+** Instructions that skip the next one ('OP_LFALSESKIP' and tests);
+** the instruction after them cannot be removed.
+*/
+static int isskip(Instruction i)
+{
+	OpCode op = GET_OPCODE(i);
+	return (op == OP_LFALSESKIP || testTMode(op));
+}
+
+
+/*
+** Return the destination of a branch instruction at 'pc', or -1 if it
+** is not a branch. For 'OP_FORPREP', the destination is the 'OP_FORLOOP'
+** (the loop exit being the instruction after it).
+*/
+static int branchdest(Instruction *code, int pc)
+{
+	Instruction i = code[pc];
+	switch (GET_OPCODE(i))
+	{
+		case OP_JMP: return pc + 1 + GETARG_sJ(i);
+		case OP_FORPREP: case OP_TFORPREP: return pc + 1 + GETARG_Bx(i);
+		case OP_FORLOOP: case OP_TFORLOOP: return pc + 1 - GETARG_Bx(i);
+		default: return -1;
+	}
+}
+
+
+/*
+** Number of active locals (which is also the number of registers they
+** occupy) at instruction 'pc'.
+*/
+static int nactiveat(FuncState *fs, int pc)
+{
+	Proto *f = fs->f;
+	int i, n = 0;
+	for (i = 0; i < fs->ndebugvars; i++)
+	{
+		if (f->locvars[i].startpc <= pc && pc < f->locvars[i].endpc)
+			n++;
+	}
+	return n;
+}
+
+
+/*
+** Mark as reachable all instructions reachable from the function entry.
+** Uses 'newpc' as a work stack.
+*/
+static void markreachable(Instruction *code, int n, lu_byte *flag,
+								  int *stack)
+{
+	int top = 0;
+	stack[top++] = 0;
+	flag[0] |= OPTREACH;
+	while (top > 0)
+	{
+		int pc = stack[--top];
+		Instruction i = code[pc];
+		OpCode op = GET_OPCODE(i);
+		int succ[3];
+		int ns = 0, k;
+		switch (op)
+		{
+			case OP_RETURN: case OP_RETURN0: case OP_RETURN1:
+				break;
+			case OP_JMP: case OP_TFORPREP:
+				succ[ns++] = branchdest(code, pc);
+				break;
+			case OP_FORPREP: {
+				int dest = branchdest(code, pc);
+				succ[ns++] = pc + 1;
+				succ[ns++] = dest; /* keep the 'OP_FORLOOP' */
+				succ[ns++] = dest + 1;
+				break;
+			}
+			case OP_FORLOOP: case OP_TFORLOOP:
+				succ[ns++] = pc + 1;
+				succ[ns++] = branchdest(code, pc);
+				break;
+			case OP_LFALSESKIP:
+				succ[ns++] = pc + 2;
+				break;
+			default: {
+				succ[ns++] = pc + 1;
+				if (testTMode(op))
+					succ[ns++] = pc + 2;
+				break;
+			}
+		}
+		for (k = 0; k < ns; k++)
+		{
+			if (succ[k] < n && !(flag[succ[k]] & OPTREACH))
+			{
+				flag[succ[k]] |= OPTREACH;
+				stack[top++] = succ[k];
+			}
+		}
+	}
+}
+
+
+/*
+** Optimize the code of a finished function (before 'luaK_finish'):
+** threads jumps to returns, removes unreachable code and jumps to the
+** next instruction, and eliminates redundant moves into locals. Line
+** information is rebuilt for the remaining instructions. Scratch
+** space comes from the lexer buffer, which is free at this point and
+** is released by the caller even on errors.
+*/
+void luaK_optimize(FuncState *fs)
+{
+	Proto *f = fs->f;
+	Instruction *code = f->code;
+	int n = fs->pc;
+	Mbuffer *b = fs->ls->buff;
+	size_t need = (2 * cast_sizet(n) + 1) * sizeof(int) + cast_sizet(n);
+	int *line, *newpc;
+	lu_byte *flag;
+	int i, nk, nabs = 0, curline = f->linedefined;
+	if (b->sizebuffer() < need)
+		b->resizebuffer(fs->ls->L, need);
+	line = cast(int *, b->getbuffer());
+	newpc = line + n;
+	flag = cast(lu_byte *, newpc + n + 1);
+	for (i = 0; i < n; i++)
+	{
+		/* decode line information (see 'savelineinfo') */
+		if (f->lineinfo[i] == ABSLINEINFO)
+			curline = f->abslineinfo[nabs++].line;
+		else
+			curline += f->lineinfo[i];
+		line[i] = curline;
+		flag[i] = 0;
+	}
+	/* thread unconditional jumps into returns */
+	for (i = 0; i < n; i++)
+	{
+		if (GET_OPCODE(code[i]) == OP_JMP && !(i > 0 && isskip(code[i - 1])))
+		{
+			int target = finaltarget(code, i);
+			OpCode op = GET_OPCODE(code[target]);
+			if (op == OP_RETURN0 || op == OP_RETURN1)
+				code[i] = code[target];
+		}
+	}
+	markreachable(code, n, flag, newpc);
+	for (i = 0; i < n; i++)
+	{
+		int dest;
+		if (!(flag[i] & OPTREACH))
+			flag[i] |= OPTDROP;
+		else if ((dest = branchdest(code, i)) >= 0)
+		{
+			flag[dest] |= OPTTARGET;
+			if (GET_OPCODE(code[i]) == OP_FORPREP)
+				flag[dest + 1] |= OPTTARGET;
+		}
+		else if (isskip(code[i]) && i + 2 < n)
+			flag[i + 2] |= OPTTARGET;
+	}
+	for (i = 1; i < n; i++)
+	{
+		Instruction cur = code[i], prev = code[i - 1];
+		if ((flag[i] & OPTDROP) || (flag[i - 1] & OPTDROP) || isskip(prev))
+			continue;
+		if (GET_OPCODE(cur) == OP_JMP)
+		{
+			if (branchdest(code, i) == i + 1) /* jump to next instruction? */
+				flag[i] |= OPTDROP;
+		}
+		else if (GET_OPCODE(cur) == OP_MOVE && !(flag[i] & OPTTARGET))
+		{
+			int a = GETARG_A(cur), t = GETARG_B(cur);
+			if (GET_OPCODE(prev) == OP_MOVE &&
+				 GETARG_A(prev) == t && GETARG_B(prev) == a)
+				flag[i] |= OPTDROP; /* 'MOVE t a; MOVE a t' */
+			else if (issimpleload(prev) && GETARG_A(prev) == t &&
+						!(flag[i - 1] & OPTTARGET) && !(i > 1 && isskip(code[i - 2])))
+			{
+				int nact = nactiveat(fs, i);
+				if (a < nact && t >= nact)
+				{
+					/* 'x t ...; MOVE a t' ==> 'x a ...' */
+					SETARG_A(code[i - 1], a);
+					flag[i] |= OPTDROP;
+				}
+			}
+		}
+	}
+	for (i = 0, nk = 0; i < n; i++)
+	{
+		newpc[i] = nk;
+		if (!(flag[i] & OPTDROP))
+			nk++;
+	}
+	newpc[n] = nk;
+	if (nk == n)
+		return; /* nothing removed */
+	/* fix branch offsets */
+	for (i = 0; i < n; i++)
+	{
+		int dest = branchdest(code, i);
+		if (dest < 0 || (flag[i] & OPTDROP))
+			continue;
+		switch (GET_OPCODE(code[i]))
+		{
+			case OP_JMP:
+				SETARG_sJ(code[i], newpc[dest] - (newpc[i] + 1));
+				break;
+			case OP_FORPREP: case OP_TFORPREP:
+				SETARG_Bx(code[i], newpc[dest] - (newpc[i] + 1));
+				break;
+			default: /* OP_FORLOOP, OP_TFORLOOP */
+				SETARG_Bx(code[i], (newpc[i] + 1) - newpc[dest]);
+				break;
+		}
+	}
+	for (i = 0; i < fs->ndebugvars; i++)
+	{
+		LocVar *var = &f->locvars[i];
+		var->startpc = newpc[var->startpc];
+		var->endpc = newpc[var->endpc];
+	}
+	/* compact code and rebuild line information */
+	fs->pc = 0;
+	fs->previousline = f->linedefined;
+	fs->iwthabs = 0;
+	fs->nabslineinfo = 0;
+	for (i = 0; i < n; i++)
+	{
+		if (!(flag[i] & OPTDROP))
+		{
+			code[fs->pc++] = code[i];
+			savelineinfo(fs, f, line[i]);
+		}
+	}
+	fs->lasttarget = 0;
+}
+
+/* }====================================================== */
+
 /*
 ** Do a final pass over the code of a function, doing small peephole
 ** optimizations and adjustments.
@@ -2155,4 +2484,5 @@ void luaK_finish(FuncState *fs)
 			default: break;
 		}
 	}
+	luaK_fuse(p->code, fs->pc);
 }
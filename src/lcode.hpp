@@ -147,8 +147,12 @@ LUAI_FUNC void luaK_settablesize(FuncState *fs, int pc,
 
 LUAI_FUNC void luaK_setlist(FuncState *fs, int base, int nelems, int tostore);
 
+LUAI_FUNC void luaK_optimize(FuncState *fs);
+
 LUAI_FUNC void luaK_finish(FuncState *fs);
 
+LUAI_FUNC void luaK_fuse(Instruction *code, int n);
+
 LUAI_FUNC l_noret luaK_semerror(LexState *ls, const char *msg);
 
 
@@ -166,6 +166,50 @@ LUA_API int lua_gethookcount(lua_State *L)
 }
 
 
+/*
+** Statistics of the inline caches of table accesses (see 'getshortstrIC'
+** in lvm.c). They are shared by all threads of a state.
+*/
+LUA_API void lua_getcachestats(lua_State *L, lua_Unsigned *hits,
+										 lua_Unsigned *misses)
+{
+	global_State *g = G(L);
+	if (hits) *hits = cast(lua_Unsigned, g->icachehits);
+	if (misses) *misses = cast(lua_Unsigned, g->icachemisses);
+}
+
+
+LUA_API void lua_getglobalcachestats(lua_State *L, lua_Unsigned *hits,
+											  lua_Unsigned *misses)
+{
+	global_State *g = G(L);
+	if (hits) *hits = cast(lua_Unsigned, g->gcachehits);
+	if (misses) *misses = cast(lua_Unsigned, g->gcachemisses);
+}
+
+
+LUA_API void lua_resetcachestats(lua_State *L)
+{
+	global_State *g = G(L);
+	g->icachehits = g->icachemisses = 0;
+	g->gcachehits = g->gcachemisses = 0;
+}
+
+
+/*
+** Turn the collection of type feedback on or off (see 'luaV_execute');
+** it takes effect for functions entered after the change. Returns the
+** previous setting.
+*/
+LUA_API int lua_settypeprofile(lua_State *L, int on)
+{
+	global_State *g = G(L);
+	int old = g->typeprofile;
+	g->typeprofile = (on != 0);
+	return old;
+}
+
+
 LUA_API int lua_getstack(lua_State *L, int level, lua_Debug *ar)
 {
 	int status;
@@ -494,12 +538,12 @@ static int findsetreg(const Proto *p, int lastpc, int reg)
 	int pc;
 	int setreg = -1; /* keep last instruction that changed 'reg' */
 	int jmptarget = 0; /* any code before this address is conditional */
-	if (testMMMode(GET_OPCODE(p->code[lastpc])))
+	if (testMMMode(GET_GENERICOP(p->code[lastpc])))
 		lastpc--; /* previous instruction was not actually executed */
 	for (pc = 0; pc < lastpc; pc++)
 	{
 		Instruction i = p->code[pc];
-		OpCode op = GET_OPCODE(i);
+		OpCode op = GET_GENERICOP(i);
 		int a = GETARG_A(i);
 		int change; /* true if current instruction changed 'reg' */
 		switch (op)
@@ -571,7 +615,7 @@ static const char *basicgetobjname(const Proto *p, int *ppc, int reg,
 	{
 		/* could find instruction? */
 		Instruction i = p->code[pc];
-		OpCode op = GET_OPCODE(i);
+		OpCode op = GET_GENERICOP(i);
 		switch (op)
 		{
 			case OP_MOVE: {
@@ -646,7 +690,7 @@ static const char *getobjname(const Proto *p, int lastpc, int reg,
 	{
 		/* could find instruction? */
 		Instruction i = p->code[lastpc];
-		OpCode op = GET_OPCODE(i);
+		OpCode op = GET_GENERICOP(i);
 		switch (op)
 		{
 			case OP_GETTABUP: {
@@ -690,7 +734,7 @@ static const char *funcnamefromcode(lua_State *L, const Proto *p,
 {
 	auto tm = (TMS) 0; /* (initial value avoids warnings) */
 	Instruction i = p->code[pc]; /* calling instruction */
-	switch (GET_OPCODE(i))
+	switch (GET_GENERICOP(i))
 	{
 		case OP_CALL:
 		case OP_TAILCALL:
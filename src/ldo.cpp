@@ -1126,7 +1126,7 @@ struct SParser
 	ZIO *z;
 	Mbuffer buff; /* dynamic structure used by the scanner */
 	Dyndata dyd; /* dynamic structures used by the parser */
-	const char *mode;
+	const char *mode; /* 'b', 't' and/or 'o' (optimize text chunks) */
 	const char *name;
 };
 
@@ -1154,7 +1154,8 @@ static void f_parser(lua_State *L, void *ud)
 	else
 	{
 		checkmode(L, p->mode, "text");
-		cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+		cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c,
+		                 p->mode != NULL && strchr(p->mode, 'o') != NULL);
 	}
 	lua_assert(cl->nupvalues == cl->p->sizeupvalues);
 	luaF::initupvals(L, cl);
@@ -1176,14 +1177,16 @@ int luaD::protectedparser(lua_State *L, ZIO *z, const char *name,
 	p.dyd.gt.size = 0;
 	p.dyd.label.arr = NULL;
 	p.dyd.label.size = 0;
+	p.dyd.arena.chunk = NULL;
+	p.dyd.arena.top = p.dyd.arena.limit = NULL;
+	p.dyd.arena.open = NULL;
+	p.dyd.arena.nopen = p.dyd.arena.sizeopen = 0;
 	p.buff.initbuffer(L);
 	// luaZ_initbuffer(L, &p.buff);
 	status = luaD::pcall(L, f_parser, &p, luaD::savestack(L, L->top.p), L->errfunc);
 	p.buff.freebuffer(L);
 	// luaZ_freebuffer(L, &p.buff);
-	luaM::freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
-	luaM::freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
-	luaM::freearray(L, p.dyd.label.arr, p.dyd.label.size);
+	luaY_freedyndata(L, &p.dyd); /* also frees the lists above */
 	L->decnny();
 	return status;
 }
@@ -11,6 +11,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.hpp"
 
@@ -18,8 +19,10 @@
 #include "ldo.hpp"
 #include "lfunc.hpp"
 #include "lgc.hpp"
+#include "ljit.hpp"
 #include "lmem.hpp"
 #include "lobject.hpp"
+#include "lopcodes.hpp"
 #include "lstate.hpp"
 
 
@@ -169,6 +172,8 @@ static void prepcallclosemth(lua_State *L, StkId level, int status, int yy)
 }
 
 
+#if !defined(LUA_USE_NANBOX)
+
 /*
 ** Maximum value for deltas in 'tbclist', dependent on the type
 ** of delta. (This macro assumes that an 'L' is in scope where it
@@ -196,6 +201,29 @@ void luaF::newtbcupval(lua_State *L, StkId level)
 	L->tbclist.p = level;
 }
 
+#else
+
+/*
+** Insert a variable in the list of to-be-closed variables. NaN-boxed
+** stack entries have no room for deltas, so 'tbclist' points only to
+** the last variable; array 'tbcprev' keeps the (stack offsets of the)
+** variables before it, in order.
+*/
+void luaF::newtbcupval(lua_State *L, StkId level)
+{
+	lua_assert(level > L->tbclist.p);
+	if (l_isfalse(s2v(level)))
+		return; /* false doesn't need to be closed */
+	checkclosemth(L, level); /* value must have a close method */
+	L->tbcprev = luaM::growvector(L, L->tbcprev, L->ntbcprev,
+	                              &L->sizetbcprev, MAX_INT,
+	                              "to-be-closed variables");
+	L->tbcprev[L->ntbcprev++] = luaD::savestack(L, L->tbclist.p);
+	L->tbclist.p = level;
+}
+
+#endif
+
 
 void luaF::unlinkupval(UpVal *uv)
 {
@@ -230,6 +258,8 @@ void luaF::closeupval(lua_State *L, StkId level)
 }
 
 
+#if !defined(LUA_USE_NANBOX)
+
 /*
 ** Remove first element from the tbclist plus its dummy nodes.
 */
@@ -243,6 +273,19 @@ static void poptbclist(lua_State *L)
 	L->tbclist.p = tbc;
 }
 
+#else
+
+/*
+** Remove first element from the tbclist.
+*/
+static void poptbclist(lua_State *L)
+{
+	lua_assert(L->ntbcprev > 0);
+	L->tbclist.p = luaD::restorestack(L, L->tbcprev[--L->ntbcprev]);
+}
+
+#endif
+
 
 /*
 ** Close all upvalues and to-be-closed variables up to the given stack
@@ -285,6 +328,16 @@ Proto *luaF::newproto(lua_State *L)
 	f->maxstacksize = 0;
 	f->locvars = NULL;
 	f->sizelocvars = 0;
+	f->icache = NULL;
+	f->envcache = NULL;
+	f->sizeenvcache = 0;
+	f->typefb = NULL;
+	f->cache = NULL;
+	f->cachemiss = 0;
+#if defined(LUA_USE_JIT)
+	f->jit = NULL;
+	f->jitcount = 0;
+#endif
 	f->linedefined = 0;
 	f->lastlinedefined = 0;
 	f->source = NULL;
@@ -292,9 +345,62 @@ Proto *luaF::newproto(lua_State *L)
 }
 
 
+/* instructions whose inline cache is an entry in 'envcache' */
+#define hasenvcache(op)  \
+	((op) == OP_GETTABUP || (op) == OP_SETTABUP || (op) == OP_GETTABUPFIELD)
+
+
+/*
+** Create the inline caches for a prototype whose code is complete.
+** (Must be called again if 'sizecode' ever changes.)
+*/
+void luaF::initcache(lua_State *L, Proto *f)
+{
+	int pc;
+	int n = 0;
+	lua_assert(f->icache == NULL && f->envcache == NULL);
+	ICache *ic = luaM::newvector<ICache>(L, f->sizecode);
+	memset(ic, 0, f->sizecode * sizeof(ICache));
+	f->icache = ic;
+	for (pc = 0; pc < f->sizecode; pc++)
+	{
+		if (hasenvcache(GET_OPCODE(f->code[pc])))
+			ic[pc].env = cast_uint(n++);
+	}
+	if (n > 0)
+	{
+		EnvCache *ec = luaM::newvector<EnvCache>(L, n);
+		memset(ec, 0, n * sizeof(EnvCache)); /* version 0 is never valid */
+		f->envcache = ec;
+		f->sizeenvcache = n;
+	}
+}
+
+
+/*
+** Create the (empty) type-feedback array of a prototype, when it first
+** runs with type profiling on.
+*/
+TypeFeedback *luaF::inittypefb(lua_State *L, Proto *f)
+{
+	TypeFeedback *fb = luaM::newvector<TypeFeedback>(L, f->sizecode);
+	memset(fb, 0, f->sizecode * sizeof(TypeFeedback));
+	f->typefb = fb;
+	return fb;
+}
+
+
 void luaF::freeproto(lua_State *L, Proto *f)
 {
 	luaM::freearray(L, f->code, f->sizecode);
+	if (f->icache != NULL) /* prototype may be incomplete */
+		luaM::freearray(L, f->icache, f->sizecode);
+	luaM::freearray(L, f->envcache, f->sizeenvcache);
+	if (f->typefb != NULL)
+		luaM::freearray(L, f->typefb, f->sizecode);
+#if defined(LUA_USE_JIT)
+	luaJ::freecode(L, f);
+#endif
 	luaM::freearray(L, f->p, f->sizep);
 	luaM::freearray(L, f->k, f->sizek);
 	luaM::freearray(L, f->lineinfo, f->sizelineinfo);
@@ -57,6 +57,8 @@ LUAI_FUNC void newtbcupval (lua_State *L, StkId level);
 LUAI_FUNC void closeupval (lua_State *L, StkId level);
 LUAI_FUNC StkId close (lua_State *L, StkId level, int status, int yy);
 LUAI_FUNC void unlinkupval (UpVal *uv);
+LUAI_FUNC void initcache (lua_State *L, Proto *f);
+LUAI_FUNC TypeFeedback *inittypefb (lua_State *L, Proto *f);
 LUAI_FUNC void freeproto (lua_State *L, Proto *f);
 LUAI_FUNC const char *getlocalname (const Proto *func, int local_number,
                                          int pc);
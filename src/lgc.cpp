@@ -9,9 +9,13 @@
 
 #include "lprefix.hpp"
 
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <bit>
+#include <chrono>
+
 
 #include "lua.hpp"
 
@@ -19,6 +23,8 @@
 #include "ldo.hpp"
 #include "lfunc.hpp"
 #include "lgc.hpp"
+#include "lgcpar.hpp"
+#include "ljit.hpp"
 #include "lmem.hpp"
 #include "lobject.hpp"
 #include "lstate.hpp"
@@ -106,11 +112,126 @@
 
 static void reallymarkobject(global_State *g, GCObject *o);
 
+static void ephkeymarked(struct EphMap *m, GCObject *o);
+
 static lu_mem atomic(lua_State *L);
 
 static void entersweep(lua_State *L);
 
 
+/*
+** {======================================================
+** Statistics
+** =======================================================
+*/
+
+/*
+** Size of object 'o' with the arrays it owns (for the count of
+** traversed bytes and for heap snapshots)
+*/
+static lu_mem objsize(GCObject *o)
+{
+	switch (o->tt)
+	{
+		case LUA_VSHRSTR: return TString::sizel(gco2ts(o)->shrlen);
+		case LUA_VLNGSTR: return TString::sizel(gco2ts(o)->u.lnglen);
+#if defined(LUA_USE_NANBOX)
+		case LUA_VNUMINT: return sizeof(IntBox);
+#endif
+		case LUA_VUPVAL: return sizeof(UpVal);
+		case LUA_VTABLE: {
+			Table *h = gco2t(o);
+			return sizeof(Table) + arraypartsize(h) + hashpartsize(h);
+		}
+		case LUA_VUSERDATA: {
+			Udata *u = gco2u(o);
+			return sizeudata(u->nuvalue, u->len);
+		}
+		case LUA_VLCL: return sizeLclosure(gco2lcl(o)->nupvalues);
+		case LUA_VCCL: return sizeCclosure(gco2ccl(o)->nupvalues);
+		case LUA_VTHREAD: {
+			lua_State *th = gco2th(o);
+			return sizeof(lua_State) + th->nci * sizeof(CallInfo) +
+					(th->stack.p ? th->stacksize() * sizeof(StackValue) : 0);
+		}
+		case LUA_VPROTO: {
+			Proto *f = gco2p(o);
+			return sizeof(Proto) + f->sizecode * sizeof(Instruction) +
+					f->sizek * sizeof(TValue) + f->sizep * sizeof(Proto *) +
+					f->sizelineinfo + f->sizeabslineinfo * sizeof(AbsLineInfo) +
+					f->sizelocvars * sizeof(LocVar) +
+					f->sizeupvalues * sizeof(Upvaldesc) +
+					(f->icache ? f->sizecode * sizeof(ICache) : 0) +
+					f->sizeenvcache * sizeof(EnvCache) +
+					(f->typefb ? f->sizecode * sizeof(TypeFeedback) : 0);
+		}
+		default: return 0;
+	}
+}
+
+
+#if defined(LUA_USE_GCSTATS)
+
+static lua_Unsigned gcclock(void)
+{
+	using namespace std::chrono;
+	return cast(lua_Unsigned,
+				duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+
+/* add a step that took 'ns' nanoseconds to the statistics */
+static void recordstep(global_State *g, lua_Unsigned ns)
+{
+	int i = std::bit_width(ns) - 1; /* floor(log2(ns)) */
+	if (i < 0)
+		i = 0;
+	else if (i >= LUA_GCHISTSIZE)
+		i = LUA_GCHISTSIZE - 1;
+	g->gcstats.stephist[i]++;
+	g->gcstats.nsteps++;
+	if (ns > g->gcstats.maxstepns)
+		g->gcstats.maxstepns = ns;
+}
+
+
+/*
+** Change the phase being timed to 'ph', charging the time since the
+** last change to the previous phase, and return the previous phase.
+** The collector is idle when the phase is LUA_GCNPHASES; a step goes
+** from leaving that phase to coming back to it.
+*/
+static int setphase(global_State *g, int ph)
+{
+	lua_Unsigned now = gcclock();
+	int old = g->gcphase;
+	if (old == LUA_GCNPHASES)
+		g->gcstepstart = now;
+	else
+		g->gcstats.phasens[old] += now - g->gcphasestart;
+	g->gcphasestart = now;
+	g->gcphase = cast_byte(ph);
+	if (ph == LUA_GCNPHASES)
+		recordstep(g, now - g->gcstepstart);
+	return old;
+}
+
+
+#define gcphase(g,ph)		int oldphase_ = setphase(g, ph)
+#define gcphaseend(g)		setphase(g, oldphase_)
+#define gcstat(g,f,n)		((g)->gcstats.f += (n))
+
+#else
+
+#define gcphase(g,ph)		((void)0)
+#define gcphaseend(g)		((void)0)
+#define gcstat(g,f,n)		((void)0)
+
+#endif
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Generic functions
@@ -184,14 +305,15 @@ static void clearkey(Node *n)
 /*
 ** tells whether a key or value can be cleared from a weak
 ** table. Non-collectable objects are never removed from weak
-** tables. Strings behave as 'values', so are never removed too. for
+** tables. Strings (and boxed integers) behave as 'values', so are never
+** removed too. for
 ** other objects: if really collected, cannot keep them; for objects
 ** being finalized, keep them in keys, but not in values
 */
 static int iscleared(global_State *g, const GCObject *o)
 {
 	if (o == NULL) return 0; /* non-collectable value */
-	if (novariant(o->tt) == LUA_TSTRING)
+	if (novariant(o->tt) == LUA_TSTRING || novariant(o->tt) == LUA_TNUMBER)
 	{
 		markobject(g, o); /* strings are 'values', so are never weak */
 		return 0;
@@ -313,10 +435,16 @@ GCObject *luaC_newobj(lua_State *L, int tt, size_t sz)
 */
 static void reallymarkobject(global_State *g, GCObject *o)
 {
+	if (l_unlikely(g->ephmap != NULL)) /* converging ephemerons? */
+		ephkeymarked(g->ephmap, o);
 	switch (o->tt)
 	{
 		case LUA_VSHRSTR:
-		case LUA_VLNGSTR: {
+		case LUA_VLNGSTR:
+#if defined(LUA_USE_NANBOX)
+		case LUA_VNUMINT:
+#endif
+		{
 			set2black(o); /* nothing to visit */
 			break;
 		}
@@ -443,6 +571,9 @@ static void restartcollection(global_State *g)
 	markvalue(g, &g->l_registry);
 	markmt(g);
 	markbeingfnz(g); /* mark any finalizing object left from previous cycle */
+#if defined(LUA_USE_NANBOX)
+	markobjectN(g, g->lastintbox);
+#endif
 }
 
 /* }====================================================== */
@@ -637,9 +768,18 @@ static int traverseudata(global_State *g, Udata *u)
 ** arrays can be larger than needed; the extra slots are filled with
 ** NULL, so the use of 'markobjectN')
 */
+/*
+** Traverse a prototype. The closure cache is weak: if the cached closure
+** is not marked yet, it is removed from the cache (it may still be marked
+** later, in which case it is only a lost cache entry). As 'luaV_execute'
+** only fills the cache of non-black prototypes, the cache can never point
+** to a collected closure.
+*/
 static int traverseproto(global_State *g, Proto *f)
 {
 	int i;
+	if (f->cache && iswhite(f->cache))
+		f->cache = NULL; /* allow cache to be collected */
 	markobjectN(g, f->source);
 	for (i = 0; i < f->sizek; i++) /* mark literals */
 		markvalue(g, &f->k[i]);
@@ -724,13 +864,13 @@ static int traversethread(global_State *g, lua_State *th)
 
 
 /*
-** traverse one gray object, turning it to black.
+** traverse a gray object (already removed from its list), turning it
+** to black.
 */
-static lu_mem propagatemark(global_State *g)
+static lu_mem traverseobject(global_State *g, GCObject *o)
 {
-	GCObject *o = g->gray;
 	nw2black(o);
-	g->gray = *getgclist(o); /* remove from 'gray' list */
+	gcstat(g, traversed, objsize(o));
 	switch (o->tt)
 	{
 		case LUA_VTABLE: return traversetable(g, gco2t(o));
@@ -745,6 +885,54 @@ static lu_mem propagatemark(global_State *g)
 }
 
 
+/*
+** traverse one gray object, turning it to black.
+*/
+static lu_mem propagatemark(global_State *g)
+{
+	GCObject *o = g->gray;
+	g->gray = *getgclist(o); /* remove from 'gray' list */
+	return traverseobject(g, o);
+}
+
+
+#if defined(LUA_USE_PARALLELMARK)
+
+/*
+** With marking threads, after a first batch of serial traversals the
+** rest of the gray list goes to 'luaC_parallelmark'; objects it cannot
+** traverse come back to be traversed here, which may create more gray
+** objects. (Only in incremental mode: in generational mode traversals
+** also change object ages and gray lists. Not while converging
+** ephemerons either, as the marking threads do not report marked keys.)
+*/
+static lu_mem propagateall(global_State *g)
+{
+	lu_mem tot = 0;
+	int n = 0;
+	while (g->gray)
+	{
+		if (n++ >= LUAI_PARMARKMIN && g->gcworkers != NULL && g->gckind == KGC_INC &&
+			g->ephmap == NULL)
+		{
+			GCObject *o;
+			tot += luaC_parallelmark(g, &o);
+			while (o != NULL)
+			{
+				GCObject *next = *getgclist(o);
+				tot += traverseobject(g, o);
+				o = next;
+			}
+			n = 0;
+		}
+		else
+			tot += propagatemark(g);
+	}
+	return tot;
+}
+
+#else
+
 static lu_mem propagateall(global_State *g)
 {
 	lu_mem tot = 0;
@@ -753,39 +941,247 @@ static lu_mem propagateall(global_State *g)
 	return tot;
 }
 
+#endif
+
 
 /*
-** Traverse all ephemeron tables propagating marks from keys to values.
-** Repeat until it converges, that is, nothing new is marked. 'dir'
-** inverts the direction of the traversals, trying to speed up
-** convergence on chains in the same table.
-**
+** Traverse once all tables in the 'ephemeron' list, which they may
+** join again. 'dir' inverts the direction of the traversals, trying
+** to speed up convergence on chains in the same table. Returns true
+** iff some value was marked.
 */
-static void convergeephemerons(global_State *g)
+static int traverseephemerons(global_State *g, int dir)
 {
-	int changed;
-	int dir = 0;
-	do
+	int changed = 0;
+	GCObject *w;
+	GCObject *next = g->ephemeron; /* get ephemeron list */
+	g->ephemeron = NULL; /* tables may return to this list when traversed */
+	while ((w = next) != NULL)
 	{
-		GCObject *w;
-		GCObject *next = g->ephemeron; /* get ephemeron list */
-		g->ephemeron = NULL; /* tables may return to this list when traversed */
-		changed = 0;
-		while ((w = next) != NULL)
+		/* for each ephemeron table */
+		Table *h = gco2t(w);
+		next = h->gclist; /* list is rebuilt during loop */
+		nw2black(h); /* out of the list (for now) */
+		if (traverseephemeron(g, h, dir))
 		{
-			/* for each ephemeron table */
-			Table *h = gco2t(w);
-			next = h->gclist; /* list is rebuilt during loop */
-			nw2black(h); /* out of the list (for now) */
-			if (traverseephemeron(g, h, dir))
-			{
-				/* marked some value? */
-				propagateall(g); /* propagate changes */
-				changed = 1; /* will have to revisit all ephemeron tables */
-			}
+			/* marked some value? */
+			propagateall(g); /* propagate changes */
+			changed = 1; /* will have to revisit all ephemeron tables */
 		}
+	}
+	return changed;
+}
+
+
+/*
+** Traverse all ephemeron tables again and again until nothing new is
+** marked. (Each round can resolve only one link of a chain of
+** dependencies, so this is quadratic on long chains; it is used only
+** when there is no memory for an 'EphMap'.)
+*/
+static void iterateephemerons(global_State *g)
+{
+	int dir = 0;
+	while (traverseephemerons(g, dir))
 		dir = !dir; /* invert direction next time */
-	} while (changed); /* repeat until no more changes */
+}
+
+
+/*
+** Pending entries of ephemeron tables, that is, white values waiting
+** for their white keys to be marked. Entries are chained by the hash
+** of their keys; when 'reallymarkobject' marks a key, its entries go
+** to 'ready', to have their values marked by 'drainephemerons'.
+*/
+typedef struct EphEntry
+{
+	GCObject *key; /* NULL after the key was marked */
+	GCObject *value;
+	int next; /* next entry in the same bucket (or -1) */
+} EphEntry;
+
+typedef struct EphMap
+{
+	EphEntry *entries;
+	int *ready; /* entries whose keys were marked */
+	int *buckets; /* first entry in each bucket (or -1) */
+	int nentries;
+	int nready;
+	int size; /* size of 'entries' and 'ready' */
+	int nbuckets; /* size of 'buckets' (a power of 2) */
+} EphMap;
+
+#define MINEPHMAP	64
+
+#define ephbucket(m,o)	cast_int(point2uint(o) >> 4 & cast_uint((m)->nbuckets - 1))
+
+
+/* key 'o' is being marked: its entries are ready */
+static void ephkeymarked(EphMap *m, GCObject *o)
+{
+	int i;
+	if (m->nbuckets == 0)
+		return;
+	for (i = m->buckets[ephbucket(m, o)]; i >= 0; i = m->entries[i].next)
+	{
+		if (m->entries[i].key == o)
+		{
+			m->entries[i].key = NULL; /* handle it only once */
+			m->ready[m->nready++] = i;
+		}
+	}
+}
+
+
+/*
+** Double the size of the map, rehashing its live entries. Returns
+** false if there is no memory (the map is left unchanged).
+*/
+static int growephmap(lua_State *L, EphMap *m)
+{
+	int i;
+	int size = (m->size > 0) ? m->size * 2 : MINEPHMAP;
+	EphEntry *entries;
+	int *ready, *buckets;
+	if (size <= m->size) /* overflow? */
+		return 0;
+	buckets = luaM::reallocvector<int>(L, NULL, 0, size);
+	if (buckets == NULL)
+		return 0;
+	ready = luaM::reallocvector(L, m->ready, m->size, size);
+	if (ready == NULL)
+	{
+		luaM::freearray(L, buckets, size);
+		return 0;
+	}
+	m->ready = ready;
+	entries = luaM::reallocvector(L, m->entries, m->size, size);
+	if (entries == NULL)
+	{
+		luaM::freearray(L, buckets, size);
+		m->ready = luaM::reallocvector(L, ready, size, m->size); /* cannot fail */
+		return 0;
+	}
+	m->entries = entries;
+	luaM::freearray(L, m->buckets, m->nbuckets);
+	m->buckets = buckets;
+	m->nbuckets = m->size = size;
+	for (i = 0; i < size; i++)
+		buckets[i] = -1;
+	for (i = 0; i < m->nentries; i++)
+	{
+		EphEntry *e = &entries[i];
+		if (e->key != NULL)
+		{
+			int b = ephbucket(m, e->key);
+			e->next = buckets[b];
+			buckets[b] = i;
+		}
+	}
+	return 1;
+}
+
+
+/*
+** Add the white->white entries of table 'h' to the map. Keys marked
+** after the table was traversed have their values marked now.
+** Returns false if there is no memory for the entries.
+*/
+static int addephemeron(lua_State *L, EphMap *m, Table *h)
+{
+	global_State *g = G(L);
+	Node *n, *limit = gnodelast(h);
+	for (n = gnode(h, 0); n < limit; n++)
+	{
+		if (isempty(gval(n)) || !valiswhite(gval(n)))
+			continue;
+		if (!iscleared(g, gckeyN(n))) /* key marked in the meantime? */
+			reallymarkobject(g, gcvalue(gval(n)));
+		else
+		{
+			EphEntry *e;
+			int b;
+			if (m->nentries == m->size && !growephmap(L, m))
+				return 0;
+			e = &m->entries[m->nentries];
+			b = ephbucket(m, gckey(n));
+			e->key = gckey(n);
+			e->value = gcvalue(gval(n));
+			e->next = m->buckets[b];
+			m->buckets[b] = m->nentries++;
+		}
+	}
+	return 1;
+}
+
+
+/*
+** Mark the values of all entries whose keys were marked, and propagate
+** those marks, until no more keys are marked.
+*/
+static void drainephemerons(global_State *g, EphMap *m)
+{
+	propagateall(g);
+	while (m->nready > 0)
+	{
+		while (m->nready > 0)
+		{
+			GCObject *v = m->entries[m->ready[--m->nready]].value;
+			if (iswhite(v))
+				reallymarkobject(g, v);
+		}
+		propagateall(g);
+	}
+}
+
+
+/*
+** Propagate marks from keys to values in all ephemeron tables until it
+** converges, that is, nothing new is marked. After a first traversal,
+** the remaining white->white entries go to an 'EphMap', and each value
+** is marked when its key is, so that the work is linear in the number
+** of entries even for long chains of dependencies. A last traversal
+** puts each table in its proper list (the traversal would also finish
+** the convergence, should the map run out of memory). The map grows
+** in the middle of 'atomic', so its allocations cannot start an
+** emergency collection; a failure just takes that slower path.
+*/
+static void convergeephemerons(lua_State *L)
+{
+	global_State *g = G(L);
+	EphMap m = {NULL, NULL, NULL, 0, 0, 0, 0};
+	GCObject *done = NULL; /* tables whose entries are in the map */
+	GCObject **last = &done;
+	int ok = 1;
+	lu_byte oldstopem;
+	traverseephemerons(g, 0);
+	if (g->ephemeron == NULL) /* no white->white entries? */
+		return;
+	oldstopem = g->gcstopem;
+	g->gcstopem = 1; /* no emergency collections while growing the map */
+	g->ephmap = &m;
+	while (g->ephemeron != NULL && ok)
+	{
+		GCObject *w = g->ephemeron;
+		g->ephemeron = NULL; /* traversals may add new tables */
+		for (; w != NULL; w = *last)
+		{
+			/* move each table (still gray) to 'done' */
+			*last = w;
+			last = &gco2t(w)->gclist;
+			if (ok)
+				ok = addephemeron(L, &m, gco2t(w));
+		}
+		drainephemerons(g, &m);
+	}
+	g->ephmap = NULL;
+	luaM::freearray(L, m.entries, m.size);
+	luaM::freearray(L, m.ready, m.size);
+	luaM::freearray(L, m.buckets, m.nbuckets);
+	g->gcstopem = oldstopem;
+	*last = g->ephemeron; /* tables not in the map, if any */
+	g->ephemeron = done;
+	iterateephemerons(g);
 }
 
 /* }====================================================== */
@@ -898,11 +1294,47 @@ static void freeobj(lua_State *L, GCObject *o)
 			luaM::freemem(L, ts, TString::sizel(ts->u.lnglen));
 			break;
 		}
+#if defined(LUA_USE_NANBOX)
+		case LUA_VNUMINT:
+			luaM::freemem(L, o, sizeof(IntBox));
+			break;
+#endif
 		default: lua_assert(0);
 	}
 }
 
 
+/*
+** free a dead object found by a sweep; with a background freeing
+** thread, its memory is released by that thread
+*/
+static void freedead(lua_State *L, GCObject *o)
+{
+#if defined(LUA_USE_GCSTATS) || defined(LUA_USE_PARALLELMARK)
+	global_State *g = G(L);
+#endif
+#if defined(LUA_USE_GCSTATS)
+	l_mem olddebt = g->GCdebt;
+#endif
+#if defined(LUA_USE_PARALLELMARK)
+	g->gcfreeing = (g->gcfreer != NULL);
+	freeobj(L, o);
+	g->gcfreeing = 0;
+#else
+	freeobj(L, o);
+#endif
+	gcstat(g, freedobjs, 1);
+	gcstat(g, freedbytes, olddebt - g->GCdebt);
+}
+
+
+#if defined(LUA_USE_PARALLELMARK)
+#define flushfree(g)	luaC_flushfree(g)
+#else
+#define flushfree(g)	((void)0)
+#endif
+
+
 /*
 ** sweep at most 'countin' elements from a list of GCObjects erasing dead
 ** objects, where a dead object is one marked with the old (non current)
@@ -925,7 +1357,7 @@ static GCObject **sweeplist(lua_State *L, GCObject **p, int countin,
 		{
 			/* is 'curr' dead? */
 			*p = curr->next; /* remove 'curr' from list */
-			freeobj(L, curr); /* erase 'curr' */
+			freedead(L, curr); /* erase 'curr' */
 		}
 		else
 		{
@@ -989,6 +1421,7 @@ static GCObject *udata2finalize(global_State *g)
 	GCObject *o = g->tobefnz; /* get first element */
 	lua_assert(tofinalize(o));
 	g->tobefnz = o->next; /* remove it from 'tobefnz' list */
+	g->finstats.pending--;
 	o->next = g->allgc; /* return it to 'allgc' list */
 	g->allgc = o;
 	resetbit(o->marked, FINALIZEDBIT); /* object is "normal" again */
@@ -1012,6 +1445,7 @@ static void GCTM(lua_State *L)
 	global_State *g = G(L);
 	const TValue *tm;
 	TValue v;
+	gcphase(g, LUA_GCPHFINALIZE);
 	lua_assert(!g->gcemergency);
 	setgcovalue(L, &v, udata2finalize(g));
 	tm = luaT_gettmbyobj(L, &v, TM_GC);
@@ -1030,13 +1464,16 @@ static void GCTM(lua_State *L)
 		L->ci->callstatus &= ~CIST_FIN; /* not running a finalizer anymore */
 		L->allowhook = oldah; /* restore hooks */
 		g->gcstp = oldgcstp; /* restore state */
+		g->finstats.finalized++;
 		if (l_unlikely(status != LUA_OK))
 		{
 			/* error while running __gc? */
+			g->finstats.errors++;
 			luaE_warnerror(L, "__gc");
 			L->top.p--; /* pops error object */
 		}
 	}
+	gcphaseend(g);
 }
 
 
@@ -1064,6 +1501,30 @@ static void callallpendingfinalizers(lua_State *L)
 }
 
 
+/*
+** Call finalizers of objects in 'tobefnz', in order, up to 'n' of them
+** (if 'n' > 0) and while less than 'us' microseconds of a monotonic
+** clock have passed (if 'us' > 0; the clock is checked between calls,
+** so at least one finalizer is called). This is how the host drains
+** the queue when 'gcfinqueue' keeps the collector from calling them.
+** Returns the number of finalizers called.
+*/
+int luaC_runfinalizers(lua_State *L, int n, l_mem us)
+{
+	using clock = std::chrono::steady_clock;
+	global_State *g = G(L);
+	clock::time_point deadline = clock::now() + std::chrono::microseconds(us);
+	int i;
+	for (i = 0; g->tobefnz && (n <= 0 || i < n); i++)
+	{
+		if (us > 0 && i > 0 && clock::now() >= deadline)
+			break;
+		GCTM(L);
+	}
+	return i;
+}
+
+
 /*
 ** find last 'next' field in list 'p' list (to add elements in its end)
 */
@@ -1101,8 +1562,12 @@ static void separatetobefnz(global_State *g, int all)
 			curr->next = *lastnext; /* link at the end of 'tobefnz' list */
 			*lastnext = curr;
 			lastnext = &curr->next;
+			g->finstats.pending++;
+			g->finstats.queued++;
 		}
 	}
+	if (g->finstats.pending > g->finstats.maxpending)
+		g->finstats.maxpending = g->finstats.pending;
 }
 
 
@@ -1212,7 +1677,7 @@ static void sweep2old(lua_State *L, GCObject **p)
 			/* is 'curr' dead? */
 			lua_assert(isdead(g, curr));
 			*p = curr->next; /* remove 'curr' from list */
-			freeobj(L, curr); /* erase 'curr' */
+			freedead(L, curr); /* erase 'curr' */
 		}
 		else
 		{
@@ -1266,7 +1731,7 @@ static GCObject **sweepgen(lua_State *L, global_State *g, GCObject **p,
 			/* is 'curr' dead? */
 			lua_assert(!isold(curr) && isdead(g, curr));
 			*p = curr->next; /* remove 'curr' from list */
-			freeobj(L, curr); /* erase 'curr' */
+			freedead(L, curr); /* erase 'curr' */
 		}
 		else
 		{
@@ -1401,7 +1866,7 @@ static void finishgencycle(lua_State *L, global_State *g)
 	correctgraylists(g);
 	checkSizes(L, g);
 	g->gcstate = GCSpropagate; /* skip restart */
-	if (!g->gcemergency)
+	if (!g->gcemergency && !g->gcfinqueue)
 		callallpendingfinalizers(L);
 }
 
@@ -1415,6 +1880,7 @@ static void youngcollection(lua_State *L, global_State *g)
 {
 	GCObject **psurvival; /* to point to first non-dead survival object */
 	GCObject *dummy; /* dummy out parameter to 'sweepgen' */
+	gcphase(g, LUA_GCPHYOUNG);
 	lua_assert(g->gcstate == GCSpropagate);
 	if (g->firstold1)
 	{
@@ -1445,7 +1911,9 @@ static void youngcollection(lua_State *L, global_State *g)
 	g->finobjsur = g->finobj; /* all news are survivals */
 
 	sweepgen(L, g, &g->tobefnz, NULL, &dummy);
+	flushfree(g);
 	finishgencycle(L, g);
+	gcphaseend(g);
 }
 
 
@@ -1470,6 +1938,7 @@ static void atomic2gen(lua_State *L, global_State *g)
 	g->finobjrold = g->finobjold1 = g->finobjsur = g->finobj;
 
 	sweep2old(L, &g->tobefnz);
+	flushfree(g);
 
 	g->gckind = KGC_GEN;
 	g->lastatomic = 0;
@@ -1693,9 +2162,27 @@ static void deletelist(lua_State *L, GCObject *p, GCObject *limit)
 }
 
 
+#if defined(LUA_USE_JIT)
+
+/* release the native code of the prototypes in a list */
+static void freejitlist(lua_State *L, GCObject *p)
+{
+	for (; p != NULL; p = p->next)
+	{
+		if (p->tt == LUA_VPROTO)
+			luaJ::freecode(L, gco2p(p));
+	}
+}
+
+#endif
+
+
 /*
 ** Call all finalizers of the objects in the given Lua state, and
-** then free all objects, except for the main thread.
+** then free all objects, except for the main thread. With an arena
+** allocator ('g->arena'), objects are not freed one by one, as all
+** their memory goes away with the main block; only native code,
+** which lives outside the allocator, is released.
 */
 void luaC_freeallobjects(lua_State *L)
 {
@@ -1705,6 +2192,14 @@ void luaC_freeallobjects(lua_State *L)
 	separatetobefnz(g, 1); /* separate all objects with finalizers */
 	lua_assert(g->finobj == NULL);
 	callallpendingfinalizers(L);
+	if (g->arena)
+	{
+#if defined(LUA_USE_JIT)
+		freejitlist(L, g->allgc);
+		freejitlist(L, g->fixedgc);
+#endif
+		return;
+	}
 	deletelist(L, g->allgc, obj2gco(g->mainthread));
 	lua_assert(g->finobj == NULL); /* no new finalizers */
 	deletelist(L, g->fixedgc, NULL); /* collect fixed objects */
@@ -1718,6 +2213,7 @@ static lu_mem atomic(lua_State *L)
 	lu_mem work = 0;
 	GCObject *origweak, *origall;
 	GCObject *grayagain = g->grayagain; /* save original list */
+	gcphase(g, LUA_GCPHATOMIC);
 	g->grayagain = NULL;
 	lua_assert(g->ephemeron == NULL && g->weak == NULL);
 	lua_assert(!iswhite(g->mainthread));
@@ -1726,13 +2222,16 @@ static lu_mem atomic(lua_State *L)
 	/* registry and global metatables may be changed by API */
 	markvalue(g, &g->l_registry);
 	markmt(g); /* mark global metatables */
+#if defined(LUA_USE_NANBOX)
+	markobjectN(g, g->lastintbox); /* integer box maybe only in a C variable */
+#endif
 	work += propagateall(g); /* empties 'gray' list */
 	/* remark occasional upvalues of (maybe) dead threads */
 	work += remarkupvals(g);
 	work += propagateall(g); /* propagate changes */
 	g->gray = grayagain;
 	work += propagateall(g); /* traverse 'grayagain' list */
-	convergeephemerons(g);
+	convergeephemerons(L);
 	/* at this point, all strongly accessible objects are marked. */
 	/* Clear values from weak tables, before checking finalizers */
 	clearbyvalues(g, g->weak, NULL);
@@ -1742,7 +2241,7 @@ static lu_mem atomic(lua_State *L)
 	separatetobefnz(g, 0); /* separate objects to be finalized */
 	work += markbeingfnz(g); /* mark objects that will be finalized */
 	work += propagateall(g); /* remark, to propagate 'resurrection' */
-	convergeephemerons(g);
+	convergeephemerons(L);
 	/* at this point, all resurrected objects are marked. */
 	/* remove dead objects from weak tables */
 	clearbykeys(g, g->ephemeron); /* clear keys from all ephemeron tables */
@@ -1753,6 +2252,7 @@ static lu_mem atomic(lua_State *L)
 	luaS::clearcache(g);
 	g->currentwhite = cast_byte(otherwhite(g)); /* flip current white */
 	lua_assert(g->gray == NULL);
+	gcphaseend(g);
 	return work; /* estimate of slots marked by 'atomic' */
 }
 
@@ -1778,10 +2278,19 @@ static int sweepstep(lua_State *L, global_State *g,
 }
 
 
+/*
+** phase timed in a single step from state 'st' ('atomic' and finalizers
+** time themselves)
+*/
+#define stepphase(st)	((st) == GCSpause || (st) == GCSpropagate ? LUA_GCPHPROPAGATE \
+	: (st) == GCScallfin ? LUA_GCPHFINALIZE : LUA_GCPHSWEEP)
+
+
 static lu_mem singlestep(lua_State *L)
 {
 	global_State *g = G(L);
 	lu_mem work;
+	gcphase(g, stepphase(g->gcstate));
 	lua_assert(!g->gcstopem); /* collector is not reentrant */
 	g->gcstopem = 1; /* no emergency collections while collecting */
 	switch (g->gcstate)
@@ -1826,21 +2335,22 @@ static lu_mem singlestep(lua_State *L)
 		}
 		case GCSswpend: {
 			/* finish sweeps */
+			flushfree(g);
 			checkSizes(L, g);
 			g->gcstate = GCScallfin;
 			work = 0;
 			break;
 		}
 		case GCScallfin: {
-			/* call remaining finalizers */
-			if (g->tobefnz && !g->gcemergency)
+			/* call remaining finalizers (unless the host calls them) */
+			if (g->tobefnz && !g->gcemergency && !g->gcfinqueue)
 			{
 				g->gcstopem = 0; /* ok collections during finalizers */
 				work = runafewfinalizers(L, GCFINMAX) * GCFINALIZECOST;
 			}
 			else
 			{
-				/* emergency mode or no more finalizers */
+				/* emergency mode, queued or no more finalizers */
 				g->gcstate = GCSpause; /* finish collection */
 				work = 0;
 			}
@@ -1850,6 +2360,7 @@ static lu_mem singlestep(lua_State *L)
 			return 0;
 	}
 	g->gcstopem = 0;
+	gcphaseend(g);
 	return work;
 }
 
@@ -1907,11 +2418,51 @@ void luaC_step(lua_State *L)
 		luaE_setdebt(g, -2000);
 	else
 	{
+		gcphase(g, LUA_GCPHOTHER);
 		if (isdecGCmodegen(g))
 			genstep(L, g);
 		else
 			incstep(L, g);
+		gcphaseend(g);
+	}
+}
+
+
+/*
+** Performs GC work for about 'us' microseconds of a monotonic clock.
+** In incremental mode, does single steps until the end of a cycle or
+** the deadline, which is only checked between steps (so an indivisible
+** step such as 'atomic' may overrun it); the work done is credited to
+** the debt as in 'incstep'. In generational mode, does one collection.
+** Returns 1 if a cycle ended.
+*/
+int luaC_budgetstep(lua_State *L, l_mem us)
+{
+	using clock = std::chrono::steady_clock;
+	global_State *g = G(L);
+	int res = 1;
+	gcphase(g, LUA_GCPHOTHER);
+	if (isdecGCmodegen(g))
+		genstep(L, g);
+	else
+	{
+		int stepmul = (getgcparam(g->gcstepmul) | 1); /* avoid division by 0 */
+		clock::time_point deadline = clock::now() + std::chrono::microseconds(us);
+		l_mem debt = (g->GCdebt / WORK2MEM) * stepmul;
+		do
+		{
+			debt -= singlestep(L); /* perform one single step */
+		} while (g->gcstate != GCSpause && clock::now() < deadline);
+		if (g->gcstate == GCSpause)
+			setpause(g); /* pause until next cycle */
+		else
+		{
+			luaE_setdebt(g, (debt / stepmul) * WORK2MEM);
+			res = 0;
+		}
 	}
+	gcphaseend(g);
+	return res;
 }
 
 
@@ -1946,6 +2497,7 @@ static void fullinc(lua_State *L, global_State *g)
 void luaC_fullgc(lua_State *L, int isemergency)
 {
 	global_State *g = G(L);
+	gcphase(g, LUA_GCPHOTHER);
 	lua_assert(!g->gcemergency);
 	g->gcemergency = isemergency; /* set flag */
 	if (g->gckind == KGC_INC)
@@ -1953,6 +2505,350 @@ void luaC_fullgc(lua_State *L, int isemergency)
 	else
 		fullgen(L, g);
 	g->gcemergency = 0;
+	gcphaseend(g);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Heap snapshots
+** =======================================================
+*/
+
+/*
+** A snapshot is LUA_SNAPSIGNATURE, a version byte (LUA_SNAPVERSION),
+** and a sequence of records, each one starting with its tag. Numbers
+** are written as sizes in precompiled chunks: groups of 7 bits, most
+** significant first, the last group with bit 0x80 set. Objects are
+** identified by their addresses.
+**   LUA_SNAPOBJECT id type flags size [extra]
+**     'type' is the variant tag; 'size' counts the arrays owned by
+**     the object. Strings add their length, the number 'n' of bytes
+**     that follow (at most LUAI_SNAPSTRLEN) and those bytes; prototypes
+**     add the line where they were defined.
+**   LUA_SNAPEDGE target kind aux
+**     a reference from the last object to 'target'.
+**   LUA_SNAPROOT id kind aux
+**   LUA_SNAPEND nobjects nedges
+** Objects are written as the lists are walked, so the snapshot needs
+** no memory beyond a small buffer.
+*/
+
+/* maximum number of bytes of a string written in a snapshot */
+#if !defined(LUAI_SNAPSTRLEN)
+#define LUAI_SNAPSTRLEN	LUAI_MAXSHORTLEN
+#endif
+
+#define SNAPBUFFSIZE	4096
+
+/* buffer for 'snapsize' (as 'DIBS' in ldump.c) */
+#define SNAPDIBS	((sizeof(size_t) * CHAR_BIT + 6) / 7)
+
+
+typedef struct SnapState
+{
+	lua_State *L;
+	lua_Writer writer;
+	void *data;
+	int status;
+	size_t n; /* number of bytes in 'buff' */
+	size_t nobjs;
+	size_t nedges;
+	lu_byte buff[SNAPBUFFSIZE];
+} SnapState;
+
+
+static void snapflush(SnapState *S)
+{
+	if (S->status == 0 && S->n > 0)
+	{
+		lua_unlock(S->L);
+		S->status = (*S->writer)(S->L, S->buff, S->n, S->data);
+		lua_lock(S->L);
+	}
+	S->n = 0;
+}
+
+
+static void snapblock(SnapState *S, const void *b, size_t size)
+{
+	const lu_byte *p = cast(const lu_byte *, b);
+	while (size > 0)
+	{
+		size_t n = SNAPBUFFSIZE - S->n;
+		if (n > size)
+			n = size;
+		memcpy(S->buff + S->n, p, n);
+		S->n += n;
+		p += n;
+		size -= n;
+		if (S->n == SNAPBUFFSIZE)
+			snapflush(S);
+	}
+}
+
+
+static void snapbyte(SnapState *S, int b)
+{
+	if (S->n == SNAPBUFFSIZE)
+		snapflush(S);
+	S->buff[S->n++] = cast_byte(b);
+}
+
+
+static void snapsize(SnapState *S, size_t x)
+{
+	lu_byte buff[SNAPDIBS];
+	int n = 0;
+	do
+	{
+		buff[SNAPDIBS - (++n)] = x & 0x7f; /* fill buffer in reverse order */
+		x >>= 7;
+	} while (x != 0);
+	buff[SNAPDIBS - 1] |= 0x80; /* mark last byte */
+	snapblock(S, buff + SNAPDIBS - n, n);
+}
+
+
+#define snapid(S,o)	snapsize(S, cast(size_t, o))
+
+
+static void snapedge(SnapState *S, GCObject *o, int kind, size_t aux)
+{
+	snapbyte(S, LUA_SNAPEDGE);
+	snapid(S, o);
+	snapbyte(S, kind);
+	snapsize(S, aux);
+	S->nedges++;
+}
+
+#define snapedgeN(S,o,k,a)	{ if (o) snapedge(S, obj2gco(o), k, a); }
+
+#define snapvalue(S,v,k,a)	{ if (iscollectable(v)) snapedge(S, gcvalue(v), k, a); }
+
+
+static void snapstring(SnapState *S, TString *ts)
+{
+	size_t len = tsslen(ts);
+	size_t n = (len < LUAI_SNAPSTRLEN) ? len : LUAI_SNAPSTRLEN;
+	snapsize(S, len);
+	snapsize(S, n);
+	snapblock(S, getstr(ts), n);
+}
+
+
+/* weak flags of table 'h' (as computed by 'traversetable') */
+static int snapweakness(global_State *g, Table *h)
+{
+	const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+	int flags = 0;
+	if (mode && ttisshrstring(mode))
+	{
+		const char *smode = getshrstr(tsvalue(mode));
+		if (strchr(smode, 'k'))
+			flags |= LUA_SNAPFWEAKK;
+		if (strchr(smode, 'v'))
+			flags |= LUA_SNAPFWEAKV;
+	}
+	return flags;
+}
+
+
+static void snaptable(SnapState *S, Table *h)
+{
+	unsigned int i;
+	unsigned int asize = luaH_realasize(h);
+	Node *n, *limit = gnodelast(h);
+	snapedgeN(S, h->metatable, LUA_SNAPEMETA, 0);
+	for (i = 0; i < asize; i++)
+		snapvalue(S, &h->array[i], LUA_SNAPEINDEX, i + 1);
+	for (n = gnode(h, 0); n < limit; n++)
+	{
+		int kind = LUA_SNAPEVALUE;
+		size_t aux = cast(size_t, gckeyN(n));
+		if (isempty(gval(n)))
+			continue;
+		if (keyiscollectable(n) && novariant(keytt(n)) == LUA_TSTRING)
+			kind = LUA_SNAPEFIELD;
+		else if (keyisinteger(n) && keyival(n) > 0)
+		{
+			kind = LUA_SNAPEINDEX;
+			aux = cast(size_t, keyival(n));
+		}
+		snapvalue(S, gval(n), kind, aux);
+		if (keyiscollectable(n))
+			snapedge(S, gckey(n), LUA_SNAPEKEY, 0);
+	}
+}
+
+
+static void snapproto(SnapState *S, Proto *f)
+{
+	int i;
+	snapedgeN(S, f->source, LUA_SNAPEINTERNAL, 0);
+	for (i = 0; i < f->sizek; i++)
+		snapvalue(S, &f->k[i], LUA_SNAPECONST, i);
+	for (i = 0; i < f->sizep; i++)
+		snapedgeN(S, f->p[i], LUA_SNAPEPROTO, i + 1);
+	for (i = 0; i < f->sizeupvalues; i++)
+		snapedgeN(S, f->upvalues[i].name, LUA_SNAPEINTERNAL, 0);
+	for (i = 0; i < f->sizelocvars; i++)
+		snapedgeN(S, f->locvars[i].varname, LUA_SNAPEINTERNAL, 0);
+}
+
+
+static void snapLclosure(SnapState *S, LClosure *cl)
+{
+	int i;
+	snapedgeN(S, cl->p, LUA_SNAPEPROTO, 0);
+	for (i = 0; i < cl->nupvalues; i++)
+	{
+		TString *name = (cl->p && i < cl->p->sizeupvalues)
+						? cl->p->upvalues[i].name : NULL;
+		snapedgeN(S, cl->upvals[i], LUA_SNAPEUPVAL, cast(size_t, name));
+	}
+}
+
+
+static void snapthread(SnapState *S, lua_State *th)
+{
+	StkId o;
+	UpVal *uv;
+	if (th->stack.p == NULL)
+		return; /* stack not completely built yet */
+	for (o = th->stack.p; o < th->top.p; o++)
+		snapvalue(S, s2v(o), LUA_SNAPESTACK, cast(size_t, o - th->stack.p));
+	for (uv = th->openupval; uv != NULL; uv = uv->u.open.next)
+		snapedge(S, obj2gco(uv), LUA_SNAPEINTERNAL, 0);
+}
+
+
+static void snapobject(SnapState *S, global_State *g, GCObject *o)
+{
+	int flags = tofinalize(o) ? LUA_SNAPFFINALIZE : 0;
+	if (o->tt == LUA_VTABLE)
+		flags |= snapweakness(g, gco2t(o));
+	snapbyte(S, LUA_SNAPOBJECT);
+	snapid(S, o);
+	snapbyte(S, o->tt);
+	snapbyte(S, flags);
+	snapsize(S, objsize(o));
+	S->nobjs++;
+	switch (o->tt)
+	{
+		case LUA_VSHRSTR:
+		case LUA_VLNGSTR:
+			snapstring(S, gco2ts(o));
+			break;
+#if defined(LUA_USE_NANBOX)
+		case LUA_VNUMINT:
+			break; /* a leaf */
+#endif
+		case LUA_VUPVAL:
+			snapvalue(S, gco2upv(o)->v.p, LUA_SNAPEINTERNAL, 0);
+			break;
+		case LUA_VTABLE:
+			snaptable(S, gco2t(o));
+			break;
+		case LUA_VUSERDATA: {
+			Udata *u = gco2u(o);
+			int i;
+			snapedgeN(S, u->metatable, LUA_SNAPEMETA, 0);
+			for (i = 0; i < u->nuvalue; i++)
+				snapvalue(S, &u->uv[i].uv, LUA_SNAPEUSER, i + 1);
+			break;
+		}
+		case LUA_VLCL:
+			snapLclosure(S, gco2lcl(o));
+			break;
+		case LUA_VCCL: {
+			CClosure *cl = gco2ccl(o);
+			int i;
+			for (i = 0; i < cl->nupvalues; i++)
+				snapvalue(S, &cl->upvalue[i], LUA_SNAPEUPVAL, 0);
+			break;
+		}
+		case LUA_VPROTO:
+			snapsize(S, cast(size_t, gco2p(o)->linedefined));
+			snapproto(S, gco2p(o));
+			break;
+		case LUA_VTHREAD:
+			snapthread(S, gco2th(o));
+			break;
+		default: lua_assert(0);
+	}
+}
+
+
+static void snaproot(SnapState *S, GCObject *o, int kind, size_t aux)
+{
+	snapbyte(S, LUA_SNAPROOT);
+	snapid(S, o);
+	snapbyte(S, kind);
+	snapsize(S, aux);
+}
+
+
+/*
+** Write the objects in list 'p'. During a sweep, the lists still have
+** the dead objects not swept yet; their fields may point to objects
+** already freed, so they are skipped.
+*/
+static void snaplist(SnapState *S, global_State *g, GCObject *p, int rootkind)
+{
+	int sweeping = issweepphase(g);
+	for (; p != NULL && S->status == 0; p = p->next)
+	{
+		if (sweeping && isdead(g, p))
+			continue;
+		snapobject(S, g, p);
+		if (rootkind >= 0)
+			snaproot(S, p, rootkind, 0);
+	}
+}
+
+
+/*
+** Write a snapshot of all objects in the state through 'writer'. The
+** collector is kept from running while the lists are walked, so the
+** writer must not run Lua code. Returns the error code of the writer
+** (0 if all went well).
+*/
+int luaC_heapsnapshot(lua_State *L, lua_Writer writer, void *data)
+{
+	global_State *g = G(L);
+	lu_byte oldgcstp = g->gcstp;
+	SnapState S;
+	int i;
+	S.L = L;
+	S.writer = writer;
+	S.data = data;
+	S.status = 0;
+	S.n = 0;
+	S.nobjs = S.nedges = 0;
+	g->gcstp |= GCSTPGC; /* avoid GC steps */
+	snapblock(&S, LUA_SNAPSIGNATURE, sizeof(LUA_SNAPSIGNATURE) - sizeof(char));
+	snapbyte(&S, LUA_SNAPVERSION);
+	snaplist(&S, g, g->allgc, -1);
+	snaplist(&S, g, g->finobj, -1);
+	snaplist(&S, g, g->tobefnz, LUA_SNAPRFINALIZE);
+	snaplist(&S, g, g->fixedgc, LUA_SNAPRFIXED);
+	if (iscollectable(&g->l_registry))
+		snaproot(&S, gcvalue(&g->l_registry), LUA_SNAPRREGISTRY, 0);
+	snaproot(&S, obj2gco(g->mainthread), LUA_SNAPRMAIN, 0);
+	for (i = 0; i < LUA_NUMTYPES; i++)
+	{
+		if (g->mt[i])
+			snaproot(&S, obj2gco(g->mt[i]), LUA_SNAPRMETA, i);
+	}
+	snapbyte(&S, LUA_SNAPEND);
+	snapsize(&S, S.nobjs);
+	snapsize(&S, S.nedges);
+	snapflush(&S);
+	g->gcstp = oldgcstp;
+	return S.status;
 }
 
 /* }====================================================== */
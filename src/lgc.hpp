@@ -188,6 +188,8 @@ constexpr auto TESTBIT =		7;
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
+LUAI_FUNC int luaC_budgetstep (lua_State *L, l_mem us);
+LUAI_FUNC int luaC_runfinalizers (lua_State *L, int n, l_mem us);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
@@ -197,6 +199,8 @@ LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+LUAI_FUNC int luaC_heapsnapshot (lua_State *L, lua_Writer writer,
+                                void *data);
 
 
 #endif
@@ -0,0 +1,751 @@
+/*
+** $Id: lgcpar.c $
+** Parallel marking and background freeing for the garbage collector
+** See Copyright Notice in lua.h
+*/
+
+#define lgcpar_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#if defined(LUA_USE_PARALLELMARK)
+
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "lua.hpp"
+
+#include "lfunc.hpp"
+#include "lgc.hpp"
+#include "lgcpar.hpp"
+#include "lobject.hpp"
+#include "lstate.hpp"
+#include "ltable.hpp"
+#include "ltm.hpp"
+
+
+/*
+** The marking threads run while the mutator is stopped inside the
+** collector (in 'propagateall'). Each one owns a stack of gray objects;
+** when it grows, part of it goes to a 'shared' stack that idle threads
+** can steal from. Colors change with atomic operations on 'marked', so
+** that each object becomes gray (and is traversed) only once. Threads
+** and weak tables are not traversed here, as their traversals link
+** them into the collector lists; they are handed back to the collector.
+** In incremental mode, traversing any other object only marks objects
+** and clears dead keys of the table being traversed.
+**
+** The stacks have fixed sizes, taken from the allocation function of
+** the state when a round starts: no memory is allocated while marking.
+** A gray object that does not fit in the stacks is also handed back,
+** still gray, for the collector to traverse it.
+*/
+
+
+/* objects moved at a time from a private stack to the shared one */
+#define PARBATCH	64
+
+/* size of a private stack (and the room for publishing in a shared one) */
+#define PARSTACK	4096
+
+
+typedef std::atomic_ref<lu_byte> AtomicMark;
+
+
+typedef struct WorkStack
+{
+	GCObject **local; /* private to its thread */
+	size_t nlocal;
+	std::mutex lock; /* protects 'shared' */
+	GCObject **shared; /* objects that can be stolen */
+	std::atomic<size_t> nshared{0}; /* number of objects in 'shared' */
+	size_t sizeshared;
+	GCObject *deferred; /* objects left to the collector */
+	lu_mem work = 0; /* work done by this thread in the current round */
+} WorkStack;
+
+
+struct GCWorkers
+{
+	int n; /* number of marking threads (including the collector's) */
+	global_State *g;
+	WorkStack *stacks; /* one per marking thread */
+	std::vector<std::thread> threads; /* 'n - 1' helper threads */
+	std::mutex lock; /* protects the fields below */
+	std::condition_variable wake; /* signals a new round (or 'quit') */
+	std::condition_variable done; /* signals the end of a round */
+	unsigned long round = 0;
+	int running = 0; /* helper threads still in the current round */
+	bool quit = false;
+	std::atomic<int> active{0}; /* threads that may still produce work */
+};
+
+
+static GCObject **gclistof(GCObject *o)
+{
+	switch (o->tt)
+	{
+		case LUA_VTABLE: return &gco2t(o)->gclist;
+		case LUA_VLCL: return &gco2lcl(o)->gclist;
+		case LUA_VCCL: return &gco2ccl(o)->gclist;
+		case LUA_VTHREAD: return &gco2th(o)->gclist;
+		case LUA_VPROTO: return &gco2p(o)->gclist;
+		default: return &gco2u(o)->gclist;
+	}
+}
+
+
+/* hand gray object 'o' back to the collector */
+static void defer(WorkStack *ws, GCObject *o)
+{
+	*gclistof(o) = ws->deferred;
+	ws->deferred = o;
+}
+
+
+static int publish(WorkStack *ws);
+
+
+/* push gray object 'o' on the private stack */
+static void pushgray(WorkStack *ws, GCObject *o)
+{
+	if (ws->nlocal == PARSTACK && !publish(ws))
+		defer(ws, o); /* no room anywhere */
+	else
+		ws->local[ws->nlocal++] = o;
+}
+
+
+static int markwhite(GCObject *o)
+{
+	return (AtomicMark(o->marked).load(std::memory_order_relaxed) & WHITEBITS);
+}
+
+
+/*
+** Turn a white object gray (or black, if 'black') and return true, or
+** return false if the object was not white (another thread got it).
+*/
+static int trymark(GCObject *o, int black)
+{
+	AtomicMark m(o->marked);
+	lu_byte old = m.load(std::memory_order_relaxed);
+	lu_byte nw;
+	do
+	{
+		if (!(old & WHITEBITS))
+			return 0;
+		nw = cast_byte(old & ~WHITEBITS);
+		if (black)
+			nw |= bitmask(BLACKBIT);
+	} while (!m.compare_exchange_weak(old, nw, std::memory_order_acq_rel));
+	return 1;
+}
+
+
+static void markobj(WorkStack *ws, GCObject *o);
+
+#define markval(ws,v)	{ const TValue *v_ = (v); \
+  if (iscollectable(v_) && markwhite(gcvalue(v_))) markobj(ws, gcvalue(v_)); }
+
+#define markobjN(ws,t)	{ if ((t) && markwhite(obj2gco(t))) markobj(ws, obj2gco(t)); }
+
+
+/* parallel version of 'reallymarkobject' */
+static void markobj(WorkStack *ws, GCObject *o)
+{
+	switch (o->tt)
+	{
+		case LUA_VSHRSTR:
+		case LUA_VLNGSTR:
+#if defined(LUA_USE_NANBOX)
+		case LUA_VNUMINT:
+#endif
+		{
+			trymark(o, 1); /* nothing to visit */
+			break;
+		}
+		case LUA_VUPVAL: {
+			UpVal *uv = gco2upv(o);
+			if (trymark(o, !upisopen(uv))) /* open upvalues are kept gray */
+				markval(ws, uv->v.p);
+			break;
+		}
+		case LUA_VUSERDATA: {
+			Udata *u = gco2u(o);
+			if (u->nuvalue == 0)
+			{
+				/* no user values? */
+				if (trymark(o, 1))
+					markobjN(ws, u->metatable);
+				break;
+			}
+			/* else... */
+		} /* FALLTHROUGH */
+		default: {
+			if (trymark(o, 0))
+				pushgray(ws, o); /* to be visited later */
+			break;
+		}
+	}
+}
+
+
+/* whether the traversal of table 'h' must be done by the collector */
+static int isweaktable(global_State *g, Table *h)
+{
+	Table *mt = h->metatable;
+	/* no writes here: cannot use 'gfasttm', which caches absent fields */
+	if (mt == NULL || (mt->flags & (1u << TM_MODE)))
+		return 0;
+	return !notm(luaH_getshortstr(mt, g->tmname[TM_MODE]));
+}
+
+
+static lu_mem traversetable(WorkStack *ws, Table *h)
+{
+	Node *n, *limit = gnode(h, cast_sizet(sizenode(h)));
+	unsigned int i;
+	unsigned int asize = luaH_realasize(h);
+	markobjN(ws, h->metatable);
+	for (i = 0; i < asize; i++) /* traverse array part */
+		markval(ws, &h->array[i]);
+	for (n = gnode(h, 0); n < limit; n++)
+	{
+		/* traverse hash part */
+		if (isempty(gval(n))) /* entry is empty? */
+		{
+			if (keyiscollectable(n))
+				setdeadkey(n); /* unused key; remove it */
+		}
+		else
+		{
+			if (keyiscollectable(n) && markwhite(gckey(n)))
+				markobj(ws, gckey(n));
+			markval(ws, gval(n));
+		}
+	}
+	return 1 + h->alimit + 2 * allocsizenode(h);
+}
+
+
+/* parallel version of 'propagatemark' for object 'o' */
+static void traverse(GCWorkers *gw, WorkStack *ws, GCObject *o)
+{
+	int i;
+	if (o->tt == LUA_VTHREAD ||
+		 (o->tt == LUA_VTABLE && isweaktable(gw->g, gco2t(o))))
+	{
+		defer(ws, o); /* left gray for the collector */
+		return;
+	}
+	AtomicMark(o->marked).fetch_or(bitmask(BLACKBIT), std::memory_order_relaxed);
+	switch (o->tt)
+	{
+		case LUA_VTABLE: {
+			ws->work += traversetable(ws, gco2t(o));
+			break;
+		}
+		case LUA_VUSERDATA: {
+			Udata *u = gco2u(o);
+			markobjN(ws, u->metatable);
+			for (i = 0; i < u->nuvalue; i++)
+				markval(ws, &u->uv[i].uv);
+			ws->work += 1 + u->nuvalue;
+			break;
+		}
+		case LUA_VLCL: {
+			LClosure *cl = gco2lcl(o);
+			markobjN(ws, cl->p);
+			for (i = 0; i < cl->nupvalues; i++)
+				markobjN(ws, cl->upvals[i]);
+			ws->work += 1 + cl->nupvalues;
+			break;
+		}
+		case LUA_VCCL: {
+			CClosure *cl = gco2ccl(o);
+			for (i = 0; i < cl->nupvalues; i++)
+				markval(ws, &cl->upvalue[i]);
+			ws->work += 1 + cl->nupvalues;
+			break;
+		}
+		case LUA_VPROTO: {
+			Proto *f = gco2p(o);
+			if (f->cache && markwhite(obj2gco(f->cache)))
+				f->cache = NULL; /* as in 'traverseproto' */
+			markobjN(ws, f->source);
+			for (i = 0; i < f->sizek; i++)
+				markval(ws, &f->k[i]);
+			for (i = 0; i < f->sizeupvalues; i++)
+				markobjN(ws, f->upvalues[i].name);
+			for (i = 0; i < f->sizep; i++)
+				markobjN(ws, f->p[i]);
+			for (i = 0; i < f->sizelocvars; i++)
+				markobjN(ws, f->locvars[i].varname);
+			ws->work += 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars;
+			break;
+		}
+		default: lua_assert(0);
+	}
+}
+
+
+/*
+** Move part of a large private stack to the shared stack. Returns
+** false if the shared stack is full.
+*/
+static int publish(WorkStack *ws)
+{
+	std::lock_guard<std::mutex> lk(ws->lock);
+	size_t n = ws->nshared.load();
+	if (ws->sizeshared - n < PARBATCH)
+		return 0;
+	ws->nlocal -= PARBATCH;
+	memcpy(ws->shared + n, ws->local + ws->nlocal, PARBATCH * sizeof(GCObject *));
+	ws->nshared.store(n + PARBATCH);
+	return 1;
+}
+
+
+/*
+** Move half of the shared stack of 'from' to the private stack of 'ws'
+** (as much as fits in it).
+*/
+static int steal(WorkStack *ws, WorkStack *from)
+{
+	std::lock_guard<std::mutex> lk(from->lock);
+	size_t n = from->nshared.load();
+	size_t k = (n + 1) / 2;
+	if (k > PARSTACK - ws->nlocal)
+		k = PARSTACK - ws->nlocal;
+	if (k == 0)
+		return 0;
+	memcpy(ws->local + ws->nlocal, from->shared + (n - k), k * sizeof(GCObject *));
+	ws->nlocal += k;
+	from->nshared.store(n - k);
+	return 1;
+}
+
+
+static int takework(GCWorkers *gw, int id)
+{
+	int i;
+	for (i = 0; i < gw->n; i++)
+	{
+		WorkStack *from = &gw->stacks[(id + i) % gw->n];
+		if (from->nshared.load() > 0 && steal(&gw->stacks[id], from))
+			return 1;
+	}
+	return 0;
+}
+
+
+static int anywork(GCWorkers *gw)
+{
+	int i;
+	for (i = 0; i < gw->n; i++)
+	{
+		if (gw->stacks[i].nshared.load() > 0)
+			return 1;
+	}
+	return 0;
+}
+
+
+/*
+** Marking loop of thread 'id'. A thread without work leaves the set of
+** active threads; it can only get work back by stealing it. The round
+** ends when no thread is active (so no one can produce more work) and
+** all shared stacks are empty.
+*/
+static void drain(GCWorkers *gw, int id)
+{
+	WorkStack *ws = &gw->stacks[id];
+	for (;;)
+	{
+		while (ws->nlocal > 0)
+		{
+			GCObject *o = ws->local[--ws->nlocal];
+			traverse(gw, ws, o);
+			if (ws->nlocal > 2 * PARBATCH && ws->nshared.load() == 0)
+				publish(ws);
+		}
+		if (takework(gw, id))
+			continue;
+		gw->active.fetch_sub(1);
+		for (;;)
+		{
+			if (anywork(gw))
+			{
+				gw->active.fetch_add(1);
+				if (takework(gw, id))
+					break;
+				gw->active.fetch_sub(1);
+			}
+			else if (gw->active.load() == 0 && !anywork(gw))
+				return; /* round is over */
+			std::this_thread::yield();
+		}
+	}
+}
+
+
+static void helper(GCWorkers *gw, int id)
+{
+	unsigned long seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lk(gw->lock);
+			gw->wake.wait(lk, [&] { return gw->quit || gw->round != seen; });
+			if (gw->quit)
+				return;
+			seen = gw->round;
+		}
+		drain(gw, id);
+		{
+			std::lock_guard<std::mutex> lk(gw->lock);
+			if (--gw->running == 0)
+				gw->done.notify_one();
+		}
+	}
+}
+
+
+static void freeworkers(GCWorkers *gw)
+{
+	{
+		std::lock_guard<std::mutex> lk(gw->lock);
+		gw->quit = true;
+	}
+	gw->wake.notify_all();
+	for (std::thread &t : gw->threads)
+		t.join();
+	delete[] gw->stacks;
+	delete gw;
+}
+
+
+int luaC_setgcworkers(lua_State *L, int n)
+{
+	global_State *g = G(L);
+	GCWorkers *gw = g->gcworkers;
+	int old = (gw != NULL) ? gw->n : 1;
+	if (n > LUAI_MAXGCWORKERS)
+		n = LUAI_MAXGCWORKERS;
+	if (n < 0 || n == old || (n <= 1 && gw == NULL))
+		return old;
+	g->gcworkers = NULL;
+	if (gw != NULL)
+		freeworkers(gw);
+	if (n <= 1)
+		return old;
+	gw = new (std::nothrow) GCWorkers;
+	if (gw == NULL)
+		return -1;
+	gw->n = n;
+	gw->g = g;
+	gw->stacks = new (std::nothrow) WorkStack[n];
+	if (gw->stacks == NULL)
+	{
+		delete gw;
+		return -1;
+	}
+	try
+	{
+		int i;
+		for (i = 1; i < n; i++)
+			gw->threads.emplace_back(helper, gw, i);
+	}
+	catch (...)
+	{
+		/* could not create all threads */
+		freeworkers(gw);
+		return -1;
+	}
+	g->gcworkers = gw;
+	return old;
+}
+
+
+lu_mem luaC_parallelmark(global_State *g, GCObject **deferred)
+{
+	GCWorkers *gw = g->gcworkers;
+	GCObject *o;
+	GCObject *l = NULL;
+	GCObject **mem;
+	lu_mem work = 0;
+	size_t ngray = 0;
+	size_t share, size;
+	int i = 0;
+	for (o = g->gray; o != NULL; o = *gclistof(o))
+		ngray++;
+	/* each shared stack gets its part of the gray list plus some room */
+	share = ngray / gw->n + 1 + PARSTACK;
+	size = gw->n * (PARSTACK + share) * sizeof(GCObject *);
+	mem = cast(GCObject **, (*g->frealloc)(g->ud, NULL, 0, size));
+	if (mem == NULL)
+	{
+		/* no memory for the stacks; collector traverses all */
+		*deferred = g->gray;
+		g->gray = NULL;
+		return 0;
+	}
+	for (i = 0; i < gw->n; i++)
+	{
+		WorkStack *ws = &gw->stacks[i];
+		ws->local = mem + i * (PARSTACK + share);
+		ws->nlocal = 0;
+		ws->shared = ws->local + PARSTACK;
+		ws->nshared.store(0);
+		ws->sizeshared = share;
+		ws->deferred = NULL;
+	}
+	/* distribute the gray list among all threads */
+	for (o = g->gray, i = 0; o != NULL; i = (i + 1) % gw->n)
+	{
+		WorkStack *ws = &gw->stacks[i];
+		ws->shared[ws->nshared++] = o;
+		o = *gclistof(o);
+	}
+	g->gray = NULL;
+	gw->active.store(gw->n);
+	{
+		std::lock_guard<std::mutex> lk(gw->lock);
+		gw->running = gw->n - 1;
+		gw->round++;
+	}
+	gw->wake.notify_all();
+	drain(gw, 0);
+	{
+		std::unique_lock<std::mutex> lk(gw->lock);
+		gw->done.wait(lk, [&] { return gw->running == 0; });
+	}
+	/* return deferred objects (still gray) */
+	for (i = 0; i < gw->n; i++)
+	{
+		WorkStack *ws = &gw->stacks[i];
+		work += ws->work;
+		ws->work = 0;
+		while ((o = ws->deferred) != NULL)
+		{
+			ws->deferred = *gclistof(o);
+			*gclistof(o) = l;
+			l = o;
+		}
+	}
+	(*g->frealloc)(g->ud, mem, size, 0);
+	*deferred = l;
+	return work;
+}
+
+
+/*
+** {======================================================
+** Background freeing
+** =======================================================
+*/
+
+/*
+** During sweeps, 'luaM::free_' does not call the allocation function
+** but gives the block to 'luaC_deferfree' (see 'gcfreeing'). Blocks are
+** collected in batches, and full batches go to a queue served by the
+** background thread. Each batch keeps the allocation function current
+** when it was filled, so that the blocks go back to their allocator.
+** The memory counts of the collector are updated when the blocks are
+** handed over, as if they were already free. A new batch is needed
+** only when all others are in the queue or being freed, so at most
+** MAXFREEBATCHES are created; 'queue' and 'spare' are reserved for them
+** when the thread starts, so that they never allocate afterwards.
+*/
+
+#define MAXFREEBATCHES	(LUAI_MAXFREEQUEUE + 2)
+
+
+typedef struct FreeBatch
+{
+	lua_Alloc frealloc;
+	void *ud;
+	int n; /* number of blocks in the batch */
+	void *block[LUAI_FREEBATCH];
+	size_t size[LUAI_FREEBATCH];
+} FreeBatch;
+
+
+struct GCFreer
+{
+	std::thread thread;
+	FreeBatch *current = NULL; /* batch being filled by the collector */
+	std::mutex lock; /* protects the fields below */
+	std::condition_variable wake; /* signals a new batch (or 'quit') */
+	std::condition_variable idle; /* signals an empty queue */
+	std::vector<FreeBatch *> queue; /* batches waiting to be freed */
+	std::vector<FreeBatch *> spare; /* empty batches for reuse */
+	int nbatches = 0; /* batches created */
+	bool busy = false; /* thread is freeing a batch */
+	bool quit = false;
+};
+
+
+static void freebatch(FreeBatch *b)
+{
+	int i;
+	for (i = 0; i < b->n; i++)
+		(*b->frealloc)(b->ud, b->block[i], b->size[i], 0);
+	b->n = 0;
+}
+
+
+static void freer(GCFreer *gf)
+{
+	std::unique_lock<std::mutex> lk(gf->lock);
+	for (;;)
+	{
+		gf->wake.wait(lk, [&] { return gf->quit || !gf->queue.empty(); });
+		if (gf->queue.empty()) /* and 'quit' */
+			return;
+		FreeBatch *b = gf->queue.back();
+		gf->queue.pop_back();
+		gf->busy = true;
+		lk.unlock();
+		freebatch(b);
+		lk.lock();
+		gf->busy = false;
+		gf->spare.push_back(b);
+		if (gf->queue.empty())
+			gf->idle.notify_all();
+	}
+}
+
+
+/* send the current batch to the background thread */
+static void submit(GCFreer *gf)
+{
+	FreeBatch *b = gf->current;
+	gf->current = NULL;
+	{
+		std::lock_guard<std::mutex> lk(gf->lock);
+		if (gf->queue.size() < LUAI_MAXFREEQUEUE)
+		{
+			gf->queue.push_back(b);
+			gf->wake.notify_one();
+			return;
+		}
+	}
+	/* thread is too far behind; free the batch here */
+	freebatch(b);
+	std::lock_guard<std::mutex> lk(gf->lock);
+	gf->spare.push_back(b);
+}
+
+
+void luaC_deferfree(global_State *g, void *block, size_t osize)
+{
+	GCFreer *gf = g->gcfreer;
+	FreeBatch *b = gf->current;
+	if (b == NULL)
+	{
+		{
+			std::lock_guard<std::mutex> lk(gf->lock);
+			if (!gf->spare.empty())
+			{
+				b = gf->spare.back();
+				gf->spare.pop_back();
+			}
+		}
+		if (b == NULL)
+		{
+			if (gf->nbatches < MAXFREEBATCHES)
+				b = new (std::nothrow) FreeBatch;
+			if (b == NULL)
+			{
+				/* no memory for a new batch; free the block now */
+				(*g->frealloc)(g->ud, block, osize, 0);
+				return;
+			}
+			gf->nbatches++;
+		}
+		b->frealloc = g->frealloc;
+		b->ud = g->ud;
+		b->n = 0;
+		gf->current = b;
+	}
+	b->block[b->n] = block;
+	b->size[b->n++] = osize;
+	if (b->n == LUAI_FREEBATCH)
+		submit(gf);
+}
+
+
+void luaC_flushfree(global_State *g)
+{
+	GCFreer *gf = g->gcfreer;
+	if (gf != NULL && gf->current != NULL)
+		submit(gf);
+}
+
+
+void luaC_syncfree(global_State *g)
+{
+	GCFreer *gf = g->gcfreer;
+	if (gf != NULL)
+	{
+		luaC_flushfree(g);
+		std::unique_lock<std::mutex> lk(gf->lock);
+		gf->idle.wait(lk, [&] { return gf->queue.empty() && !gf->busy; });
+	}
+}
+
+
+int luaC_setbgfree(lua_State *L, int on)
+{
+	global_State *g = G(L);
+	GCFreer *gf = g->gcfreer;
+	int old = (gf != NULL);
+	if (on < 0 || (on > 0) == old)
+		return old;
+	if (gf != NULL)
+	{
+		/* stop the thread */
+		luaC_flushfree(g);
+		{
+			std::lock_guard<std::mutex> lk(gf->lock);
+			gf->quit = true; /* thread finishes the queue before quitting */
+		}
+		gf->wake.notify_one();
+		gf->thread.join();
+		for (FreeBatch *b : gf->spare)
+			delete b;
+		g->gcfreer = NULL;
+		delete gf;
+		return old;
+	}
+	gf = new (std::nothrow) GCFreer;
+	if (gf == NULL)
+		return -1;
+	try
+	{
+		gf->queue.reserve(LUAI_MAXFREEQUEUE);
+		gf->spare.reserve(MAXFREEBATCHES);
+		gf->thread = std::thread(freer, gf);
+	}
+	catch (...)
+	{
+		delete gf;
+		return -1;
+	}
+	g->gcfreer = gf;
+	return old;
+}
+
+/* }====================================================== */
+
+#endif
@@ -0,0 +1,81 @@
+/*
+** $Id: lgcpar.h $
+** Parallel marking and background freeing for the garbage collector
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lgcpar_h
+#define lgcpar_h
+
+#include "lobject.hpp"
+#include "lstate.hpp"
+
+
+#if defined(LUA_USE_PARALLELMARK)
+
+/*
+** Number of gray objects traversed serially before 'propagateall'
+** hands the rest of the gray list to the marking threads.
+*/
+#if !defined(LUAI_PARMARKMIN)
+#define LUAI_PARMARKMIN	1024
+#endif
+
+/* maximum number of marking threads (including the collector's) */
+#if !defined(LUAI_MAXGCWORKERS)
+#define LUAI_MAXGCWORKERS	64
+#endif
+
+
+/*
+** Set the number of marking threads to 'n' (counting the thread running
+** the collector; 'n' <= 1 means serial marking; 'n' < 0 only queries).
+** Returns the previous number, or -1 if the threads could not be created.
+*/
+LUAI_FUNC int luaC_setgcworkers (lua_State *L, int n);
+
+/*
+** Traverse all objects reachable from the gray list with the marking
+** threads, leaving 'g->gray' empty. Objects whose traversal changes
+** global collector lists (threads and weak tables) are left gray and
+** returned in '*deferred' (linked by 'gclist') for a serial traversal.
+** Returns the work done, as 'propagatemark'.
+*/
+LUAI_FUNC lu_mem luaC_parallelmark (global_State *g, GCObject **deferred);
+
+
+/* number of blocks freed together by the background thread */
+#if !defined(LUAI_FREEBATCH)
+#define LUAI_FREEBATCH	256
+#endif
+
+/*
+** Maximum number of batches waiting for the background thread; beyond
+** that, the collector frees the blocks itself.
+*/
+#if !defined(LUAI_MAXFREEQUEUE)
+#define LUAI_MAXFREEQUEUE	64
+#endif
+
+
+/*
+** Start ('on' > 0) or stop ('on' == 0) the thread that frees the blocks
+** of dead objects found by the sweeps ('on' < 0 only queries). With the
+** thread running, the allocation function is called from two threads,
+** so it must be thread safe. Returns the previous state, or -1 if the
+** thread could not be created.
+*/
+LUAI_FUNC int luaC_setbgfree (lua_State *L, int on);
+
+/* hand block 'block' (of size 'osize') to the background thread */
+LUAI_FUNC void luaC_deferfree (global_State *g, void *block, size_t osize);
+
+/* pass the blocks collected so far to the background thread */
+LUAI_FUNC void luaC_flushfree (global_State *g);
+
+/* wait until all blocks given to the background thread are freed */
+LUAI_FUNC void luaC_syncfree (global_State *g);
+
+#endif
+
+#endif
@@ -221,6 +221,77 @@ static int pushmode(lua_State *L, int oldmode)
 }
 
 
+/*
+** Push a table with the collector statistics (see 'lua_gcstats'):
+** the time in each phase, counters, and 'histogram', whose entry 'i'
+** counts the steps taking from 2^(i-1) to 2^i - 1 nanoseconds.
+*/
+static int pushgcstats(lua_State *L, int reset)
+{
+	static const char *const phasenames[] = {
+		"propagate", "atomic", "sweep", "finalize", "young", "other"
+	};
+	lua_GCStats s;
+	int i;
+	if (!lua_gcstats(L, &s, reset))
+	{
+		luaL_pushfail(L); /* statistics not compiled in */
+		return 1;
+	}
+	lua_createtable(L, 0, LUA_GCNPHASES + 6);
+	for (i = 0; i < LUA_GCNPHASES; i++)
+	{
+		lua_pushinteger(L, (lua_Integer) s.phasens[i]);
+		lua_setfield(L, -2, phasenames[i]);
+	}
+	lua_pushinteger(L, (lua_Integer) s.traversed);
+	lua_setfield(L, -2, "traversed");
+	lua_pushinteger(L, (lua_Integer) s.freedobjs);
+	lua_setfield(L, -2, "freedobjects");
+	lua_pushinteger(L, (lua_Integer) s.freedbytes);
+	lua_setfield(L, -2, "freedbytes");
+	lua_pushinteger(L, (lua_Integer) s.nsteps);
+	lua_setfield(L, -2, "steps");
+	lua_pushinteger(L, (lua_Integer) s.maxstepns);
+	lua_setfield(L, -2, "maxstep");
+	lua_createtable(L, LUA_GCHISTSIZE, 0);
+	for (i = 0; i < LUA_GCHISTSIZE; i++)
+	{
+		lua_pushinteger(L, (lua_Integer) s.stephist[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "histogram");
+	return 1;
+}
+
+
+/*
+** Push a table with the finalizer statistics (see 'lua_finstats').
+*/
+static int pushfinstats(lua_State *L, int reset)
+{
+	lua_FinStats s;
+	lua_finstats(L, &s, reset);
+	lua_createtable(L, 0, 5);
+	lua_pushinteger(L, (lua_Integer) s.pending);
+	lua_setfield(L, -2, "pending");
+	lua_pushinteger(L, (lua_Integer) s.maxpending);
+	lua_setfield(L, -2, "maxpending");
+	lua_pushinteger(L, (lua_Integer) s.queued);
+	lua_setfield(L, -2, "queued");
+	lua_pushinteger(L, (lua_Integer) s.finalized);
+	lua_setfield(L, -2, "finalized");
+	lua_pushinteger(L, (lua_Integer) s.errors);
+	lua_setfield(L, -2, "errors");
+	return 1;
+}
+
+
+/* "stats" and "finstats" are not 'lua_gc' options */
+constexpr auto GCSTATSOPT = -1;
+constexpr auto FINSTATSOPT = -2;
+
+
 /*
 ** check whether call to 'lua_gc' was valid (not inside a finalizer)
 */
@@ -231,12 +302,14 @@ static int luaB_collectgarbage(lua_State *L)
 	static const char *const opts[] = {
 		"stop", "restart", "collect",
 		"count", "step", "setpause", "setstepmul",
-		"isrunning", "generational", "incremental", NULL
+		"isrunning", "generational", "incremental", "budget", "parallel",
+		"background", "stats", "finqueue", "finalize", "finstats", NULL
 	};
 	static const int optsnum[] = {
 		LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
 		LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-		LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC
+		LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, LUA_GCBUDGET, LUA_GCPARALLEL,
+		LUA_GCBGFREE, GCSTATSOPT, LUA_GCFINQUEUE, LUA_GCFINALIZE, FINSTATSOPT
 	};
 	int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
 	switch (o)
@@ -255,6 +328,13 @@ static int luaB_collectgarbage(lua_State *L)
 			lua_pushboolean(L, res);
 			return 1;
 		}
+		case LUA_GCBUDGET: {
+			int us = (int) luaL_checkinteger(L, 2);
+			int res = lua_gc(L, o, us);
+			checkvalres(res);
+			lua_pushboolean(L, res);
+			return 1;
+		}
 		case LUA_GCSETPAUSE:
 		case LUA_GCSETSTEPMUL: {
 			int p = (int) luaL_optinteger(L, 2, 0);
@@ -263,6 +343,39 @@ static int luaB_collectgarbage(lua_State *L)
 			lua_pushinteger(L, previous);
 			return 1;
 		}
+		case LUA_GCPARALLEL: {
+			int n = (int) luaL_optinteger(L, 2, -1); /* default only queries */
+			int previous = lua_gc(L, o, n);
+			checkvalres(previous);
+			lua_pushinteger(L, previous);
+			return 1;
+		}
+		case LUA_GCBGFREE: {
+			int on = lua_isnone(L, 2) ? -1 : lua_toboolean(L, 2);
+			int previous = lua_gc(L, o, on);
+			checkvalres(previous);
+			lua_pushboolean(L, previous);
+			return 1;
+		}
+		case LUA_GCFINQUEUE: {
+			int on = lua_isnone(L, 2) ? -1 : lua_toboolean(L, 2);
+			int previous = lua_gc(L, o, on);
+			checkvalres(previous);
+			lua_pushboolean(L, previous);
+			return 1;
+		}
+		case LUA_GCFINALIZE: {
+			int n = (int) luaL_optinteger(L, 2, 0);
+			int us = (int) luaL_optinteger(L, 3, 0);
+			int pending = lua_gc(L, o, n, us);
+			checkvalres(pending);
+			lua_pushinteger(L, pending);
+			return 1;
+		}
+		case GCSTATSOPT:
+			return pushgcstats(L, lua_toboolean(L, 2));
+		case FINSTATSOPT:
+			return pushfinstats(L, lua_toboolean(L, 2));
 		case LUA_GCISRUNNING: {
 			int res = lua_gc(L, o);
 			checkvalres(res);
@@ -608,6 +721,7 @@ LUAMOD_API int luaopen_base(lua_State *L)
 	/* open lib into global table */
 	lua_pushglobaltable(L);
 	luaL_setfuncs(L, base_funcs, 0);
+	lua_setnextfunction(L, luaB_next); /* let loops traverse tables directly */
 	/* set global _G */
 	lua_pushvalue(L, -1);
 	lua_setfield(L, -2, LUA_GNAME);
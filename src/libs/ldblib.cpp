@@ -513,6 +513,169 @@ static int db_setcstacklimit(lua_State *L)
 }
 
 
+/*
+** Returns the number of hits and misses of the inline caches of field
+** accesses and of global accesses; if the optional argument is true,
+** also resets them.
+*/
+static int db_getcachestats(lua_State *L)
+{
+	lua_Unsigned hits, misses, ghits, gmisses;
+	lua_getcachestats(L, &hits, &misses);
+	lua_getglobalcachestats(L, &ghits, &gmisses);
+	if (lua_toboolean(L, 1))
+		lua_resetcachestats(L);
+	lua_pushinteger(L, (lua_Integer) hits);
+	lua_pushinteger(L, (lua_Integer) misses);
+	lua_pushinteger(L, (lua_Integer) ghits);
+	lua_pushinteger(L, (lua_Integer) gmisses);
+	return 4;
+}
+
+
+static int db_settypeprofile(lua_State *L)
+{
+	luaL_checkany(L, 1);
+	lua_pushboolean(L, lua_settypeprofile(L, lua_toboolean(L, 1)));
+	return 1;
+}
+
+
+/*
+** Names of the type tags in type-feedback masks, indexed by
+** 'type * 3 + variant'
+*/
+static const char *const fbtagnames[] = {
+	"nil", "empty", "abstkey",
+	"false", "true", NULL,
+	"lightuserdata", NULL, NULL,
+	"integer", "float", NULL,
+	"shortstring", "longstring", NULL,
+	"table", NULL, NULL,
+	"Lua function", "light C function", "C closure",
+	"userdata", NULL, NULL,
+	"thread", NULL, NULL
+};
+
+
+static void pushfbtags(lua_State *L, unsigned int seen)
+{
+	luaL_Buffer b;
+	int i;
+	luaL_buffinit(L, &b);
+	for (i = 0; i < (int)(sizeof(fbtagnames) / sizeof(fbtagnames[0])); i++)
+	{
+		if ((seen & (1u << i)) && fbtagnames[i] != NULL)
+		{
+			if (luaL_bufflen(&b) > 0)
+				luaL_addchar(&b, '|');
+			luaL_addstring(&b, fbtagnames[i]);
+		}
+	}
+	luaL_pushresult(&b);
+}
+
+
+/*
+** Returns the type feedback collected for a Lua function: a table
+** mapping each profiled instruction (by its 1-based index) that ran to
+** a table with fields 'count' and 'line' and, in [1] and [2], the
+** types seen in its operands, separated by '|'.
+*/
+static int db_gettypefeedback(lua_State *L)
+{
+	unsigned int count, seen[2];
+	int n, line;
+	luaL_argcheck(L, lua_type(L, 1) == LUA_TFUNCTION && !lua_iscfunction(L, 1),
+					  1, "Lua function expected");
+	lua_newtable(L);
+	for (n = 1; lua_gettypefeedback(L, 1, n, &count, seen, &line); n++)
+	{
+		if (count == 0)
+			continue;
+		lua_createtable(L, 2, 2);
+		lua_pushinteger(L, (lua_Integer) count);
+		lua_setfield(L, -2, "count");
+		lua_pushinteger(L, line);
+		lua_setfield(L, -2, "line");
+		pushfbtags(L, seen[0]);
+		lua_rawseti(L, -2, 1);
+		if (seen[1] != 0)
+		{
+			pushfbtags(L, seen[1]);
+			lua_rawseti(L, -2, 2);
+		}
+		lua_rawseti(L, -2, n);
+	}
+	return 1;
+}
+
+
+/*
+** Returns a table with the statistics of the size-class allocator
+** (see 'luaL_allocstats'), plus its 'hitrate' (fraction of small
+** allocations served by a free list) and 'fragmentation' (fraction of
+** slab memory not holding requested data), or fail if the state does
+** not use that allocator.
+*/
+static int db_allocstats(lua_State *L)
+{
+	luaL_AllocStats s;
+	if (!luaL_allocstats(L, &s))
+	{
+		luaL_pushfail(L);
+		return 1;
+	}
+	lua_createtable(L, 0, 9);
+	lua_pushinteger(L, (lua_Integer) s.slabbytes);
+	lua_setfield(L, -2, "slabbytes");
+	lua_pushinteger(L, (lua_Integer) s.usedbytes);
+	lua_setfield(L, -2, "usedbytes");
+	lua_pushinteger(L, (lua_Integer) s.requestedbytes);
+	lua_setfield(L, -2, "requestedbytes");
+	lua_pushinteger(L, (lua_Integer) s.largebytes);
+	lua_setfield(L, -2, "largebytes");
+	lua_pushinteger(L, (lua_Integer) s.nalloc);
+	lua_setfield(L, -2, "nalloc");
+	lua_pushinteger(L, (lua_Integer) s.nhits);
+	lua_setfield(L, -2, "nhits");
+	lua_pushinteger(L, (lua_Integer) s.nlarge);
+	lua_setfield(L, -2, "nlarge");
+	lua_pushnumber(L, s.nalloc ? (lua_Number) s.nhits / s.nalloc : 0);
+	lua_setfield(L, -2, "hitrate");
+	lua_pushnumber(L, s.slabbytes
+							? 1 - (lua_Number) s.requestedbytes / s.slabbytes : 0);
+	lua_setfield(L, -2, "fragmentation");
+	return 1;
+}
+
+
+static int snapwriter(lua_State *L, const void *b, size_t size, void *f)
+{
+	(void) L;
+	return (fwrite(b, size, 1, (FILE *) f) != 1);
+}
+
+
+/*
+** Writes a snapshot of the heap to the file named by its argument (see
+** 'lua_heapsnapshot'; the 'luaheap' program analyzes it). Returns true,
+** or fail plus an error message.
+*/
+static int db_heapsnapshot(lua_State *L)
+{
+	const char *fname = luaL_checkstring(L, 1);
+	FILE *f = fopen(fname, "wb");
+	int status;
+	if (f == NULL)
+		return luaL_fileresult(L, 0, fname);
+	status = lua_heapsnapshot(L, snapwriter, f);
+	if (fclose(f) != 0)
+		status = 1;
+	return luaL_fileresult(L, status == 0, fname);
+}
+
+
 static const luaL_Reg dblib[] = {
 	{"debug", db_debug},
 	{"getuservalue", db_getuservalue},
@@ -531,6 +694,11 @@ static const luaL_Reg dblib[] = {
 	{"setupvalue", db_setupvalue},
 	{"traceback", db_traceback},
 	{"setcstacklimit", db_setcstacklimit},
+	{"getcachestats", db_getcachestats},
+	{"settypeprofile", db_settypeprofile},
+	{"gettypefeedback", db_gettypefeedback},
+	{"allocstats", db_allocstats},
+	{"heapsnapshot", db_heapsnapshot},
 	{NULL, NULL}
 };
 
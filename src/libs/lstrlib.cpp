@@ -20,6 +20,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <bit>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+		(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LUAI_FINDSSE2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LUAI_FINDAVX2	/* selected at run time */
+#endif
+#endif
+
 #include "../lua.hpp"
 
 #include "../lauxlib.hpp"
@@ -289,11 +301,119 @@ static const luaL_Reg stringmetamethods[] = {
 #define CAP_POSITION	(-2)
 
 
+/*
+** Patterns are compiled into a sequence of items before matching, and
+** the matcher walks that sequence instead of the pattern text. Each
+** state keeps the last compiled patterns in a small LRU cache, so that
+** code calling 'find', 'match', 'gmatch', or 'gsub' with the same few
+** patterns does not parse them again and again.
+*/
+
+/* number of compiled patterns kept by each state */
+#if !defined(LUAI_PATTCACHE)
+#define LUAI_PATTCACHE		32
+#endif
+
+/* longest pattern kept in the cache (longer ones are compiled on each use) */
+#if !defined(LUAI_PATTCACHELEN)
+#define LUAI_PATTCACHELEN	256
+#endif
+
+
+/* item kinds */
+enum
+{
+	PI_END, /* end of pattern */
+	PI_CHAR, /* a literal character ('c1') */
+	PI_ANY, /* '.' */
+	PI_SET, /* a class or a bracket class (set 'arg') */
+	PI_OPEN, /* '(' */
+	PI_POSITION, /* '()' */
+	PI_CLOSE, /* ')' */
+	PI_EOS, /* '$' at the end of the pattern */
+	PI_BALANCE, /* '%b' ('c1' and 'c2') */
+	PI_FRONTIER, /* '%f' (set 'arg') */
+	PI_BACKREF, /* '%0'-'%9' (digit 'c1') */
+	PI_ERROR /* malformed pattern from here on (message 'arg') */
+};
+
+
+/*
+** Errors found when compiling a pattern only show when matching reaches
+** them (as an interpreter would), so they are compiled as 'PI_ERROR'.
+*/
+static const char *const patterrors[] = {
+	"malformed pattern (ends with '%')",
+	"malformed pattern (missing ']')",
+	"malformed pattern (missing arguments to '%b')",
+	"missing '[' after '%f' in pattern"
+};
+
+#define PE_ESC		0
+#define PE_BRACKET	1
+#define PE_BALANCE	2
+#define PE_FRONTIER	3
+
+
+typedef struct PatItem
+{
+	unsigned char op; /* item kind */
+	unsigned char rep; /* suffix of single-char items ('?', '*', '+', '-' or 0) */
+	unsigned char c1, c2;
+	int arg;
+} PatItem;
+
+
+/* set of characters (a bit for each value of 'unsigned char') */
+typedef struct CharSet
+{
+	unsigned char bits[(UCHAR_MAX + 1) / CHAR_BIT];
+} CharSet;
+
+#define inset(cs,c)	(((cs)->bits[(c) / CHAR_BIT] >> ((c) % CHAR_BIT)) & 1)
+
+#define setbit(cs,c)  \
+	((cs)->bits[(c) / CHAR_BIT] |= (unsigned char)(1u << ((c) % CHAR_BIT)))
+
+
+/* a compiled pattern (a userdata whose user value is the pattern text) */
+typedef struct Pattern
+{
+	const CharSet *sets; /* character sets (after the items) */
+	int classes; /* true if some set has a class like '%a' */
+	PatItem items[1]; /* items, ended by 'PI_END' or 'PI_ERROR' */
+} Pattern;
+
+
+/* letters of the classes '%x' (see 'match_class') */
+#define CLASSES		"acdglpsuwxz"
+#define NCLASSES	(sizeof(CLASSES) - 1)
+
+
+/* LRU cache of compiled patterns (shared upvalue of the library functions) */
+typedef struct PattCache
+{
+	const char *locale; /* LC_CTYPE locale of the sets built so far */
+	unsigned int clock; /* counter for the stamps of use */
+	unsigned int classok; /* which sets of 'classes' are built */
+	int last; /* entry used last */
+	CharSet classes[NCLASSES]; /* characters in each class of CLASSES */
+	struct
+	{
+		Pattern *pt; /* compiled pattern (NULL if entry is free) */
+		const char *key; /* pattern text (in the string 'pt' anchors) */
+		size_t len; /* length of pattern text */
+		unsigned int hash; /* hash of pattern text */
+		unsigned int stamp; /* 'clock' at last use */
+	} e[LUAI_PATTCACHE];
+} PattCache;
+
+
 typedef struct MatchState
 {
 	const char *src_init; /* init of source string */
 	const char *src_end; /* end ('\0') of source string */
-	const char *p_end; /* end ('\0') of pattern */
+	const CharSet *sets; /* character sets of the pattern */
 	lua_State *L;
 	int matchdepth; /* control for recursive depth (to avoid C stack overflow) */
 	unsigned char level; /* total number of captures (finished or unfinished) */
@@ -306,7 +426,7 @@ typedef struct MatchState
 
 
 /* recursive function */
-static const char *match(MatchState *ms, const char *s, const char *p);
+static const char *match(MatchState *ms, const char *s, const PatItem *pi);
 
 
 /* maximum recursion depth for 'match' */
@@ -338,13 +458,20 @@ static int capture_to_close(MatchState *ms)
 }
 
 
-static const char *classend(MatchState *ms, const char *p)
+/*
+** Return the end of the single-char class starting at 'p', or NULL
+** (with the error in '*err') if the class is malformed.
+*/
+static const char *classend(const char *p, const char *p_end, int *err)
 {
 	switch (*p++)
 	{
 		case L_ESC: {
-			if (l_unlikely(p == ms->p_end))
-				luaL_error(ms->L, "malformed pattern (ends with '%%')");
+			if (l_unlikely(p == p_end))
+			{
+				*err = PE_ESC;
+				return NULL;
+			}
 			return p + 1;
 		}
 		case '[': {
@@ -352,9 +479,12 @@ static const char *classend(MatchState *ms, const char *p)
 			do
 			{
 				/* look for a ']' */
-				if (l_unlikely(p == ms->p_end))
-					luaL_error(ms->L, "malformed pattern (missing ']')");
-				if (*(p++) == L_ESC && p < ms->p_end)
+				if (l_unlikely(p == p_end))
+				{
+					*err = PE_BRACKET;
+					return NULL;
+				}
+				if (*(p++) == L_ESC && p < p_end)
 					p++; /* skip escapes (e.g. '%]') */
 			} while (*p != ']');
 			return p + 1;
@@ -399,9 +529,86 @@ static int match_class(int c, int cl)
 }
 
 
-static int matchbracketclass(int c, const char *p, const char *ec)
+/*
+** {======================================================
+** Pattern compilation
+** =======================================================
+*/
+
+
+typedef struct CompState
+{
+	PattCache *pc;
+	Pattern *pt; /* pattern being built (NULL when only counting) */
+	int nitems; /* number of items so far */
+	int nsets; /* number of sets so far */
+	PatItem dummy; /* item written when only counting */
+} CompState;
+
+
+static PatItem *additem(CompState *cs, int op)
+{
+	PatItem *pi = (cs->pt) ? &cs->pt->items[cs->nitems] : &cs->dummy;
+	cs->nitems++;
+	pi->op = (unsigned char)op;
+	pi->rep = 0;
+	pi->c1 = pi->c2 = 0;
+	pi->arg = 0;
+	return pi;
+}
+
+
+static void adderror(CompState *cs, int err)
+{
+	additem(cs, PI_ERROR)->arg = err;
+}
+
+
+/*
+** Add to 'set' the characters matched by '%cl'. The sets of the letter
+** classes come from 'match_class', once for each locale. Return true
+** if 'cl' is such a class.
+*/
+static int addclass(PattCache *pc, CharSet *set, int cl)
+{
+	const char *q = (cl != '\0') ? strchr(CLASSES, tolower(cl)) : NULL;
+	if (q == NULL)
+	{
+		setbit(set, cl); /* '%' escapes a single character */
+		return 0;
+	}
+	else
+	{
+		unsigned int k = (unsigned int)(q - CLASSES);
+		CharSet *cls = &pc->classes[k];
+		size_t i;
+		if (!(pc->classok & (1u << k)))
+		{
+			int c;
+			memset(cls, 0, sizeof(CharSet));
+			for (c = 0; c <= UCHAR_MAX; c++)
+				if (match_class(c, *q)) setbit(cls, c);
+			pc->classok |= 1u << k;
+		}
+		for (i = 0; i < sizeof(set->bits); i++)
+			set->bits[i] |= islower(cl) ? cls->bits[i]
+			                            : (unsigned char)~cls->bits[i];
+		return 1;
+	}
+}
+
+
+/*
+** Add to 'set' the characters matched by the bracket class 'p'..'ec'
+** (parsed as the interpreter did, with 'ec' at the closing ']').
+** Return true if it has a letter class.
+*/
+static int addbracket(PattCache *pc, CharSet *set, const char *p,
+                      const char *ec)
 {
 	int sig = 1;
+	int classes = 0;
+	size_t i;
 	if (*(p + 1) == '^')
 	{
 		sig = 0;
@@ -412,58 +619,340 @@ static int matchbracketclass(int c, const char *p, const char *ec)
 		if (*p == L_ESC)
 		{
 			p++;
-			if (match_class(c, uchar(*p)))
-				return sig;
+			classes |= addclass(pc, set, uchar(*p));
 		}
 		else if ((*(p + 1) == '-') && (p + 2 < ec))
 		{
+			int c;
 			p += 2;
-			if (uchar(*(p-2)) <= c && c <= uchar(*p))
-				return sig;
+			for (c = uchar(*(p-2)); c <= uchar(*p); c++)
+				setbit(set, c);
+		}
+		else setbit(set, uchar(*p));
+	}
+	if (!sig)
+		for (i = 0; i < sizeof(set->bits); i++)
+			set->bits[i] = (unsigned char)~set->bits[i];
+	return classes;
+}
+
+
+/* add the set of characters matched by class 'p'..'ep' ('%x' or '[...]') */
+static int addset(CompState *cs, const char *p, const char *ep)
+{
+	if (cs->pt)
+	{
+		CharSet *set = (CharSet *)cs->pt->sets + cs->nsets;
+		memset(set, 0, sizeof(CharSet));
+		if (*p == L_ESC)
+			cs->pt->classes |= addclass(cs->pc, set, uchar(*(p + 1)));
+		else
+			cs->pt->classes |= addbracket(cs->pc, set, p, ep - 1);
+	}
+	return cs->nsets++;
+}
+
+
+/*
+** Compile pattern 'p' (with length 'lp') into 'cs->pt', or only count
+** its items and sets if 'cs->pt' is NULL. The items follow the order in
+** which the interpreter visited the pattern text.
+*/
+static void compile(CompState *cs, const char *p, size_t lp)
+{
+	const char *p_end = p + lp;
+	cs->nitems = cs->nsets = 0;
+	while (p != p_end)
+	{
+		switch (*p)
+		{
+			case '(': {
+				/* start capture */
+				if (*(p + 1) == ')') /* position capture? */
+				{
+					additem(cs, PI_POSITION);
+					p += 2;
+				}
+				else
+				{
+					additem(cs, PI_OPEN);
+					p++;
+				}
+				break;
+			}
+			case ')': {
+				/* end capture */
+				additem(cs, PI_CLOSE);
+				p++;
+				break;
+			}
+			case '$': {
+				if ((p + 1) != p_end) /* is the '$' the last char in pattern? */
+					goto dflt; /* no; go to default */
+				additem(cs, PI_EOS);
+				p++;
+				break;
+			}
+			case L_ESC: {
+				/* escaped sequences not in the format class[*+?-]? */
+				switch (*(p + 1))
+				{
+					case 'b': {
+						/* balanced string? */
+						PatItem *pi;
+						if (l_unlikely(p + 2 >= p_end - 1))
+						{
+							adderror(cs, PE_BALANCE);
+							return;
+						}
+						pi = additem(cs, PI_BALANCE);
+						pi->c1 = uchar(*(p + 2));
+						pi->c2 = uchar(*(p + 3));
+						p += 4;
+						break;
+					}
+					case 'f': {
+						/* frontier? */
+						const char *ep;
+						int err;
+						p += 2;
+						if (l_unlikely(*p != '['))
+						{
+							adderror(cs, PE_FRONTIER);
+							return;
+						}
+						if ((ep = classend(p, p_end, &err)) == NULL)
+						{
+							adderror(cs, err);
+							return;
+						}
+						int set = addset(cs, p, ep);
+						additem(cs, PI_FRONTIER)->arg = set;
+						p = ep;
+						break;
+					}
+					case '0':
+					case '1':
+					case '2':
+					case '3':
+					case '4':
+					case '5':
+					case '6':
+					case '7':
+					case '8':
+					case '9': {
+						/* capture results (%0-%9)? */
+						additem(cs, PI_BACKREF)->c1 = uchar(*(p + 1));
+						p += 2;
+						break;
+					}
+					default: goto dflt;
+				}
+				break;
+			}
+			default: dflt:
+				{
+					/* pattern class plus optional suffix */
+					int err;
+					const char *ep = classend(p, p_end, &err);
+					PatItem *pi;
+					if (ep == NULL)
+					{
+						adderror(cs, err);
+						return;
+					}
+					if (*p == '.')
+						pi = additem(cs, PI_ANY);
+					else if (*p == L_ESC || *p == '[')
+					{
+						int set = addset(cs, p, ep);
+						pi = additem(cs, PI_SET);
+						pi->arg = set;
+					}
+					else
+					{
+						pi = additem(cs, PI_CHAR);
+						pi->c1 = uchar(*p);
+					}
+					if (*ep == '?' || *ep == '*' || *ep == '+' || *ep == '-')
+					{
+						pi->rep = uchar(*ep);
+						ep++; /* skip suffix */
+					}
+					p = ep;
+					break;
+				}
 		}
-		else if (uchar(*p) == c) return sig;
 	}
-	return !sig;
+	additem(cs, PI_END);
+}
+
+
+/*
+** Push a new userdata with the compilation of pattern 'p', which is in
+** the string at index 'parg' (anchored as the user value).
+*/
+static Pattern *newpattern(lua_State *L, PattCache *pc, int parg,
+                           const char *p, size_t lp)
+{
+	CompState cs;
+	Pattern *pt;
+	size_t itemsz;
+	cs.pc = pc;
+	cs.pt = NULL;
+	compile(&cs, p, lp); /* count items and sets */
+	itemsz = offsetof(Pattern, items) + cs.nitems * sizeof(PatItem);
+	pt = (Pattern *) lua_newuserdatauv(L,
+		itemsz + cs.nsets * sizeof(CharSet), 1);
+	pt->sets = (const CharSet *)((char *)pt + itemsz);
+	pt->classes = 0;
+	cs.pt = pt;
+	compile(&cs, p, lp); /* fill it */
+	lua_pushvalue(L, parg);
+	lua_setiuservalue(L, -2, 1);
+	return pt;
+}
+
+
+/* the cache anchors its patterns (and its locale name) in user values */
+#define CACHEIDX	lua_upvalueindex(1)
+#define LOCALEUV	(LUAI_PATTCACHE + 1)
+
+
+static void newpattcache(lua_State *L)
+{
+	PattCache *pc = (PattCache *) lua_newuserdatauv(L, sizeof(PattCache),
+	                                                LOCALEUV);
+	memset(pc, 0, sizeof(PattCache));
+}
+
+
+/*
+** Sets of classes like '%a' depend on the locale, so the cache is
+** emptied when LC_CTYPE changes. Only new patterns and cached ones with
+** such sets need this check. Return true if the cache was emptied.
+*/
+static int checklocale(lua_State *L, PattCache *pc)
+{
+	const char *loc = setlocale(LC_CTYPE, NULL);
+	if (loc == NULL) loc = "";
+	if (l_unlikely(pc->locale == NULL || strcmp(loc, pc->locale) != 0))
+	{
+		int i;
+		for (i = 0; i < LUAI_PATTCACHE; i++)
+		{
+			if (pc->e[i].pt != NULL)
+			{
+				pc->e[i].pt = NULL;
+				pc->e[i].key = NULL;
+				lua_pushnil(L);
+				lua_setiuservalue(L, CACHEIDX, i + 1);
+			}
+		}
+		pc->classok = 0;
+		pc->locale = lua_pushstring(L, loc);
+		lua_setiuservalue(L, CACHEIDX, LOCALEUV);
+		return 1;
+	}
+	return 0;
+}
+
+
+/*
+** Return the compilation of pattern 'p' (in the string at index 'parg').
+** A new pattern is left on the stack, as it may not fit in the cache;
+** a cached one is pushed only if 'keep', for callers whose callbacks
+** may evict it from the cache while it is used.
+** A pattern given by the same string as a cached one (the usual case)
+** is found by its address; others are found by their hashes.
+*/
+static const Pattern *getpattern(lua_State *L, int parg,
+                                 const char *p, size_t lp, int keep)
+{
+	PattCache *pc = (PattCache *) lua_touserdata(L, CACHEIDX);
+	unsigned int h;
+	Pattern *pt;
+	int i, victim = 0;
+	i = pc->last;
+	if (pc->e[i].key == p && pc->e[i].len == lp)
+		goto found;
+	for (i = 0; i < LUAI_PATTCACHE; i++)
+		if (pc->e[i].key == p && pc->e[i].len == lp)
+			goto found;
+	h = (unsigned int)lp;
+	for (i = (int)lp; i > 0; i--)
+		h ^= ((h << 5) + (h >> 2) + uchar(p[i - 1]));
+	for (i = 0; i < LUAI_PATTCACHE; i++)
+	{
+		if (pc->e[i].pt == NULL)
+			victim = i; /* prefer a free entry */
+		else if (pc->e[i].hash == h && pc->e[i].len == lp &&
+		         memcmp(pc->e[i].key, p, lp) == 0)
+			goto found;
+		else if (pc->e[victim].pt != NULL &&
+		         pc->e[i].stamp - pc->e[victim].stamp > UINT_MAX / 2)
+			victim = i; /* used less recently than current victim */
+	}
+	checklocale(L, pc); /* (an emptied cache leaves 'victim' free) */
+	pt = newpattern(L, pc, parg, p, lp);
+	if (lp <= LUAI_PATTCACHELEN)
+	{
+		pc->e[victim].pt = pt;
+		pc->e[victim].key = p;
+		pc->e[victim].len = lp;
+		pc->e[victim].hash = h;
+		pc->e[victim].stamp = ++pc->clock;
+		pc->last = victim;
+		lua_pushvalue(L, -1);
+		lua_setiuservalue(L, CACHEIDX, victim + 1);
+	}
+	return pt;
+ found:
+	if (pc->e[i].pt->classes && checklocale(L, pc)) /* cache emptied? */
+		return getpattern(L, parg, p, lp, keep); /* compile it again */
+	pc->e[i].stamp = ++pc->clock;
+	pc->last = i;
+	if (keep)
+		lua_getiuservalue(L, CACHEIDX, i + 1);
+	return pc->e[i].pt;
 }
 
+/* }====================================================== */
+
 
-static int singlematch(MatchState *ms, const char *s, const char *p,
-								const char *ep)
+static int singlematch(MatchState *ms, const char *s, const PatItem *pi)
 {
 	if (s >= ms->src_end)
 		return 0;
 	else
 	{
 		int c = uchar(*s);
-		switch (*p)
+		switch (pi->op)
 		{
-			case '.': return 1; /* matches any char */
-			case L_ESC: return match_class(c, uchar(*(p+1)));
-			case '[': return matchbracketclass(c, p, ep - 1);
-			default: return (uchar(*p) == c);
+			case PI_ANY: return 1; /* matches any char */
+			case PI_SET: return inset(&ms->sets[pi->arg], c);
+			default: return (pi->c1 == c);
 		}
 	}
 }
 
 
 static const char *matchbalance(MatchState *ms, const char *s,
-											const char *p)
+											const PatItem *pi)
 {
-	if (l_unlikely(p >= ms->p_end - 1))
-		luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
-	if (*s != *p) return NULL;
+	if (uchar(*s) != pi->c1) return NULL;
 	else
 	{
-		int b = *p;
-		int e = *(p + 1);
+		int b = pi->c1;
+		int e = pi->c2;
 		int cont = 1;
 		while (++s < ms->src_end)
 		{
-			if (*s == e)
+			if (uchar(*s) == e)
 			{
 				if (--cont == 0) return s + 1;
 			}
-			else if (*s == b) cont++;
+			else if (uchar(*s) == b) cont++;
 		}
 	}
 	return NULL; /* string ends out of balance */
@@ -471,15 +960,20 @@ static const char *matchbalance(MatchState *ms, const char *s,
 
 
 static const char *max_expand(MatchState *ms, const char *s,
-										const char *p, const char *ep)
+										const PatItem *pi)
 {
 	ptrdiff_t i = 0; /* counts maximum expand for item */
-	while (singlematch(ms, s + i, p, ep))
-		i++;
+	if (pi->op == PI_ANY)
+		i = ms->src_end - s;
+	else
+	{
+		while (singlematch(ms, s + i, pi))
+			i++;
+	}
 	/* keeps trying to match with the maximum repetitions */
 	while (i >= 0)
 	{
-		const char *res = match(ms, (s + i), ep + 1);
+		const char *res = match(ms, (s + i), pi + 1);
 		if (res) return res;
 		i--; /* else didn't match; reduce 1 repetition to try again */
 	}
@@ -488,14 +982,14 @@ static const char *max_expand(MatchState *ms, const char *s,
 
 
 static const char *min_expand(MatchState *ms, const char *s,
-										const char *p, const char *ep)
+										const PatItem *pi)
 {
 	for (;;)
 	{
-		const char *res = match(ms, s, ep + 1);
+		const char *res = match(ms, s, pi + 1);
 		if (res != NULL)
 			return res;
-		else if (singlematch(ms, s, p, ep))
+		else if (singlematch(ms, s, pi))
 			s++; /* try with one more repetition */
 		else return NULL;
 	}
@@ -503,7 +997,7 @@ static const char *min_expand(MatchState *ms, const char *s,
 
 
 static const char *start_capture(MatchState *ms, const char *s,
-											const char *p, int what)
+											const PatItem *pi, int what)
 {
 	const char *res;
 	int level = ms->level;
@@ -511,19 +1005,19 @@ static const char *start_capture(MatchState *ms, const char *s,
 	ms->capture[level].init = s;
 	ms->capture[level].len = what;
 	ms->level = level + 1;
-	if ((res = match(ms, s, p)) == NULL) /* match failed? */
+	if ((res = match(ms, s, pi)) == NULL) /* match failed? */
 		ms->level--; /* undo capture */
 	return res;
 }
 
 
 static const char *end_capture(MatchState *ms, const char *s,
-										const char *p)
+										const PatItem *pi)
 {
 	int l = capture_to_close(ms);
 	const char *res;
 	ms->capture[l].len = s - ms->capture[l].init; /* close capture */
-	if ((res = match(ms, s, p)) == NULL) /* match failed? */
+	if ((res = match(ms, s, pi)) == NULL) /* match failed? */
 		ms->capture[l].len = CAP_UNFINISHED; /* undo capture */
 	return res;
 }
@@ -541,141 +1035,118 @@ static const char *match_capture(MatchState *ms, const char *s, int l)
 }
 
 
-static const char *match(MatchState *ms, const char *s, const char *p)
+static const char *match(MatchState *ms, const char *s, const PatItem *pi)
 {
 	if (l_unlikely(ms->matchdepth-- == 0))
 		luaL_error(ms->L, "pattern too complex");
 init: /* using goto to optimize tail recursion */
-	if (p != ms->p_end)
+	switch (pi->op)
 	{
-		/* end of pattern? */
-		switch (*p)
-		{
-			case '(': {
-				/* start capture */
-				if (*(p + 1) == ')') /* position capture? */
-					s = start_capture(ms, s, p + 2, CAP_POSITION);
-				else
-					s = start_capture(ms, s, p + 1, CAP_UNFINISHED);
-				break;
+		case PI_END: /* end of pattern */
+			break;
+		case PI_OPEN: {
+			/* start capture */
+			s = start_capture(ms, s, pi + 1, CAP_UNFINISHED);
+			break;
+		}
+		case PI_POSITION: {
+			/* position capture */
+			s = start_capture(ms, s, pi + 1, CAP_POSITION);
+			break;
+		}
+		case PI_CLOSE: {
+			/* end capture */
+			s = end_capture(ms, s, pi + 1);
+			break;
+		}
+		case PI_EOS: {
+			s = (s == ms->src_end) ? s : NULL; /* check end of string */
+			break;
+		}
+		case PI_BALANCE: {
+			/* balanced string? */
+			s = matchbalance(ms, s, pi);
+			if (s != NULL)
+			{
+				pi++;
+				goto init; /* return match(ms, s, pi + 1); */
+			} /* else fail (s == NULL) */
+			break;
+		}
+		case PI_FRONTIER: {
+			/* frontier? */
+			const CharSet *set = &ms->sets[pi->arg];
+			int previous = (s == ms->src_init) ? '\0' : uchar(*(s - 1));
+			if (!inset(set, previous) && inset(set, uchar(*s)))
+			{
+				pi++;
+				goto init; /* return match(ms, s, pi + 1); */
 			}
-			case ')': {
-				/* end capture */
-				s = end_capture(ms, s, p + 1);
-				break;
+			s = NULL; /* match failed */
+			break;
+		}
+		case PI_BACKREF: {
+			/* capture results (%0-%9)? */
+			s = match_capture(ms, s, pi->c1);
+			if (s != NULL)
+			{
+				pi++;
+				goto init; /* return match(ms, s, pi + 1) */
 			}
-			case '$': {
-				if ((p + 1) != ms->p_end) /* is the '$' the last char in pattern? */
-					goto dflt; /* no; go to default */
-				s = (s == ms->src_end) ? s : NULL; /* check end of string */
-				break;
+			break;
+		}
+		case PI_ERROR: {
+			luaL_error(ms->L, "%s", patterrors[pi->arg]);
+			break;
+		}
+		default: {
+			/* single char class plus optional suffix */
+			/* does not match at least once? */
+			if (!singlematch(ms, s, pi))
+			{
+				if (pi->rep == '*' || pi->rep == '?' || pi->rep == '-')
+				{
+					/* accept empty? */
+					pi++;
+					goto init; /* return match(ms, s, pi + 1); */
+				}
+				else /* '+' or no suffix */
+					s = NULL; /* fail */
 			}
-			case L_ESC: {
-				/* escaped sequences not in the format class[*+?-]? */
-				switch (*(p + 1))
+			else
+			{
+				/* matched once */
+				switch (pi->rep)
 				{
-					case 'b': {
-						/* balanced string? */
-						s = matchbalance(ms, s, p + 2);
-						if (s != NULL)
-						{
-							p += 4;
-							goto init; /* return match(ms, s, p + 4); */
-						} /* else fail (s == NULL) */
-						break;
-					}
-					case 'f': {
-						/* frontier? */
-						const char *ep;
-						char previous;
-						p += 2;
-						if (l_unlikely(*p != '['))
-							luaL_error(ms->L, "missing '[' after '%%f' in pattern");
-						ep = classend(ms, p); /* points to what is next */
-						previous = (s == ms->src_init) ? '\0' : *(s - 1);
-						if (!matchbracketclass(uchar(previous), p, ep - 1) &&
-							matchbracketclass(uchar(*s), p, ep - 1))
+					/* handle optional suffix */
+					case '?': {
+						/* optional */
+						const char *res;
+						if ((res = match(ms, s + 1, pi + 1)) != NULL)
+							s = res;
+						else
 						{
-							p = ep;
-							goto init; /* return match(ms, s, ep); */
+							pi++;
+							goto init; /* else return match(ms, s, pi + 1); */
 						}
-						s = NULL; /* match failed */
 						break;
 					}
-					case '0':
-					case '1':
-					case '2':
-					case '3':
-					case '4':
-					case '5':
-					case '6':
-					case '7':
-					case '8':
-					case '9': {
-						/* capture results (%0-%9)? */
-						s = match_capture(ms, s, uchar(*(p + 1)));
-						if (s != NULL)
-						{
-							p += 2;
-							goto init; /* return match(ms, s, p + 2) */
-						}
+					case '+': /* 1 or more repetitions */
+						s++; /* 1 match already done */
+					/* FALLTHROUGH */
+					case '*': /* 0 or more repetitions */
+						s = max_expand(ms, s, pi);
 						break;
-					}
-					default: goto dflt;
+					case '-': /* 0 or more repetitions (minimum) */
+						s = min_expand(ms, s, pi);
+						break;
+					default: /* no suffix */
+						s++;
+						pi++;
+						goto init; /* return match(ms, s + 1, pi + 1); */
 				}
-				break;
 			}
-			default: dflt:
-				{
-					/* pattern class plus optional suffix */
-					const char *ep = classend(ms, p); /* points to optional suffix */
-					/* does not match at least once? */
-					if (!singlematch(ms, s, p, ep))
-					{
-						if (*ep == '*' || *ep == '?' || *ep == '-')
-						{
-							/* accept empty? */
-							p = ep + 1;
-							goto init; /* return match(ms, s, ep + 1); */
-						}
-						else /* '+' or no suffix */
-							s = NULL; /* fail */
-					}
-					else
-					{
-						/* matched once */
-						switch (*ep)
-						{
-							/* handle optional suffix */
-							case '?': {
-								/* optional */
-								const char *res;
-								if ((res = match(ms, s + 1, ep + 1)) != NULL)
-									s = res;
-								else
-								{
-									p = ep + 1;
-									goto init; /* else return match(ms, s, ep + 1); */
-								}
-								break;
-							}
-							case '+': /* 1 or more repetitions */
-								s++; /* 1 match already done */
-							/* FALLTHROUGH */
-							case '*': /* 0 or more repetitions */
-								s = max_expand(ms, s, p, ep);
-								break;
-							case '-': /* 0 or more repetitions (minimum) */
-								s = min_expand(ms, s, p, ep);
-								break;
-							default: /* no suffix */
-								s++;
-								p = ep;
-								goto init; /* return match(ms, s + 1, ep); */
-						}
-					}
-					break;
-				}
+			break;
 		}
 	}
 	ms->matchdepth++;
@@ -683,32 +1154,257 @@ init: /* using goto to optimize tail recursion */
 }
 
 
+/*
+** {======================================================
+** Search for literals
+** =======================================================
+*/
+
+/*
+** The text is filtered for positions where both the first and the last
+** characters of the literal match, 16 or 32 positions at a time when
+** SSE2 or AVX2 are available; only those candidates are compared in
+** full. For literals longer than LUAI_TWOWAYMIN, once the comparisons
+** cost more than a few times the text scanned (see 'toocostly'), the
+** search goes on with the Two-Way algorithm, which is linear in any
+** case.
+*/
+#if !defined(LUAI_TWOWAYMIN)
+#define LUAI_TWOWAYMIN	32
+#endif
+
+#define toocostly(work,i,l2)	((l2) > LUAI_TWOWAYMIN && (work) > 4 * ((i) + (l2)))
+
+
+typedef struct LitSearch
+{
+	const char *s; /* text */
+	size_t ls; /* length of text */
+	const char *p; /* literal (at least 2 characters) */
+	size_t lp; /* length of literal */
+	size_t work; /* bytes compared checking candidates */
+	size_t resume; /* where Two-Way goes on plus 1 (0 if not needed) */
+} LitSearch;
+
+
+/*
+** Check the candidate at position 'i' (whose first and last characters
+** match). Return 1 if the literal is there, -1 if the filter must give
+** up, 0 otherwise.
+*/
+static int checkcandidate(LitSearch *S, size_t i)
+{
+	if (memcmp(S->s + i + 1, S->p + 1, S->lp - 2) == 0)
+		return 1;
+	S->work += S->lp;
+	if (toocostly(S->work, i, S->lp))
+	{
+		S->resume = i + 2;
+		return -1;
+	}
+	return 0;
+}
+
+
+/* filter candidates from position 'i' one at a time */
+static const char *scanfind(LitSearch *S, size_t i)
+{
+	const char *s = S->s;
+	size_t last = S->ls - S->lp; /* last candidate position */
+	const char *init;
+	while (i <= last &&
+	       (init = (const char *) memchr(s + i, *S->p, last - i + 1)) != NULL)
+	{
+		i = init - s;
+		if (s[i + S->lp - 1] == S->p[S->lp - 1])
+		{
+			int r = checkcandidate(S, i);
+			if (r != 0)
+				return (r > 0) ? s + i : NULL;
+		}
+		i++;
+	}
+	return NULL;
+}
+
+
+#if defined(LUAI_FINDSSE2)
+
+/* filter candidates from position 'i' 16 at a time */
+static const char *sse2find(LitSearch *S, size_t i)
+{
+	const __m128i first = _mm_set1_epi8(S->p[0]);
+	const __m128i last = _mm_set1_epi8(S->p[S->lp - 1]);
+	for (; i + S->lp + 15 <= S->ls; i += 16)
+	{
+		__m128i f = _mm_loadu_si128((const __m128i *) (S->s + i));
+		__m128i l = _mm_loadu_si128((const __m128i *) (S->s + i + S->lp - 1));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last)));
+		for (; mask != 0; mask &= mask - 1)
+		{
+			size_t j = i + std::countr_zero(mask);
+			int r = checkcandidate(S, j);
+			if (r != 0)
+				return (r > 0) ? S->s + j : NULL;
+		}
+	}
+	return scanfind(S, i);
+}
+
+#endif
+
+
+#if defined(LUAI_FINDAVX2)
+
+/* filter candidates from position 'i' 32 at a time */
+__attribute__((target("avx2")))
+static const char *avx2find(LitSearch *S, size_t i)
+{
+	const __m256i first = _mm256_set1_epi8(S->p[0]);
+	const __m256i last = _mm256_set1_epi8(S->p[S->lp - 1]);
+	for (; i + S->lp + 31 <= S->ls; i += 32)
+	{
+		__m256i f = _mm256_loadu_si256((const __m256i *) (S->s + i));
+		__m256i l = _mm256_loadu_si256((const __m256i *) (S->s + i + S->lp - 1));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(f, first),
+			                 _mm256_cmpeq_epi8(l, last)));
+		for (; mask != 0; mask &= mask - 1)
+		{
+			size_t j = i + std::countr_zero(mask);
+			int r = checkcandidate(S, j);
+			if (r != 0)
+				return (r > 0) ? S->s + j : NULL;
+		}
+	}
+	return sse2find(S, i);
+}
+
+#endif
+
+
+static const char *filterfind(LitSearch *S)
+{
+#if defined(LUAI_FINDAVX2)
+	if (__builtin_cpu_supports("avx2"))
+		return avx2find(S, 0);
+#endif
+#if defined(LUAI_FINDSSE2)
+	return sse2find(S, 0);
+#else
+	return scanfind(S, 0);
+#endif
+}
+
+
+/*
+** Maximal suffix of 'x' (with length 'n') for the order of characters
+** (or the reverse order, if 'rev'); its period goes to '*per'. Returns
+** the position before the suffix.
+*/
+static size_t maxsuffix(const unsigned char *x, size_t n, size_t *per,
+                        int rev)
+{
+	size_t ip = (size_t) -1; /* position before the suffix */
+	size_t jp = 0, k = 1, p = 1;
+	while (jp + k < n)
+	{
+		unsigned char a = x[ip + k];
+		unsigned char b = x[jp + k];
+		if (a == b)
+		{
+			if (k == p)
+			{
+				jp += p;
+				k = 1;
+			}
+			else k++;
+		}
+		else if ((a > b) != rev)
+		{
+			jp += k;
+			k = 1;
+			p = jp - ip;
+		}
+		else
+		{
+			ip = jp++;
+			k = p = 1;
+		}
+	}
+	*per = p;
+	return ip;
+}
+
+
+/* Two-Way algorithm (Crochemore and Perrin) */
+static const char *twowayfind(const char *s, size_t ls,
+                              const char *p, size_t lp)
+{
+	const unsigned char *h = (const unsigned char *) s;
+	const unsigned char *n = (const unsigned char *) p;
+	size_t per, per2, mem, mem0, j;
+	size_t ms = maxsuffix(n, lp, &per, 0); /* critical factorization */
+	size_t ms2 = maxsuffix(n, lp, &per2, 1);
+	if (ms2 + 1 > ms + 1)
+	{
+		ms = ms2;
+		per = per2;
+	}
+	if (memcmp(n, n + per, ms + 1) != 0)
+	{
+		/* not periodic */
+		mem0 = 0;
+		per = ((ms > lp - ms - 1) ? ms : lp - ms - 1) + 1;
+	}
+	else mem0 = lp - per;
+	mem = 0;
+	for (j = 0; j + lp <= ls;)
+	{
+		/* compare the right half, then the left one */
+		size_t k = (ms + 1 > mem) ? ms + 1 : mem;
+		while (k < lp && n[k] == h[j + k])
+			k++;
+		if (k < lp)
+		{
+			j += k - ms;
+			mem = 0;
+			continue;
+		}
+		k = ms + 1;
+		while (k > mem && n[k - 1] == h[j + k - 1])
+			k--;
+		if (k <= mem)
+			return s + j;
+		j += per;
+		mem = mem0;
+	}
+	return NULL;
+}
+
+
 static const char *lmemfind(const char *s1, size_t l1,
 									const char *s2, size_t l2)
 {
 	if (l2 == 0) return s1; /* empty strings are everywhere */
 	else if (l2 > l1) return NULL; /* avoids a negative 'l1' */
+	else if (l2 == 1) return (const char *) memchr(s1, *s2, l1);
 	else
 	{
-		const char *init; /* to search for a '*s2' inside 's1' */
-		l2--; /* 1st char will be checked by 'memchr' */
-		l1 = l1 - l2; /* 's2' cannot be found after that */
-		while (l1 > 0 && (init = (const char *) memchr(s1, *s2, l1)) != NULL)
+		LitSearch S = {s1, l1, s2, l2, 0, 0};
+		const char *res = filterfind(&S);
+		if (res == NULL && S.resume != 0) /* filtering got too costly? */
 		{
-			init++; /* 1st char is already checked */
-			if (memcmp(init, s2 + 1, l2) == 0)
-				return init - 1;
-			else
-			{
-				/* correct 'l1' and 's1' to try again */
-				l1 -= init - s1;
-				s1 = init;
-			}
+			size_t i = S.resume - 1;
+			res = twowayfind(s1 + i, l1 - i, s2, l2);
 		}
-		return NULL; /* not found */
+		return res;
 	}
 }
 
+/* }====================================================== */
+
 
 /*
 ** get information about the i-th capture. If there are no captures
@@ -779,14 +1475,24 @@ static int nospecials(const char *p, size_t l)
 }
 
 
+/*
+** check whether pattern matches only itself (for 'find', which does not
+** use captures, a ')' is not special)
+*/
+static int isliteral(const char *p, size_t l)
+{
+	return (nospecials(p, l) && memchr(p, ')', l) == NULL);
+}
+
+
 static void prepstate(MatchState *ms, lua_State *L,
-							const char *s, size_t ls, const char *p, size_t lp)
+							const char *s, size_t ls, const Pattern *pt)
 {
 	ms->L = L;
 	ms->matchdepth = MAXCCALLS;
 	ms->src_init = s;
 	ms->src_end = s + ls;
-	ms->p_end = p + lp;
+	ms->sets = pt->sets;
 }
 
 
@@ -810,12 +1516,17 @@ static int str_find_aux(lua_State *L, int find)
 		return 1;
 	}
 	/* explicit request or no special characters? */
-	if (find && (lua_toboolean(L, 4) || nospecials(p, lp)))
+	if (find ? (lua_toboolean(L, 4) || nospecials(p, lp)) : isliteral(p, lp))
 	{
 		/* do a plain search */
 		const char *s2 = lmemfind(s + init, ls - init, p, lp);
 		if (s2)
 		{
+			if (!find)
+			{
+				lua_pushlstring(L, s2, lp); /* the whole match */
+				return 1;
+			}
 			lua_pushinteger(L, (s2 - s) + 1);
 			lua_pushinteger(L, (s2 - s) + lp);
 			return 2;
@@ -824,6 +1535,7 @@ static int str_find_aux(lua_State *L, int find)
 	else
 	{
 		MatchState ms;
+		const Pattern *pt;
 		const char *s1 = s + init;
 		int anchor = (*p == '^');
 		if (anchor)
@@ -831,12 +1543,13 @@ static int str_find_aux(lua_State *L, int find)
 			p++;
 			lp--; /* skip anchor character */
 		}
-		prepstate(&ms, L, s, ls, p, lp);
+		pt = getpattern(L, 2, p, lp, 0);
+		prepstate(&ms, L, s, ls, pt);
 		do
 		{
 			const char *res;
 			reprepstate(&ms);
-			if ((res = match(&ms, s1, p)) != NULL)
+			if ((res = match(&ms, s1, pt->items)) != NULL)
 			{
 				if (find)
 				{
@@ -870,7 +1583,9 @@ static int str_match(lua_State *L)
 typedef struct GMatchState
 {
 	const char *src; /* current position */
-	const char *p; /* pattern */
+	const PatItem *p; /* compiled pattern */
+	const char *lit; /* pattern, if it is a non-empty literal; else NULL */
+	size_t llit; /* length of 'lit' */
 	const char *lastmatch; /* end of last match */
 	MatchState ms; /* match state */
 } GMatchState;
@@ -884,6 +1599,11 @@ static int gmatch_aux(lua_State *L)
 	for (src = gm->src; src <= gm->ms.src_end; src++)
 	{
 		const char *e;
+		if (gm->lit != NULL) /* skip to next occurrence of literal */
+		{
+			src = lmemfind(src, gm->ms.src_end - src, gm->lit, gm->llit);
+			if (src == NULL) break;
+		}
 		reprepstate(&gm->ms);
 		if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch)
 		{
@@ -902,15 +1622,19 @@ static int gmatch(lua_State *L)
 	const char *p = luaL_checklstring(L, 2, &lp);
 	size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
 	GMatchState *gm;
+	const Pattern *pt;
 	lua_settop(L, 2); /* keep strings on closure to avoid being collected */
 	gm = (GMatchState *) lua_newuserdatauv(L, sizeof(GMatchState), 0);
 	if (init > ls) /* start after string's end? */
 		init = ls + 1; /* avoid overflows in 's + init' */
-	prepstate(&gm->ms, L, s, ls, p, lp);
+	pt = getpattern(L, 2, p, lp, 1); /* also kept on closure */
+	prepstate(&gm->ms, L, s, ls, pt);
 	gm->src = s + init;
-	gm->p = p;
+	gm->p = pt->items;
+	gm->lit = (lp > 0 && isliteral(p, lp)) ? p : NULL;
+	gm->llit = lp;
 	gm->lastmatch = NULL;
-	lua_pushcclosure(L, gmatch_aux, 3);
+	lua_pushcclosure(L, gmatch_aux, 4);
 	return 1;
 }
 
@@ -1007,25 +1731,36 @@ static int str_gsub(lua_State *L)
 	int tr = lua_type(L, 3); /* replacement type */
 	lua_Integer max_s = luaL_optinteger(L, 4, srcl + 1); /* max replacements */
 	int anchor = (*p == '^');
+	int plain; /* pattern is a non-empty literal (and not anchored)? */
 	lua_Integer n = 0; /* replacement count */
 	int changed = 0; /* change flag */
 	MatchState ms;
+	const Pattern *pt;
 	luaL_Buffer b;
 	luaL_argexpected(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
 							tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
 							"string/function/table");
-	luaL_buffinit(L, &b);
 	if (anchor)
 	{
 		p++;
 		lp--; /* skip anchor character */
 	}
-	prepstate(&ms, L, src, srcl, p, lp);
+	pt = getpattern(L, 2, p, lp, tr == LUA_TFUNCTION || tr == LUA_TTABLE);
+	plain = !anchor && lp > 0 && isliteral(p, lp);
+	luaL_buffinit(L, &b);
+	prepstate(&ms, L, src, srcl, pt);
 	while (n < max_s)
 	{
 		const char *e;
+		if (plain) /* skip to next occurrence of literal */
+		{
+			const char *next = lmemfind(src, ms.src_end - src, p, lp);
+			if (next == NULL) break;
+			luaL_addlstring(&b, src, next - src);
+			src = next;
+		}
 		reprepstate(&ms); /* (re)prepare state for new match */
-		if ((e = match(&ms, src, p)) != NULL && e != lastmatch)
+		if ((e = match(&ms, src, pt->items)) != NULL && e != lastmatch)
 		{
 			/* match? */
 			n++;
@@ -2068,7 +2803,10 @@ static void createmetatable(lua_State *L)
 */
 LUAMOD_API int luaopen_string(lua_State *L)
 {
-	luaL_newlib(L, strlib);
+	luaL_checkversion(L);
+	luaL_newlibtable(L, strlib);
+	newpattcache(L);
+	luaL_setfuncs(L, strlib, 1); /* functions share the pattern cache */
 	createmetatable(L);
 	return 1;
 }
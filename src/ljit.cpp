@@ -0,0 +1,653 @@
+/*
+** $Id: ljit.c $
+** Baseline JIT compiler (x86-64)
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+
+#if defined(LUA_USE_JIT)
+
+#if defined(LUA_USE_NANBOX)
+#error "the JIT compiler assumes the default 'TValue' layout"
+#endif
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lua.hpp"
+
+#include "ldebug.hpp"
+#include "lfunc.hpp"
+#include "ljit.hpp"
+#include "lmem.hpp"
+#include "lobject.hpp"
+#include "lopcodes.hpp"
+#include "lstate.hpp"
+
+
+/*
+** The compiler stitches together fixed machine-code templates, one per
+** bytecode instruction, patching register offsets, constants and jump
+** displacements into their holes. Native code runs only instructions
+** that cannot raise errors, call functions, allocate memory or yield;
+** any other instruction (or a failed type guard) makes it return the
+** index of the instruction where the interpreter must resume. So, a
+** native frame never lives across a call, an error or a yield, and
+** hooks are handled by the interpreter: native code is only entered
+** without hooks, and every backward jump returns to the interpreter
+** if hooks were set in the meantime.
+**
+** Native code is called as
+**   int f (StackValue *base, const TValue *k, lua_State *L, LClosure *cl)
+** so that, following the System V ABI, rdi = base, rsi = k, rdx = L and
+** rcx = cl. It uses only caller-saved registers and no stack, so the
+** code of any instruction can be used as an entry point.
+*/
+typedef int (*JitFunction) (StackValue *base, const TValue *k,
+                            lua_State *L, LClosure *cl);
+
+
+/* sizes of the objects handled by the templates */
+static_assert(sizeof(StackValue) == 16 && sizeof(TValue) == 16,
+              "unexpected layout of TValue");
+
+
+/* memory offset of the value and the tag of register/constant 'r' */
+#define OV(r)	(cast_int(r) * 16 + cast_int(offsetof(TValue, value_)))
+#define OT(r)	(cast_int(r) * 16 + cast_int(offsetof(TValue, tt_)))
+
+
+/* x86-64 base registers of register and constant operands */
+#define RBASE	0x87	/* [rdi + disp32] */
+#define RK	0x86	/* [rsi + disp32] */
+
+
+/* condition codes (low nibble of Jcc opcodes) */
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+
+/* negation of a condition code */
+#define negcc(cc)	((cc) ^ 1)
+
+
+/* mark for labels of instructions that are not compiled */
+#define NOENTRY		0x80000000u
+
+
+typedef struct JitState
+{
+	lu_byte *code; /* output buffer (NULL when only measuring) */
+	size_t pc; /* current offset in the output */
+	unsigned int *label; /* offset of the code for each instruction */
+	int ninstr; /* number of instructions */
+	int idx; /* index of the instruction being compiled */
+} JitState;
+
+
+/*
+** {==================================================================
+** Emission of machine code
+** ===================================================================
+*/
+
+static void emit(JitState *J, const char *b, int n)
+{
+	if (J->code != NULL)
+		memcpy(J->code + J->pc, b, n);
+	J->pc += n;
+}
+
+
+static void emitb(JitState *J, int b)
+{
+	if (J->code != NULL)
+		J->code[J->pc] = cast_byte(b);
+	J->pc++;
+}
+
+
+static void emit32(JitState *J, l_uint32 v)
+{
+	if (J->code != NULL)
+		memcpy(J->code + J->pc, &v, sizeof(v));
+	J->pc += sizeof(v);
+}
+
+
+static void emit64(JitState *J, lua_Unsigned v)
+{
+	if (J->code != NULL)
+		memcpy(J->code + J->pc, &v, sizeof(v));
+	J->pc += sizeof(v);
+}
+
+
+/* rel32 displacement to the code of instruction 'target' */
+static void emitrel(JitState *J, int target)
+{
+	lua_assert(0 <= target && target < J->ninstr);
+	emit32(J, cast(l_uint32, (J->label[target] & ~NOENTRY) - (J->pc + 4)));
+}
+
+
+/*
+** Local forward jumps inside a template: 'emitfwd' emits a jump with
+** condition code 'cc' (or an unconditional one, if 'cc' is -1) and
+** returns the position of its displacement, to be fixed by 'patchhere'
+** when the code for the destination is reached.
+*/
+static size_t emitfwd(JitState *J, int cc)
+{
+	if (cc < 0)
+		emitb(J, 0xE9);
+	else
+	{
+		emitb(J, 0x0F);
+		emitb(J, 0x80 | cc);
+	}
+	emit32(J, 0);
+	return J->pc - 4;
+}
+
+
+static void patchhere(JitState *J, size_t pos)
+{
+	if (J->code != NULL)
+	{
+		l_uint32 rel = cast(l_uint32, J->pc - (pos + 4));
+		memcpy(J->code + pos, &rel, sizeof(rel));
+	}
+}
+
+
+/* 'opcode' with a [base + disp32] memory operand */
+static void emitmem(JitState *J, const char *opcode, int n, int base, int disp)
+{
+	emit(J, opcode, n);
+	emitb(J, base);
+	emit32(J, cast(l_uint32, disp));
+}
+
+
+/* mov eax, idx; ret */
+static void emitexit(JitState *J, int idx)
+{
+	emitb(J, 0xB8);
+	emit32(J, cast(l_uint32, idx));
+	emitb(J, 0xC3);
+}
+
+
+/* cmp byte [base + disp], tag; jne <fixup> */
+static size_t emitguard(JitState *J, int base, int disp, int tag)
+{
+	emitmem(J, "\x80", 1, base + 0x38, disp); /* cmp byte [m], imm8 */
+	emitb(J, tag);
+	return emitfwd(J, CC_NE);
+}
+
+
+/*
+** Jump to instruction 'target', with condition code 'cc' (or always,
+** if 'cc' is -1). Backward jumps first check whether hooks were set,
+** so that loops give control back to the interpreter.
+*/
+static void emitjump(JitState *J, int cc, int target)
+{
+	if (target > J->idx)
+	{
+		/* forward jump */
+		if (cc < 0)
+			emitb(J, 0xE9);
+		else
+		{
+			emitb(J, 0x0F);
+			emitb(J, 0x80 | cc);
+		}
+		emitrel(J, target);
+	}
+	else
+	{
+		/* backward jump */
+		size_t skip = 0;
+		if (cc >= 0)
+			skip = emitfwd(J, negcc(cc)); /* skip it if condition is false */
+		emitmem(J, "\x8B", 1, 0x82, offsetof(lua_State, hookmask)); /* mov eax, [rdx+d] */
+		emit(J, "\x85\xC0", 2); /* test eax, eax */
+		emit(J, "\x0F\x84", 2); /* jz rel32 */
+		emitrel(J, target);
+		emitexit(J, target); /* hooks are on: continue in the interpreter */
+		if (cc >= 0)
+			patchhere(J, skip);
+	}
+}
+
+
+/* R[A] := value/tag from [base + disp] */
+static void emitcopy(JitState *J, int a, int base, int disp)
+{
+	emitmem(J, "\x48\x8B", 2, base, disp); /* mov rax, [m] */
+	emitmem(J, "\x48\x89", 2, RBASE, OV(a)); /* mov [R[A]], rax */
+	emitmem(J, "\x44\x0F\xB6", 3, base + 8, disp + 8); /* movzx r9d, byte [m+8] */
+	emitmem(J, "\x44\x88", 2, RBASE + 8, OT(a)); /* mov [tag of R[A]], r9b */
+}
+
+
+/* set tag of R[A] to 'tag' */
+static void emitsettag(JitState *J, int a, int tag)
+{
+	emitmem(J, "\xC6", 1, RBASE, OT(a));
+	emitb(J, tag);
+}
+
+
+/* R[A] := 64-bit constant 'v' with tag 'tag' */
+static void emitloadimm(JitState *J, int a, lua_Unsigned v, int tag)
+{
+	emit(J, "\x48\xB8", 2); /* mov rax, imm64 */
+	emit64(J, v);
+	emitmem(J, "\x48\x89", 2, RBASE, OV(a));
+	emitsettag(J, a, tag);
+}
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Templates
+** ===================================================================
+*/
+
+/* integer and float opcodes for ADD, SUB and MUL */
+static const char *const intop[] = {"\x48\x03", "\x48\x2B", "\x48\x0F\xAF"};
+static const int intopsize[] = {2, 2, 3};
+static const char *const fltop[] = {"\xF2\x0F\x58", "\xF2\x0F\x5C", "\xF2\x0F\x59"};
+
+
+/*
+** R[A] := R[B] op <c>, where <c> is at [cbase + cdisp]. On success,
+** continue after the (skipped) metamethod instruction.
+*/
+static void arith(JitState *J, int op, int a, int b, int cbase, int cdisp)
+{
+	size_t notint, exit1, exit2, exit3;
+	notint = emitguard(J, RBASE, OT(b), LUA_VNUMINT);
+	exit1 = emitguard(J, cbase, cdisp + 8, LUA_VNUMINT);
+	emitmem(J, "\x48\x8B", 2, RBASE, OV(b)); /* mov rax, [R[B]] */
+	emitmem(J, intop[op], intopsize[op], cbase, cdisp); /* op rax, [c] */
+	emitmem(J, "\x48\x89", 2, RBASE, OV(a));
+	emitsettag(J, a, LUA_VNUMINT);
+	emitjump(J, -1, J->idx + 2);
+	patchhere(J, notint);
+	exit2 = emitguard(J, RBASE, OT(b), LUA_VNUMFLT);
+	exit3 = emitguard(J, cbase, cdisp + 8, LUA_VNUMFLT);
+	emitmem(J, "\xF2\x0F\x10", 3, RBASE, OV(b)); /* movsd xmm0, [R[B]] */
+	emitmem(J, fltop[op], 3, cbase, cdisp); /* op xmm0, [c] */
+	emitmem(J, "\xF2\x0F\x11", 3, RBASE, OV(a)); /* movsd [R[A]], xmm0 */
+	emitsettag(J, a, LUA_VNUMFLT);
+	emitjump(J, -1, J->idx + 2);
+	patchhere(J, exit1); patchhere(J, exit2); patchhere(J, exit3);
+	emitexit(J, J->idx);
+}
+
+
+/* R[A] := R[B] + sC */
+static void arithimm(JitState *J, int a, int b, int sc)
+{
+	lua_Number n = cast_num(sc);
+	lua_Unsigned bits;
+	size_t notint, exit;
+	memcpy(&bits, &n, sizeof(bits));
+	notint = emitguard(J, RBASE, OT(b), LUA_VNUMINT);
+	emitmem(J, "\x48\x8B", 2, RBASE, OV(b)); /* mov rax, [R[B]] */
+	emit(J, "\x48\x05", 2); /* add rax, imm32 */
+	emit32(J, cast(l_uint32, sc));
+	emitmem(J, "\x48\x89", 2, RBASE, OV(a));
+	emitsettag(J, a, LUA_VNUMINT);
+	emitjump(J, -1, J->idx + 2);
+	patchhere(J, notint);
+	exit = emitguard(J, RBASE, OT(b), LUA_VNUMFLT);
+	emit(J, "\x48\xB8", 2); /* mov rax, imm64 */
+	emit64(J, bits);
+	emit(J, "\x66\x48\x0F\x6E\xC8", 5); /* movq xmm1, rax */
+	emitmem(J, "\xF2\x0F\x10", 3, RBASE, OV(b)); /* movsd xmm0, [R[B]] */
+	emit(J, "\xF2\x0F\x58\xC1", 4); /* addsd xmm0, xmm1 */
+	emitmem(J, "\xF2\x0F\x11", 3, RBASE, OV(a));
+	emitsettag(J, a, LUA_VNUMFLT);
+	emitjump(J, -1, J->idx + 2);
+	patchhere(J, exit);
+	emitexit(J, J->idx);
+}
+
+
+/*
+** Conditional jump of a test instruction: when the test result
+** (condition 'cc' of the flags) differs from 'k', skip the next
+** instruction; otherwise do the jump that follows it.
+*/
+static void condjump(JitState *J, int cc, int k, const Instruction *code)
+{
+	int target = J->idx + 2 + GETARG_sJ(code[J->idx + 1]);
+	emitjump(J, k ? cc : negcc(cc), target);
+	emitjump(J, -1, J->idx + 2);
+}
+
+
+/* integer comparisons, with a register or an immediate operand */
+static void compare(JitState *J, Instruction i, const Instruction *code)
+{
+	OpCode op = GET_GENERICOP(i);
+	int a = GETARG_A(i);
+	size_t exit1, exit2 = 0;
+	int cc;
+	exit1 = emitguard(J, RBASE, OT(a), LUA_VNUMINT);
+	if (op == OP_EQ || op == OP_LT || op == OP_LE)
+	{
+		int b = GETARG_B(i);
+		exit2 = emitguard(J, RBASE, OT(b), LUA_VNUMINT);
+		emitmem(J, "\x48\x8B", 2, RBASE, OV(a)); /* mov rax, [R[A]] */
+		emitmem(J, "\x48\x3B", 2, RBASE, OV(b)); /* cmp rax, [R[B]] */
+		cc = (op == OP_EQ) ? CC_E : (op == OP_LT) ? CC_L : CC_LE;
+	}
+	else
+	{
+		emitmem(J, "\x48\x8B", 2, RBASE, OV(a)); /* mov rax, [R[A]] */
+		emit(J, "\x48\x3D", 2); /* cmp rax, imm32 */
+		emit32(J, cast(l_uint32, GETARG_sB(i)));
+		switch (op)
+		{
+			case OP_EQI: cc = CC_E; break;
+			case OP_LTI: cc = CC_L; break;
+			case OP_LEI: cc = CC_LE; break;
+			case OP_GTI: cc = CC_G; break;
+			default: lua_assert(op == OP_GEI); cc = CC_GE; break;
+		}
+	}
+	condjump(J, cc, GETARG_k(i), code);
+	patchhere(J, exit1);
+	if (exit2 != 0)
+		patchhere(J, exit2);
+	emitexit(J, J->idx);
+}
+
+
+/*
+** Float order comparisons. Operands are swapped (b > a, b >= a) so that
+** 'ucomisd' with a NaN makes them false.
+*/
+static void comparefloat(JitState *J, Instruction i, const Instruction *code)
+{
+	int a = GETARG_A(i);
+	int b = GETARG_B(i);
+	size_t exit1, exit2;
+	exit1 = emitguard(J, RBASE, OT(a), LUA_VNUMFLT);
+	exit2 = emitguard(J, RBASE, OT(b), LUA_VNUMFLT);
+	emitmem(J, "\xF2\x0F\x10", 3, RBASE, OV(b)); /* movsd xmm0, [R[B]] */
+	emitmem(J, "\x66\x0F\x2E", 3, RBASE, OV(a)); /* ucomisd xmm0, [R[A]] */
+	condjump(J, (GET_GENERICOP(i) == OP_LT) ? CC_A : CC_AE, GETARG_k(i), code);
+	patchhere(J, exit1); patchhere(J, exit2);
+	emitexit(J, J->idx);
+}
+
+
+/* LT/LE over registers: integer template, falling back to floats */
+static void order(JitState *J, Instruction i, const Instruction *code)
+{
+	size_t notint = emitguard(J, RBASE, OT(GETARG_A(i)), LUA_VNUMINT);
+	compare(J, i, code);
+	patchhere(J, notint);
+	comparefloat(J, i, code);
+}
+
+
+/* TEST: a value is false iff its tag is LUA_VFALSE or a nil variant */
+static void test(JitState *J, Instruction i, const Instruction *code)
+{
+	int target = J->idx + 2 + GETARG_sJ(code[J->idx + 1]);
+	int k = GETARG_k(i);
+	size_t isfalse1, isfalse2;
+	emitmem(J, "\x44\x0F\xB6", 3, RBASE + 8, OT(GETARG_A(i))); /* movzx r9d, tag */
+	emit(J, "\x41\x83\xF9", 3); /* cmp r9d, imm8 */
+	emitb(J, LUA_VFALSE);
+	isfalse1 = emitfwd(J, CC_E);
+	emit(J, "\x41\xF6\xC1\x0F", 4); /* test r9b, 0x0F */
+	isfalse2 = emitfwd(J, CC_E);
+	/* value is true: jump if 'k' */
+	emitjump(J, -1, k ? target : J->idx + 2);
+	patchhere(J, isfalse1); patchhere(J, isfalse2);
+	/* value is false: jump if not 'k' */
+	emitjump(J, -1, k ? J->idx + 2 : target);
+}
+
+
+/* integer loops; float loops go back to the interpreter */
+static void forloop(JitState *J, Instruction i)
+{
+	int a = GETARG_A(i);
+	size_t exit = emitguard(J, RBASE, OT(a + 2), LUA_VNUMINT);
+	emitmem(J, "\x48\x8B", 2, RBASE, OV(a + 1)); /* mov rax, count */
+	emit(J, "\x48\x85\xC0", 3); /* test rax, rax */
+	emitjump(J, CC_E, J->idx + 1); /* loop is over */
+	emit(J, "\x48\xFF\xC8", 3); /* dec rax */
+	emitmem(J, "\x48\x89", 2, RBASE, OV(a + 1)); /* update counter */
+	emitmem(J, "\x48\x8B", 2, RBASE, OV(a)); /* mov rax, idx */
+	emitmem(J, "\x48\x03", 2, RBASE, OV(a + 2)); /* add rax, step */
+	emitmem(J, "\x48\x89", 2, RBASE, OV(a)); /* update internal index */
+	emitmem(J, "\x48\x89", 2, RBASE, OV(a + 3)); /* and control variable */
+	emitsettag(J, a + 3, LUA_VNUMINT);
+	emitjump(J, -1, J->idx + 1 - GETARG_Bx(i));
+	patchhere(J, exit);
+	emitexit(J, J->idx);
+}
+
+
+/*
+** Emit the code for instruction 'idx'. Returns true if the instruction
+** was compiled, false if its code only returns to the interpreter.
+*/
+static int compileinstr(JitState *J, const Proto *p, LClosure *cl)
+{
+	const Instruction *code = p->code;
+	Instruction i = code[J->idx];
+	int a = GETARG_A(i);
+	UNUSED(cl);
+	switch (GET_GENERICOP(i))
+	{
+		case OP_MOVE:
+			emitcopy(J, a, RBASE, OV(GETARG_B(i)));
+			return 1;
+		case OP_LOADI:
+			emitloadimm(J, a, l_castS2U(GETARG_sBx(i)), LUA_VNUMINT);
+			return 1;
+		case OP_LOADF: {
+			lua_Number n = cast_num(GETARG_sBx(i));
+			lua_Unsigned bits;
+			memcpy(&bits, &n, sizeof(bits));
+			emitloadimm(J, a, bits, LUA_VNUMFLT);
+			return 1;
+		}
+		case OP_LOADK:
+			emitcopy(J, a, RK, OV(GETARG_Bx(i)));
+			return 1;
+		case OP_LOADFALSE:
+			emitsettag(J, a, LUA_VFALSE);
+			return 1;
+		case OP_LOADTRUE:
+			emitsettag(J, a, LUA_VTRUE);
+			return 1;
+		case OP_LOADNIL: {
+			int b = GETARG_B(i);
+			do
+			{
+				emitsettag(J, a++, LUA_VNIL);
+			} while (b--);
+			return 1;
+		}
+		case OP_GETUPVAL: {
+			int b = GETARG_B(i);
+			/* mov rax, cl->upvals[b]; mov rax, uv->v.p */
+			emitmem(J, "\x48\x8B", 2, 0x81,
+			        cast_int(offsetof(LClosure, upvals) + b * sizeof(UpVal *)));
+			emitmem(J, "\x48\x8B", 2, 0x80, cast_int(offsetof(UpVal, v)));
+			emit(J, "\x4C\x8B\x10", 3); /* mov r10, [rax] */
+			emitmem(J, "\x4C\x89", 2, RBASE + 0x10, OV(a)); /* mov [R[A]], r10 */
+			emit(J, "\x44\x0F\xB6\x48", 4); /* movzx r9d, byte [rax+tt] */
+			emitb(J, cast_int(offsetof(TValue, tt_)));
+			emitmem(J, "\x44\x88", 2, RBASE + 8, OT(a));
+			return 1;
+		}
+		case OP_ADD: case OP_SUB: case OP_MUL: {
+			int op = GET_GENERICOP(i) - OP_ADD;
+			arith(J, op, a, GETARG_B(i), RBASE, OV(GETARG_C(i)));
+			return 1;
+		}
+		case OP_ADDK: case OP_SUBK: case OP_MULK: {
+			int op = GET_GENERICOP(i) - OP_ADDK;
+			arith(J, op, a, GETARG_B(i), RK, OV(GETARG_C(i)));
+			return 1;
+		}
+		case OP_ADDI:
+			arithimm(J, a, GETARG_B(i), GETARG_sC(i));
+			return 1;
+		case OP_LT: case OP_LE:
+			order(J, i, code);
+			return 1;
+		case OP_EQ: case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+			compare(J, i, code);
+			return 1;
+		case OP_TEST:
+			test(J, i, code);
+			return 1;
+		case OP_JMP:
+			emitjump(J, -1, J->idx + 1 + GETARG_sJ(i));
+			return 1;
+		case OP_FORLOOP:
+			forloop(J, i);
+			return 1;
+		default:
+			emitexit(J, J->idx);
+			return 0;
+	}
+}
+
+/* }================================================================== */
+
+
+/*
+** Compile the whole function: a first pass only measures the code (to
+** fix the offset of each instruction); the second one emits it.
+*/
+static JitCode *compile(lua_State *L, Proto *p, LClosure *cl)
+{
+	JitState J;
+	JitCode *jc;
+	lu_byte *mcode;
+	int n = p->sizecode;
+	int ncompiled = 0;
+	int pass;
+	jc = cast(JitCode *, luaM::malloc_(L, sizeof(JitCode) + n * sizeof(unsigned int), 0));
+	jc->entry = cast(unsigned int *, jc + 1);
+	jc->sizeentry = n;
+	J.label = jc->entry;
+	J.ninstr = n;
+	J.code = NULL;
+	for (pass = 0; pass < 2; pass++)
+	{
+		J.pc = 1; /* offset 0 is never an entry point */
+		for (J.idx = 0; J.idx < n; J.idx++)
+		{
+			unsigned int start = cast_uint(J.pc);
+			lua_assert(J.code == NULL || (J.label[J.idx] & ~NOENTRY) == start);
+			J.label[J.idx] = start;
+			if (compileinstr(&J, p, cl))
+				ncompiled++;
+			else
+				J.label[J.idx] |= NOENTRY;
+		}
+		if (pass == 0)
+		{
+			if (ncompiled == 0)
+				break; /* nothing worth compiling */
+			mcode = cast(lu_byte *, mmap(NULL, J.pc, PROT_READ | PROT_WRITE,
+			                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+			if (mcode == MAP_FAILED)
+				break;
+			jc->mcode = mcode;
+			jc->size = J.pc;
+			J.code = mcode;
+			J.code[0] = 0xCC; /* int3 */
+		}
+	}
+	if (J.code == NULL)
+	{
+		/* could not compile */
+		luaM::free_(L, jc, sizeof(JitCode) + n * sizeof(unsigned int));
+		return NULL;
+	}
+	if (mprotect(jc->mcode, jc->size, PROT_READ | PROT_EXEC) != 0)
+	{
+		munmap(jc->mcode, jc->size);
+		luaM::free_(L, jc, sizeof(JitCode) + n * sizeof(unsigned int));
+		return NULL;
+	}
+	/* keep entry points only for instructions with real code */
+	for (J.idx = 0; J.idx < n; J.idx++)
+	{
+		if (jc->entry[J.idx] & NOENTRY)
+			jc->entry[J.idx] = 0;
+	}
+	return jc;
+}
+
+
+/*
+** Called by the interpreter, at calls and backward jumps of a hot
+** function, to run native code from 'pc'. Returns where the
+** interpreter must continue.
+*/
+const Instruction *luaJ::enter(lua_State *L, LClosure *cl, StkId base,
+                               const Instruction *pc)
+{
+	Proto *p = cl->p;
+	unsigned int entry;
+	if (p->jit == NULL)
+	{
+		p->jit = compile(L, p, cl);
+		if (p->jit == NULL)
+			return pc; /* not compiled; 'jitcount' keeps it from retrying */
+	}
+	entry = p->jit->entry[pc - p->code];
+	if (entry == 0)
+		return pc;
+	JitFunction f = cast(JitFunction, p->jit->mcode + entry);
+	return p->code + f(base, p->k, L, cl);
+}
+
+
+void luaJ::freecode(lua_State *L, Proto *f)
+{
+	JitCode *jc = f->jit;
+	if (jc != NULL)
+	{
+		munmap(jc->mcode, jc->size);
+		luaM::free_(L, jc, sizeof(JitCode) + jc->sizeentry * sizeof(unsigned int));
+		f->jit = NULL;
+	}
+}
+
+#endif
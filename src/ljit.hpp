@@ -0,0 +1,56 @@
+/*
+** $Id: ljit.h $
+** Baseline JIT compiler (x86-64)
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.hpp"
+
+
+#if defined(LUA_USE_JIT)
+
+#if !(defined(__x86_64__) && defined(__linux__))
+#error "the baseline JIT only supports x86-64 Linux"
+#endif
+
+
+/*
+** Number of calls plus backward jumps after which a function is
+** compiled to native code.
+*/
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT	1000
+#endif
+
+
+/*
+** Native code of a prototype. 'entry[i]' is the offset in 'mcode' of
+** the code for instruction 'i', or 0 if that instruction is not
+** compiled (its code only returns to the interpreter).
+*/
+typedef struct JitCode
+{
+	lu_byte *mcode; /* executable memory */
+	size_t size; /* size of 'mcode' */
+	unsigned int *entry; /* entry points (size 'sizecode') */
+	int sizeentry;
+} JitCode;
+
+
+/* count a call or back edge of 'p'; true if it has (or needs) native code */
+#define luaJ_ishot(p)	((p)->jit != NULL || \
+	((p)->jitcount < LUAI_JITHOT && ++(p)->jitcount == LUAI_JITHOT))
+
+
+namespace luaJ {
+LUAI_FUNC const Instruction *enter (lua_State *L, LClosure *cl, StkId base,
+                                     const Instruction *pc);
+LUAI_FUNC void freecode (lua_State *L, Proto *f);
+}
+
+#endif
+
+#endif
@@ -8,13 +8,16 @@
 #undef vmdispatch
 #undef vmcase
 #undef vmbreak
+#undef vmselect
 
-#define vmdispatch(x)     goto *disptab[x];
+#define vmdispatch(x)     goto *disp[x];
 
 #define vmcase(l)     L_##l:
 
 #define vmbreak		vmfetch(); vmdispatch(GET_OPCODE(i));
 
+#define vmselect()	(disp = G(L)->typeprofile ? proftab : disptab)
+
 
 static const void *const disptab[NUM_OPCODES] = {
 
@@ -100,6 +103,135 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_CLOSURE,
 &&L_OP_VARARG,
 &&L_OP_VARARGPREP,
-&&L_OP_EXTRAARG
+&&L_OP_EXTRAARG,
+&&L_OP_ADDII,
+&&L_OP_ADDFF,
+&&L_OP_SUBII,
+&&L_OP_SUBFF,
+&&L_OP_MULII,
+&&L_OP_MULFF,
+&&L_OP_EQII,
+&&L_OP_EQFF,
+&&L_OP_LTII,
+&&L_OP_LTFF,
+&&L_OP_LEII,
+&&L_OP_LEFF,
+&&L_OP_GETTABUPFIELD,
+&&L_OP_GETUPVALFIELD,
+&&L_OP_GETFIELDCALL,
+&&L_OP_LOADKSETFIELD
 
 };
+
+
+/*
+** Dispatch table used while collecting type feedback: profiled opcodes
+** go first to a 'P_' label that records the types of their operands
+** (grouped by operand layout) and then to their regular handler.
+*/
+static const void *const proftab[NUM_OPCODES] = {
+
+&&L_OP_MOVE,
+&&L_OP_LOADI,
+&&L_OP_LOADF,
+&&L_OP_LOADK,
+&&L_OP_LOADKX,
+&&L_OP_LOADFALSE,
+&&L_OP_LFALSESKIP,
+&&L_OP_LOADTRUE,
+&&L_OP_LOADNIL,
+&&L_OP_GETUPVAL,
+&&L_OP_SETUPVAL,
+&&P_UB,
+&&P_BC,
+&&P_B,
+&&P_B,
+&&P_UA,
+&&P_AB,
+&&P_A,
+&&P_A,
+&&L_OP_NEWTABLE,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_B,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&L_OP_MMBIN,
+&&L_OP_MMBINI,
+&&L_OP_MMBINK,
+&&P_B,
+&&P_B,
+&&L_OP_NOT,
+&&P_B,
+&&L_OP_CONCAT,
+&&L_OP_CLOSE,
+&&L_OP_TBC,
+&&L_OP_JMP,
+&&P_AB,
+&&P_AB,
+&&P_AB,
+&&L_OP_EQK,
+&&L_OP_EQI,
+&&L_OP_LTI,
+&&L_OP_LEI,
+&&L_OP_GTI,
+&&L_OP_GEI,
+&&L_OP_TEST,
+&&L_OP_TESTSET,
+&&P_A,
+&&P_A,
+&&L_OP_RETURN,
+&&L_OP_RETURN0,
+&&L_OP_RETURN1,
+&&L_OP_FORLOOP,
+&&L_OP_FORPREP,
+&&L_OP_TFORPREP,
+&&L_OP_TFORCALL,
+&&L_OP_TFORLOOP,
+&&L_OP_SETLIST,
+&&L_OP_CLOSURE,
+&&L_OP_VARARG,
+&&L_OP_VARARGPREP,
+&&L_OP_EXTRAARG,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_BC,
+&&P_AB,
+&&P_AB,
+&&P_AB,
+&&P_AB,
+&&P_AB,
+&&P_AB,
+&&P_FUSED,
+&&P_FUSED,
+&&P_FUSED,
+&&P_FUSED
+
+};
+
+/* current dispatch table (selected on function entry) */
+const void *const *disp = disptab;
@@ -259,7 +259,7 @@ static int read_numeral(LexState *ls, SemInfo *seminfo)
 	if (lislalpha(ls->current)) /* is numeral touching a letter? */
 		save_and_next(ls); /* force an error */
 	save(ls, '\0');
-	if (luaO_str2num(ls->buff->getbuffer(), &obj) == 0) /* format error? */
+	if (luaO_str2num(ls->L, ls->buff->getbuffer(), &obj) == 0) /* format error? */
 		lexerror(ls, "malformed number", TK_FLT);
 	if (ttisinteger(&obj))
 	{
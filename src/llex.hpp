@@ -109,6 +109,7 @@ struct LexState
 	struct Dyndata *dyd; /* dynamic structures used by the parser */
 	TString *source; /* current source name */
 	TString *envn; /* environment variable name */
+	int optimize; /* run the optimizer over each function */
 
 	auto next () -> void
 	{
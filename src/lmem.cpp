@@ -17,6 +17,7 @@
 #include "ldebug.hpp"
 #include "ldo.hpp"
 #include "lgc.hpp"
+#include "lgcpar.hpp"
 #include "lmem.hpp"
 #include "lobject.hpp"
 #include "lstate.hpp"
@@ -151,6 +152,11 @@ void luaM::free_(lua_State *L, void *block, size_t osize)
 {
 	global_State *g = G(L);
 	lua_assert((osize == 0) == (block == NULL));
+#if defined(LUA_USE_PARALLELMARK)
+	if (g->gcfreeing) /* freeing a dead object in a sweep? */
+		luaC_deferfree(g, block, osize); /* let the background thread do it */
+	else
+#endif
 	callfrealloc(g, block, osize, 0);
 	g->GCdebt -= osize;
 }
@@ -167,6 +173,9 @@ static void *tryagain(lua_State *L, void *block,
 	if (cantryagain(g))
 	{
 		luaC_fullgc(L, 1); /* try to free some memory... */
+#if defined(LUA_USE_PARALLELMARK)
+		luaC_syncfree(g); /* ...and wait until it is really free */
+#endif
 		return callfrealloc(g, block, osize, nsize); /* try again */
 	}
 	else return NULL; /* cannot run an emergency collection */
@@ -23,6 +23,7 @@
 #include "ldebug.hpp"
 #include "ldo.hpp"
 #include "lmem.hpp"
+#include "lgc.hpp"
 #include "lobject.hpp"
 #include "lstate.hpp"
 #include "lstring.hpp"
@@ -116,7 +117,7 @@ int luaO_rawarith(lua_State *L, int op, const TValue *p1, const TValue *p2,
 			lua_Integer i2;
 			if (tointegerns(p1, &i1) && tointegerns(p2, &i2))
 			{
-				setivalue(res, intarith(L, op, i1, i2));
+				setivalue(L, res, intarith(L, op, i1, i2));
 				return 1;
 			}
 			else return 0; /* fail */
@@ -140,7 +141,7 @@ int luaO_rawarith(lua_State *L, int op, const TValue *p1, const TValue *p2,
 			lua_Number n2;
 			if (ttisinteger(p1) && ttisinteger(p2))
 			{
-				setivalue(res, intarith(L, op, ivalue(p1), ivalue(p2)));
+				setivalue(L, res, intarith(L, op, ivalue(p1), ivalue(p2)));
 				return 1;
 			}
 			if (tonumberns(p1, n1) && tonumberns(p2, n2))
@@ -364,7 +365,11 @@ static const char *l_str2int(const char *s, lua_Integer *result)
 }
 
 
-size_t luaO_str2num(const char *s, TValue *o)
+#if defined(LUA_USE_NANBOX)
+size_t luaO_str2num(lua_State *L, const char *s, TValue *o)
+#else
+size_t luaO_str2num_(const char *s, TValue *o) /* 'setivalue' ignores 'L' */
+#endif
 {
 	lua_Integer i;
 	lua_Number n;
@@ -372,7 +377,7 @@ size_t luaO_str2num(const char *s, TValue *o)
 	if ((e = l_str2int(s, &i)) != NULL)
 	{
 		/* try as an integer */
-		setivalue(o, i);
+		setivalue(L, o, i);
 	}
 	else if ((e = l_str2d(s, &n)) != NULL)
 	{
@@ -385,6 +390,26 @@ size_t luaO_str2num(const char *s, TValue *o)
 }
 
 
+#if defined(LUA_USE_NANBOX)
+
+/*
+** Put into 'obj' an integer too large for a NaN-box payload, boxed in a
+** new 'IntBox'. The box is anchored in 'lastintbox' until the next one
+** is created, so that it survives a collection while it is only in a
+** C variable (e.g., an emergency collection triggered by the next
+** allocation).
+*/
+void luaO_boxint(lua_State *L, TValue *obj, lua_Integer i)
+{
+	GCObject *o = luaC_newobj(L, LUA_VNUMINT, sizeof(IntBox));
+	gco2ib(o)->i = i;
+	G(L)->lastintbox = o;
+	val_(obj) = nbptrbox(NBGCO, o);
+}
+
+#endif
+
+
 int luaO_utf8esc(char *buff, unsigned long x)
 {
 	int n = 1; /* number of bytes put in buffer (backwards) */
@@ -589,14 +614,14 @@ const char *luaO_pushvfstring(lua_State *L, const char *fmt, va_list argp)
 			case 'd': {
 				/* an 'int' */
 				TValue num;
-				setivalue(&num, va_arg(argp, int));
+				setivalue(L, &num, va_arg(argp, int));
 				addnum2buff(&buff, &num);
 				break;
 			}
 			case 'I': {
 				/* a 'lua_Integer' */
 				TValue num;
-				setivalue(&num, cast(lua_Integer, va_arg(argp, l_uacInt)));
+				setivalue(L, &num, cast(lua_Integer, va_arg(argp, l_uacInt)));
 				addnum2buff(&buff, &num);
 				break;
 			}
@@ -11,6 +11,11 @@
 
 #include <cstdarg>
 
+#if defined(LUA_USE_NANBOX)
+#include <bit>
+#include <cstdint>
+#endif
+
 
 #include "llimits.hpp"
 #include "lua.hpp"
@@ -65,6 +70,8 @@ union Value
 ** an actual value plus a tag with its type.
 */
 
+#if !defined(LUA_USE_NANBOX)
+
 #define TValuefields	Value value_; lu_byte tt_
 
 typedef struct TValue
@@ -80,6 +87,91 @@ typedef struct TValue
 /* raw type tag of a TValue */
 #define rawtt(o)	((o)->tt_)
 
+#else
+
+/*
+** NaN-boxed Tagged Values: the value and its tag share one 64-bit
+** word. Floats are kept as themselves; every other value is "boxed" in
+** a quiet NaN whose top 16 bits, ignoring the sign, are above 0x7FF8
+** (a NaN arithmetic never produces). Those 16 bits are the box tag
+** (NB* below) and the lower 48 bits are the payload: a pointer, an
+** integer, or the type tag of values without contents (nil and
+** booleans). Box tags of collectable objects have the sign bit set, so
+** that these are the words above all others. Pointers must fit in the
+** payload, as user-space addresses do in x86-64 and AArch64; integers
+** that do not fit in it are kept in collectable boxes ('IntBox').
+*/
+
+static_assert(sizeof(lua_Number) == 8 && sizeof(lua_Integer) == 8 &&
+              sizeof(void *) <= 8, "NaN boxing needs 64-bit numbers");
+
+#define TValuefields	uint64_t value_
+
+typedef struct TValue
+{
+	TValuefields;
+} TValue;
+
+
+#define val_(o)		((o)->value_)
+
+
+#define NBPAYLOADBITS	48
+#define NBPAYLOAD	((cast(uint64_t, 1) << NBPAYLOADBITS) - 1)
+
+/* box tag of word 'w' */
+#define nbtag(w)	cast_uint((w) >> NBPAYLOADBITS)
+
+/* word with box tag 't' and payload 'p' */
+#define nbbox(t,p)	((cast(uint64_t, t) << NBPAYLOADBITS) | ((p) & NBPAYLOAD))
+
+/* word with box tag 't' for pointer 'p' */
+#define nbptrbox(t,p)	nbbox(t, cast(uint64_t, p))
+
+/* box tags of non-collectable values */
+#define NBMISC		0x7FF9	/* nil and booleans (payload is the tag) */
+#define NBINT		0x7FFA	/* integers that fit in the payload */
+#define NBLUD		0x7FFB	/* light userdata */
+#define NBLCF		0x7FFC	/* light C functions */
+#define NBDEADKEY	0x7FFD	/* dead keys (payload is the dead object) */
+
+/* box tags of collectable objects */
+#define NBSHRSTR	0xFFF9
+#define NBLNGSTR	0xFFFA
+#define NBTABLE		0xFFFB
+#define NBLCL		0xFFFC
+#define NBCCL		0xFFFD
+#define NBUDATA		0xFFFE
+#define NBGCO		0xFFFF	/* other objects (threads and 'IntBox'es) */
+
+/* whether word 'w' is a float (that is, not a box) */
+#define nbisfloat(w)	(((w) & ~(cast(uint64_t, 1) << 63)) < nbbox(NBMISC, 0))
+
+
+/*
+** Word for float 'n'. A NaN that looks like a box loses the bits of
+** the box tag below its quiet bit, which keeps it a NaN (and its sign).
+*/
+inline uint64_t nbfloat (lua_Number n)
+{
+	uint64_t w = std::bit_cast<uint64_t>(n);
+	if (l_unlikely(!nbisfloat(w)))
+		w &= ~nbbox(0x7, 0);
+	return w;
+}
+
+
+/* whether integer 'i' fits in a payload */
+#define nbintfits(i)  \
+	((l_castU2S(l_castS2U(i) << (64 - NBPAYLOADBITS)) >> \
+	  (64 - NBPAYLOADBITS)) == (i))
+
+
+/* raw type tag of a TValue (see 'nbrawtt') */
+#define rawtt(o)	nbrawtt(val_(o))
+
+#endif
+
 /* tag with no variants (bits 0-3) */
 #define novariant(t)	((t) & 0x0F)
 
@@ -114,6 +206,8 @@ typedef struct TValue
 
 /* Macros to set values */
 
+#if !defined(LUA_USE_NANBOX)
+
 /* set a value's tag */
 #define settt_(o,t)	((o)->tt_=(t))
 
@@ -124,6 +218,20 @@ typedef struct TValue
           io1->value_ = io2->value_; settt_(io1, io2->tt_); \
 	  checkliveness(L,io1); lua_assert(!isnonstrictnil(io1)); }
 
+#else
+
+/* set a value's tag (only for tags of values without contents) */
+#define settt_(o,t)	(val_(o) = nbbox(NBMISC, t))
+
+
+/* main macro to copy values (from 'obj2' to 'obj1') */
+#define setobj(L,obj1,obj2) \
+	{ TValue *io1=(obj1); const TValue *io2=(obj2); \
+	  io1->value_ = io2->value_; \
+	  checkliveness(L,io1); lua_assert(!isnonstrictnil(io1)); }
+
+#endif
+
 /*
 ** Different types of assignments, according to source and destination.
 ** (They are mostly equal now, but may be different in the future.)
@@ -141,6 +249,8 @@ typedef struct TValue
 #define setobj2t	setobj
 
 
+#if !defined(LUA_USE_NANBOX)
+
 /*
 ** Entries in a Lua stack. Field 'tbclist' forms a list of all
 ** to-be-closed variables active in this stack. Dummy entries are
@@ -160,6 +270,20 @@ union StackValue
 	} tbclist;
 };
 
+#else
+
+/*
+** Entries in a Lua stack. A NaN-boxed entry has no room for a 'tbclist'
+** delta, so threads keep their list of to-be-closed variables apart
+** (see 'luaF::newtbcupval').
+*/
+union StackValue
+{
+	TValue val;
+};
+
+#endif
+
 
 /* index to stack elements */
 using StkId = StackValue*;
@@ -196,6 +320,8 @@ typedef union
 #define LUA_VABSTKEY	makevariant(LUA_TNIL, 2)
 
 
+#if !defined(LUA_USE_NANBOX)
+
 /* macro to test for (any kind of) nil */
 #define ttisnil(v)		checktype((v), LUA_TNIL)
 
@@ -204,10 +330,25 @@ typedef union
 #define ttisstrictnil(o)	checktag((o), LUA_VNIL)
 
 
-#define setnilvalue(obj) settt_(obj, LUA_VNIL)
+#define isabstkey(v)		checktag((v), LUA_VABSTKEY)
 
+#else
+
+/* macro to test for (any kind of) nil (ignoring the variant bits) */
+#define ttisnil(v)  \
+	((val_(v) & ~cast(uint64_t, makevariant(0, 3))) == nbbox(NBMISC, LUA_TNIL))
 
-#define isabstkey(v)		checktag((v), LUA_VABSTKEY)
+
+/* macro to test for a standard nil */
+#define ttisstrictnil(o)	(val_(o) == nbbox(NBMISC, LUA_VNIL))
+
+
+#define isabstkey(v)		(val_(v) == nbbox(NBMISC, LUA_VABSTKEY))
+
+#endif
+
+
+#define setnilvalue(obj) settt_(obj, LUA_VNIL)
 
 
 /*
@@ -224,9 +365,21 @@ typedef union
 #define isempty(v)		ttisnil(v)
 
 
+#if !defined(LUA_USE_NANBOX)
+
 /* macro defining a value corresponding to an absent key */
 #define ABSTKEYCONSTANT		{NULL}, LUA_VABSTKEY
 
+/* macro defining an empty value */
+#define EMPTYCONSTANT		{NULL}, LUA_VEMPTY
+
+#else
+
+#define ABSTKEYCONSTANT		nbbox(NBMISC, LUA_VABSTKEY)
+#define EMPTYCONSTANT		nbbox(NBMISC, LUA_VEMPTY)
+
+#endif
+
 
 /* mark an entry as empty */
 #define setempty(v)		settt_(v, LUA_VEMPTY)
@@ -245,9 +398,16 @@ typedef union
 #define LUA_VFALSE	makevariant(LUA_TBOOLEAN, 0)
 #define LUA_VTRUE	makevariant(LUA_TBOOLEAN, 1)
 
+#if !defined(LUA_USE_NANBOX)
 #define ttisboolean(o)		checktype((o), LUA_TBOOLEAN)
 #define ttisfalse(o)		checktag((o), LUA_VFALSE)
 #define ttistrue(o)		checktag((o), LUA_VTRUE)
+#else
+#define ttisboolean(o)  ((val_(o) & ~cast(uint64_t, makevariant(0, 1))) == \
+	nbbox(NBMISC, LUA_TBOOLEAN))
+#define ttisfalse(o)		(val_(o) == nbbox(NBMISC, LUA_VFALSE))
+#define ttistrue(o)		(val_(o) == nbbox(NBMISC, LUA_VTRUE))
+#endif
 
 
 #define l_isfalse(o)	(ttisfalse(o) || ttisnil(o))
@@ -267,6 +427,8 @@ typedef union
 
 #define LUA_VTHREAD		makevariant(LUA_TTHREAD, 0)
 
+#if !defined(LUA_USE_NANBOX)
+
 #define ttisthread(o)		checktag((o), ctb(LUA_VTHREAD))
 
 #define thvalue(o)	check_exp(ttisthread(o), gco2th(val_(o).gc))
@@ -276,6 +438,20 @@ typedef union
     val_(io).gc = obj2gco(x_); settt_(io, ctb(LUA_VTHREAD)); \
     checkliveness(L,io); }
 
+#else
+
+#define ttisthread(o)  \
+	(nbtag(val_(o)) == NBGCO && nbgco(val_(o))->tt == LUA_VTHREAD)
+
+#define thvalue(o)	check_exp(ttisthread(o), gco2th(nbgco(val_(o))))
+
+#define setthvalue(L,obj,x) \
+  { TValue *io = (obj); lua_State *x_ = (x); \
+    val_(io) = nbptrbox(NBGCO, obj2gco(x_)); \
+    checkliveness(L,io); }
+
+#endif
+
 #define setthvalue2s(L,o,t)	setthvalue(L,s2v(o),t)
 
 /* }================================================================== */
@@ -304,11 +480,13 @@ typedef struct GCObject
 /* Bit mark for collectable types */
 constexpr auto BIT_ISCOLLECTABLE =	(1 << 6);
 
-#define iscollectable(o)	(rawtt(o) & BIT_ISCOLLECTABLE)
-
 /* mark a tag as collectable */
 #define ctb(t)			((t) | BIT_ISCOLLECTABLE)
 
+#if !defined(LUA_USE_NANBOX)
+
+#define iscollectable(o)	(rawtt(o) & BIT_ISCOLLECTABLE)
+
 #define gcvalue(o)	check_exp(iscollectable(o), val_(o).gc)
 
 #define gcvalueraw(v)	((v).gc)
@@ -317,6 +495,68 @@ constexpr auto BIT_ISCOLLECTABLE =	(1 << 6);
   { TValue *io = (obj); GCObject *i_g=(x); \
     val_(io).gc = i_g; settt_(io, ctb(i_g->tt)); }
 
+#else
+
+#define iscollectable(o)	(val_(o) >= nbbox(NBSHRSTR, 0))
+
+/* collectable object boxed in word 'w' */
+#define nbgco(w)	cast(GCObject *, (w) & NBPAYLOAD)
+
+#define gcvalue(o)	check_exp(iscollectable(o), nbgco(val_(o)))
+
+#define setgcovalue(L,obj,x) \
+  { TValue *io = (obj); GCObject *i_g=(x); \
+    val_(io) = nbptrbox(nbgctag(i_g->tt), i_g); }
+
+
+/* box tag for a collectable object with type tag 'tt' */
+inline unsigned int nbgctag (lu_byte tt)
+{
+	switch (tt)
+	{
+		case makevariant(LUA_TSTRING, 0): return NBSHRSTR;
+		case makevariant(LUA_TSTRING, 1): return NBLNGSTR;
+		case makevariant(LUA_TTABLE, 0): return NBTABLE;
+		case makevariant(LUA_TFUNCTION, 0): return NBLCL;
+		case makevariant(LUA_TFUNCTION, 2): return NBCCL;
+		case makevariant(LUA_TUSERDATA, 0): return NBUDATA;
+		default: return NBGCO;
+	}
+}
+
+
+/*
+** Type tag of the value in word 'w'. An 'IntBox' gives the tag of the
+** integers (LUA_VNUMINT), so that boxed integers are like any others
+** for the code dispatching on tags; only the collector (which finds
+** them collectable) tells them apart.
+*/
+inline lu_byte nbrawtt (uint64_t w)
+{
+	if (nbisfloat(w))
+		return makevariant(LUA_TNUMBER, 1);
+	switch (nbtag(w))
+	{
+		case NBMISC: return cast_byte(w);
+		case NBINT: return makevariant(LUA_TNUMBER, 0);
+		case NBLUD: return makevariant(LUA_TLIGHTUSERDATA, 0);
+		case NBLCF: return makevariant(LUA_TFUNCTION, 1);
+		case NBDEADKEY: return LUA_TDEADKEY;
+		case NBSHRSTR: return ctb(makevariant(LUA_TSTRING, 0));
+		case NBLNGSTR: return ctb(makevariant(LUA_TSTRING, 1));
+		case NBTABLE: return ctb(makevariant(LUA_TTABLE, 0));
+		case NBLCL: return ctb(makevariant(LUA_TFUNCTION, 0));
+		case NBCCL: return ctb(makevariant(LUA_TFUNCTION, 2));
+		case NBUDATA: return ctb(makevariant(LUA_TUSERDATA, 0));
+		default: {
+			lu_byte tt = nbgco(w)->tt;
+			return (tt == makevariant(LUA_TNUMBER, 0)) ? tt : ctb(tt);
+		}
+	}
+}
+
+#endif
+
 /* }================================================================== */
 
 
@@ -330,12 +570,15 @@ constexpr auto BIT_ISCOLLECTABLE =	(1 << 6);
 #define LUA_VNUMINT	makevariant(LUA_TNUMBER, 0)  /* integer numbers */
 #define LUA_VNUMFLT	makevariant(LUA_TNUMBER, 1)  /* float numbers */
 
+#define nvalue(o)	check_exp(ttisnumber(o), \
+	(ttisinteger(o) ? cast_num(ivalue(o)) : fltvalue(o)))
+
+#if !defined(LUA_USE_NANBOX)
+
 #define ttisnumber(o)		checktype((o), LUA_TNUMBER)
 #define ttisfloat(o)		checktag((o), LUA_VNUMFLT)
 #define ttisinteger(o)		checktag((o), LUA_VNUMINT)
 
-#define nvalue(o)	check_exp(ttisnumber(o), \
-	(ttisinteger(o) ? cast_num(ivalue(o)) : fltvalue(o)))
 #define fltvalue(o)	check_exp(ttisfloat(o), val_(o).n)
 #define ivalue(o)	check_exp(ttisinteger(o), val_(o).i)
 
@@ -348,12 +591,72 @@ constexpr auto BIT_ISCOLLECTABLE =	(1 << 6);
 #define chgfltvalue(obj,x) \
   { TValue *io=(obj); lua_assert(ttisfloat(io)); val_(io).n=(x); }
 
-#define setivalue(obj,x) \
+/* ('L' is needed only by NaN-boxed integers, which may need a box) */
+#define setivalue(L,obj,x) \
   { TValue *io=(obj); val_(io).i=(x); settt_(io, LUA_VNUMINT); }
 
-#define chgivalue(obj,x) \
+#define chgivalue(L,obj,x) \
   { TValue *io=(obj); lua_assert(ttisinteger(io)); val_(io).i=(x); }
 
+/* set an integer that needs no box (in this representation, any one) */
+#define setinlineivalue(obj,x)	setivalue(NULL,obj,x)
+
+#else
+
+/*
+** Box for an integer that does not fit in a NaN box. Boxes are never
+** changed, so copies of a value can share its box. The last box created
+** is kept alive until the next one ('lastintbox' in 'global_State'), so
+** that a box can be stored in a C variable while it is anchored.
+*/
+typedef struct IntBox
+{
+	CommonHeader;
+	lua_Integer i;
+} IntBox;
+
+/* whether 'o' is an integer in an 'IntBox' */
+#define isintbox(o)  \
+	(nbtag(val_(o)) == NBGCO && nbgco(val_(o))->tt == LUA_VNUMINT)
+
+#define ttisnumber(o)		(ttisfloat(o) || ttisinteger(o))
+#define ttisfloat(o)		nbisfloat(val_(o))
+#define ttisinteger(o)		(nbtag(val_(o)) == NBINT || isintbox(o))
+
+
+/* integer in word 'w' (either in the payload or in a box) */
+inline lua_Integer nbivalue (uint64_t w)
+{
+	if (l_likely(nbtag(w) == NBINT))
+		return l_castU2S(w << (64 - NBPAYLOADBITS)) >> (64 - NBPAYLOADBITS);
+	else
+		return cast(IntBox *, nbgco(w))->i;
+}
+
+#define fltvalue(o)	check_exp(ttisfloat(o), std::bit_cast<lua_Number>(val_(o)))
+#define ivalue(o)	check_exp(ttisinteger(o), nbivalue(val_(o)))
+
+#define setfltvalue(obj,x) \
+  { TValue *io=(obj); val_(io) = nbfloat(x); }
+
+#define chgfltvalue(obj,x) \
+  { TValue *io=(obj); lua_assert(ttisfloat(io)); val_(io) = nbfloat(x); }
+
+#define setivalue(L,obj,x) \
+  { TValue *io=(obj); lua_Integer i_=(x); \
+    if (l_likely(nbintfits(i_))) val_(io) = nbbox(NBINT, l_castS2U(i_)); \
+    else luaO_boxint(L, io, i_); }
+
+#define chgivalue(L,obj,x) \
+  { lua_assert(ttisinteger(obj)); setivalue(L,obj,x); }
+
+/* set an integer that fits in a payload, so needing no 'lua_State' */
+#define setinlineivalue(obj,x) \
+  { TValue *io=(obj); lua_Integer i_=(x); lua_assert(nbintfits(i_)); \
+    val_(io) = nbbox(NBINT, l_castS2U(i_)); }
+
+#endif
+
 /* }================================================================== */
 
 
@@ -367,6 +670,8 @@ constexpr auto BIT_ISCOLLECTABLE =	(1 << 6);
 #define LUA_VSHRSTR	makevariant(LUA_TSTRING, 0)  /* short strings */
 #define LUA_VLNGSTR	makevariant(LUA_TSTRING, 1)  /* long strings */
 
+#if !defined(LUA_USE_NANBOX)
+
 #define ttisstring(o)		checktype((o), LUA_TSTRING)
 #define ttisshrstring(o)	checktag((o), ctb(LUA_VSHRSTR))
 #define ttislngstring(o)	checktag((o), ctb(LUA_VLNGSTR))
@@ -380,6 +685,21 @@ constexpr auto BIT_ISCOLLECTABLE =	(1 << 6);
     val_(io).gc = obj2gco(x_); settt_(io, ctb(x_->tt)); \
     checkliveness(L,io); }
 
+#else
+
+#define ttisstring(o)		(nbtag(val_(o)) - NBSHRSTR <= NBLNGSTR - NBSHRSTR)
+#define ttisshrstring(o)	(nbtag(val_(o)) == NBSHRSTR)
+#define ttislngstring(o)	(nbtag(val_(o)) == NBLNGSTR)
+
+#define tsvalue(o)	check_exp(ttisstring(o), gco2ts(nbgco(val_(o))))
+
+#define setsvalue(L,obj,x) \
+  { TValue *io = (obj); TString *x_ = (x); \
+    val_(io) = nbptrbox(x_->tt == LUA_VSHRSTR ? NBSHRSTR : NBLNGSTR, x_); \
+    checkliveness(L,io); }
+
+#endif
+
 /* set a string to the stack */
 #define setsvalue2s(L,o,s)	setsvalue(L,s2v(o),s)
 
@@ -447,6 +767,8 @@ typedef struct TString
 
 #define LUA_VUSERDATA		makevariant(LUA_TUSERDATA, 0)
 
+#if !defined(LUA_USE_NANBOX)
+
 #define ttislightuserdata(o)	checktag((o), LUA_VLIGHTUSERDATA)
 #define ttisfulluserdata(o)	checktag((o), ctb(LUA_VUSERDATA))
 
@@ -463,6 +785,28 @@ typedef struct TString
     val_(io).gc = obj2gco(x_); settt_(io, ctb(LUA_VUSERDATA)); \
     checkliveness(L,io); }
 
+#else
+
+#define ttislightuserdata(o)	(nbtag(val_(o)) == NBLUD)
+#define ttisfulluserdata(o)	(nbtag(val_(o)) == NBUDATA)
+
+#define pvalue(o)  \
+	check_exp(ttislightuserdata(o), cast(void *, val_(o) & NBPAYLOAD))
+#define uvalue(o)	check_exp(ttisfulluserdata(o), gco2u(nbgco(val_(o))))
+
+/* whether pointer 'p' can be a light userdata */
+#define nbptrfits(p)	((cast(uint64_t, p) & ~NBPAYLOAD) == 0)
+
+#define setpvalue(obj,x) \
+  { TValue *io=(obj); val_(io) = nbptrbox(NBLUD, x); }
+
+#define setuvalue(L,obj,x) \
+  { TValue *io = (obj); Udata *x_ = (x); \
+    val_(io) = nbptrbox(NBUDATA, obj2gco(x_)); \
+    checkliveness(L,io); }
+
+#endif
+
 
 /* Ensures that addresses after this type are always fully aligned. */
 typedef union UValue
@@ -573,6 +917,66 @@ typedef struct AbsLineInfo
 	int line;
 } AbsLineInfo;
 
+/*
+** Per-instruction cache used by the interpreter.
+** For global accesses (OP_GETTABUP, OP_SETTABUP and OP_GETTABUPFIELD),
+** 'env' is the index of the instruction's entry in the 'envcache' of
+** its prototype (see 'EnvCache'), which keeps these entries small.
+** For other table access instructions (OP_GETFIELD and OP_SELF),
+** 'slot' is the index, in the hash part of the last table accessed by
+** the instruction, of the node holding the instruction's (constant)
+** key. The index is only a hint: it is checked against the current size
+** of the table's hash part and the key stored in that node before use,
+** so a resize or rehash of the table simply turns the next access into
+** a miss.
+** For instructions that can be quickened (see lopcodes.h), 'q' keeps
+** the candidate quickened opcode, how many consecutive executions have
+** agreed with it, and how many times the instruction was de-optimized.
+*/
+typedef union ICache
+{
+	unsigned int slot;
+
+	struct
+	{
+		lu_byte op; /* candidate quickened opcode */
+		lu_byte hits; /* consecutive executions matching 'op' */
+		lu_byte deopts; /* number of de-optimizations */
+	} q;
+
+	unsigned int env; /* index in 'envcache' */
+} ICache;
+
+
+/*
+** Cache of a global access: the version of the table last accessed and
+** the index of the node holding the key in that version. Versions are
+** unique in a state (see 'luaH_newversion'), so a matching version
+** identifies both the table and the layout of its hash part, and the
+** node can be used without further checks.
+*/
+typedef struct EnvCache
+{
+	lu_mem version; /* version of the table when 'slot' was cached */
+	unsigned int slot; /* node index */
+} EnvCache;
+
+
+/*
+** Type feedback of an instruction (see 'luaV_execute'): how many times
+** it ran while profiling was on, and for each of its (up to two)
+** profiled operands the set of type tags seen, as a bit mask with bit
+** 'novariant(tag) * 3 + variant' set for each tag.
+*/
+typedef struct TypeFeedback
+{
+	unsigned int count;
+	unsigned int seen[2];
+} TypeFeedback;
+
+#define fbtagbit(o)	(1u << (novariant(ttypetag(o)) * 3 + (ttypetag(o) >> 4)))
+
+
 /*
 ** Function Prototypes
 */
@@ -582,6 +986,7 @@ typedef struct Proto
 	lu_byte numparams; /* number of fixed (named) parameters */
 	lu_byte is_vararg;
 	lu_byte maxstacksize; /* number of registers needed by this function */
+	lu_byte cachemiss; /* count for successive misses for 'cache' field */
 	int sizeupvalues; /* size of 'upvalues' */
 	int sizek; /* size of 'k' */
 	int sizecode;
@@ -589,6 +994,7 @@ typedef struct Proto
 	int sizep; /* size of 'p' */
 	int sizelocvars;
 	int sizeabslineinfo; /* size of 'abslineinfo' */
+	int sizeenvcache; /* size of 'envcache' */
 	int linedefined; /* debug information  */
 	int lastlinedefined; /* debug information  */
 	TValue *k; /* constants used by the function */
@@ -598,6 +1004,14 @@ typedef struct Proto
 	ls_byte *lineinfo; /* information about source lines (debug information) */
 	AbsLineInfo *abslineinfo; /* idem */
 	LocVar *locvars; /* information about local variables (debug information) */
+	ICache *icache; /* inline caches, one per instruction (size 'sizecode') */
+	EnvCache *envcache; /* caches of global accesses */
+	TypeFeedback *typefb; /* type feedback (size 'sizecode') or NULL */
+#if defined(LUA_USE_JIT)
+	struct JitCode *jit; /* native code (NULL if not compiled) */
+	int jitcount; /* number of calls and backward jumps (up to LUAI_JITHOT) */
+#endif
+	struct LClosure *cache; /* last-created closure with this prototype */
 	TString *source; /* used for debug information */
 	GCObject *gclist;
 } Proto;
@@ -619,15 +1033,29 @@ typedef struct Proto
 #define LUA_VLCF	makevariant(LUA_TFUNCTION, 1)  /* light C function */
 #define LUA_VCCL	makevariant(LUA_TFUNCTION, 2)  /* C closure */
 
+#if !defined(LUA_USE_NANBOX)
+
 #define ttisfunction(o)		checktype(o, LUA_TFUNCTION)
 #define ttisLclosure(o)		checktag((o), ctb(LUA_VLCL))
 #define ttislcf(o)		checktag((o), LUA_VLCF)
 #define ttisCclosure(o)		checktag((o), ctb(LUA_VCCL))
+
+#else
+
+#define ttisfunction(o)		(ttisclosure(o) || ttislcf(o))
+#define ttisLclosure(o)		(nbtag(val_(o)) == NBLCL)
+#define ttislcf(o)		(nbtag(val_(o)) == NBLCF)
+#define ttisCclosure(o)		(nbtag(val_(o)) == NBCCL)
+
+#endif
+
 #define ttisclosure(o)         (ttisLclosure(o) || ttisCclosure(o))
 
 
 #define isLfunction(o)	ttisLclosure(o)
 
+#if !defined(LUA_USE_NANBOX)
+
 #define clvalue(o)	check_exp(ttisclosure(o), gco2cl(val_(o).gc))
 #define clLvalue(o)	check_exp(ttisLclosure(o), gco2lcl(val_(o).gc))
 #define fvalue(o)	check_exp(ttislcf(o), val_(o).f)
@@ -640,8 +1068,6 @@ typedef struct Proto
     val_(io).gc = obj2gco(x_); settt_(io, ctb(LUA_VLCL)); \
     checkliveness(L,io); }
 
-#define setclLvalue2s(L,o,cl)	setclLvalue(L,s2v(o),cl)
-
 #define setfvalue(obj,x) \
   { TValue *io=(obj); val_(io).f=(x); settt_(io, LUA_VLCF); }
 
@@ -650,6 +1076,31 @@ typedef struct Proto
     val_(io).gc = obj2gco(x_); settt_(io, ctb(LUA_VCCL)); \
     checkliveness(L,io); }
 
+#else
+
+#define clvalue(o)	check_exp(ttisclosure(o), gco2cl(nbgco(val_(o))))
+#define clLvalue(o)	check_exp(ttisLclosure(o), gco2lcl(nbgco(val_(o))))
+#define fvalue(o)  \
+	check_exp(ttislcf(o), cast(lua_CFunction, val_(o) & NBPAYLOAD))
+#define clCvalue(o)	check_exp(ttisCclosure(o), gco2ccl(nbgco(val_(o))))
+
+#define setclLvalue(L,obj,x) \
+  { TValue *io = (obj); LClosure *x_ = (x); \
+    val_(io) = nbptrbox(NBLCL, obj2gco(x_)); \
+    checkliveness(L,io); }
+
+#define setfvalue(obj,x) \
+  { TValue *io=(obj); val_(io) = nbptrbox(NBLCF, x); }
+
+#define setclCvalue(L,obj,x) \
+  { TValue *io = (obj); CClosure *x_ = (x); \
+    val_(io) = nbptrbox(NBCCL, obj2gco(x_)); \
+    checkliveness(L,io); }
+
+#endif
+
+#define setclLvalue2s(L,o,cl)	setclLvalue(L,s2v(o),cl)
+
 
 /*
 ** Upvalues for Lua closures
@@ -717,6 +1168,8 @@ typedef union Closure
 
 #define LUA_VTABLE	makevariant(LUA_TTABLE, 0)
 
+#if !defined(LUA_USE_NANBOX)
+
 #define ttistable(o)		checktag((o), ctb(LUA_VTABLE))
 
 #define hvalue(o)	check_exp(ttistable(o), gco2t(val_(o).gc))
@@ -726,9 +1179,24 @@ typedef union Closure
     val_(io).gc = obj2gco(x_); settt_(io, ctb(LUA_VTABLE)); \
     checkliveness(L,io); }
 
+#else
+
+#define ttistable(o)		(nbtag(val_(o)) == NBTABLE)
+
+#define hvalue(o)	check_exp(ttistable(o), gco2t(nbgco(val_(o))))
+
+#define sethvalue(L,obj,x) \
+  { TValue *io = (obj); Table *x_ = (x); \
+    val_(io) = nbptrbox(NBTABLE, obj2gco(x_)); \
+    checkliveness(L,io); }
+
+#endif
+
 #define sethvalue2s(L,o,h)	sethvalue(L,s2v(o),h)
 
 
+#if !defined(LUA_USE_NANBOX)
+
 /*
 ** Nodes for Hash tables: A pack of two TValue's (key-value pairs)
 ** plus a 'next' field to link colliding entries. The distribution
@@ -763,12 +1231,48 @@ typedef union Node
 	  io_->value_ = n_->u.key_val; io_->tt_ = n_->u.key_tt; \
 	  checkliveness(L,io_); }
 
+#else
+
+/*
+** Nodes for Hash tables: with NaN-boxed values, the key is a proper
+** 'TValue' ('nodekey').
+*/
+typedef union Node
+{
+	struct NodeKey
+	{
+		TValuefields; /* fields for value */
+		TValue key_val; /* key */
+		int next; /* for chaining */
+	} u;
+
+	TValue i_val; /* direct access to node's value as a proper 'TValue' */
+} Node;
+
+
+#define nodekey(node)	(&(node)->u.key_val)
+
+/* copy a value into a key */
+#define setnodekey(L,node,obj) \
+	{ Node *n_=(node); const TValue *io_=(obj); \
+	  val_(nodekey(n_)) = val_(io_); checkliveness(L,io_); }
+
+
+/* copy a value from a key */
+#define getnodekey(L,obj,node) \
+	{ TValue *io_=(obj); const Node *n_=(node); \
+	  val_(io_) = val_(nodekey(n_)); checkliveness(L,io_); }
+
+#endif
+
 
 /*
 ** About 'alimit': if 'isrealasize(t)' is true, then 'alimit' is the
 ** real size of 'array'. Otherwise, the real size of 'array' is the
 ** smallest power of two not smaller than 'alimit' (or zero iff 'alimit'
 ** is zero); 'alimit' is then used as a hint for #t.
+** A table whose array part is packed ('ispacked') has 'alimit' zero
+** (and 'isrealasize' true); its entries are in 'packed' instead.
 */
 
 #define BITRAS		(1 << 7)
@@ -776,6 +1280,39 @@ typedef union Node
 #define setrealasize(t)		((t)->flags &= cast_byte(~BITRAS))
 #define setnorealasize(t)	((t)->flags |= BITRAS)
 
+#if defined(LUA_USE_PACKEDARRAY)
+
+#define BITPACKED	(1 << 6)
+#define ispacked(t)		((t)->flags & BITPACKED)
+
+
+/*
+** Packed array part: while all entries in the array part of a table
+** are floats, or all are integers, they are kept unboxed, without tags.
+** Absent entries hold a value that such a part never stores: a NaN for
+** floats and LUA_MININTEGER for integers. (Storing one of those, or a
+** value of another type, turns the part back into TValues.)
+*/
+typedef union PackedEntry
+{
+	lua_Number n;
+	lua_Integer i;
+} PackedEntry;
+
+typedef struct PackedArray
+{
+	unsigned int size; /* number of entries */
+	unsigned int border; /* hint for #t */
+	lu_byte kind; /* LUA_VNUMFLT or LUA_VNUMINT */
+	PackedEntry e[1];
+} PackedArray;
+
+#else
+
+#define ispacked(t)		0
+
+#endif
+
 
 typedef struct Table
 {
@@ -783,16 +1320,34 @@ typedef struct Table
 	lu_byte flags; /* 1<<p means tagmethod(p) is not present */
 	lu_byte lsizenode; /* log2 of size of 'node' array */
 	unsigned int alimit; /* "limit" of 'array' array */
+#if defined(LUA_USE_PACKEDARRAY)
+	union
+	{
+		TValue *array; /* array part */
+		PackedArray *packed; /* packed array part (if 'ispacked') */
+	};
+#else
 	TValue *array; /* array part */
+#endif
 	Node *node;
+#if defined(LUA_USE_SWISSHASH)
+	lu_byte *ctrl; /* control bytes of 'node' (see ltable.c) */
+	unsigned int growthleft; /* empty slots usable before a rehash */
+#else
 	Node *lastfree; /* any free position is before this position */
+#endif
 	struct Table *metatable;
 	GCObject *gclist;
+	lu_mem version; /* layout stamp of the hash part (see 'luaH_newversion') */
 
 	/* true when 't' is using 'dummynode' as its hash part */
 	auto isdummy () const -> bool
 	{
+#if defined(LUA_USE_SWISSHASH)
+		return ((this)->ctrl == nullptr);
+#else
 		return ((this)->lastfree == nullptr);
+#endif
 	}
 } Table;
 
@@ -800,6 +1355,8 @@ typedef struct Table
 /*
 ** Macros to manipulate keys inserted in nodes
 */
+#if !defined(LUA_USE_NANBOX)
+
 #define keytt(node)		((node)->u.key_tt)
 #define keyval(node)		((node)->u.key_val)
 
@@ -814,6 +1371,25 @@ typedef struct Table
 #define keyiscollectable(n)	(keytt(n) & BIT_ISCOLLECTABLE)
 
 #define gckey(n)	(keyval(n).gc)
+
+#else
+
+#define keytt(node)		rawtt(nodekey(node))
+
+#define keyisnil(node)		ttisstrictnil(nodekey(node))
+#define keyisinteger(node)	ttisinteger(nodekey(node))
+#define keyival(node)		ivalue(nodekey(node))
+#define keyisshrstr(node)	ttisshrstring(nodekey(node))
+#define keystrval(node)		tsvalue(nodekey(node))
+
+#define setnilkey(node)		setnilvalue(nodekey(node))
+
+#define keyiscollectable(n)	iscollectable(nodekey(n))
+
+#define gckey(n)	nbgco(val_(nodekey(n)))
+
+#endif
+
 #define gckeyN(n)	(keyiscollectable(n) ? gckey(n) : NULL)
 
 
@@ -823,8 +1399,14 @@ typedef struct Table
 ** be found when searched in a special way. ('next' needs that to find
 ** keys removed from a table during a traversal.)
 */
+#if !defined(LUA_USE_NANBOX)
 #define setdeadkey(node)	(keytt(node) = LUA_TDEADKEY)
 #define keyisdead(node)		(keytt(node) == LUA_TDEADKEY)
+#else
+#define setdeadkey(node)  \
+	(val_(nodekey(node)) = nbbox(NBDEADKEY, val_(nodekey(node))))
+#define keyisdead(node)		(nbtag(val_(nodekey(node))) == NBDEADKEY)
+#endif
 
 /* }================================================================== */
 
@@ -845,6 +1427,10 @@ typedef struct Table
 
 LUAI_FUNC int luaO_utf8esc(char *buff, unsigned long x);
 
+#if defined(LUA_USE_NANBOX)
+LUAI_FUNC void luaO_boxint(lua_State *L, TValue *obj, lua_Integer i);
+#endif
+
 LUAI_FUNC int luaO_ceillog2(unsigned int x);
 
 LUAI_FUNC int luaO_rawarith(lua_State *L, int op, const TValue *p1,
@@ -853,7 +1439,13 @@ LUAI_FUNC int luaO_rawarith(lua_State *L, int op, const TValue *p1,
 LUAI_FUNC void luaO_arith(lua_State *L, int op, const TValue *p1,
 									const TValue *p2, StkId res);
 
-LUAI_FUNC size_t luaO_str2num(const char *s, TValue *o);
+/* ('L' is needed only by NaN-boxed integers, which may need a box) */
+#if defined(LUA_USE_NANBOX)
+LUAI_FUNC size_t luaO_str2num(lua_State *L, const char *s, TValue *o);
+#else
+LUAI_FUNC size_t luaO_str2num_(const char *s, TValue *o);
+#define luaO_str2num(L,s,o)	luaO_str2num_(s,o)
+#endif
 
 LUAI_FUNC int luaO_hexavalue(int c);
 
@@ -100,5 +100,40 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, 0, 0, 1, iABC)		/* OP_VARARG */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDFF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBFF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULFF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_EQII */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_EQFF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTII */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTFF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEII */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEFF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABUPFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETUPVALFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETFIELDCALL */
+ ,opmode(0, 0, 0, 0, 1, iABx)		/* OP_LOADKSETFIELD */
 };
 
+
+OpCode luaP_genericop(OpCode op)
+{
+	switch (op)
+	{
+		case OP_ADDII: case OP_ADDFF: return OP_ADD;
+		case OP_SUBII: case OP_SUBFF: return OP_SUB;
+		case OP_MULII: case OP_MULFF: return OP_MUL;
+		case OP_EQII: case OP_EQFF: return OP_EQ;
+		case OP_LTII: case OP_LTFF: return OP_LT;
+		case OP_LEII: case OP_LEFF: return OP_LE;
+		case OP_GETTABUPFIELD: return OP_GETTABUP;
+		case OP_GETUPVALFIELD: return OP_GETUPVAL;
+		case OP_GETFIELDCALL: return OP_GETFIELD;
+		case OP_LOADKSETFIELD: return OP_LOADK;
+		default: return op;
+	}
+}
+
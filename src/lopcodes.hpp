@@ -400,10 +400,49 @@ typedef enum {
 
 	/*	Ax	extra (larger) argument for previous opcode	*/
 	OP_EXTRAARG,
+
+	/* quickened opcodes (see note below) */
+
+	/*	A B C	R[A] := R[B] + R[C]  (both integers)		*/
+	OP_ADDII,
+	/*	A B C	R[A] := R[B] + R[C]  (both floats)		*/
+	OP_ADDFF,
+	/*	A B C	R[A] := R[B] - R[C]  (both integers)		*/
+	OP_SUBII,
+	/*	A B C	R[A] := R[B] - R[C]  (both floats)		*/
+	OP_SUBFF,
+	/*	A B C	R[A] := R[B] * R[C]  (both integers)		*/
+	OP_MULII,
+	/*	A B C	R[A] := R[B] * R[C]  (both floats)		*/
+	OP_MULFF,
+
+	/*	A B k	if ((R[A] == R[B]) ~= k) then pc++  (integers)	*/
+	OP_EQII,
+	/*	A B k	if ((R[A] == R[B]) ~= k) then pc++  (floats)	*/
+	OP_EQFF,
+	/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++  (integers)	*/
+	OP_LTII,
+	/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++  (floats)	*/
+	OP_LTFF,
+	/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++  (integers)	*/
+	OP_LEII,
+	/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++  (floats)	*/
+	OP_LEFF,
+
+	/* superinstructions (see note below) */
+
+	/*	A B C	R[A] := UpValue[B][K[C]:shortstring]; next is OP_GETFIELD	*/
+	OP_GETTABUPFIELD,
+	/*	A B	R[A] := UpValue[B]; next is OP_GETFIELD			*/
+	OP_GETUPVALFIELD,
+	/*	A B C	R[A] := R[B][K[C]:shortstring]; next is OP_CALL		*/
+	OP_GETFIELDCALL,
+	/*	A Bx	R[A] := K[Bx]; next is OP_SETFIELD			*/
+	OP_LOADKSETFIELD,
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_OPCODES	((int)(OP_LOADKSETFIELD) + 1)
 
 
 
@@ -458,6 +497,24 @@ typedef enum {
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) Quickened opcodes (OP_ADDII to OP_LEFF) are never generated by
+  the code generator nor stored in binary chunks. The interpreter
+  rewrites a generic instruction in place into one of these variants
+  after it has seen stable operand types, and rewrites it back into
+  the generic opcode (and executes that) on the first type miss. So,
+  any instruction that may call a metamethod or raise an error is
+  always seen in its generic form.
+
+  (*) Superinstructions (OP_GETTABUPFIELD to OP_LOADKSETFIELD) are
+  created by 'luaK_fuse' when a function is finished or loaded, and
+  are also never stored in binary chunks. Each one replaces only the
+  opcode of the first instruction of a pair; it does the work of that
+  instruction and then executes the (unchanged) next one without going
+  through the dispatcher. So, the code keeps its size and all jump
+  targets, and the second instruction can still be executed on its
+  own. For all other purposes (opmodes, debug information) a
+  superinstruction behaves as its first instruction.
+
 ===========================================================================*/
 
 
@@ -491,6 +548,22 @@ LUAI_DDEC(const lu_byte luaP_opmodes[NUM_OPCODES];)
 #define opmode(mm,ot,it,t,a,m) (((mm) << 7) | ((ot) << 6) | ((it) << 5) | ((t) << 4) | ((a) << 3) | (m))
 
 
+/* whether 'op' is a quickened variant of some generic opcode */
+#define isquickened(op)	(OP_ADDII <= (op) && (op) <= OP_LEFF)
+
+/* whether 'op' is a superinstruction */
+#define isfused(op)	((op) >= OP_GETTABUPFIELD)
+
+/*
+** generic opcode corresponding to a (possibly quickened or fused)
+** opcode; for a superinstruction, that is the opcode of its first
+** instruction
+*/
+LUAI_FUNC OpCode luaP_genericop (OpCode op);
+
+#define GET_GENERICOP(i)	luaP_genericop(GET_OPCODE(i))
+
+
 /* number of list items to accumulate before a SETLIST instruction */
 constexpr auto LFIELDS_PER_FLUSH = 50;
 
@@ -94,6 +94,22 @@ static const char *const opnames[] = {
 	"VARARG",
 	"VARARGPREP",
 	"EXTRAARG",
+	"ADDII",
+	"ADDFF",
+	"SUBII",
+	"SUBFF",
+	"MULII",
+	"MULFF",
+	"EQII",
+	"EQFF",
+	"LTII",
+	"LTFF",
+	"LEII",
+	"LEFF",
+	"GETTABUPFIELD",
+	"GETUPVALFIELD",
+	"GETFIELDCALL",
+	"LOADKSETFIELD",
 	NULL
 };
 
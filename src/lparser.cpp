@@ -65,6 +65,205 @@ static void statement(LexState *ls);
 static void expr(LexState *ls, expdesc *v);
 
 
+/*
+** {======================================================
+** Parser arena
+** =======================================================
+*/
+
+/* minimum size of an arena chunk */
+#define MINCHUNK	4096
+
+/* maximum size of an arena chunk, except for single large arrays */
+#define MAXCHUNK	(256 * 1024)
+
+/* minimum size of an array in the arena */
+#define MINARENAARRAY	8
+
+/*
+** Arrays larger than this live in the heap, where 'realloc' can grow
+** them without copying and the final shrink is cheap.
+*/
+#define MAXARENAARRAY	(MAXCHUNK / 4)
+
+#define isbigarray(n,size_elems)	(cast_sizet(n) * (size_elems) > MAXARENAARRAY)
+
+/* alignment of arena blocks */
+#define ARENAALIGN	(sizeof(TValue) > sizeof(void *) ? sizeof(TValue) : sizeof(void *))
+
+#define arenaround(n)	(((n) + ARENAALIGN - 1) & ~(ARENAALIGN - 1))
+
+
+static void *arenaalloc(lua_State *L, Parena *a, size_t size)
+{
+	void *block;
+	size = arenaround(size);
+	if (cast_sizet(a->limit - a->top) < size)
+	{
+		/* need a new chunk */
+		size_t csize = (a->chunk == NULL) ? MINCHUNK : a->chunk->size * 2;
+		ArenaChunk *c;
+		if (csize > MAXCHUNK)
+			csize = MAXCHUNK;
+		if (csize < size + arenaround(sizeof(ArenaChunk)))
+			csize = size + arenaround(sizeof(ArenaChunk));
+		c = cast(ArenaChunk *, luaM::newvector<char>(L, cast_int(csize)));
+		c->prev = a->chunk;
+		c->size = csize;
+		a->chunk = c;
+		a->top = cast_charp(c) + arenaround(sizeof(ArenaChunk));
+		a->limit = cast_charp(c) + csize;
+	}
+	block = a->top;
+	a->top += size;
+	return block;
+}
+
+
+/*
+** Grow an array, as 'luaM::growaux_', with memory from the arena. An
+** array at the top of the current chunk grows in place, if there is
+** room; otherwise it is copied to a new block. Big arrays go to the
+** heap (see 'MAXARENAARRAY').
+*/
+void *luaY_arenagrow(lua_State *L, Parena *a, void *block, int nelems,
+							int *psize, int size_elems, int limit, const char *what)
+{
+	void *newblock;
+	int size = *psize;
+	size_t oldbytes = arenaround(cast_sizet(size) * size_elems);
+	if (nelems + 1 <= size) /* does one extra element still fit? */
+		return block; /* nothing to be done */
+	if (size >= limit / 2)
+	{
+		/* cannot double it? */
+		if (l_unlikely(size >= limit)) /* cannot grow even a little? */
+			luaG_runerror(L, "too many %s (limit is %d)", what, limit);
+		size = limit; /* still have at least one free place */
+	}
+	else
+	{
+		size *= 2;
+		if (size < MINARENAARRAY)
+			size = MINARENAARRAY; /* minimum size */
+	}
+	lua_assert(nelems + 1 <= size && size <= limit);
+	if (isbigarray(size, size_elems))
+	{
+		if (isbigarray(*psize, size_elems)) /* already in the heap? */
+			newblock = luaM::saferealloc_(L, block, cast_sizet(*psize) * size_elems,
+													cast_sizet(size) * size_elems);
+		else
+		{
+			newblock = luaM::malloc_(L, cast_sizet(size) * size_elems, 0);
+			if (block != NULL)
+				memcpy(newblock, block, cast_sizet(*psize) * size_elems);
+		}
+	}
+	else if (block != NULL && cast_charp(block) + oldbytes == a->top &&
+		 cast_sizet(a->limit - cast_charp(block)) >= cast_sizet(size) * size_elems)
+	{
+		/* block is the last one in the chunk and there is room */
+		a->top = cast_charp(block) + arenaround(cast_sizet(size) * size_elems);
+		newblock = block;
+	}
+	else
+	{
+		newblock = arenaalloc(L, a, cast_sizet(size) * size_elems);
+		if (block != NULL)
+			memcpy(newblock, block, cast_sizet(*psize) * size_elems);
+	}
+	*psize = size; /* update only when everything else is OK */
+	return newblock;
+}
+
+
+static int inarena(Parena *a, void *block)
+{
+	ArenaChunk *c;
+	for (c = a->chunk; c != NULL; c = c->prev)
+	{
+		if (cast_charp(block) >= cast_charp(c) &&
+			 cast_charp(block) < cast_charp(c) + c->size)
+			return 1;
+	}
+	return 0;
+}
+
+
+#define dropifinarena(a,v,size)	\
+	{ if ((v) != NULL && inarena(a, v)) { (v) = NULL; (size) = 0; } }
+
+
+/* free a list of the parser if it grew out of the arena */
+template<typename T>
+static void freebigarray(lua_State *L, T *v, int size)
+{
+	if (isbigarray(size, sizeof(T)))
+		luaM::freearray(L, v, size);
+}
+
+
+/*
+** Release the arena. If parsing was interrupted by an error, the
+** prototypes still open may point to arrays in the arena; as these
+** prototypes will be collected, clear those arrays. (Their big arrays,
+** in the heap, are freed with them.)
+*/
+void luaY_freedyndata(lua_State *L, Dyndata *dyd)
+{
+	Parena *a = &dyd->arena;
+	ArenaChunk *c = a->chunk;
+	int i;
+	freebigarray(L, dyd->actvar.arr, dyd->actvar.size);
+	freebigarray(L, dyd->gt.arr, dyd->gt.size);
+	freebigarray(L, dyd->label.arr, dyd->label.size);
+	for (i = 0; i < a->nopen; i++)
+	{
+		Proto *f = a->open[i];
+		dropifinarena(a, f->code, f->sizecode);
+		dropifinarena(a, f->lineinfo, f->sizelineinfo);
+		dropifinarena(a, f->abslineinfo, f->sizeabslineinfo);
+		dropifinarena(a, f->k, f->sizek);
+		dropifinarena(a, f->locvars, f->sizelocvars);
+		dropifinarena(a, f->upvalues, f->sizeupvalues);
+	}
+	freebigarray(L, a->open, a->sizeopen);
+	while (c != NULL)
+	{
+		ArenaChunk *prev = c->prev;
+		luaM::freearray(L, cast_charp(c), c->size);
+		c = prev;
+	}
+	a->chunk = NULL;
+	a->top = a->limit = NULL;
+	a->open = NULL;
+	a->nopen = a->sizeopen = 0;
+}
+
+
+/*
+** Give array 'v' of a prototype its exact size 'n': an array in the
+** arena is copied to a new one, a big array is shrunk.
+*/
+template<typename T>
+static T *fixarray(lua_State *L, T *v, int *size, int n)
+{
+	T *nv = NULL;
+	if (isbigarray(*size, sizeof(T)))
+		return luaM::shrinkvector<T>(L, v, size, n);
+	if (n > 0)
+	{
+		nv = luaM::newvector<T>(L, n);
+		memcpy(nv, v, cast_sizet(n) * sizeof(T));
+	}
+	*size = n;
+	return nv;
+}
+
+/* }====================================================== */
+
+
 static l_noret error_expected(LexState *ls, int token)
 {
 	luaX_syntaxerror(ls,
@@ -190,8 +389,9 @@ static int registerlocalvar(LexState *ls, FuncState *fs, TString *varname)
 {
 	Proto *f = fs->f;
 	int oldsize = f->sizelocvars;
-	f->locvars = luaM::growvector(
+	f->locvars = luaY_growvector(
 		ls->L,
+		&ls->dyd->arena,
 		f->locvars,
 		fs->ndebugvars,
 		&f->sizelocvars,
@@ -218,8 +418,9 @@ static int new_localvar(LexState *ls, TString *name)
 	Dyndata *dyd = ls->dyd;
 	checklimit(fs, dyd->actvar.n + 1 - fs->firstlocal,
 					MAXVARS, "local variables");
-	dyd->actvar.arr = luaM::growvector(
+	dyd->actvar.arr = luaY_growvector(
 		L,
+		&dyd->arena,
 		dyd->actvar.arr,
 		dyd->actvar.n + 1,
 		&dyd->actvar.size,
@@ -396,7 +597,7 @@ static Upvaldesc *allocupvalue(FuncState *fs)
 	Proto *f = fs->f;
 	int oldsize = f->sizeupvalues;
 	checklimit(fs, fs->nups + 1, MAXUPVAL, "upvalues");
-	f->upvalues = luaM::growvector<Upvaldesc>(fs->ls->L, f->upvalues, fs->nups, &f->sizeupvalues, MAXUPVAL, "upvalues");
+	f->upvalues = luaY_growvector<Upvaldesc>(fs->ls->L, &fs->ls->dyd->arena, f->upvalues, fs->nups, &f->sizeupvalues, MAXUPVAL, "upvalues");
 	while (oldsize < f->sizeupvalues)
 		f->upvalues[oldsize++].name = NULL;
 	return &f->upvalues[fs->nups++];
@@ -631,7 +832,7 @@ static int newlabelentry(LexState *ls, Labellist *l, TString *name,
 								int line, int pc)
 {
 	int n = l->n;
-	l->arr = luaM::growvector<Labeldesc>(ls->L, l->arr, n, &l->size, SHRT_MAX, "labels/gotos");
+	l->arr = luaY_growvector<Labeldesc>(ls->L, &ls->dyd->arena, l->arr, n, &l->size, SHRT_MAX, "labels/gotos");
 	l->arr[n].name = name;
 	l->arr[n].line = line;
 	l->arr[n].nactvar = ls->fs->nactvar;
@@ -820,6 +1021,7 @@ static void codeclosure(LexState *ls, expdesc *v)
 static void open_func(LexState *ls, FuncState *fs, BlockCnt *bl)
 {
 	Proto *f = fs->f;
+	Parena *a = &ls->dyd->arena;
 	fs->prev = ls->fs; /* linked list of funcstates */
 	fs->ls = ls;
 	ls->fs = fs;
@@ -838,6 +1040,9 @@ static void open_func(LexState *ls, FuncState *fs, BlockCnt *bl)
 	fs->firstlocal = ls->dyd->actvar.n;
 	fs->firstlabel = ls->dyd->label.n;
 	fs->bl = NULL;
+	a->open = luaY_growvector<Proto *>(ls->L, a, a->open, a->nopen, &a->sizeopen,
+												  MAX_INT, "functions");
+	a->open[a->nopen++] = f; /* its arrays will be in the arena */
 	f->source = ls->source;
 	luaC_objbarrier(ls->L, f, f->source);
 	f->maxstacksize = 2; /* registers 0/1 are always valid */
@@ -853,14 +1058,20 @@ static void close_func(LexState *ls)
 	luaK_ret(fs, luaY_nvarstack(fs), 0); /* final return */
 	leaveblock(fs);
 	lua_assert(fs->bl == NULL);
+	if (ls->optimize)
+		luaK_optimize(fs);
 	luaK_finish(fs);
-	f->code = luaM::shrinkvector<Instruction>(L, f->code, &f->sizecode, fs->pc);
-	f->lineinfo = luaM::shrinkvector<ls_byte>(L, f->lineinfo, &f->sizelineinfo, fs->pc);
-	f->abslineinfo = luaM::shrinkvector<AbsLineInfo>(L, f->abslineinfo, &f->sizeabslineinfo, fs->nabslineinfo);
-	f->k = luaM::shrinkvector<TValue>(L, f->k, &f->sizek, fs->nk);
+	/* move arrays out of the arena, with their final sizes */
+	f->code = fixarray<Instruction>(L, f->code, &f->sizecode, fs->pc);
+	f->lineinfo = fixarray<ls_byte>(L, f->lineinfo, &f->sizelineinfo, fs->pc);
+	f->abslineinfo = fixarray<AbsLineInfo>(L, f->abslineinfo, &f->sizeabslineinfo, fs->nabslineinfo);
+	f->k = fixarray<TValue>(L, f->k, &f->sizek, fs->nk);
 	f->p = luaM::shrinkvector<Proto*>(L, f->p, &f->sizep, fs->np);
-	f->locvars = luaM::shrinkvector<LocVar>(L, f->locvars, &f->sizelocvars, fs->ndebugvars);
-	f->upvalues = luaM::shrinkvector<Upvaldesc>(L, f->upvalues, &f->sizeupvalues, fs->nups);
+	f->locvars = fixarray<LocVar>(L, f->locvars, &f->sizelocvars, fs->ndebugvars);
+	f->upvalues = fixarray<Upvaldesc>(L, f->upvalues, &f->sizeupvalues, fs->nups);
+	lua_assert(ls->dyd->arena.open[ls->dyd->arena.nopen - 1] == f);
+	ls->dyd->arena.nopen--;
+	luaF::initcache(L, f);
 	ls->fs = fs->prev;
 	luaC_checkGC(L);
 }
@@ -2199,7 +2410,8 @@ static void mainfunc(LexState *ls, FuncState *fs)
 
 
 LClosure *luaY_parser(lua_State *L, ZIO *z, Mbuffer *buff,
-							Dyndata *dyd, const char *name, int firstchar)
+							Dyndata *dyd, const char *name, int firstchar,
+							int optimize)
 {
 	LexState lexstate;
 	FuncState funcstate;
@@ -2215,6 +2427,7 @@ LClosure *luaY_parser(lua_State *L, ZIO *z, Mbuffer *buff,
 	luaC_objbarrier(L, funcstate.f, funcstate.f->source);
 	lexstate.buff = buff;
 	lexstate.dyd = dyd;
+	lexstate.optimize = optimize;
 	dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
 	luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
 	mainfunc(&lexstate, &funcstate);
@@ -8,6 +8,7 @@
 #define lparser_h
 
 #include "llimits.hpp"
+#include "lmem.hpp"
 #include "lobject.hpp"
 #include "lzio.hpp"
 
@@ -138,6 +139,30 @@ typedef struct Labellist
 } Labellist;
 
 
+/*
+** Bump allocator for the growing arrays of the parser: the lists in
+** 'Dyndata' and the arrays of the prototypes being built, which
+** 'close_func' copies to arrays of their exact sizes. Grown arrays are
+** not freed; all the memory goes away at once when parsing ends.
+*/
+typedef struct ArenaChunk
+{
+	struct ArenaChunk *prev; /* previous chunk */
+	size_t size; /* size of this chunk, including this header */
+} ArenaChunk;
+
+
+typedef struct Parena
+{
+	ArenaChunk *chunk; /* current chunk */
+	char *top; /* free space in current chunk */
+	char *limit;
+	Proto **open; /* prototypes with arrays in the arena */
+	int nopen;
+	int sizeopen;
+} Parena;
+
+
 /* dynamic structures used by the parser */
 typedef struct Dyndata
 {
@@ -151,6 +176,7 @@ typedef struct Dyndata
 
 	Labellist gt; /* list of pending gotos */
 	Labellist label; /* list of active labels */
+	Parena arena; /* memory for all the above and for prototype arrays */
 } Dyndata;
 
 
@@ -184,8 +210,25 @@ typedef struct FuncState
 
 LUAI_FUNC int luaY_nvarstack(FuncState *fs);
 
+LUAI_FUNC void *luaY_arenagrow(lua_State *L, Parena *a, void *block, int nelems,
+										 int *psize, int size_elems, int limit,
+										 const char *what);
+
+LUAI_FUNC void luaY_freedyndata(lua_State *L, Dyndata *dyd);
+
+
+/* grow vector 'v' in the parser arena, as 'luaM::growvector' */
+template<typename T>
+T *luaY_growvector(lua_State *L, Parena *a, T *v, int nelems, int *size,
+						 int limit, const char *what)
+{
+	return static_cast<T *>(luaY_arenagrow(L, a, v, nelems, size, sizeof(T),
+														 cast_int(luaM::limitN<T>(limit)), what));
+}
+
 LUAI_FUNC LClosure *luaY_parser(lua_State *L, ZIO *z, Mbuffer *buff,
-											Dyndata *dyd, const char *name, int firstchar);
+											Dyndata *dyd, const char *name, int firstchar,
+											int optimize);
 
 
 #endif
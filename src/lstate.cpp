@@ -20,6 +20,7 @@
 #include "ldo.hpp"
 #include "lfunc.hpp"
 #include "lgc.hpp"
+#include "lgcpar.hpp"
 #include "llex.hpp"
 #include "lmem.hpp"
 #include "lstate.hpp"
@@ -219,6 +220,9 @@ static void freestack(lua_State *L)
 	freeCI(L);
 	lua_assert(L->nci == 0);
 	luaM::freearray(L, L->stack.p, L->stacksize() + EXTRA_STACK); /* free stack */
+#if defined(LUA_USE_NANBOX)
+	luaM::freearray(L, L->tbcprev, L->sizetbcprev);
+#endif
 }
 
 
@@ -278,6 +282,10 @@ static void preinit_thread(lua_State *L, global_State *g)
 	L->status = LUA_OK;
 	L->errfunc = 0;
 	L->oldpc = 0;
+#if defined(LUA_USE_NANBOX)
+	L->tbcprev = NULL;
+	L->ntbcprev = L->sizetbcprev = 0;
+#endif
 }
 
 
@@ -294,6 +302,15 @@ static void close_state(lua_State *L)
 		luaC_freeallobjects(L); /* collect all objects */
 		luai_userstateclose(L);
 	}
+#if defined(LUA_USE_PARALLELMARK)
+	luaC_setgcworkers(L, 0); /* stop marking threads */
+	luaC_setbgfree(L, 0); /* free pending blocks and stop freeing thread */
+#endif
+	if (g->arena) /* allocator releases everything with the main block? */
+	{
+		(*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);
+		return;
+	}
 	luaM::freearray(L, G(L)->strt.hash, G(L)->strt.size);
 	freestack(L);
 	lua_assert(gettotalbytes(g) == sizeof(LG));
@@ -392,6 +409,7 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud)
 	g->ud = ud;
 	g->warnf = NULL;
 	g->ud_warn = NULL;
+	g->nextf = NULL;
 	g->mainthread = L;
 	g->seed = luai_makeseed(L);
 	g->gcstp = GCSTPGC; /* no GC while building state */
@@ -404,16 +422,37 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud)
 	g->gcstopem = 0;
 	g->gcemergency = 0;
 	g->finobj = g->tobefnz = g->fixedgc = NULL;
+#if defined(LUA_USE_NANBOX)
+	g->lastintbox = NULL;
+#endif
 	g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
 	g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
 	g->sweepgc = NULL;
 	g->gray = g->grayagain = NULL;
 	g->weak = g->ephemeron = g->allweak = NULL;
+	g->ephmap = NULL;
 	g->twups = NULL;
 	g->totalbytes = sizeof(LG);
 	g->GCdebt = 0;
 	g->lastatomic = 0;
-	setivalue(&g->nilvalue, 0); /* to signal that state is not yet built */
+	g->icachehits = g->icachemisses = 0;
+	g->gcachehits = g->gcachemisses = 0;
+	g->tabversion = 0;
+	g->typeprofile = 0;
+	g->arena = 0;
+	g->gcfinqueue = 0;
+	memset(&g->finstats, 0, sizeof(g->finstats));
+#if defined(LUA_USE_PARALLELMARK)
+	g->gcworkers = NULL;
+	g->gcfreer = NULL;
+	g->gcfreeing = 0;
+#endif
+#if defined(LUA_USE_GCSTATS)
+	memset(&g->gcstats, 0, sizeof(g->gcstats));
+	g->gcphase = LUA_GCNPHASES;
+	g->gcphasestart = g->gcstepstart = 0;
+#endif
+	setivalue(L, &g->nilvalue, 0); /* to signal that state is not yet built */
 	setgcparam(g->gcpause, LUAI_GCPAUSE);
 	setgcparam(g->gcstepmul, LUAI_GCMUL);
 	g->gcstepsize = LUAI_GCSTEPSIZE;
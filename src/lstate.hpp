@@ -296,9 +296,13 @@ typedef struct global_State
 	GCObject *grayagain; /* list of objects to be traversed atomically */
 	GCObject *weak; /* list of tables with weak values */
 	GCObject *ephemeron; /* list of ephemeron tables (weak keys) */
+	struct EphMap *ephmap; /* pending ephemeron entries, while converging */
 	GCObject *allweak; /* list of all-weak tables */
 	GCObject *tobefnz; /* list of userdata to be GC */
 	GCObject *fixedgc; /* list of objects not to be collected */
+#if defined(LUA_USE_NANBOX)
+	GCObject *lastintbox; /* last 'IntBox' created (see lobject.h) */
+#endif
 	/* fields for generational collector */
 	GCObject *survival; /* start of objects that survived one GC cycle */
 	GCObject *old1; /* start of old1 objects */
@@ -316,6 +320,27 @@ typedef struct global_State
 	TString *strcache[STRCACHE_N][STRCACHE_M]; /* cache for strings in API */
 	lua_WarnFunction warnf; /* warning function */
 	void *ud_warn; /* auxiliary data to 'warnf' */
+	lua_CFunction nextf; /* primitive 'next' (see OP_TFORCALL) */
+	lu_mem icachehits; /* table accesses served by an inline cache */
+	lu_mem icachemisses; /* table accesses that missed their inline cache */
+	lu_mem gcachehits; /* global accesses served by an inline cache */
+	lu_mem gcachemisses; /* global accesses that missed their inline cache */
+	lu_mem tabversion; /* last table version given (see 'luaH_newversion') */
+	lu_byte typeprofile; /* true if collecting type feedback */
+	lu_byte arena; /* true if freeing the main block frees all memory */
+	lu_byte gcfinqueue; /* true if finalizers wait for LUA_GCFINALIZE */
+	lua_FinStats finstats;
+#if defined(LUA_USE_PARALLELMARK)
+	struct GCWorkers *gcworkers; /* marking threads (NULL if serial) */
+	struct GCFreer *gcfreer; /* background freeing thread (or NULL) */
+	lu_byte gcfreeing; /* true while a sweep frees a dead object */
+#endif
+#if defined(LUA_USE_GCSTATS)
+	lua_GCStats gcstats;
+	lu_byte gcphase; /* phase being timed (LUA_GCNPHASES if none) */
+	lua_Unsigned gcphasestart; /* clock when 'gcphase' started */
+	lua_Unsigned gcstepstart; /* clock when current step started */
+#endif
 } global_State;
 
 
@@ -335,6 +360,11 @@ struct lua_State
 	StkIdRel stack; /* stack base */
 	UpVal *openupval; /* list of open upvalues in this stack */
 	StkIdRel tbclist; /* list of to-be-closed variables */
+#if defined(LUA_USE_NANBOX)
+	ptrdiff_t *tbcprev; /* rest of 'tbclist' (see 'luaF::newtbcupval') */
+	int ntbcprev; /* number of entries in 'tbcprev' */
+	int sizetbcprev; /* size of 'tbcprev' */
+#endif
 	GCObject *gclist;
 	struct lua_State *twups; /* list of threads with open upvalues */
 	struct lua_longjmp *errorJmp; /* current error recover point */
@@ -416,6 +446,9 @@ union GCUnion
 	struct Proto p;
 	struct lua_State th; /* thread */
 	struct UpVal upv;
+#if defined(LUA_USE_NANBOX)
+	struct IntBox ib;
+#endif
 };
 
 
@@ -438,6 +471,7 @@ union GCUnion
 #define gco2p(o)  check_exp((o)->tt == LUA_VPROTO, &((cast_u(o))->p))
 #define gco2th(o)  check_exp((o)->tt == LUA_VTHREAD, &((cast_u(o))->th))
 #define gco2upv(o)	check_exp((o)->tt == LUA_VUPVAL, &((cast_u(o))->upv))
+#define gco2ib(o)  check_exp((o)->tt == LUA_VNUMINT, &((cast_u(o))->ib))
 
 
 /*
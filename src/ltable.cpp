@@ -21,10 +21,30 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** With LUA_USE_SWISSHASH, the hash part uses open addressing over groups
+** of control bytes instead (see "Control bytes" below).
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
+
+#if defined(LUA_USE_SWISSHASH)
+#include <bit>
+#if defined(__SSE2__) || defined(_M_X64) || \
+		(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LUAI_CTRLSSE2
+#endif
+/* start loading a node that a search will probably need */
+#if defined(__GNUC__)
+#define prefetchnode(n)	__builtin_prefetch(n)
+#elif defined(LUAI_CTRLSSE2)
+#define prefetchnode(n)	_mm_prefetch(cast(const char *, n), _MM_HINT_T0)
+#else
+#define prefetchnode(n)	((void)0)
+#endif
+#endif
 
 #include "lua.hpp"
 
@@ -90,17 +110,28 @@
 
 #define dummynode		(&dummynode_)
 
+#if !defined(LUA_USE_NANBOX)
 static const Node dummynode_ = {
 	{
 		{NULL}, LUA_VEMPTY, /* value's value and type */
 		LUA_VNIL, 0, {NULL}
 	} /* key type, next, and key value */
 };
+#else
+static const Node dummynode_ = {
+	{
+		EMPTYCONSTANT, /* value */
+		{nbbox(NBMISC, LUA_VNIL)}, 0
+	} /* key and next */
+};
+#endif
 
 
 static const TValue absentkey = {ABSTKEYCONSTANT};
 
 
+#if !defined(LUA_USE_SWISSHASH)
+
 /*
 ** Hash for integers. To allow a good hash, use the remainder operator
 ** ('%'). If integer fits as a non-negative int, compute an int
@@ -116,6 +147,8 @@ static Node *hashint(const Table *t, lua_Integer i)
 		return hashmod(t, ui);
 }
 
+#endif
+
 
 /*
 ** Hash for floating-point numbers.
@@ -152,6 +185,8 @@ static int l_hashfloat(lua_Number n)
 #endif
 
 
+#if !defined(LUA_USE_SWISSHASH)
+
 /*
 ** returns the 'main' position of an element in a table (that is,
 ** the index of its hash value).
@@ -203,6 +238,186 @@ l_sinline Node *mainpositionfromnode(const Table *t, Node *nd)
 	return mainpositionTV(t, &key);
 }
 
+#else
+
+/*
+** {=============================================================
+** Control bytes
+** ==============================================================
+*/
+
+/*
+** With LUA_USE_SWISSHASH, collisions in the hash part are resolved by
+** open addressing. Besides 'node', a table keeps an array 'ctrl' with a
+** control byte per node: CTRLEMPTY for a free node, or seven bits of the
+** hash of its key (its "tag") for a used one. A search loads CTRLGROUP
+** control bytes at once and compares all of them with the tag of the
+** key, so that only nodes with a matching tag have their keys compared;
+** it ends at the first group with a free node. The first CTRLGROUP - 1
+** control bytes are cloned after the last one, so that a group can
+** start at any node, wrapping around the array.
+** As with chaining, nodes never move and keys are never removed (a
+** removed entry keeps its key with an empty value, which a rehash will
+** drop), so there are no tombstones. At most 7/8 of the nodes can be
+** used; 'growthleft' counts the free nodes that still can be.
+*/
+
+#define CTRLEMPTY	cast_byte(0x80)
+
+/* maximum number of used nodes in a hash part with 'n' nodes */
+#define maxload(n)	((n) - (n) / 8)
+
+/* tag and initial position for a hash value */
+#define ctrltag(h)	cast_byte((h) & 0x7f)
+#define ctrlpos(h)	cast_uint((h) >> 7)
+
+
+/* bit mask with one bit for each control byte in a group */
+typedef unsigned int GroupMask;
+
+#if defined(LUAI_CTRLSSE2)
+
+/* control bytes in group 'g' equal to 'c' */
+l_sinline GroupMask matchctrl(const lu_byte *g, lu_byte c)
+{
+	__m128i grp = _mm_loadu_si128(cast(const __m128i *, g));
+	__m128i eq = _mm_cmpeq_epi8(grp, _mm_set1_epi8(cast(char, c)));
+	return cast_uint(_mm_movemask_epi8(eq));
+}
+
+/* free nodes in group 'g' (CTRLEMPTY is the only byte with its high bit) */
+l_sinline GroupMask matchempty(const lu_byte *g)
+{
+	__m128i grp = _mm_loadu_si128(cast(const __m128i *, g));
+	return cast_uint(_mm_movemask_epi8(grp));
+}
+
+#else
+
+l_sinline GroupMask matchctrl(const lu_byte *g, lu_byte c)
+{
+	GroupMask m = 0;
+	for (int i = 0; i < CTRLGROUP; i++)
+		m |= cast_uint(g[i] == c) << i;
+	return m;
+}
+
+l_sinline GroupMask matchempty(const lu_byte *g)
+{
+	return matchctrl(g, CTRLEMPTY);
+}
+
+#endif
+
+
+/*
+** Spread the bits of a raw hash, so that both the tag and the position
+** depend on all of them. (Integer keys and pointers, in particular, have
+** very regular low bits.)
+*/
+l_sinline lua_Unsigned mixhash(lua_Unsigned h)
+{
+	h *= 0x9E3779B97F4A7C15u;
+	return h ^ (h >> 32);
+}
+
+
+static lua_Unsigned keyhash(const TValue *key)
+{
+	switch (ttypetag(key))
+	{
+		case LUA_VNUMINT:
+			return mixhash(l_castS2U(ivalue(key)));
+		case LUA_VNUMFLT:
+			return mixhash(cast_uint(l_hashfloat(fltvalue(key))));
+		case LUA_VSHRSTR:
+			return mixhash(tsvalue(key)->hash);
+		case LUA_VLNGSTR:
+			return mixhash(luaS::hashlongstr(tsvalue(key)));
+		case LUA_VFALSE:
+			return mixhash(0);
+		case LUA_VTRUE:
+			return mixhash(1);
+		case LUA_VLIGHTUSERDATA:
+			return mixhash(cast(L_P2I, pvalue(key)));
+		case LUA_VLCF:
+			return mixhash(cast(L_P2I, fvalue(key)));
+		default:
+			return mixhash(cast(L_P2I, gcvalue(key)));
+	}
+}
+
+
+/*
+** Search the hash part of 't' for a node with hash 'h' satisfying 'eq'.
+** Groups are probed at 'pos', 'pos + CTRLGROUP', 'pos + 3*CTRLGROUP',
+** 'pos + 6*CTRLGROUP', ... (modulo the size), a sequence that covers
+** all nodes in 'sizenode(t) / CTRLGROUP' steps; so, the search also
+** ends when the table has no free nodes.
+** Many keys are in the node at 'pos' itself, which is prefetched so
+** that it loads while the control bytes are checked (misses, which
+** usually end there, do not wait for it).
+*/
+template<typename Eq>
+l_sinline const TValue *findslot(const Table *t, lua_Unsigned h, Eq eq)
+{
+	if (t->isdummy())
+		return &absentkey;
+	unsigned int mask = sizenode(t) - 1;
+	unsigned int pos = ctrlpos(h) & mask;
+	lu_byte tag = ctrltag(h);
+	prefetchnode(gnode(t, pos));
+	for (unsigned int step = CTRLGROUP;; step += CTRLGROUP)
+	{
+		const lu_byte *g = t->ctrl + pos;
+		for (GroupMask m = matchctrl(g, tag); m != 0; m &= m - 1)
+		{
+			Node *n = gnode(t, (pos + std::countr_zero(m)) & mask);
+			if (eq(n))
+				return gval(n); /* that's it */
+		}
+		if (matchempty(g) != 0 || step > mask)
+			return &absentkey; /* not found */
+		pos = (pos + step) & mask;
+	}
+}
+
+
+/* set the control byte of node 'i' (and its clone, if any) */
+l_sinline void setctrl(Table *t, unsigned int i, lu_byte c)
+{
+	unsigned int size = sizenode(t);
+	t->ctrl[i] = c;
+	for (unsigned int j = i; j < CTRLGROUP - 1; j += size)
+		t->ctrl[size + j] = c;
+}
+
+
+/*
+** Take the first free node in the probe sequence of hash 'h' for a new
+** key. The caller ensures there is one ('growthleft > 0').
+*/
+static Node *claimslot(Table *t, lua_Unsigned h)
+{
+	unsigned int mask = sizenode(t) - 1;
+	unsigned int pos = ctrlpos(h) & mask;
+	GroupMask m;
+	lua_assert(t->growthleft > 0);
+	for (unsigned int step = CTRLGROUP;
+			(m = matchempty(t->ctrl + pos)) == 0; step += CTRLGROUP)
+		pos = (pos + step) & mask;
+	pos = (pos + std::countr_zero(m)) & mask;
+	setctrl(t, pos, ctrltag(h));
+	t->growthleft--;
+	return gnode(t, pos);
+}
+
+/*
+** }=============================================================
+*/
+
+#endif
+
 
 /*
 ** Check whether key 'k1' is equal to the key in node 'n2'. This
@@ -224,6 +439,8 @@ l_sinline Node *mainpositionfromnode(const Table *t, Node *nd)
 ** positive does not break anything.  (In particular, 'next' will return
 ** some other valid item on the table or nil.)
 */
+#if !defined(LUA_USE_NANBOX)
+
 static int equalkey(const TValue *k1, const Node *n2, int deadok)
 {
 	if ((rawtt(k1) != keytt(n2)) && /* not the same variants? */
@@ -250,6 +467,30 @@ static int equalkey(const TValue *k1, const Node *n2, int deadok)
 	}
 }
 
+#else
+
+/*
+** With NaN-boxed values, equal keys have equal words, except for long
+** strings (compared by contents) and integers (boxed integers never
+** have the same value as an unboxed one, but two boxes may hold the
+** same value). A dead key keeps the payload of its original value.
+*/
+static int equalkey(const TValue *k1, const Node *n2, int deadok)
+{
+	const TValue *k2 = nodekey(n2);
+	if (val_(k1) == val_(k2))
+		return 1;
+	if (keyisdead(n2))
+		return (deadok && iscollectable(k1) && gcvalue(k1) == gckey(n2));
+	if (ttislngstring(k1) && ttislngstring(k2))
+		return luaS::eqlngstr(tsvalue(k1), tsvalue(k2));
+	if (isintbox(k1) && isintbox(k2))
+		return (ivalue(k1) == ivalue(k2));
+	return 0;
+}
+
+#endif
+
 
 /*
 ** True if value of 'alimit' is equal to the real size of the array
@@ -309,6 +550,150 @@ static unsigned int setlimittosize(Table *t)
 #define limitasasize(t)	check_exp(isrealasize(t), t->alimit)
 
 
+/*
+** {=============================================================
+** Packed array parts
+** ==============================================================
+*/
+
+#if defined(LUA_USE_PACKEDARRAY)
+
+/* smallest array part worth packing */
+#if !defined(LUAI_MINPACK)
+#define LUAI_MINPACK	16
+#endif
+
+/* values marking absent entries */
+#define PACKEDNOFLT	cast_num(NAN)
+#define PACKEDNOINT	LUA_MININTEGER
+
+/* whether entry 'i' (0-based) of packed part 'p' is absent */
+#define packedempty(p,x)  ((p)->kind == LUA_VNUMFLT \
+	? luai_numisnan((p)->e[x].n) : (p)->e[x].i == PACKEDNOINT)
+
+/* mark entry 'i' (0-based) of packed part 'p' as absent */
+#define setpackedempty(p,x)  { if ((p)->kind == LUA_VNUMFLT) \
+	(p)->e[x].n = PACKEDNOFLT; else (p)->e[x].i = PACKEDNOINT; }
+
+/* whether packed part 'p' can hold value 'v' */
+#define canpack(p,v)  ((p)->kind == LUA_VNUMFLT \
+	? ttisfloat(v) && !luai_numisnan(fltvalue(v)) \
+	: ttisinteger(v) && packableint(ivalue(v)))
+
+
+LUAI_DDEF const TValue luaH_packedslot = {EMPTYCONSTANT};
+
+
+/*
+** Turn the packed array part of 't' back into TValues. Raises a memory
+** error with the table unchanged if the new part cannot be allocated.
+*/
+void luaH_unpackarray(lua_State *L, Table *t)
+{
+	PackedArray *p = t->packed;
+	unsigned int size = p->size;
+	TValue *array = luaM::newvector<TValue>(L, size);
+	for (unsigned int i = 0; i < size; i++)
+	{
+		if (!luaH_getpacked(t, i + 1, &array[i]))
+			setempty(&array[i]);
+	}
+	luaM::freemem(L, p, sizepacked(size));
+	t->flags &= cast_byte(~BITPACKED);
+	t->array = array;
+	t->alimit = size;
+	setrealasize(t);
+}
+
+
+/*
+** Pack the array part of 't' if it is large enough and all its entries
+** are floats or all are integers. Packing is an optimization, so it is
+** simply skipped if the packed part cannot be allocated.
+*/
+void luaH_packarray(lua_State *L, Table *t)
+{
+	lu_byte kind = LUA_VNIL; /* type of the entries seen so far */
+	if (ispacked(t))
+		return;
+	unsigned int size = setlimittosize(t);
+	if (size < LUAI_MINPACK)
+		return;
+	for (unsigned int i = 0; i < size; i++)
+	{
+		const TValue *v = &t->array[i];
+		if (isempty(v))
+			continue;
+		if (kind == LUA_VNIL && (ttisfloat(v) || ttisinteger(v)))
+			kind = ttypetag(v);
+		if (ttypetag(v) != kind ||
+			(kind == LUA_VNUMFLT ? luai_numisnan(fltvalue(v))
+			                     : !packableint(ivalue(v))))
+			return; /* entry cannot be packed */
+	}
+	if (kind == LUA_VNIL)
+		return; /* no entries to tell the type */
+	PackedArray *p = cast(PackedArray *,
+		luaM::realloc_(L, NULL, 0, sizepacked(size)));
+	if (p == NULL)
+		return;
+	p->size = size;
+	p->border = 0;
+	p->kind = kind;
+	for (unsigned int i = 0; i < size; i++)
+	{
+		const TValue *v = &t->array[i];
+		if (kind == LUA_VNUMFLT)
+			p->e[i].n = isempty(v) ? PACKEDNOFLT : fltvalue(v);
+		else
+			p->e[i].i = isempty(v) ? PACKEDNOINT : ivalue(v);
+	}
+	luaM::freearray(L, t->array, size);
+	t->packed = p;
+	t->flags |= BITPACKED;
+	t->alimit = 0;
+}
+
+
+/*
+** Store 'value' into entry 'key' of the packed array part of 't',
+** unpacking the part if it cannot hold the value. (Packed entries are
+** not collectable, so there is no barrier to check.)
+*/
+static void setpacked(lua_State *L, Table *t, lua_Integer key,
+							 TValue *value)
+{
+	PackedArray *p = t->packed;
+	if (ttisnil(value))
+	{
+		/* remove the entry */
+		setpackedempty(p, key - 1);
+	}
+	else if (!luaH_setpacked(t, key, value))
+	{
+		luaH_unpackarray(L, t);
+		setobj2t(L, &t->array[key - 1], value);
+	}
+}
+
+
+/* size of the array part for traversals, packed or not */
+static unsigned int traversalsize(const Table *t)
+{
+	return ispacked(t) ? t->packed->size : luaH_realasize(t);
+}
+
+#else
+
+#define traversalsize(t)	luaH_realasize(t)
+
+#endif
+
+/*
+** }=============================================================
+*/
+
+
 /*
 ** "Generic" get version. (Not that generic: not valid for integers,
 ** which may be in array part, nor for floats with integral values.)
@@ -316,6 +701,11 @@ static unsigned int setlimittosize(Table *t)
 */
 static const TValue *getgeneric(Table *t, const TValue *key, int deadok)
 {
+#if defined(LUA_USE_SWISSHASH)
+	return findslot(t, keyhash(key), [key, deadok](const Node *n) {
+		return equalkey(key, n, deadok);
+	});
+#else
 	Node *n = mainpositionTV(t, key);
 	for (;;)
 	{
@@ -327,6 +717,7 @@ static const TValue *getgeneric(Table *t, const TValue *key, int deadok)
 			return &absentkey; /* not found */
 		n += nx;
 	}
+#endif
 }
 
 
@@ -364,22 +755,64 @@ static unsigned int findindex(lua_State *L, Table *t, TValue *key,
 }
 
 
-int luaH_next(lua_State *L, Table *t, StkId key)
+/*
+** Puts in 'key' and 'key + 1' the first non-empty entry at or after
+** index 'i' (numbered as in 'findindex'). Returns the index following
+** that entry, or 0 if there are no more elements.
+*/
+static unsigned int nextfrom(lua_State *L, Table *t, StkId key,
+									  unsigned int i, unsigned int asize)
 {
-	unsigned int asize = luaH_realasize(t);
-	unsigned int i = findindex(L, t, s2v(key), asize); /* find original key */
+#if defined(LUA_USE_PACKEDARRAY)
+	if (ispacked(t))
+	{
+		for (; i < asize; i++)
+		{
+			/* try first the packed array part */
+			if (luaH_getpacked(t, i + 1, s2v(key + 1)))
+			{
+				/* a present entry? */
+				setivalue(L, s2v(key), i + 1);
+				return i + 1;
+			}
+		}
+	}
+#endif
 	for (; i < asize; i++)
 	{
 		/* try first array part */
 		if (!isempty(&t->array[i]))
 		{
 			/* a non-empty entry? */
-			setivalue(s2v(key), i + 1);
+			setivalue(L, s2v(key), i + 1);
 			setobj2s(L, key + 1, &t->array[i]);
-			return 1;
+			return i + 1;
+		}
+	}
+	i -= asize;
+#if defined(LUA_USE_SWISSHASH)
+	/* skip runs of free nodes by their control bytes */
+	for (unsigned int size = sizenode(t); !t->isdummy() && i < size; i++)
+	{
+		GroupMask m = ~matchempty(t->ctrl + i) & ((1u << CTRLGROUP) - 1);
+		if (m == 0)
+		{
+			/* whole group is free? */
+			i += CTRLGROUP - 1;
+			continue;
+		}
+		i += std::countr_zero(m);
+		if (i < size && !isempty(gval(gnode(t, i))))
+		{
+			/* a non-empty entry? */
+			Node *n = gnode(t, i);
+			getnodekey(L, s2v(key), n);
+			setobj2s(L, key + 1, gval(n));
+			return (i + 1) + asize;
 		}
 	}
-	for (i -= asize; cast_int(i) < sizenode(t); i++)
+#else
+	for (; cast_int(i) < sizenode(t); i++)
 	{
 		/* hash part */
 		if (!isempty(gval(gnode(t, i))))
@@ -388,17 +821,66 @@ int luaH_next(lua_State *L, Table *t, StkId key)
 			Node *n = gnode(t, i);
 			getnodekey(L, s2v(key), n);
 			setobj2s(L, key + 1, gval(n));
-			return 1;
+			return (i + 1) + asize;
 		}
 	}
+#endif
 	return 0; /* no more elements */
 }
 
 
+int luaH_next(lua_State *L, Table *t, StkId key)
+{
+	unsigned int asize = traversalsize(t);
+	unsigned int i = findindex(L, t, s2v(key), asize); /* find original key */
+	return (nextfrom(L, t, key, i, asize) != 0);
+}
+
+
+/*
+** Check whether entry 'i - 1' (numbered as in 'findindex') has key
+** 'key', so that a traversal can go on from index 'i'.
+*/
+static int iscursor(Table *t, const TValue *key, unsigned int i,
+						  unsigned int asize)
+{
+	if (i == 0)
+		return ttisnil(key);
+	else if (i <= asize)
+		return (ttisinteger(key) && l_castS2U(ivalue(key)) == i);
+	else
+	{
+		i -= asize + 1;
+		return (cast_int(i) < sizenode(t) && equalkey(key, gnode(t, i), 0));
+	}
+}
+
+
+/*
+** Variant of 'luaH_next' for loops: '*cursor' is the index returned by
+** the previous step of the traversal, which is used instead of searching
+** for 'key' as long as its entry still has that key. Updates '*cursor'.
+*/
+int luaH_nextcursor(lua_State *L, Table *t, StkId key, unsigned int *cursor)
+{
+	unsigned int asize = traversalsize(t);
+	unsigned int i = *cursor;
+	if (!iscursor(t, s2v(key), i, asize))
+		i = findindex(L, t, s2v(key), asize);
+	*cursor = nextfrom(L, t, key, i, asize);
+	return (*cursor != 0);
+}
+
+
 static void freehash(lua_State *L, Table *t)
 {
 	if (!t->isdummy())
+	{
+#if defined(LUA_USE_SWISSHASH)
+		luaM::freearray(L, t->ctrl, sizectrl(cast_sizet(sizenode(t))));
+#endif
 		luaM::freearray(L, t->node, cast_sizet(sizenode(t)));
+	}
 }
 
 
@@ -466,7 +948,7 @@ static unsigned int numusearray(const Table *t, unsigned int *nums)
 	unsigned int ttlg; /* 2^lg */
 	unsigned int ause = 0; /* summation of 'nums' */
 	unsigned int i = 1; /* count to traverse all array keys */
-	unsigned int asize = limitasasize(t); /* real array size */
+	unsigned int asize = traversalsize(t); /* real array size */
 	/* traverse each slice */
 	for (lg = 0, ttlg = 1; lg <= MAXABITS; lg++, ttlg *= 2)
 	{
@@ -481,7 +963,12 @@ static unsigned int numusearray(const Table *t, unsigned int *nums)
 		/* count elements in range (2^(lg - 1), 2^lg] */
 		for (; i <= lim; i++)
 		{
+#if defined(LUA_USE_PACKEDARRAY)
+			if (ispacked(t) ? !packedempty(t->packed, i - 1)
+			                : !isempty(&t->array[i-1]))
+#else
 			if (!isempty(&t->array[i-1]))
+#endif
 				lc++;
 		}
 		nums[lg] += lc;
@@ -525,11 +1012,21 @@ static void setnodevector(lua_State *L, Table *t, unsigned int size)
 		/* no elements to hash part? */
 		t->node = cast(Node *, dummynode); /* use common 'dummynode' */
 		t->lsizenode = 0;
+#if defined(LUA_USE_SWISSHASH)
+		t->ctrl = NULL; /* signal that it is using dummy node */
+		t->growthleft = 0;
+#else
 		t->lastfree = NULL; /* signal that it is using dummy node */
+#endif
 	}
 	else
 	{
 		int lsize = luaO_ceillog2(size);
+#if defined(LUA_USE_SWISSHASH)
+		/* 'size' keys must fit under the load limit */
+		if (lsize <= MAXHBITS && cast_uint(maxload(twoto(lsize))) < size)
+			lsize++;
+#endif
 		if (lsize > MAXHBITS || (1u << lsize) > MAXHSIZE)
 			luaG_runerror(L, "table overflow");
 		size = twoto(lsize);
@@ -542,7 +1039,19 @@ static void setnodevector(lua_State *L, Table *t, unsigned int size)
 			setempty(gval(n));
 		}
 		t->lsizenode = cast_byte(lsize);
+#if defined(LUA_USE_SWISSHASH)
+		t->ctrl = luaM::reallocvector<lu_byte>(L, NULL, 0, sizectrl(size));
+		if (l_unlikely(t->ctrl == NULL))
+		{
+			/* allocation failed? */
+			luaM::freearray(L, t->node, size);
+			luaD::lthrow(L, LUA_ERRMEM);
+		}
+		memset(t->ctrl, CTRLEMPTY, sizectrl(size)); /* all nodes are free */
+		t->growthleft = maxload(size);
+#else
 		t->lastfree = gnode(t, size); /* all positions are free */
+#endif
 	}
 }
 
@@ -575,15 +1084,101 @@ static void exchangehashpart(Table *t1, Table *t2)
 {
 	lu_byte lsizenode = t1->lsizenode;
 	Node *node = t1->node;
-	Node *lastfree = t1->lastfree;
 	t1->lsizenode = t2->lsizenode;
 	t1->node = t2->node;
-	t1->lastfree = t2->lastfree;
 	t2->lsizenode = lsizenode;
 	t2->node = node;
+#if defined(LUA_USE_SWISSHASH)
+	lu_byte *ctrl = t1->ctrl;
+	unsigned int growthleft = t1->growthleft;
+	t1->ctrl = t2->ctrl;
+	t1->growthleft = t2->growthleft;
+	t2->ctrl = ctrl;
+	t2->growthleft = growthleft;
+#else
+	Node *lastfree = t1->lastfree;
+	t1->lastfree = t2->lastfree;
 	t2->lastfree = lastfree;
+#endif
+}
+
+
+#if defined(LUA_USE_PACKEDARRAY)
+
+/*
+** Resize a table with a packed array part in place, as 'luaH_resize'
+** (below) does with a plain one: entries of a vanishing slice go to
+** the new hash part, and new entries are marked absent. Returns false,
+** with the table unchanged, if the part would not stay packed (it
+** would be too small, or the old hash part has an entry moving into it
+** that it cannot hold); the caller then unpacks the part first.
+*/
+static int resizepacked(lua_State *L, Table *t, unsigned int newasize,
+						unsigned int nhsize)
+{
+	PackedArray *p = t->packed;
+	unsigned int oldasize = p->size;
+	unsigned int i;
+	Table newt; /* to keep the new hash part */
+	if (newasize < LUAI_MINPACK)
+		return 0;
+	for (int j = 0; j < sizenode(t); j++)
+	{
+		Node *n = gnode(t, j);
+		if (!isempty(gval(n)) && keyisinteger(n) &&
+			l_castS2U(keyival(n)) - 1u < newasize && !canpack(p, gval(n)))
+			return 0; /* entry cannot move into the part */
+	}
+	setnodevector(L, &newt, nhsize);
+	if (newasize < oldasize)
+	{
+		/* will the part shrink? */
+		p->size = newasize; /* pretend it has new size... */
+		exchangehashpart(t, &newt); /* and new hash */
+		for (i = newasize; i < oldasize; i++)
+		{
+			if (!packedempty(p, i))
+			{
+				TValue v;
+				if (p->kind == LUA_VNUMFLT)
+				{
+					setfltvalue(&v, p->e[i].n);
+				}
+				else
+				{
+					setinlineivalue(&v, p->e[i].i);
+				}
+				luaH_setint(L, t, i + 1, &v);
+			}
+		}
+		p->size = oldasize; /* restore current size... */
+		exchangehashpart(t, &newt); /* and hash (in case of errors) */
+	}
+	if (newasize != oldasize)
+	{
+		PackedArray *np = cast(PackedArray *, luaM::realloc_(L, p,
+			sizepacked(oldasize), sizepacked(newasize)));
+		if (l_unlikely(np == NULL))
+		{
+			/* allocation failed? */
+			freehash(L, &newt); /* release new hash part */
+			luaD::lthrow(L, LUA_ERRMEM); /* raise error (with part unchanged) */
+		}
+		p = t->packed = np;
+		p->size = newasize;
+		for (i = oldasize; i < newasize; i++) /* clear new slice of the part */
+			setpackedempty(p, i);
+	}
+	exchangehashpart(t, &newt); /* 't' has the new hash ('newt' has the old) */
+	/* re-insert elements from old hash part into new parts */
+	reinsert(L, &newt, t); /* 'newt' now has the old hash */
+	freehash(L, &newt); /* free old hash part */
+	luaH_newversion(L, t);
+	return 1;
 }
 
+#endif
+
 
 /*
 ** Resize table 't' for the new given sizes. Both allocations (for
@@ -597,12 +1192,24 @@ static void exchangehashpart(Table *t1, Table *t2)
 ** into the table, initializes the new part of the array (if any) with
 ** nils and reinserts the elements of the old hash back into the new
 ** parts of the table.
+** The inline caches of the interpreter (see 'getshortstrIC' in lvm.c)
+** hold only node indices, which are checked against the node array at
+** each use; so, moving nodes around here invalidates them for free.
+** Global caches rely on the table version instead, which is renewed.
 */
 void luaH_resize(lua_State *L, Table *t, unsigned int newasize,
 						unsigned int nhsize)
 {
 	unsigned int i;
 	Table newt; /* to keep the new hash part */
+#if defined(LUA_USE_PACKEDARRAY)
+	if (ispacked(t))
+	{
+		if (resizepacked(L, t, newasize, nhsize))
+			return;
+		luaH_unpackarray(L, t); /* resize it as a plain array part */
+	}
+#endif
 	unsigned int oldasize = setlimittosize(t);
 	/* create new hash part with appropriate size into 'newt' */
 	setnodevector(L, &newt, nhsize);
@@ -637,6 +1244,7 @@ void luaH_resize(lua_State *L, Table *t, unsigned int newasize,
 	/* re-insert elements from old hash part into new parts */
 	reinsert(L, &newt, t); /* 'newt' now has the old hash */
 	freehash(L, &newt); /* free old hash part */
+	luaH_newversion(L, t);
 }
 
 
@@ -669,6 +1277,9 @@ static void rehash(lua_State *L, Table *t, const TValue *ek)
 	asize = computesizes(nums, &na);
 	/* resize the table to new computed sizes */
 	luaH_resize(L, t, asize, totaluse - na);
+#if defined(LUA_USE_PACKEDARRAY)
+	luaH_packarray(L, t);
+#endif
 }
 
 
@@ -686,6 +1297,7 @@ Table *luaH_newt(lua_State *L)
 	t->array = nullptr;
 	t->alimit = 0;
 	setnodevector(L, t, 0);
+	luaH_newversion(L, t);
 	return t;
 }
 
@@ -693,11 +1305,18 @@ Table *luaH_newt(lua_State *L)
 void luaH_free(lua_State *L, Table *t)
 {
 	freehash(L, t);
-	luaM::freearray(L, t->array, luaH_realasize(t));
+#if defined(LUA_USE_PACKEDARRAY)
+	if (ispacked(t))
+		luaM::freemem(L, t->packed, sizepacked(t->packed->size));
+	else
+#endif
+		luaM::freearray(L, t->array, luaH_realasize(t));
 	luaM::free(L, t);
 }
 
 
+#if !defined(LUA_USE_SWISSHASH)
+
 static Node *getfreepos(Table *t)
 {
 	if (!t->isdummy())
@@ -712,6 +1331,8 @@ static Node *getfreepos(Table *t)
 	return nullptr; /* could not find a free place */
 }
 
+#endif
+
 
 /*
 ** inserts a new key into a hash table; first, check whether key's main
@@ -719,6 +1340,8 @@ static Node *getfreepos(Table *t)
 ** position or not: if it is not, move colliding node to an empty place and
 ** put new key in its main position; otherwise (colliding node is in its main
 ** position), new key goes to an empty position.
+** (With LUA_USE_SWISSHASH, the new key simply goes to the first free
+** node in its probe sequence, unless the table is at its load limit.)
 */
 static void luaH_newkey(lua_State *L, Table *t, const TValue *key,
 								TValue *value)
@@ -734,7 +1357,7 @@ static void luaH_newkey(lua_State *L, Table *t, const TValue *key,
 		if (luaV_flttointeger(f, &k, F2Ieq))
 		{
 			/* does key fit in an integer? */
-			setivalue(&aux, k);
+			setivalue(L, &aux, k);
 			key = &aux; /* insert it as an integer */
 		}
 		else if (l_unlikely(luai_numisnan(f)))
@@ -742,6 +1365,17 @@ static void luaH_newkey(lua_State *L, Table *t, const TValue *key,
 	}
 	if (ttisnil(value))
 		return; /* do not insert nil values */
+#if defined(LUA_USE_SWISSHASH)
+	if (t->growthleft == 0)
+	{
+		/* no free node under the load limit? */
+		rehash(L, t, key); /* grow table */
+		/* whatever called 'newkey' takes care of TM cache */
+		luaH_set(L, t, key, value); /* insert key into grown table */
+		return;
+	}
+	mp = claimslot(t, keyhash(key));
+#else
 	mp = mainpositionTV(t, key);
 	if (!isempty(gval(mp)) || t->isdummy())
 	{
@@ -785,7 +1419,9 @@ static void luaH_newkey(lua_State *L, Table *t, const TValue *key,
 			mp = f;
 		}
 	}
+#endif
 	setnodekey(L, mp, key);
+	luaH_newversion(L, t);
 	luaC_barrierback(L, obj2gco(t), key);
 	lua_assert(isempty(gval(mp)));
 	setobj2t(L, gval(mp), value);
@@ -825,7 +1461,16 @@ const TValue *luaH_getint(Table *t, lua_Integer key)
 		t->alimit = cast_uint(key); /* probably '#t' is here now */
 		return &t->array[key - 1];
 	}
+#if defined(LUA_USE_PACKEDARRAY)
+	if (ispacked(t) && l_castS2U(key) - 1u < t->packed->size)
+		return &luaH_packedslot; /* key is in the packed array part */
+#endif
 	/* key is not in the array part; check the hash */
+#if defined(LUA_USE_SWISSHASH)
+	return findslot(t, mixhash(l_castS2U(key)), [key](const Node *n) {
+		return keyisinteger(n) && keyival(n) == key;
+	});
+#else
 	Node *n = hashint(t, key);
 	for (;;)
 	{
@@ -837,6 +1482,7 @@ const TValue *luaH_getint(Table *t, lua_Integer key)
 		n += nx;
 	}
 	return &absentkey;
+#endif
 }
 
 
@@ -845,8 +1491,13 @@ const TValue *luaH_getint(Table *t, lua_Integer key)
 */
 const TValue *luaH_getshortstr(Table *t, TString *key)
 {
-	Node *n = hashstr(t, key);
 	lua_assert(key->tt == LUA_VSHRSTR);
+#if defined(LUA_USE_SWISSHASH)
+	return findslot(t, mixhash(key->hash), [key](const Node *n) {
+		return keyisshrstr(n) && eqshrstr(keystrval(n), key);
+	});
+#else
+	Node *n = hashstr(t, key);
 	for (;;)
 	{
 		/* check whether 'key' is somewhere in the chain */
@@ -857,6 +1508,7 @@ const TValue *luaH_getshortstr(Table *t, TString *key)
 			return &absentkey; /* not found */
 		n += nx;
 	}
+#endif
 }
 
 
@@ -904,6 +1556,10 @@ void luaH_finishset(lua_State *L, Table *t, const TValue *key,
 {
 	if (isabstkey(slot))
 		luaH_newkey(L, t, key, value);
+#if defined(LUA_USE_PACKEDARRAY)
+	else if (ispackedslot(slot))
+		setpacked(L, t, packedkey(key), value);
+#endif
 	else
 		setobj2t(L, cast(TValue *, slot), value);
 }
@@ -926,9 +1582,13 @@ void luaH_setint(lua_State *L, Table *t, lua_Integer key, TValue *value)
 	if (isabstkey(p))
 	{
 		TValue k;
-		setivalue(&k, key);
+		setivalue(L, &k, key);
 		luaH_newkey(L, t, &k, value);
 	}
+#if defined(LUA_USE_PACKEDARRAY)
+	else if (ispackedslot(p))
+		setpacked(L, t, key, value);
+#endif
 	else
 		setobj2t(L, cast(TValue *, p), value);
 }
@@ -992,6 +1652,52 @@ static unsigned int binsearch(const TValue *array, unsigned int i,
 }
 
 
+#if defined(LUA_USE_PACKEDARRAY)
+
+/*
+** Find a boundary in a table with a packed array part. Its field
+** 'border' keeps the last boundary found inside the part; it is tried
+** first, and so is the next index (after 't[#t + 1] = v').
+*/
+static lua_Unsigned packedgetn(Table *t)
+{
+	PackedArray *p = t->packed;
+	unsigned int size = p->size;
+	unsigned int b = p->border;
+	/* is 't[k]' present? (for 0 < k <= size) */
+#define present(k)	(!packedempty(p, (k) - 1))
+	for (unsigned int hint = b; hint <= b + 1 && hint < size; hint++)
+	{
+		if ((hint == 0 || present(hint)) && !present(hint + 1))
+		{
+			p->border = hint;
+			return hint;
+		}
+	}
+	if (present(size))
+	{
+		/* whole part is in use; check the hash part */
+		if (t->isdummy() || isempty(luaH_getint(t, cast(lua_Integer, size) + 1)))
+			return size; /* 'size + 1' is absent */
+		else
+			return hash_search(t, size);
+	}
+	/* there is a boundary in [0, size); do a binary search */
+	unsigned int i = 0, j = size;
+	while (j - i > 1u)
+	{
+		unsigned int m = (i + j) / 2;
+		if (present(m)) i = m;
+		else j = m;
+	}
+#undef present
+	p->border = i;
+	return i;
+}
+
+#endif
+
+
 /*
 ** Try to find a boundary in table 't'. (A 'boundary' is an integer index
 ** such that t[i] is present and t[i+1] is absent, or 0 if t[1] is absent
@@ -1026,6 +1732,10 @@ static unsigned int binsearch(const TValue *array, unsigned int i,
 */
 lua_Unsigned luaH_getn(Table *t)
 {
+#if defined(LUA_USE_PACKEDARRAY)
+	if (ispacked(t))
+		return packedgetn(t);
+#endif
 	unsigned int limit = t->alimit;
 	if (limit > 0 && isempty(&t->array[limit - 1]))
 	{
@@ -1089,7 +1799,11 @@ lua_Unsigned luaH_getn(Table *t)
 /* export these functions for the test library */
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
+#if defined(LUA_USE_SWISSHASH)
+  return gnode(t, ctrlpos(keyhash(key)) & (sizenode(t) - 1));
+#else
   return mainpositionTV(t, key);
+#endif
 }
 
 #endif
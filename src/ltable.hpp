@@ -26,10 +26,83 @@
 #define allocsizenode(t)	((t)->isdummy() ? 0 : sizenode(t))
 
 
+#if defined(LUA_USE_PACKEDARRAY)
+
+/* bytes allocated for a packed array part with 'n' entries */
+#define sizepacked(n) \
+	(offsetof(PackedArray, e) + cast_sizet(n) * sizeof(PackedEntry))
+
+/* bytes allocated for the array part */
+#define arraypartsize(t) (ispacked(t) \
+	? sizepacked((t)->packed->size) : luaH_realasize(t) * sizeof(TValue))
+
+
+/*
+** Entries of a packed array part are not TValues, so 'luaH_getint' (and
+** 'luaH_get') answer keys inside it with 'luaH_packedslot'. That slot is
+** empty, so fast paths fail on it; the code they fall back to reads the
+** entry with 'luaH_getpacked' and writes it with 'luaH_finishset' (or
+** 'luaH_setpacked'), giving it the key as 'packedkey(k)'.
+*/
+LUAI_DDEC(const TValue luaH_packedslot;)
+
+#define ispackedslot(s)	((s) == &luaH_packedslot)
+
+/* key answered by 'luaH_packedslot' (an integer or an integral float) */
+#define packedkey(k) \
+	(ttisinteger(k) ? ivalue(k) : cast(lua_Integer, fltvalue(k)))
+
+/*
+** Integers a packed array part can hold: all but the one marking absent
+** entries. With NaN-boxed values, only those that need no box (so that
+** reading an entry never allocates).
+*/
+#if !defined(LUA_USE_NANBOX)
+#define packableint(i)	((i) != LUA_MININTEGER)
+#else
+#define packableint(i)	nbintfits(i)
+#endif
+
+#else
+
+#define arraypartsize(t)	(luaH_realasize(t) * sizeof(TValue))
+
+#endif
+
+
+#if defined(LUA_USE_SWISSHASH)
+
+/* number of control bytes probed together */
+#define CTRLGROUP	16
+
+/* number of control bytes of a hash part with 'n' nodes */
+#define sizectrl(n)	((n) + CTRLGROUP)
+
+/* bytes allocated for the hash part */
+#define hashpartsize(t) \
+	((t)->isdummy() ? 0 : sizenode(t) * sizeof(Node) + sizectrl(sizenode(t)))
+
+#else
+
+/* bytes allocated for the hash part */
+#define hashpartsize(t)	(allocsizenode(t) * sizeof(Node))
+
+#endif
+
+
 /* returns the Node, given the value of a table entry */
 #define nodefromval(v)	cast(Node *, (v))
 
 
+/*
+** Give table 't' a new version. It must be called whenever a key is
+** inserted in its hash part, the hash part is rebuilt or the table
+** gets a new metatable. Versions come from a per-state counter, so no
+** two tables (nor two layouts of the same table) share a version.
+*/
+#define luaH_newversion(L,t)	((t)->version = ++G(L)->tabversion)
+
+
 LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
@@ -46,9 +119,71 @@ LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC int luaH_nextcursor (lua_State *L, Table *t, StkId key,
+                                unsigned int *cursor);
 LUAI_FUNC lua_Unsigned luaH_getn (Table *t);
 LUAI_FUNC unsigned int luaH_realasize (const Table *t);
 
+#if defined(LUA_USE_PACKEDARRAY)
+
+LUAI_FUNC void luaH_packarray (lua_State *L, Table *t);
+LUAI_FUNC void luaH_unpackarray (lua_State *L, Table *t);
+
+
+/*
+** Copy entry 'key' (answered by 'luaH_packedslot') of the packed array
+** part of 't' into 'res'. Returns false, leaving 'res' untouched, if the
+** entry is absent.
+*/
+inline int luaH_getpacked (Table *t, lua_Integer key, TValue *res)
+{
+	PackedArray *p = t->packed;
+	lua_assert(ispacked(t) && l_castS2U(key) - 1u < p->size);
+	if (p->kind == LUA_VNUMFLT)
+	{
+		lua_Number n = p->e[key - 1].n;
+		if (luai_numisnan(n))
+			return 0;
+		setfltvalue(res, n);
+	}
+	else
+	{
+		lua_Integer i = p->e[key - 1].i;
+		if (i == LUA_MININTEGER)
+			return 0;
+		setinlineivalue(res, i); /* 'packableint' */
+	}
+	return 1;
+}
+
+
+/*
+** Store 'value' into entry 'key' (answered by 'luaH_packedslot') of the
+** packed array part of 't', if it is a number the part can hold. Returns
+** false otherwise; 'luaH_finishset' handles the other values (including
+** nil, which removes the entry).
+*/
+inline int luaH_setpacked (Table *t, lua_Integer key, const TValue *value)
+{
+	PackedArray *p = t->packed;
+	lua_assert(ispacked(t) && l_castS2U(key) - 1u < p->size);
+	if (p->kind == LUA_VNUMFLT)
+	{
+		if (!ttisfloat(value) || luai_numisnan(fltvalue(value)))
+			return 0;
+		p->e[key - 1].n = fltvalue(value);
+	}
+	else
+	{
+		if (!ttisinteger(value) || !packableint(ivalue(value)))
+			return 0;
+		p->e[key - 1].i = ivalue(value);
+	}
+	return 1;
+}
+
+#endif
+
 
 #if defined(LUA_DEBUG)
 LUAI_FUNC Node *luaH_mainposition (const Table *t, const TValue *key);
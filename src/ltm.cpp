@@ -207,7 +207,7 @@ void luaT_trybiniTM(lua_State *L, const TValue *p1, lua_Integer i2,
 							int flip, StkId res, TMS event)
 {
 	TValue aux;
-	setivalue(&aux, i2);
+	setivalue(L, &aux, i2);
 	luaT_trybinassocTM(L, p1, &aux, flip, res, event);
 }
 
@@ -252,7 +252,7 @@ int luaT_callorderiTM(lua_State *L, const TValue *p1, int v2,
 		setfltvalue(&aux, cast_num(v2));
 	}
 	else
-		setivalue(&aux, v2);
+		setivalue(L, &aux, v2);
 	if (flip)
 	{
 		/* arguments were exchanged? */
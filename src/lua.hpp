@@ -344,21 +344,117 @@ constexpr auto LUA_GCSETSTEPMUL = 7;
 constexpr auto LUA_GCISRUNNING  = 9;
 constexpr auto LUA_GCGEN        = 10;
 constexpr auto LUA_GCINC        = 11;
+constexpr auto LUA_GCBUDGET     = 12;
+constexpr auto LUA_GCPARALLEL   = 13;
+constexpr auto LUA_GCBGFREE     = 14;
+constexpr auto LUA_GCFINQUEUE   = 15;
+constexpr auto LUA_GCFINALIZE   = 16;
 
 LUA_APIA lua_gc(lua_State *L, int what, ...) -> int;
 
 
+/*
+** garbage-collection statistics, collected when the library is built
+** with LUA_USE_GCSTATS; times are in nanoseconds
+*/
+
+constexpr auto LUA_GCPHPROPAGATE = 0; /* marking, between cycles too */
+constexpr auto LUA_GCPHATOMIC    = 1;
+constexpr auto LUA_GCPHSWEEP     = 2;
+constexpr auto LUA_GCPHFINALIZE  = 3; /* calling finalizers */
+constexpr auto LUA_GCPHYOUNG     = 4; /* young collections (but their atomic) */
+constexpr auto LUA_GCPHOTHER     = 5; /* bookkeeping between phases */
+constexpr auto LUA_GCNPHASES     = 6;
+
+constexpr auto LUA_GCHISTSIZE    = 32;
+
+struct lua_GCStats
+{
+	lua_Unsigned phasens[LUA_GCNPHASES]; /* time spent in each phase */
+	lua_Unsigned traversed; /* bytes of objects traversed by the marker */
+	lua_Unsigned freedobjs; /* objects freed by sweeps */
+	lua_Unsigned freedbytes; /* memory of those objects */
+	lua_Unsigned nsteps; /* number of collector steps */
+	lua_Unsigned maxstepns; /* duration of the longest step */
+	lua_Unsigned stephist[LUA_GCHISTSIZE]; /* steps taking [2^i, 2^(i+1)) ns */
+};
+
+LUA_APIA lua_gcstats(lua_State *L, lua_GCStats *stats, int reset) -> int;
+
+
+/*
+** finalizer statistics; with LUA_GCFINQUEUE on, 'pending' finalizers
+** wait for LUA_GCFINALIZE
+*/
+
+struct lua_FinStats
+{
+	lua_Unsigned pending; /* objects waiting for their finalizers */
+	lua_Unsigned maxpending; /* largest value of 'pending' */
+	lua_Unsigned queued; /* objects that became ready for finalization */
+	lua_Unsigned finalized; /* finalizers called */
+	lua_Unsigned errors; /* finalizers that raised errors */
+};
+
+LUA_APIA lua_finstats(lua_State *L, lua_FinStats *stats, int reset) -> void;
+
+
+/*
+** heap snapshots: a stream of records describing every collectable
+** object, its references, and the roots (the format is described
+** in lgc.c)
+*/
+
+#define LUA_SNAPSIGNATURE	"\x1bLuaHeap"
+constexpr auto LUA_SNAPVERSION   = 1;
+
+/* record tags */
+constexpr auto LUA_SNAPOBJECT    = 'O';
+constexpr auto LUA_SNAPEDGE      = 'E';
+constexpr auto LUA_SNAPROOT      = 'R';
+constexpr auto LUA_SNAPEND       = 'Z';
+
+/* object flags */
+constexpr auto LUA_SNAPFWEAKK    = 1; /* table with weak keys */
+constexpr auto LUA_SNAPFWEAKV    = 2; /* table with weak values */
+constexpr auto LUA_SNAPFFINALIZE = 4; /* object marked for finalization */
+
+/* edge kinds (meaning of the edge's 'aux' in comments) */
+constexpr auto LUA_SNAPEFIELD    = 0; /* table value (id of its string key) */
+constexpr auto LUA_SNAPEINDEX    = 1; /* table value (its positive integer key) */
+constexpr auto LUA_SNAPEVALUE    = 2; /* table value (id of its key or 0) */
+constexpr auto LUA_SNAPEKEY      = 3; /* table key */
+constexpr auto LUA_SNAPEMETA     = 4; /* metatable */
+constexpr auto LUA_SNAPEUPVAL    = 5; /* closure upvalue (id of its name or 0) */
+constexpr auto LUA_SNAPEUSER     = 6; /* user value (its index) */
+constexpr auto LUA_SNAPECONST    = 7; /* prototype constant (its index) */
+constexpr auto LUA_SNAPEPROTO    = 8; /* prototype (index of a nested one or 0) */
+constexpr auto LUA_SNAPESTACK    = 9; /* thread stack slot (its index) */
+constexpr auto LUA_SNAPEINTERNAL = 10; /* names, upvalue contents, etc. */
+
+/* root kinds */
+constexpr auto LUA_SNAPRREGISTRY = 0;
+constexpr auto LUA_SNAPRMAIN     = 1; /* main thread */
+constexpr auto LUA_SNAPRMETA     = 2; /* metatable for basic type 'aux' */
+constexpr auto LUA_SNAPRFIXED    = 3; /* object never collected */
+constexpr auto LUA_SNAPRFINALIZE = 4; /* object waiting for its finalizer */
+
+LUA_APIA lua_heapsnapshot(lua_State *L, lua_Writer writer, void *data) -> int;
+
+
 /*
 ** miscellaneous functions
 */
 
 LUA_APIA lua_error(lua_State *L) -> int;
 LUA_APIA lua_next(lua_State *L, int idx) -> int;
+LUA_APIA lua_setnextfunction(lua_State *L, lua_CFunction f) -> void;
 LUA_APIA lua_concat(lua_State *L, int n) -> void;
 LUA_APIA lua_len(lua_State *L, int idx) -> void;
 LUA_APIA lua_stringtonumber(lua_State *L, const char *s) -> size_t;
 LUA_APIA lua_getallocf(lua_State *L, void **ud) -> lua_Alloc;
 LUA_APIA lua_setallocf(lua_State *L, lua_Alloc f, void *ud) -> void;
+LUA_APIA lua_setarena(lua_State *L, int on) -> void;
 LUA_APIA lua_toclose(lua_State *L, int idx) -> void;
 LUA_APIA lua_closeslot(lua_State *L, int idx) -> void;
 
@@ -446,6 +542,11 @@ LUA_APIA lua_gethook(lua_State *L) -> lua_Hook;
 LUA_APIA lua_gethookmask(lua_State *L) -> int;
 LUA_APIA lua_gethookcount(lua_State *L) -> int;
 LUA_APIA lua_setcstacklimit(lua_State *L, unsigned int limit) -> int;
+LUA_APIA lua_getcachestats(lua_State *L, lua_Unsigned *hits, lua_Unsigned *misses) -> void;
+LUA_APIA lua_getglobalcachestats(lua_State *L, lua_Unsigned *hits, lua_Unsigned *misses) -> void;
+LUA_APIA lua_resetcachestats(lua_State *L) -> void;
+LUA_APIA lua_settypeprofile(lua_State *L, int on) -> int;
+LUA_APIA lua_gettypefeedback(lua_State *L, int funcindex, int n, unsigned int *count, unsigned int *seen, int *line) -> int;
 
 struct lua_Debug
 {
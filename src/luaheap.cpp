@@ -0,0 +1,773 @@
+/*
+** $Id: luaheap.c $
+** Lua heap analyzer (reads snapshots written by 'lua_heapsnapshot' and
+** reports retained sizes from the dominator tree)
+** See Copyright Notice in lua.h
+*/
+
+#define luaheap_c
+#define LUA_CORE
+
+#include "lprefix.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lua.hpp"
+
+#include "lobject.hpp"
+
+#define PROGNAME	"luaheap"		/* default program name */
+
+static const char *progname = PROGNAME; /* actual program name */
+static const char *input = NULL; /* snapshot file name */
+static int ntop = 20; /* number of objects to list */
+static int maxpath = 12; /* maximum number of steps in a path */
+
+
+static void fatal(const char *message)
+{
+	fprintf(stderr, "%s: %s\n", progname, message);
+	exit(EXIT_FAILURE);
+}
+
+static void cannot(const char *what)
+{
+	fprintf(stderr, "%s: cannot %s %s: %s\n", progname, what, input, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static void usage(const char *message)
+{
+	if (*message == '-')
+		fprintf(stderr, "%s: unrecognized option '%s'\n", progname, message);
+	else
+		fprintf(stderr, "%s: %s\n", progname, message);
+	fprintf(stderr,
+				"usage: %s [options] snapshot\n"
+				"Available options are:\n"
+				"  -n count  list the 'count' largest objects (default 20)\n"
+				"  -p steps  show at most 'steps' steps of each path (default 12)\n"
+				"  -v        show version information\n"
+				, progname);
+	exit(EXIT_FAILURE);
+}
+
+#define IS(s)	(strcmp(argv[i],s)==0)
+
+static int getcount(const char *arg, const char *opt)
+{
+	char *end;
+	long n;
+	if (arg == NULL)
+		usage(opt);
+	n = strtol(arg, &end, 10);
+	if (*end != '\0' || n < 0 || n > 1000000)
+		usage(opt);
+	return (int) n;
+}
+
+static void doargs(int argc, char *argv[])
+{
+	int i;
+	if (argv[0] != NULL && *argv[0] != 0) progname = argv[0];
+	for (i = 1; i < argc; i++)
+	{
+		if (*argv[i] != '-') /* snapshot name */
+		{
+			if (input != NULL)
+				usage("only one snapshot can be read");
+			input = argv[i];
+		}
+		else if (IS("-n")) /* number of objects */
+		{
+			i++;
+			ntop = getcount(argv[i], "'-n' needs a count");
+		}
+		else if (IS("-p")) /* path length */
+		{
+			i++;
+			maxpath = getcount(argv[i], "'-p' needs a count");
+		}
+		else if (IS("-v")) /* show version */
+		{
+			printf("%s\n", LUA_COPYRIGHT);
+			exit(EXIT_SUCCESS);
+		}
+		else /* unknown option */
+			usage(argv[i]);
+	}
+	if (input == NULL)
+		usage("no snapshot given");
+}
+
+
+/*
+** {======================================================
+** Reading snapshots
+** =======================================================
+*/
+
+typedef struct Object
+{
+	size_t id;
+	size_t size;
+	size_t len; /* length of a string, line of a prototype */
+	std::string text; /* first bytes of a string */
+	int tt;
+	int flags;
+	size_t firstedge; /* edges of this object are [firstedge, lastedge) */
+	size_t lastedge;
+} Object;
+
+typedef struct Edge
+{
+	size_t target; /* object id, then object index (or NONE) */
+	size_t aux;
+	int kind;
+} Edge;
+
+typedef struct Root
+{
+	size_t target;
+	size_t aux;
+	int kind;
+} Root;
+
+typedef struct Heap
+{
+	std::vector<Object> objs;
+	std::vector<Edge> edges;
+	std::vector<Root> roots;
+	std::unordered_map<size_t, size_t> index; /* object id -> index */
+	size_t dangling; /* edges to objects not in the snapshot */
+} Heap;
+
+static const size_t NONE = ~(size_t) 0;
+
+
+typedef struct LoadState
+{
+	FILE *f;
+} LoadState;
+
+
+static int loadbyte(LoadState *S)
+{
+	int b = getc(S->f);
+	if (b == EOF)
+		fatal(ferror(S->f) ? "read error" : "truncated snapshot");
+	return b;
+}
+
+/* read a number written by 'snapsize' */
+static size_t loadsize(LoadState *S)
+{
+	size_t x = 0;
+	int b;
+	do
+	{
+		b = loadbyte(S);
+		x = (x << 7) | (b & 0x7f);
+	} while ((b & 0x80) == 0);
+	return x;
+}
+
+static void loadheader(LoadState *S)
+{
+	char sig[sizeof(LUA_SNAPSIGNATURE) - 1];
+	if (fread(sig, 1, sizeof(sig), S->f) != sizeof(sig) ||
+		memcmp(sig, LUA_SNAPSIGNATURE, sizeof(sig)) != 0)
+		fatal("not a heap snapshot");
+	if (loadbyte(S) != LUA_SNAPVERSION)
+		fatal("snapshot version mismatch");
+}
+
+static void loadobject(LoadState *S, Heap *H)
+{
+	Object o;
+	o.id = loadsize(S);
+	o.tt = loadbyte(S);
+	o.flags = loadbyte(S);
+	o.size = loadsize(S);
+	o.len = 0;
+	switch (o.tt)
+	{
+		case LUA_VSHRSTR:
+		case LUA_VLNGSTR: {
+			size_t n;
+			o.len = loadsize(S);
+			n = loadsize(S);
+			o.text.resize(n);
+			if (n > 0 && fread(&o.text[0], 1, n, S->f) != n)
+				fatal("truncated snapshot");
+			break;
+		}
+		case LUA_VPROTO:
+			o.len = loadsize(S);
+			break;
+		default: break;
+	}
+	o.firstedge = o.lastedge = H->edges.size();
+	H->index[o.id] = H->objs.size();
+	H->objs.push_back(std::move(o));
+}
+
+static void loadheap(Heap *H)
+{
+	LoadState S;
+	size_t nobjs, nedges;
+	S.f = fopen(input, "rb");
+	if (S.f == NULL)
+		cannot("open");
+	loadheader(&S);
+	H->dangling = 0;
+	for (;;)
+	{
+		int tag = loadbyte(&S);
+		if (tag == LUA_SNAPOBJECT)
+			loadobject(&S, H);
+		else if (tag == LUA_SNAPEDGE)
+		{
+			Edge e;
+			if (H->objs.empty())
+				fatal("edge before any object");
+			e.target = loadsize(&S);
+			e.kind = loadbyte(&S);
+			e.aux = loadsize(&S);
+			H->edges.push_back(e);
+			H->objs.back().lastedge = H->edges.size();
+		}
+		else if (tag == LUA_SNAPROOT)
+		{
+			Root r;
+			r.target = loadsize(&S);
+			r.kind = loadbyte(&S);
+			r.aux = loadsize(&S);
+			H->roots.push_back(r);
+		}
+		else if (tag == LUA_SNAPEND)
+			break;
+		else
+			fatal("bad record in snapshot");
+	}
+	nobjs = loadsize(&S);
+	nedges = loadsize(&S);
+	if (nobjs != H->objs.size() || nedges != H->edges.size())
+		fatal("inconsistent snapshot");
+	fclose(S.f);
+	/* translate ids into indices */
+	for (Edge &e : H->edges)
+	{
+		auto it = H->index.find(e.target);
+		if (it == H->index.end())
+		{
+			e.target = NONE;
+			H->dangling++;
+		}
+		else
+			e.target = it->second;
+	}
+	for (Root &r : H->roots)
+	{
+		auto it = H->index.find(r.target);
+		r.target = (it == H->index.end()) ? NONE : it->second;
+	}
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Dominators
+** =======================================================
+*/
+
+/*
+** The graph has a node 0 pointing to all roots, and node 'i + 1' for
+** object 'i'. References from weak tables do not keep objects alive,
+** so they are not part of the graph: keys of tables with weak keys
+** and values of tables with weak values. (Values of ephemeron tables
+** are taken as strong, which may make some retained sizes larger.)
+*/
+static int isstrong(const Object &o, const Edge &e)
+{
+	if (e.target == NONE)
+		return 0;
+	switch (e.kind)
+	{
+		case LUA_SNAPEKEY:
+			return !(o.flags & LUA_SNAPFWEAKK);
+		case LUA_SNAPEFIELD:
+		case LUA_SNAPEINDEX:
+		case LUA_SNAPEVALUE:
+			return !(o.flags & LUA_SNAPFWEAKV);
+		default:
+			return 1;
+	}
+}
+
+
+typedef struct Graph
+{
+	std::vector<size_t> first; /* successors of 'v' are [first[v], first[v + 1]) */
+	std::vector<size_t> succ;
+	std::vector<size_t> via; /* edge (or '~i' for root 'i') of each successor */
+} Graph;
+
+
+static void buildgraph(const Heap *H, Graph *G)
+{
+	size_t n = H->objs.size() + 1;
+	size_t v;
+	G->first.resize(n + 1);
+	G->first[0] = 0;
+	for (size_t i = 0; i < H->roots.size(); i++)
+	{
+		if (H->roots[i].target != NONE)
+		{
+			G->succ.push_back(H->roots[i].target + 1);
+			G->via.push_back(~i);
+		}
+	}
+	for (v = 1; v < n; v++)
+	{
+		const Object &o = H->objs[v - 1];
+		G->first[v] = G->succ.size();
+		for (size_t e = o.firstedge; e < o.lastedge; e++)
+		{
+			if (isstrong(o, H->edges[e]))
+			{
+				G->succ.push_back(H->edges[e].target + 1);
+				G->via.push_back(e);
+			}
+		}
+	}
+	G->first[n] = G->succ.size();
+}
+
+
+typedef struct DomTree
+{
+	std::vector<size_t> dfn; /* DFS number of each node (0 if unreachable) */
+	std::vector<size_t> vertex; /* node of each DFS number */
+	std::vector<size_t> parent; /* DFS parent (a DFS number) */
+	std::vector<size_t> parentvia; /* successor index leading to it */
+	std::vector<size_t> idom; /* immediate dominator (a DFS number) */
+	size_t nreach; /* number of reachable nodes */
+} DomTree;
+
+
+/* depth-first numbering from node 0, without recursion */
+static void dfs(const Graph *G, DomTree *D)
+{
+	size_t n = G->first.size() - 1;
+	std::vector<std::pair<size_t, size_t>> stack; /* (node, next successor) */
+	D->dfn.assign(n, 0);
+	D->vertex.assign(n + 1, 0);
+	D->parent.assign(n + 1, 0);
+	D->parentvia.assign(n + 1, NONE);
+	D->nreach = 1;
+	D->dfn[0] = 1;
+	D->vertex[1] = 0;
+	stack.emplace_back(0, G->first[0]);
+	while (!stack.empty())
+	{
+		size_t v = stack.back().first;
+		size_t &next = stack.back().second;
+		if (next == G->first[v + 1])
+		{
+			stack.pop_back();
+			continue;
+		}
+		size_t s = next++;
+		size_t w = G->succ[s];
+		if (D->dfn[w] == 0)
+		{
+			size_t k = ++D->nreach;
+			D->dfn[w] = k;
+			D->vertex[k] = w;
+			D->parent[k] = D->dfn[v];
+			D->parentvia[k] = s;
+			stack.emplace_back(w, G->first[w]);
+		}
+	}
+}
+
+
+/*
+** Lengauer-Tarjan, with the simple (path compression only) version of
+** 'eval'. All arrays are indexed by DFS numbers.
+*/
+typedef struct LTState
+{
+	std::vector<size_t> semi, label, ancestor;
+	std::vector<size_t> chain; /* scratch for 'compress' */
+} LTState;
+
+static void compress(LTState *T, size_t v)
+{
+	T->chain.clear();
+	while (T->ancestor[T->ancestor[v]] != 0)
+	{
+		T->chain.push_back(v);
+		v = T->ancestor[v];
+	}
+	while (!T->chain.empty())
+	{
+		size_t x = T->chain.back();
+		size_t a = T->ancestor[x];
+		T->chain.pop_back();
+		if (T->semi[T->label[a]] < T->semi[T->label[x]])
+			T->label[x] = T->label[a];
+		T->ancestor[x] = T->ancestor[a];
+	}
+}
+
+static size_t eval(LTState *T, size_t v)
+{
+	if (T->ancestor[v] == 0)
+		return v;
+	compress(T, v);
+	return T->label[v];
+}
+
+static void dominators(const Graph *G, DomTree *D)
+{
+	size_t r = D->nreach;
+	size_t n = G->first.size() - 1;
+	LTState T;
+	std::vector<size_t> pfirst(r + 2, 0), preds;
+	std::vector<std::vector<size_t>> bucket(r + 1);
+	/* predecessors, by DFS number */
+	for (size_t v = 0; v < n; v++)
+	{
+		if (D->dfn[v] == 0) continue;
+		for (size_t s = G->first[v]; s < G->first[v + 1]; s++)
+			pfirst[D->dfn[G->succ[s]] + 1]++;
+	}
+	for (size_t k = 1; k <= r + 1; k++)
+		pfirst[k] += pfirst[k - 1];
+	preds.resize(pfirst[r + 1]);
+	{
+		std::vector<size_t> fill(pfirst.begin(), pfirst.end() - 1);
+		for (size_t v = 0; v < n; v++)
+		{
+			if (D->dfn[v] == 0) continue;
+			for (size_t s = G->first[v]; s < G->first[v + 1]; s++)
+				preds[fill[D->dfn[G->succ[s]]]++] = D->dfn[v];
+		}
+	}
+	T.semi.resize(r + 1);
+	T.label.resize(r + 1);
+	T.ancestor.assign(r + 1, 0);
+	D->idom.assign(r + 1, 0);
+	for (size_t k = 1; k <= r; k++)
+		T.semi[k] = T.label[k] = k;
+	for (size_t w = r; w >= 2; w--)
+	{
+		size_t p = D->parent[w];
+		for (size_t i = pfirst[w]; i < pfirst[w + 1]; i++)
+		{
+			size_t u = eval(&T, preds[i]);
+			if (T.semi[u] < T.semi[w])
+				T.semi[w] = T.semi[u];
+		}
+		bucket[T.semi[w]].push_back(w);
+		T.ancestor[w] = p; /* link */
+		for (size_t v : bucket[p])
+		{
+			size_t u = eval(&T, v);
+			D->idom[v] = (T.semi[u] < T.semi[v]) ? u : p;
+		}
+		bucket[p].clear();
+	}
+	for (size_t w = 2; w <= r; w++)
+	{
+		if (D->idom[w] != T.semi[w])
+			D->idom[w] = D->idom[D->idom[w]];
+	}
+	D->idom[1] = 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Report
+** =======================================================
+*/
+
+static const char *typename_(int tt)
+{
+	switch (tt)
+	{
+		case LUA_VSHRSTR: return "string";
+		case LUA_VLNGSTR: return "long string";
+		case LUA_VTABLE: return "table";
+		case LUA_VLCL: return "function";
+		case LUA_VCCL: return "C function";
+		case LUA_VUSERDATA: return "userdata";
+		case LUA_VTHREAD: return "thread";
+		case LUA_VUPVAL: return "upvalue";
+		case LUA_VPROTO: return "prototype";
+		case LUA_VNUMINT: return "integer"; /* boxed (NaN-boxed builds) */
+		default: return "?";
+	}
+}
+
+static std::string quoted(const Object &o)
+{
+	std::string s = "\"";
+	for (unsigned char c : o.text)
+		s += (c >= ' ' && c < 127 && c != '"') ? (char) c : '?';
+	if (o.len > o.text.size())
+		s += "...";
+	return s + "\"";
+}
+
+static const Object *target(const Heap *H, const Edge &e)
+{
+	return (e.target == NONE) ? NULL : &H->objs[e.target];
+}
+
+static const Object *byid(const Heap *H, size_t id)
+{
+	auto it = H->index.find(id);
+	return (it == H->index.end()) ? NULL : &H->objs[it->second];
+}
+
+/* '<source:line>' of a prototype */
+static std::string protoname(const Heap *H, const Object &p)
+{
+	for (size_t e = p.firstedge; e < p.lastedge; e++)
+	{
+		const Object *s = target(H, H->edges[e]);
+		if (H->edges[e].kind == LUA_SNAPEINTERNAL && s && s->tt == LUA_VSHRSTR)
+			return std::string("<").append(s->text).append(":")
+						.append(std::to_string(p.len)).append(">");
+	}
+	return std::string("<?:").append(std::to_string(p.len)).append(">");
+}
+
+static std::string describe(const Heap *H, const Object &o)
+{
+	std::string s = typename_(o.tt);
+	if (o.tt == LUA_VSHRSTR || o.tt == LUA_VLNGSTR)
+		s.append(" ").append(quoted(o));
+	else if (o.tt == LUA_VPROTO)
+		s.append(" ").append(protoname(H, o));
+	else if (o.tt == LUA_VLCL)
+	{
+		for (size_t e = o.firstedge; e < o.lastedge; e++)
+		{
+			const Object *p = target(H, H->edges[e]);
+			if (H->edges[e].kind == LUA_SNAPEPROTO && p)
+				return s.append(" ").append(protoname(H, *p));
+		}
+	}
+	if (o.flags & (LUA_SNAPFWEAKK | LUA_SNAPFWEAKV))
+		s += (o.flags & LUA_SNAPFWEAKK) ? ((o.flags & LUA_SNAPFWEAKV) ? " (weak)" : " (weak keys)")
+									: " (weak values)";
+	if (o.flags & LUA_SNAPFFINALIZE)
+		s += " (finalizer)";
+	return s;
+}
+
+static std::string namestring(const Heap *H, size_t id)
+{
+	const Object *s = byid(H, id);
+	if (s == NULL || (s->tt != LUA_VSHRSTR && s->tt != LUA_VLNGSTR))
+		return "?";
+	return s->text + ((s->len > s->text.size()) ? "..." : "");
+}
+
+static std::string edgename(const Heap *H, const Edge &e)
+{
+	switch (e.kind)
+	{
+		case LUA_SNAPEFIELD: return std::string(".").append(namestring(H, e.aux));
+		case LUA_SNAPEINDEX:
+			return std::string("[").append(std::to_string(e.aux)).append("]");
+		case LUA_SNAPEVALUE: {
+			const Object *k = byid(H, e.aux);
+			return std::string("[") + (k ? typename_(k->tt) : "?") + "]";
+		}
+		case LUA_SNAPEKEY: return "(key)";
+		case LUA_SNAPEMETA: return "(metatable)";
+		case LUA_SNAPEUPVAL:
+			return "(upvalue " + (e.aux ? namestring(H, e.aux) : std::string("?")) + ")";
+		case LUA_SNAPEUSER: return "(uservalue " + std::to_string(e.aux) + ")";
+		case LUA_SNAPECONST: return "(constant " + std::to_string(e.aux) + ")";
+		case LUA_SNAPEPROTO:
+			return e.aux ? "(prototype " + std::to_string(e.aux) + ")" : "(prototype)";
+		case LUA_SNAPESTACK: return "(stack " + std::to_string(e.aux) + ")";
+		default: return "(internal)";
+	}
+}
+
+/* name of basic type 't' (as 'lua_typename', which needs the library) */
+static const char *basicname(size_t t)
+{
+	static const char *const names[] = {"nil", "boolean", "userdata", "number",
+		"string", "table", "function", "userdata", "thread"};
+	return (t < sizeof(names) / sizeof(names[0])) ? names[t] : "?";
+}
+
+static std::string rootname(const Root &r)
+{
+	switch (r.kind)
+	{
+		case LUA_SNAPRREGISTRY: return "registry";
+		case LUA_SNAPRMAIN: return "mainthread";
+		case LUA_SNAPRMETA: return "metatable(" + std::string(basicname(r.aux)) + ")";
+		case LUA_SNAPRFIXED: return "(fixed)";
+		case LUA_SNAPRFINALIZE: return "(to be finalized)";
+		default: return "(root)";
+	}
+}
+
+/*
+** Shortest paths from the roots, as the parent of each node in a
+** breadth-first traversal and the successor index leading to it
+*/
+typedef struct Paths
+{
+	std::vector<size_t> prev;
+	std::vector<size_t> via;
+} Paths;
+
+static void shortestpaths(const Graph *G, Paths *P)
+{
+	size_t n = G->first.size() - 1;
+	std::vector<size_t> queue;
+	P->prev.assign(n, NONE);
+	P->via.assign(n, NONE);
+	queue.push_back(0);
+	P->prev[0] = 0;
+	for (size_t q = 0; q < queue.size(); q++)
+	{
+		size_t v = queue[q];
+		for (size_t s = G->first[v]; s < G->first[v + 1]; s++)
+		{
+			size_t w = G->succ[s];
+			if (P->prev[w] == NONE)
+			{
+				P->prev[w] = v;
+				P->via[w] = s;
+				queue.push_back(w);
+			}
+		}
+	}
+}
+
+/* path from a root to node 'v' */
+static std::string path(const Heap *H, const Graph *G, const Paths *P, size_t v)
+{
+	std::vector<std::string> steps;
+	int truncated = 0;
+	while (v != 0)
+	{
+		size_t via = G->via[P->via[v]];
+		if ((int) steps.size() == maxpath)
+		{
+			truncated = 1;
+			break;
+		}
+		if (P->prev[v] == 0) /* reached through a root */
+			steps.push_back(rootname(H->roots[~via]));
+		else
+			steps.push_back(edgename(H, H->edges[via]));
+		v = P->prev[v];
+	}
+	std::string s = truncated ? "..." : "";
+	for (auto it = steps.rbegin(); it != steps.rend(); ++it)
+		s += *it;
+	return s;
+}
+
+
+static void report(const Heap *H, const Graph *G, const DomTree *D)
+{
+	size_t r = D->nreach;
+	size_t total = 0, reach = 0;
+	std::vector<size_t> retained(r + 1, 0);
+	std::vector<size_t> order;
+	Paths P;
+	struct TypeStats { size_t count, bytes; } types[256] = {};
+	for (const Object &o : H->objs)
+	{
+		total += o.size;
+		types[o.tt].count++;
+		types[o.tt].bytes += o.size;
+	}
+	for (size_t k = 2; k <= r; k++)
+	{
+		retained[k] = H->objs[D->vertex[k] - 1].size;
+		reach += retained[k];
+	}
+	for (size_t k = r; k >= 2; k--) /* dominators have smaller numbers */
+		retained[D->idom[k]] += retained[k];
+	printf("%zu objects, %zu references, %zu bytes\n",
+			H->objs.size(), H->edges.size(), total);
+	printf("reachable: %zu objects, %zu bytes; garbage: %zu objects, %zu bytes\n",
+			r - 1, reach, H->objs.size() - (r - 1), total - reach);
+	if (H->dangling > 0)
+		printf("%zu references to objects missing from the snapshot\n", H->dangling);
+	printf("\n%12s %10s  %s\n", "bytes", "count", "type");
+	{
+		std::vector<int> tts;
+		for (int tt = 0; tt < 256; tt++)
+			if (types[tt].count > 0) tts.push_back(tt);
+		std::sort(tts.begin(), tts.end(), [&](int a, int b) {
+			return types[a].bytes > types[b].bytes;
+		});
+		for (int tt : tts)
+			printf("%12zu %10zu  %s\n", types[tt].bytes, types[tt].count, typename_(tt));
+	}
+	for (size_t k = 2; k <= r; k++)
+		order.push_back(k);
+	if ((size_t) ntop < order.size())
+	{
+		std::partial_sort(order.begin(), order.begin() + ntop, order.end(),
+						[&](size_t a, size_t b) { return retained[a] > retained[b]; });
+		order.resize(ntop);
+	}
+	else
+		std::sort(order.begin(), order.end(),
+				[&](size_t a, size_t b) { return retained[a] > retained[b]; });
+	shortestpaths(G, &P);
+	printf("\n%12s %10s  %s\n", "retained", "self", "object");
+	for (size_t k : order)
+	{
+		const Object &o = H->objs[D->vertex[k] - 1];
+		printf("%12zu %10zu  %s\n", retained[k], o.size, describe(H, o).c_str());
+		printf("%24s%s\n", "", path(H, G, &P, D->vertex[k]).c_str());
+	}
+}
+
+/* }====================================================== */
+
+
+int main(int argc, char *argv[])
+{
+	Heap H;
+	Graph G;
+	DomTree D;
+	doargs(argc, argv);
+	loadheap(&H);
+	buildgraph(&H, &G);
+	dfs(&G, &D);
+	dominators(&G, &D);
+	report(&H, &G, &D);
+	return EXIT_SUCCESS;
+}
@@ -22,6 +22,7 @@
 #include "ldo.hpp"
 #include "lfunc.hpp"
 #include "lgc.hpp"
+#include "ljit.hpp"
 #include "lobject.hpp"
 #include "lopcodes.hpp"
 #include "lstate.hpp"
@@ -44,10 +45,29 @@
 #endif
 
 
+/*
+** By default, the interpreter rewrites arithmetic and comparison
+** instructions with stable operand types into quickened variants.
+*/
+#if !defined(LUA_USE_QUICKENING)
+#define LUA_USE_QUICKENING	1
+#endif
+
+
 /* limit for table tag-method chains (to avoid infinite loops) */
 #define MAXTAGLOOP	2000
 
 
+/*
+** number of consecutive executions with the same operand types needed
+** to quicken an instruction
+*/
+#define QUICKENLIMIT	16
+
+/* number of de-optimizations after which an instruction stays generic */
+#define MAXDEOPT	4
+
+
 /*
 ** 'l_intfitsf' checks whether a given integer is in the range that
 ** can be converted to a float without rounding. Used in comparisons.
@@ -86,6 +106,7 @@
 ** are disabled via macro 'cvt2num'), do not modify 'result'
 ** and return 0.
 */
+#if !defined(LUA_USE_NANBOX)
 static int l_strton(const TValue *obj, TValue *result)
 {
 	lua_assert(obj != result);
@@ -94,9 +115,19 @@ static int l_strton(const TValue *obj, TValue *result)
 	else
 	{
 		TString *st = tsvalue(obj);
-		return (luaO_str2num(getstr(st), result) == tsslen(st) + 1);
+		return (luaO_str2num_(getstr(st), result) == tsslen(st) + 1);
 	}
 }
+#else
+/* (a NaN-boxed conversion may need a box, and so a 'lua_State', which
+   callers do not have; coercions are disabled anyway) */
+static int l_strton(const TValue *obj, TValue *result)
+{
+	lua_assert(obj != result && !cvt2num(obj));
+	UNUSED(obj); UNUSED(result);
+	return 0;
+}
+#endif
 
 
 /*
@@ -218,7 +249,8 @@ static int forlimit(lua_State *L, lua_Integer init, const TValue *lim,
 ** Return true to skip the loop. Otherwise,
 ** after preparation, stack will be as follows:
 **   ra : internal index (safe copy of the control variable)
-**   ra + 1 : loop counter (integer loops) or limit (float loops)
+**   ra + 1 : loop counter (integer loops; the limit, with NaN boxing)
+**            or limit (float loops)
 **   ra + 2 : step
 **   ra + 3 : control variable
 */
@@ -235,9 +267,13 @@ static int forprep(lua_State *L, StkId ra)
 		lua_Integer limit;
 		if (step == 0)
 			luaG_runerror(L, "'for' step is zero");
-		setivalue(s2v(ra + 3), init); /* control variable */
+		setivalue(L, s2v(ra + 3), init); /* control variable */
 		if (forlimit(L, init, plimit, &limit, step))
 			return 1; /* skip the loop */
+#if defined(LUA_USE_NANBOX)
+		else /* keep the limit (see 'forintloop') */
+			setivalue(L, plimit, limit);
+#else
 		else
 		{
 			/* prepare loop counter */
@@ -258,8 +294,9 @@ static int forprep(lua_State *L, StkId ra)
 			}
 			/* store the counter in place of the limit (which won't be
 				needed anymore) */
-			setivalue(plimit, l_castU2S(count));
+			setivalue(L, plimit, l_castU2S(count));
 		}
+#endif
 	}
 	else
 	{
@@ -289,6 +326,25 @@ static int forprep(lua_State *L, StkId ra)
 }
 
 
+#if defined(LUA_USE_NANBOX)
+/*
+** Whether an integer loop whose internal index is 'idx' must run again.
+** With NaN boxing, 'forprep' leaves the limit in place of the counter:
+** a counter near LUA_MAXINTEGER (as in 'for i = 1, math.huge') would
+** need a new box at every step, while the limit is boxed at most once.
+** The index never passes the limit, so the room left before it is
+** computed without overflow, like the counter in 'forprep'.
+*/
+inline int forintloop(lua_Integer idx, lua_Integer limit, lua_Integer step)
+{
+	if (step > 0)
+		return (l_castS2U(limit) - l_castS2U(idx) >= l_castS2U(step));
+	else /* 'step+1' avoids negating 'mininteger' */
+		return (l_castS2U(idx) - l_castS2U(limit) >= l_castS2U(-(step + 1)) + 1u);
+}
+#endif
+
+
 /*
 ** Execute a step of a float numerical for loop, returning
 ** true iff the loop must continue. (The integer case is
@@ -338,6 +394,8 @@ void luaV_finishget(lua_State *L, const TValue *t, TValue *key, StkId val,
 		{
 			/* 't' is a table */
 			lua_assert(isempty(slot));
+			if (luaV_fastgetpacked(t, packedkey(key), slot, s2v(val)))
+				return; /* present entry of a packed array part */
 			tm = fasttm(L, hvalue(t)->metatable, TM_INDEX); /* table's metamethod */
 			if (tm == NULL)
 			{
@@ -386,9 +444,15 @@ void luaV_finishset(lua_State *L, const TValue *t, TValue *key,
 			Table *h = hvalue(t); /* save 't' table */
 			lua_assert(isempty(slot)); /* slot must be empty */
 			tm = fasttm(L, h->metatable, TM_NEWINDEX); /* get metamethod */
+#if defined(LUA_USE_PACKEDARRAY)
+			TValue aux;
+			if (tm == NULL ||
+				luaV_fastgetpacked(t, packedkey(key), slot, &aux))
+#else
 			if (tm == NULL)
+#endif
 			{
-				/* no metamethod? */
+				/* no metamethod or present entry of a packed array part? */
 				luaH_finishset(L, h, key, slot, val); /* set new value */
 				invalidateTMcache(h);
 				luaC_barrierback(L, obj2gco(h), val);
@@ -421,6 +485,65 @@ void luaV_finishset(lua_State *L, const TValue *t, TValue *key,
 }
 
 
+/*
+** Search function for short strings used by instructions with an inline
+** cache 'ic'. The cached slot is validated against the current hash part
+** of 't' (its size and the key in that node), so it is never trusted
+** after a table resize; on a miss, do a regular search and remember
+** where the key was found.
+*/
+l_sinline const TValue *getshortstrIC(global_State *g, Table *t,
+												  TString *key, ICache *ic)
+{
+	unsigned int slot = ic->slot;
+	if (slot < cast_uint(sizenode(t)))
+	{
+		Node *n = gnode(t, slot);
+		if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
+		{
+			g->icachehits++;
+			return gval(n);
+		}
+	}
+	g->icachemisses++;
+	const TValue *res = luaH_getshortstr(t, key);
+	if (!isabstkey(res)) /* key is present? */
+		ic->slot = cast_uint(nodefromval(res) - gnode(t, 0));
+	return res;
+}
+
+
+/*
+** Search short string 'key' in table 't' (usually an _ENV table) with the
+** global cache 'ec'. A cached node is valid while the table keeps the
+** version it had when the node was cached; even so, an empty value
+** (whose key may have been cleared by the collector) is not trusted.
+*/
+l_sinline const TValue *getenvIC(global_State *g, Table *t, TString *key,
+											EnvCache *ec)
+{
+	if (ec->version == t->version)
+	{
+		const TValue *res = gval(gnode(t, ec->slot));
+		if (l_likely(!isempty(res)))
+		{
+			lua_assert(eqshrstr(keystrval(gnode(t, ec->slot)), key));
+			g->gcachehits++;
+			return res;
+		}
+	}
+	g->gcachemisses++;
+	const TValue *res = luaH_getshortstr(t, key);
+	if (!isabstkey(res))
+	{
+		/* key is present? */
+		ec->slot = cast_uint(nodefromval(res) - gnode(t, 0));
+		ec->version = t->version;
+	}
+	return res;
+}
+
+
 /*
 ** Compare two strings 'ts1' x 'ts2', returning an integer less-equal-
 ** -greater than zero if 'ts1' is less-equal-greater than 'ts2'.
@@ -808,15 +931,15 @@ void luaV_objlen(lua_State *L, StkId ra, const TValue *rb)
 			Table *h = hvalue(rb);
 			tm = fasttm(L, h->metatable, TM_LEN);
 			if (tm) break; /* metamethod? break switch to call it */
-			setivalue(s2v(ra), luaH_getn(h)); /* else primitive len */
+			setivalue(L, s2v(ra), luaH_getn(h)); /* else primitive len */
 			return;
 		}
 		case LUA_VSHRSTR: {
-			setivalue(s2v(ra), tsvalue(rb)->shrlen);
+			setivalue(L, s2v(ra), tsvalue(rb)->shrlen);
 			return;
 		}
 		case LUA_VLNGSTR: {
-			setivalue(s2v(ra), tsvalue(rb)->u.lnglen);
+			setivalue(L, s2v(ra), tsvalue(rb)->u.lnglen);
 			return;
 		}
 		default: {
@@ -915,9 +1038,39 @@ lua_Integer luaV_shiftl(lua_Integer x, lua_Integer y)
 }
 
 
+/*
+** check whether cached closure in prototype 'p' may be reused, that is,
+** whether there is a cached closure with the same upvalues needed by
+** new closure to be created.
+*/
+static LClosure *getcached(Proto *p, UpVal **encup, StkId base)
+{
+	LClosure *c = p->cache;
+	if (c != NULL)
+	{
+		/* is there a cached closure? */
+		int nup = p->sizeupvalues;
+		Upvaldesc *uv = p->upvalues;
+		int i;
+		for (i = 0; i < nup; i++)
+		{
+			/* check whether it has right upvalues */
+			TValue *v = uv[i].instack ? s2v(base + uv[i].idx) : encup[uv[i].idx]->v.p;
+			if (c->upvals[i]->v.p != v)
+				return NULL; /* wrong upvalue; cannot reuse closure */
+		}
+	}
+	return c; /* return cached closure (or NULL if no cached closure) */
+}
+
+
 /*
 ** create a new Lua closure, push it in the stack, and initialize
-** its upvalues.
+** its upvalues. Before that, try to reuse the closure cached in the
+** prototype; a prototype whose closures keep missing the cache
+** (MAXMISS times in a row) stops being cached. The cache is not
+** updated if the prototype is black: the GC clears it only when it
+** traverses the prototype.
 */
 static void pushclosure(lua_State *L, Proto *p, UpVal **encup, StkId base,
 								StkId ra)
@@ -925,7 +1078,21 @@ static void pushclosure(lua_State *L, Proto *p, UpVal **encup, StkId base,
 	int nup = p->sizeupvalues;
 	Upvaldesc *uv = p->upvalues;
 	int i;
-	LClosure *ncl = luaF::newLclosure(L, nup);
+	LClosure *ncl;
+	if (p->cachemiss < MAXMISS)
+	{
+		ncl = getcached(p, encup, base);
+		if (ncl != NULL)
+		{
+			/* cache hit: reuse closure */
+			p->cachemiss = 0;
+			setclLvalue2s(L, ra, ncl);
+			return;
+		}
+		if (p->cache != NULL)
+			p->cachemiss++;
+	}
+	ncl = luaF::newLclosure(L, nup);
 	ncl->p = p;
 	setclLvalue2s(L, ra, ncl); /* anchor new closure in stack */
 	for (i = 0; i < nup; i++)
@@ -937,6 +1104,8 @@ static void pushclosure(lua_State *L, Proto *p, UpVal **encup, StkId base,
 			ncl->upvals[i] = encup[uv[i].idx];
 		luaC_objbarrier(L, ncl, ncl->upvals[i]);
 	}
+	if (p->cachemiss < MAXMISS && !isblack(p))
+		p->cache = ncl; /* save it on cache for reuse */
 }
 
 
@@ -948,7 +1117,7 @@ void luaV_finishOp(lua_State *L)
 	CallInfo *ci = L->ci;
 	StkId base = ci->func.p + 1;
 	Instruction inst = *(ci->u.l.savedpc - 1); /* interrupted instruction */
-	OpCode op = GET_OPCODE(inst);
+	OpCode op = GET_GENERICOP(inst);
 	switch (op)
 	{
 		/* finish its execution */
@@ -1025,6 +1194,51 @@ void luaV_finishOp(lua_State *L)
 }
 
 
+/*
+** {==================================================================
+** Quickening
+** ===================================================================
+*/
+
+/*
+** Instruction 'pi' (with inline cache 'ic') has just run with operand
+** types matching quickened opcode 'op'. After QUICKENLIMIT consecutive
+** such executions, rewrite it in place into 'op'; instructions that
+** were already de-optimized too many times stay generic.
+*/
+l_sinline void quicken(ICache *ic, const Instruction *pi, OpCode op)
+{
+#if LUA_USE_QUICKENING
+	if (ic->q.op != op)
+	{
+		/* operand types changed; restart counting */
+		ic->q.op = cast_byte(op);
+		ic->q.hits = 0;
+	}
+	else if (ic->q.deopts < MAXDEOPT && ++ic->q.hits >= QUICKENLIMIT)
+		SET_OPCODE(*cast(Instruction *, pi), op);
+#else
+	UNUSED(ic); UNUSED(pi); UNUSED(op);
+#endif
+}
+
+
+/*
+** Quickened instruction 'pi' met operands of other types: rewrite it
+** back into its generic opcode 'op'.
+*/
+static void deoptimize(ICache *ic, const Instruction *pi, OpCode op)
+{
+	SET_OPCODE(*cast(Instruction *, pi), op);
+	ic->q.op = cast_byte(op);
+	ic->q.hits = 0;
+	if (ic->q.deopts < MAXDEOPT)
+		ic->q.deopts++;
+}
+
+/* }================================================================== */
+
+
 /*
 ** {==================================================================
 ** Macros for arithmetic/bitwise/comparison opcodes in 'luaV_execute'
@@ -1038,6 +1252,7 @@ void luaV_finishOp(lua_State *L)
 #define l_bor(a,b)	intop(|, a, b)
 #define l_bxor(a,b)	intop(^, a, b)
 
+#define l_eqi(a,b)	(a == b)
 #define l_lti(a,b)	(a < b)
 #define l_lei(a,b)	(a <= b)
 #define l_gti(a,b)	(a > b)
@@ -1054,7 +1269,7 @@ void luaV_finishOp(lua_State *L)
   int imm = GETARG_sC(i);  \
   if (ttisinteger(v1)) {  \
     lua_Integer iv1 = ivalue(v1);  \
-    pc++; setivalue(s2v(ra), iop(L, iv1, imm));  \
+    pc++; setivalue(L, s2v(ra), iop(L, iv1, imm));  \
   }  \
   else if (ttisfloat(v1)) {  \
     lua_Number nb = fltvalue(v1);  \
@@ -1101,7 +1316,7 @@ void luaV_finishOp(lua_State *L)
   StkId ra = RA(i); \
   if (ttisinteger(v1) && ttisinteger(v2)) {  \
     lua_Integer i1 = ivalue(v1); lua_Integer i2 = ivalue(v2);  \
-    pc++; setivalue(s2v(ra), iop(L, i1, i2));  \
+    pc++; setivalue(L, s2v(ra), iop(L, i1, i2));  \
   }  \
   else op_arithf_aux(L, v1, v2, fop); }
 
@@ -1115,6 +1330,57 @@ void luaV_finishOp(lua_State *L)
   op_arith_aux(L, v1, v2, iop, fop); }
 
 
+/*
+** Arithmetic operations with register operands that can be quickened
+** into 'opii' (integer operands) or 'opff' (float operands).
+*/
+#define op_arithQ(L,iop,fop,opii,opff) {  \
+  StkId ra = RA(i); \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (ttisinteger(v1) && ttisinteger(v2)) {  \
+    lua_Integer i1 = ivalue(v1); lua_Integer i2 = ivalue(v2);  \
+    quicken(ICACHE(), pc - 1, opii);  \
+    pc++; setivalue(L, s2v(ra), iop(L, i1, i2));  \
+  }  \
+  else if (ttisfloat(v1) && ttisfloat(v2)) {  \
+    lua_Number n1 = fltvalue(v1); lua_Number n2 = fltvalue(v2);  \
+    quicken(ICACHE(), pc - 1, opff);  \
+    pc++; setfltvalue(s2v(ra), fop(L, n1, n2));  \
+  }  \
+  else op_arithf_aux(L, v1, v2, fop); }
+
+
+/*
+** Quickened arithmetic operations: fast path for integer operands
+** ('opi' is ivalue/setivalue based) or float operands; on a type miss,
+** de-optimize into generic opcode 'gop' and run it.
+*/
+#define op_arithII(L,iop,fop,gop,opii,opff) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisinteger(v1) && ttisinteger(v2))) {  \
+    StkId ra = RA(i); \
+    pc++; setivalue(L, s2v(ra), iop(L, ivalue(v1), ivalue(v2)));  \
+  }  \
+  else {  \
+    deoptimize(ICACHE(), pc - 1, gop);  \
+    op_arithQ(L, iop, fop, opii, opff);  \
+  }}
+
+#define op_arithFF(L,iop,fop,gop,opii,opff) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisfloat(v1) && ttisfloat(v2))) {  \
+    StkId ra = RA(i); \
+    pc++; setfltvalue(s2v(ra), fop(L, fltvalue(v1), fltvalue(v2)));  \
+  }  \
+  else {  \
+    deoptimize(ICACHE(), pc - 1, gop);  \
+    op_arithQ(L, iop, fop, opii, opff);  \
+  }}
+
+
 /*
 ** Arithmetic operations with K operands.
 */
@@ -1134,7 +1400,7 @@ void luaV_finishOp(lua_State *L)
   lua_Integer i1;  \
   lua_Integer i2 = ivalue(v2);  \
   if (tointegerns(v1, &i1)) {  \
-    pc++; setivalue(s2v(ra), op(i1, i2));  \
+    pc++; setivalue(L, s2v(ra), op(i1, i2));  \
   }}
 
 
@@ -1147,23 +1413,27 @@ void luaV_finishOp(lua_State *L)
   TValue *v2 = vRC(i);  \
   lua_Integer i1; lua_Integer i2;  \
   if (tointegerns(v1, &i1) && tointegerns(v2, &i2)) {  \
-    pc++; setivalue(s2v(ra), op(i1, i2));  \
+    pc++; setivalue(L, s2v(ra), op(i1, i2));  \
   }}
 
 
 /*
 ** Order operations with register operands. 'opn' actually works
-** for all numbers, but the fast track improves performance for
-** integers.
+** for all numbers, but the fast tracks improve performance for
+** integers and floats; they also quicken the instruction into 'opii'
+** (integer operands) or 'opff' (float operands).
 */
-#define op_order(L,opi,opn,other) {  \
+#define op_orderQ(L,opi,opf,opn,other,opii,opff) {  \
   StkId ra = RA(i); \
   int cond;  \
   TValue *rb = vRB(i);  \
   if (ttisinteger(s2v(ra)) && ttisinteger(rb)) {  \
-    lua_Integer ia = ivalue(s2v(ra));  \
-    lua_Integer ib = ivalue(rb);  \
-    cond = opi(ia, ib);  \
+    quicken(ICACHE(), pc - 1, opii);  \
+    cond = opi(ivalue(s2v(ra)), ivalue(rb));  \
+  }  \
+  else if (ttisfloat(s2v(ra)) && ttisfloat(rb)) {  \
+    quicken(ICACHE(), pc - 1, opff);  \
+    cond = opf(fltvalue(s2v(ra)), fltvalue(rb));  \
   }  \
   else if (ttisnumber(s2v(ra)) && ttisnumber(rb))  \
     cond = opn(s2v(ra), rb);  \
@@ -1172,6 +1442,45 @@ void luaV_finishOp(lua_State *L)
   docondjump(); }
 
 
+/*
+** Equality with register operands that can be quickened into OP_EQII
+** or OP_EQFF.
+*/
+#define op_eqQ(L) {  \
+  StkId ra = RA(i); \
+  int cond;  \
+  TValue *rb = vRB(i);  \
+  if (ttisinteger(s2v(ra)) && ttisinteger(rb)) {  \
+    quicken(ICACHE(), pc - 1, OP_EQII);  \
+    cond = l_eqi(ivalue(s2v(ra)), ivalue(rb));  \
+  }  \
+  else if (ttisfloat(s2v(ra)) && ttisfloat(rb)) {  \
+    quicken(ICACHE(), pc - 1, OP_EQFF);  \
+    cond = luai_numeq(fltvalue(s2v(ra)), fltvalue(rb));  \
+  }  \
+  else  \
+    Protect(cond = luaV_equalobj(L, s2v(ra), rb));  \
+  docondjump(); }
+
+
+/*
+** Quickened order operations. 'tt' is the expected tag of both
+** operands, 'get' the macro to read them; on a type miss, de-optimize
+** into generic opcode 'gop' and run it.
+*/
+#define op_orderQQ(L,tt,get,op,gop,generic) {  \
+  StkId ra = RA(i); \
+  TValue *rb = vRB(i);  \
+  if (l_likely(checktag(s2v(ra), tt) && checktag(rb, tt))) {  \
+    int cond = op(get(s2v(ra)), get(rb));  \
+    docondjump();  \
+  }  \
+  else {  \
+    deoptimize(ICACHE(), pc - 1, gop);  \
+    generic;  \
+  }}
+
+
 /*
 ** Order operations with immediate operand. (Immediate operand is
 ** always small enough to have an exact representation as a float.)
@@ -1216,6 +1525,25 @@ void luaV_finishOp(lua_State *L)
 #define KC(i)	(k+GETARG_C(i))
 #define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
 
+/* inline cache of the current instruction */
+#define ICACHE()	(&cl->p->icache[pcRel(pc, cl->p)])
+
+/* variant of 'luaV_fastget' for short strings using an inline cache */
+#define fastgetIC(L,t,key,slot) \
+  (!ttistable(t)  \
+   ? (slot = NULL, 0)  \
+   : (slot = getshortstrIC(G(L), hvalue(t), key, ICACHE()), !isempty(slot)))
+
+
+/* global cache of the current instruction */
+#define ENVCACHE()	(&cl->p->envcache[ICACHE()->env])
+
+/* variant of 'luaV_fastget' for global accesses using the global cache */
+#define fastgetenv(L,t,key,slot) \
+  (!ttistable(t)  \
+   ? (slot = NULL, 0)  \
+   : (slot = getenvIC(G(L), hvalue(t), key, ENVCACHE()), !isempty(slot)))
+
 
 #define updatetrap(ci)  (trap = ci->u.l.trap)
 
@@ -1292,6 +1620,60 @@ void luaV_finishOp(lua_State *L)
 #define vmcase(l)	case l:
 #define vmbreak		break
 
+/* select the dispatch table for the running function (see 'proftab') */
+#define vmselect()	((void)0)
+
+
+/*
+** Count an execution of the running instruction in the type feedback
+** of its function (creating it if needed) and record the type of its
+** operand 'o' in slot 'n'.
+*/
+#define fbrecord(n,o)	{ \
+  Proto *p_ = cl->p; \
+  TypeFeedback *fb_ = p_->typefb; \
+  if (l_unlikely(fb_ == NULL)) { \
+    savepc(L);  /* in case of memory errors */ \
+    fb_ = luaF::inittypefb(L, p_); \
+  } \
+  fb_ += pcRel(pc, p_); \
+  if ((n) == 0) fb_->count++; \
+  fb_->seen[n] |= fbtagbit(o); \
+}
+
+
+/*
+** Baseline JIT: at calls and backward jumps, count the hotness of the
+** running function and, once it has native code, run it from 'pc'.
+*/
+#if defined(LUA_USE_JIT)
+#define jitcheck()	{ \
+  if (l_unlikely(luaJ_ishot(cl->p)) && !trap && !G(L)->typeprofile) { \
+    savepc(L);  /* in case of (memory) errors */ \
+    pc = luaJ::enter(L, cl, base, pc); \
+  } \
+}
+#else
+#define jitcheck()	((void)0)
+#endif
+
+
+/*
+** Superinstructions: 'vmlabel' marks the handler of an instruction that
+** can be the second one of a pair, and 'vmfuse' ends the first part of
+** a superinstruction by executing that next instruction directly.
+** When hooks are active (or the stack changed) it goes through the
+** regular dispatch instead, so that 'luaG_traceexec' sees it.
+*/
+#define vmlabel(l)	F_##l:
+
+#define vmfuse(l)	{ \
+  if (l_unlikely(trap)) { vmbreak; } \
+  i = *(pc++); \
+  lua_assert(GET_OPCODE(i) == l); \
+  goto F_##l; \
+}
+
 
 void luaV_execute(lua_State *L, CallInfo *ci)
 {
@@ -1308,11 +1690,13 @@ startfunc:
 	trap = L->hookmask;
 returning: /* trap already set */
 	cl = ci_func(ci);
+	vmselect();
 	k = cl->p->k;
 	pc = ci->u.l.savedpc;
 	if (l_unlikely(trap))
 		trap = luaG_tracecall(L);
 	base = ci->func.p + 1;
+	jitcheck();
 	/* main loop of interpreter */
 	for (;;)
 	{
@@ -1337,7 +1721,7 @@ returning: /* trap already set */
 			{
 				StkId ra = RA(i);
 				lua_Integer b = GETARG_sBx(i);
-				setivalue(s2v(ra), b);
+				setivalue(L, s2v(ra), b);
 				vmbreak;
 			}
 		vmcase(OP_LOADF)
@@ -1414,7 +1798,7 @@ returning: /* trap already set */
 				TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
 				TValue *rc = KC(i);
 				TString *key = tsvalue(rc); /* key must be a short string */
-				if (luaV_fastget(L, upval, key, slot, luaH_getshortstr))
+				if (fastgetenv(L, upval, key, slot))
 				{
 					setobj2s(L, ra, slot);
 				}
@@ -1435,7 +1819,7 @@ returning: /* trap already set */
 				{
 					setobj2s(L, ra, slot);
 				}
-				else
+				else if (!luaV_fastgetpacked(rb, packedkey(rc), slot, s2v(ra)))
 					Protect(luaV_finishget(L, rb, rc, ra, slot));
 				vmbreak;
 			}
@@ -1449,22 +1833,23 @@ returning: /* trap already set */
 				{
 					setobj2s(L, ra, slot);
 				}
-				else
+				else if (!luaV_fastgetpacked(rb, c, slot, s2v(ra)))
 				{
 					TValue key;
-					setivalue(&key, c);
+					setivalue(L, &key, c);
 					Protect(luaV_finishget(L, rb, &key, ra, slot));
 				}
 				vmbreak;
 			}
 		vmcase(OP_GETFIELD)
+		vmlabel(OP_GETFIELD)
 			{
 				StkId ra = RA(i);
 				const TValue *slot;
 				TValue *rb = vRB(i);
 				TValue *rc = KC(i);
 				TString *key = tsvalue(rc); /* key must be a short string */
-				if (luaV_fastget(L, rb, key, slot, luaH_getshortstr))
+				if (fastgetIC(L, rb, key, slot))
 				{
 					setobj2s(L, ra, slot);
 				}
@@ -1479,7 +1864,7 @@ returning: /* trap already set */
 				TValue *rb = KB(i);
 				TValue *rc = RKC(i);
 				TString *key = tsvalue(rb); /* key must be a short string */
-				if (luaV_fastget(L, upval, key, slot, luaH_getshortstr))
+				if (fastgetenv(L, upval, key, slot))
 				{
 					luaV_finishfastset(L, upval, slot, rc);
 				}
@@ -1500,7 +1885,7 @@ returning: /* trap already set */
 				{
 					luaV_finishfastset(L, s2v(ra), slot, rc);
 				}
-				else
+				else if (!luaV_fastsetpacked(s2v(ra), packedkey(rb), slot, rc))
 					Protect(luaV_finishset(L, s2v(ra), rb, rc, slot));
 				vmbreak;
 			}
@@ -1514,15 +1899,16 @@ returning: /* trap already set */
 				{
 					luaV_finishfastset(L, s2v(ra), slot, rc);
 				}
-				else
+				else if (!luaV_fastsetpacked(s2v(ra), c, slot, rc))
 				{
 					TValue key;
-					setivalue(&key, c);
+					setivalue(L, &key, c);
 					Protect(luaV_finishset(L, s2v(ra), &key, rc, slot));
 				}
 				vmbreak;
 			}
 		vmcase(OP_SETFIELD)
+		vmlabel(OP_SETFIELD)
 			{
 				StkId ra = RA(i);
 				const TValue *slot;
@@ -1565,7 +1951,9 @@ returning: /* trap already set */
 				TValue *rc = RKC(i);
 				TString *key = tsvalue(rc); /* key must be a string */
 				setobj2s(L, ra + 1, rb);
-				if (luaV_fastget(L, rb, key, slot, luaH_getstr))
+				if (key->tt == LUA_VSHRSTR
+						? fastgetIC(L, rb, key, slot)
+						: luaV_fastget(L, rb, key, slot, luaH_getstr))
 				{
 					setobj2s(L, ra, slot);
 				}
@@ -1639,7 +2027,7 @@ returning: /* trap already set */
 				if (tointegerns(rb, &ib))
 				{
 					pc++;
-					setivalue(s2v(ra), luaV_shiftl(ib, -ic));
+					setivalue(L, s2v(ra), luaV_shiftl(ib, -ic));
 				}
 				vmbreak;
 			}
@@ -1652,23 +2040,23 @@ returning: /* trap already set */
 				if (tointegerns(rb, &ib))
 				{
 					pc++;
-					setivalue(s2v(ra), luaV_shiftl(ic, ib));
+					setivalue(L, s2v(ra), luaV_shiftl(ic, ib));
 				}
 				vmbreak;
 			}
 		vmcase(OP_ADD)
 			{
-				op_arith(L, l_addi, luai_numadd);
+				op_arithQ(L, l_addi, luai_numadd, OP_ADDII, OP_ADDFF);
 				vmbreak;
 			}
 		vmcase(OP_SUB)
 			{
-				op_arith(L, l_subi, luai_numsub);
+				op_arithQ(L, l_subi, luai_numsub, OP_SUBII, OP_SUBFF);
 				vmbreak;
 			}
 		vmcase(OP_MUL)
 			{
-				op_arith(L, l_muli, luai_nummul);
+				op_arithQ(L, l_muli, luai_nummul, OP_MULII, OP_MULFF);
 				vmbreak;
 			}
 		vmcase(OP_MOD)
@@ -1761,7 +2149,7 @@ returning: /* trap already set */
 				if (ttisinteger(rb))
 				{
 					lua_Integer ib = ivalue(rb);
-					setivalue(s2v(ra), intop(-, 0, ib));
+					setivalue(L, s2v(ra), intop(-, 0, ib));
 				}
 				else if (tonumberns(rb, nb))
 				{
@@ -1778,7 +2166,7 @@ returning: /* trap already set */
 				lua_Integer ib;
 				if (tointegerns(rb, &ib))
 				{
-					setivalue(s2v(ra), intop(^, ~l_castS2U(0), ib));
+					setivalue(L, s2v(ra), intop(^, ~l_castS2U(0), ib));
 				}
 				else
 					Protect(luaT_trybinTM(L, rb, rb, ra, TM_BNOT));
@@ -1825,25 +2213,25 @@ returning: /* trap already set */
 		vmcase(OP_JMP)
 			{
 				dojump(ci, i, 0);
+				if (GETARG_sJ(i) < 0) /* backward jump? */
+					jitcheck();
 				vmbreak;
 			}
 		vmcase(OP_EQ)
 			{
-				StkId ra = RA(i);
-				int cond;
-				TValue *rb = vRB(i);
-				Protect(cond = luaV_equalobj(L, s2v(ra), rb));
-				docondjump();
+				op_eqQ(L);
 				vmbreak;
 			}
 		vmcase(OP_LT)
 			{
-				op_order(L, l_lti, LTnum, lessthanothers);
+				op_orderQ(L, l_lti, luai_numlt, LTnum, lessthanothers,
+							 OP_LTII, OP_LTFF);
 				vmbreak;
 			}
 		vmcase(OP_LE)
 			{
-				op_order(L, l_lei, LEnum, lessequalothers);
+				op_orderQ(L, l_lei, luai_numle, LEnum, lessequalothers,
+							 OP_LEII, OP_LEFF);
 				vmbreak;
 			}
 		vmcase(OP_EQK)
@@ -1910,13 +2298,37 @@ returning: /* trap already set */
 				vmbreak;
 			}
 		vmcase(OP_CALL)
+		vmlabel(OP_CALL)
 			{
 				StkId ra = RA(i);
 				CallInfo *newci;
 				int b = GETARG_B(i);
 				int nresults = GETARG_C(i) - 1;
 				if (b != 0) /* fixed number of arguments? */
+				{
 					L->top.p = ra + b; /* top signals number of arguments */
+					if (ttisLclosure(s2v(ra)))
+					{
+						/* Lua function with fixed arguments: try the fast path */
+						Proto *p = clLvalue(s2v(ra))->p;
+						if (!p->is_vararg &&
+						    l_likely(L->stack_last.p - L->top.p > p->maxstacksize))
+						{
+							int narg = b - 1;
+							savepc(L); /* return point (and for memory errors) */
+							newci = L->ci->next ? L->ci->next : luaE_extendCI(L);
+							newci->func.p = ra;
+							newci->nresults = nresults;
+							newci->callstatus = 0;
+							newci->top.p = ra + 1 + p->maxstacksize;
+							newci->u.l.savedpc = p->code;
+							for (; narg < p->numparams; narg++)
+								setnilvalue(s2v(L->top.p++)); /* complete missing arguments */
+							L->ci = ci = newci;
+							goto startfunc;
+						}
+					}
+				}
 				/* else previous instruction set top */
 				savepc(L); /* in case of errors */
 				if ((newci = luaD::precall(L, ra, nresults)) == NULL)
@@ -2020,7 +2432,18 @@ returning: /* trap already set */
 					/* do the 'poscall' here */
 					int nres = ci->nresults;
 					L->ci = ci->previous; /* back to caller */
-					if (nres == 0)
+					if (l_likely(nres == 1)) /* usual case for expressions */
+					{
+						setobjs2s(L, base - 1, RA(i));
+						L->top.p = base;
+						if (l_likely(!(ci->callstatus & CIST_FRESH)))
+						{
+							ci = ci->previous; /* Lua caller: continue it here */
+							goto returning;
+						}
+						return; /* end this frame */
+					}
+					else if (nres == 0)
 						L->top.p = base - 1; /* asked for no results */
 					else
 					{
@@ -2046,22 +2469,36 @@ returning: /* trap already set */
 				if (ttisinteger(s2v(ra + 2)))
 				{
 					/* integer loop? */
+#if defined(LUA_USE_NANBOX)
+					lua_Integer step = ivalue(s2v(ra + 2));
+					lua_Integer idx = ivalue(s2v(ra)); /* internal index */
+					if (forintloop(idx, ivalue(s2v(ra + 1)), step))
+					{
+						/* still more iterations? */
+						idx = intop(+, idx, step); /* add step to index */
+						chgivalue(L, s2v(ra), idx); /* update internal index */
+						setivalue(L, s2v(ra + 3), idx); /* and control variable */
+						pc -= GETARG_Bx(i); /* jump back */
+					}
+#else
 					lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));
 					if (count > 0)
 					{
 						/* still more iterations? */
 						lua_Integer step = ivalue(s2v(ra + 2));
 						lua_Integer idx = ivalue(s2v(ra)); /* internal index */
-						chgivalue(s2v(ra + 1), count - 1); /* update counter */
+						chgivalue(L, s2v(ra + 1), count - 1); /* update counter */
 						idx = intop(+, idx, step); /* add step to index */
-						chgivalue(s2v(ra), idx); /* update internal index */
-						setivalue(s2v(ra + 3), idx); /* and control variable */
+						chgivalue(L, s2v(ra), idx); /* update internal index */
+						setivalue(L, s2v(ra + 3), idx); /* and control variable */
 						pc -= GETARG_Bx(i); /* jump back */
 					}
+#endif
 				}
 				else if (floatforloop(ra)) /* float loop */
 					pc -= GETARG_Bx(i); /* jump back */
 				updatetrap(ci); /* allows a signal to break the loop */
+				jitcheck();
 				vmbreak;
 			}
 		vmcase(OP_FORPREP)
@@ -2092,6 +2529,25 @@ returning: /* trap already set */
 						to-be-closed variable. The call will use the stack after
 						these values (starting at 'ra + 4')
 					*/
+					if (ttislcf(s2v(ra)) && fvalue(s2v(ra)) == G(L)->nextf &&
+						 ttistable(s2v(ra + 1)) && l_likely(!L->hookmask) &&
+						 (ttisnil(s2v(ra + 3)) || ttisinteger(s2v(ra + 3))))
+					{
+						/* primitive 'next' over a table: traverse it here, keeping
+							the position of the last key in the (unused) closing slot */
+						unsigned int cursor = ttisinteger(s2v(ra + 3))
+							? cast_uint(ivalue(s2v(ra + 3))) : 0;
+						int n;
+						setobjs2s(L, ra + 4, ra + 2);
+						if (!halfProtect(luaH_nextcursor(L, hvalue(s2v(ra + 1)), ra + 4, &cursor)))
+							setnilvalue(s2v(ra + 4)); /* end of traversal */
+						setivalue(L, s2v(ra + 3), cast(lua_Integer, cursor));
+						for (n = 2; n < GETARG_C(i); n++)
+							setnilvalue(s2v(ra + 4 + n)); /* extra loop variables */
+						i = *(pc++); /* go to next instruction */
+						lua_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
+						goto l_tforloop;
+					}
 					/* push function, state, and control variable */
 					memcpy(ra + 4, ra, 3 * sizeof(*ra));
 					L->top.p = ra + 4 + 3;
@@ -2132,8 +2588,15 @@ returning: /* trap already set */
 					last += GETARG_Ax(*pc) * (MAXARG_C + 1);
 					pc++;
 				}
+#if defined(LUA_USE_PACKEDARRAY)
+				if (ispacked(h)) /* constructors fill plain array parts */
+					luaH_unpackarray(L, h);
+#endif
 				if (last > luaH_realasize(h)) /* needs more space? */
 					luaH_resizearray(L, h, last); /* preallocate it at once */
+#if defined(LUA_USE_PACKEDARRAY)
+				int filled = (last == luaH_realasize(h)); /* last batch? */
+#endif
 				for (; n > 0; n--)
 				{
 					TValue *val = s2v(ra + n);
@@ -2141,6 +2604,10 @@ returning: /* trap already set */
 					last--;
 					luaC_barrierback(L, obj2gco(h), val);
 				}
+#if defined(LUA_USE_PACKEDARRAY)
+				if (filled)
+					luaH_packarray(L, h);
+#endif
 				vmbreak;
 			}
 		vmcase(OP_CLOSURE)
@@ -2175,6 +2642,151 @@ returning: /* trap already set */
 				lua_assert(0);
 				vmbreak;
 			}
+		vmcase(OP_ADDII)
+			{
+				op_arithII(L, l_addi, luai_numadd, OP_ADD, OP_ADDII, OP_ADDFF);
+				vmbreak;
+			}
+		vmcase(OP_ADDFF)
+			{
+				op_arithFF(L, l_addi, luai_numadd, OP_ADD, OP_ADDII, OP_ADDFF);
+				vmbreak;
+			}
+		vmcase(OP_SUBII)
+			{
+				op_arithII(L, l_subi, luai_numsub, OP_SUB, OP_SUBII, OP_SUBFF);
+				vmbreak;
+			}
+		vmcase(OP_SUBFF)
+			{
+				op_arithFF(L, l_subi, luai_numsub, OP_SUB, OP_SUBII, OP_SUBFF);
+				vmbreak;
+			}
+		vmcase(OP_MULII)
+			{
+				op_arithII(L, l_muli, luai_nummul, OP_MUL, OP_MULII, OP_MULFF);
+				vmbreak;
+			}
+		vmcase(OP_MULFF)
+			{
+				op_arithFF(L, l_muli, luai_nummul, OP_MUL, OP_MULII, OP_MULFF);
+				vmbreak;
+			}
+		vmcase(OP_EQII)
+			{
+				op_orderQQ(L, LUA_VNUMINT, ivalue, l_eqi, OP_EQ,
+							  op_eqQ(L));
+				vmbreak;
+			}
+		vmcase(OP_EQFF)
+			{
+				op_orderQQ(L, LUA_VNUMFLT, fltvalue, luai_numeq, OP_EQ,
+							  op_eqQ(L));
+				vmbreak;
+			}
+		vmcase(OP_LTII)
+			{
+				op_orderQQ(L, LUA_VNUMINT, ivalue, l_lti, OP_LT,
+							  op_orderQ(L, l_lti, luai_numlt, LTnum,
+										 lessthanothers, OP_LTII, OP_LTFF));
+				vmbreak;
+			}
+		vmcase(OP_LTFF)
+			{
+				op_orderQQ(L, LUA_VNUMFLT, fltvalue, luai_numlt, OP_LT,
+							  op_orderQ(L, l_lti, luai_numlt, LTnum,
+										 lessthanothers, OP_LTII, OP_LTFF));
+				vmbreak;
+			}
+		vmcase(OP_LEII)
+			{
+				op_orderQQ(L, LUA_VNUMINT, ivalue, l_lei, OP_LE,
+							  op_orderQ(L, l_lei, luai_numle, LEnum,
+										 lessequalothers, OP_LEII, OP_LEFF));
+				vmbreak;
+			}
+		vmcase(OP_LEFF)
+			{
+				op_orderQQ(L, LUA_VNUMFLT, fltvalue, luai_numle, OP_LE,
+							  op_orderQ(L, l_lei, luai_numle, LEnum,
+										 lessequalothers, OP_LEII, OP_LEFF));
+				vmbreak;
+			}
+		vmcase(OP_GETTABUPFIELD)
+			{
+				StkId ra = RA(i);
+				const TValue *slot;
+				TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
+				TValue *rc = KC(i);
+				TString *key = tsvalue(rc); /* key must be a short string */
+				if (fastgetenv(L, upval, key, slot))
+				{
+					setobj2s(L, ra, slot);
+				}
+				else
+					Protect(luaV_finishget(L, upval, rc, ra, slot));
+				vmfuse(OP_GETFIELD);
+			}
+		vmcase(OP_GETUPVALFIELD)
+			{
+				StkId ra = RA(i);
+				int b = GETARG_B(i);
+				setobj2s(L, ra, cl->upvals[b]->v.p);
+				vmfuse(OP_GETFIELD);
+			}
+		vmcase(OP_GETFIELDCALL)
+			{
+				StkId ra = RA(i);
+				const TValue *slot;
+				TValue *rb = vRB(i);
+				TValue *rc = KC(i);
+				TString *key = tsvalue(rc); /* key must be a short string */
+				if (fastgetIC(L, rb, key, slot))
+				{
+					setobj2s(L, ra, slot);
+				}
+				else
+					Protect(luaV_finishget(L, rb, rc, ra, slot));
+				vmfuse(OP_CALL);
+			}
+		vmcase(OP_LOADKSETFIELD)
+			{
+				StkId ra = RA(i);
+				TValue *rb = k + GETARG_Bx(i);
+				setobj2s(L, ra, rb);
+				vmfuse(OP_SETFIELD);
+			}
+#if LUA_USE_JUMPTABLE
+		/*
+		** Type-feedback collection, reached only through 'proftab'.
+		** Labels are named after the profiled operands; superinstructions
+		** run as their first instruction, so that the second one is
+		** dispatched (and profiled) by itself.
+		*/
+		P_AB:
+			fbrecord(0, s2v(RA(i)));
+			fbrecord(1, s2v(RB(i)));
+			goto *disptab[GET_OPCODE(i)];
+		P_BC:
+			fbrecord(0, s2v(RB(i)));
+			fbrecord(1, s2v(RC(i)));
+			goto *disptab[GET_OPCODE(i)];
+		P_A:
+			fbrecord(0, s2v(RA(i)));
+			goto *disptab[GET_OPCODE(i)];
+		P_B:
+			fbrecord(0, s2v(RB(i)));
+			goto *disptab[GET_OPCODE(i)];
+		P_UA:
+			fbrecord(0, cl->upvals[GETARG_A(i)]->v.p);
+			goto *disptab[GET_OPCODE(i)];
+		P_UB:
+			fbrecord(0, cl->upvals[GETARG_B(i)]->v.p);
+			goto *disptab[GET_OPCODE(i)];
+		P_FUSED:
+			SET_OPCODE(i, luaP_genericop(GET_OPCODE(i)));
+			goto *proftab[GET_OPCODE(i)];
+#endif
 		}
 	}
 }
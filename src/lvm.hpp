@@ -91,6 +91,37 @@ bool luaV_rawequalobj(const TValue * t1,  const TValue * t2);
       !isempty(slot)))  /* result not empty? */
 
 
+#if defined(LUA_USE_PACKEDARRAY)
+
+/*
+** Special case of 'luaV_fastget' for integers, inlining the fast cases
+** of 'luaH_getint' (for plain and packed array parts).
+*/
+#define luaV_fastgeti(L,t,k,slot) \
+  (!ttistable(t)  \
+   ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
+   : (slot = (l_castS2U(k) - 1u < hvalue(t)->alimit) \
+              ? &hvalue(t)->array[k - 1] \
+              : (ispacked(hvalue(t)) && \
+                 l_castS2U(k) - 1u < hvalue(t)->packed->size) \
+              ? &luaH_packedslot : luaH_getint(hvalue(t), k), \
+      !isempty(slot)))  /* result not empty? */
+
+
+/*
+** Fast tracks for entries of packed array parts, which 'luaV_fastgeti'
+** (or 'luaV_fastget') answers with 'luaH_packedslot'. The set stores
+** only values the part can hold, and only if no '__newindex' can apply.
+*/
+#define luaV_fastgetpacked(t,k,slot,res) \
+  (ispackedslot(slot) && luaH_getpacked(hvalue(t), k, res))
+
+#define luaV_fastsetpacked(t,k,slot,v) \
+  (ispackedslot(slot) && hvalue(t)->metatable == NULL && \
+   luaH_setpacked(hvalue(t), k, v))
+
+#else
+
 /*
 ** Special case of 'luaV_fastget' for integers, inlining the fast case
 ** of 'luaH_getint'.
@@ -102,6 +133,12 @@ bool luaV_rawequalobj(const TValue * t1,  const TValue * t2);
               ? &hvalue(t)->array[k - 1] : luaH_getint(hvalue(t), k), \
       !isempty(slot)))  /* result not empty? */
 
+/* without packed array parts, there are no such entries */
+#define luaV_fastgetpacked(t,k,slot,res)	0
+#define luaV_fastsetpacked(t,k,slot,v)	0
+
+#endif
+
 
 /*
 ** Finish a fast set operation (when fast get succeeds). In that case,